@@ -0,0 +1,427 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef MCLOCK_QUEUE_H
+#define MCLOCK_QUEUE_H
+
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "common/OpQueue.h"
+#include "include/assert.h"
+
+#include <time.h>
+
+#include <limits>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * Op queue scheduling by reservation, weight and limit (mClock, Gulati
+ * et al., OSDI 2010).
+ *
+ * Items are sorted into op classes (client ops, recovery, ...) by a
+ * classifier.  Each class has a reservation (a minimum rate), a weight
+ * (its share of whatever is left over) and a limit (a maximum rate).
+ * Classes marked per_client keep separate tags for each client K, so
+ * that every client of the class gets those settings; in the others all
+ * of the clients share the class's.  Rates are in units of min_cost
+ * bytes per second: an item of cost c counts as max(c, min_cost) /
+ * min_cost units.
+ *
+ * The head of each client's queue is tagged with when it is due under
+ * each of the three settings.  dequeue() serves the earliest
+ * reservation tag that is due; failing that, the earliest weight tag
+ * among those under their limit.  The OSD cannot leave a shard idle
+ * while it has queued ops, so if every client is over its limit the
+ * one that gets under it soonest is served anyway: limits only hold
+ * while there is other work to do.
+ *
+ * Strict items are served first, highest priority first, as in
+ * PrioritizedQueue.
+ */
+template <typename T, typename K>
+class MClockQueue : public OpQueue<T, K> {
+public:
+  struct class_info_t {
+    const char *name;
+    double reservation;   ///< units/s, 0 for none
+    double weight;
+    double limit;         ///< units/s, 0 for none
+    bool per_client;
+    class_info_t(const char *n = "", double r = 0, double w = 1,
+		 double l = 0, bool pc = false)
+      : name(n), reservation(r), weight(w > 0 ? w : 1), limit(l),
+	per_client(pc) {}
+  };
+  typedef unsigned (*classifier_t)(const T &item);
+
+  enum {
+    PHASE_RESERVATION,
+    PHASE_WEIGHT,
+    PHASE_OVER_LIMIT,
+    PHASE_MAX
+  };
+
+private:
+  struct request_t {
+    K cl;       ///< even in a class whose clients share tags
+    T item;
+    double units;
+    double arrival;
+    request_t(K c, const T &i, double u, double a)
+      : cl(c), item(i), units(u), arrival(a) {}
+  };
+
+  struct client_t {
+    unsigned cls;
+    double r_prev, p_prev, l_prev;  ///< tags of the last item served
+    double r_tag, p_tag, l_tag;     ///< tags of the head, if any
+    std::list<request_t> requests;
+    client_t() : cls(0), r_prev(0), p_prev(0), l_prev(0),
+		 r_tag(0), p_tag(0), l_tag(0) {}
+  };
+
+  typedef std::pair<unsigned, K> client_key_t;
+  typedef std::map<client_key_t, client_t> client_map_t;
+
+  std::vector<class_info_t> classes;
+  classifier_t classify;
+  unsigned min_cost;
+  client_map_t clients;
+  std::map<unsigned, std::list<std::pair<K, T> > > high_queue;
+  unsigned count;            ///< items in clients
+  unsigned high_count;
+  unsigned dequeues;         ///< since the last trim_clients
+  /// items served, per class and phase
+  std::vector<std::vector<uint64_t> > served;
+
+  double get_units(unsigned cost) const {
+    if (cost < min_cost)
+      cost = min_cost;
+    return (double)cost / (double)min_cost;
+  }
+
+  client_key_t get_key(K cl, const T &item) const {
+    unsigned cls = classify(item);
+    assert(cls < classes.size());
+    return client_key_t(cls, classes[cls].per_client ? cl : K());
+  }
+
+  /// tag the (new) head of c's queue
+  void update_tags(client_t &c) {
+    assert(!c.requests.empty());
+    const class_info_t &ci = classes[c.cls];
+    const request_t &r = c.requests.front();
+    if (ci.reservation > 0)
+      c.r_tag = std::max(c.r_prev + r.units / ci.reservation, r.arrival);
+    else
+      c.r_tag = std::numeric_limits<double>::infinity();
+    c.p_tag = std::max(c.p_prev + r.units / ci.weight, r.arrival);
+    if (ci.limit > 0)
+      c.l_tag = std::max(c.l_prev + r.units / ci.limit, r.arrival);
+    else
+      c.l_tag = 0;
+  }
+
+  client_t &get_client(const client_key_t &key) {
+    typename client_map_t::iterator p = clients.find(key);
+    if (p == clients.end()) {
+      p = clients.insert(std::make_pair(key, client_t())).first;
+      p->second.cls = key.first;
+    }
+    return p->second;
+  }
+
+  /**
+   * forget the idle clients whose tags have all passed: a new item
+   * would be tagged with its arrival time anyway
+   */
+  void trim_clients(double t) {
+    for (typename client_map_t::iterator p = clients.begin();
+	 p != clients.end(); ) {
+      client_t &c = p->second;
+      if (c.requests.empty() &&
+	  c.r_prev <= t && c.p_prev <= t && c.l_prev <= t)
+	clients.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  template <class F>
+  void remove_from_client(client_t &c, F &f, std::list<T> *out) {
+    bool head = false;
+    typename std::list<request_t>::iterator i = c.requests.begin();
+    while (i != c.requests.end()) {
+      if (f(*i)) {
+	if (out)
+	  out->push_back(i->item);
+	if (i == c.requests.begin())
+	  head = true;
+	c.requests.erase(i++);
+	--count;
+      } else {
+	++i;
+      }
+    }
+    if (head && !c.requests.empty())
+      update_tags(c);
+  }
+
+  struct FilterRef {
+    typename OpQueue<T, K>::Filter *f;
+    FilterRef(typename OpQueue<T, K>::Filter *f) : f(f) {}
+    bool operator()(const T &item) {
+      return (*f)(item);
+    }
+  };
+
+  template <class F>
+  struct ItemFilter {
+    F &f;
+    ItemFilter(F &f) : f(f) {}
+    bool operator()(const request_t &r) {
+      return f(r.item);
+    }
+  };
+
+  struct ClientFilter {
+    K cl;
+    ClientFilter(K cl) : cl(cl) {}
+    bool operator()(const request_t &r) {
+      return r.cl == cl;
+    }
+  };
+
+protected:
+  /**
+   * seconds, monotonic: tags are compared with it, and a wall clock
+   * step would hold every class back or let them all past their
+   * limits.  virtual for simulations.
+   */
+  virtual double now() const {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+  }
+
+public:
+  MClockQueue(const std::vector<class_info_t> &c, classifier_t f,
+	      unsigned min_c)
+    : classes(c), classify(f), min_cost(min_c ? min_c : 1),
+      count(0), high_count(0), dequeues(0),
+      served(c.size(), std::vector<uint64_t>(PHASE_MAX, 0)) {
+    assert(!classes.empty());
+  }
+
+  unsigned length() const {
+    return count + high_count;
+  }
+
+  bool empty() const {
+    return !length();
+  }
+
+  template <class F>
+  void remove_by_filter(F f, std::list<T> *removed = 0) {
+    ItemFilter<F> rf(f);
+    for (typename client_map_t::iterator p = clients.begin();
+	 p != clients.end();
+	 ++p)
+      remove_from_client(p->second, rf, removed);
+    for (typename std::map<unsigned, std::list<std::pair<K, T> > >::iterator p =
+	   high_queue.begin();
+	 p != high_queue.end(); ) {
+      typename std::list<std::pair<K, T> >::iterator i = p->second.begin();
+      while (i != p->second.end()) {
+	if (f(i->second)) {
+	  if (removed)
+	    removed->push_back(i->second);
+	  p->second.erase(i++);
+	  --high_count;
+	} else {
+	  ++i;
+	}
+      }
+      if (p->second.empty())
+	high_queue.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  /// OpQueue
+  void remove_by_filter(typename OpQueue<T, K>::Filter &f,
+			std::list<T> *removed = 0) {
+    remove_by_filter(FilterRef(&f), removed);
+  }
+
+  void remove_by_class(K k, std::list<T> *out = 0) {
+    ClientFilter f(k);
+    for (typename client_map_t::iterator p = clients.begin();
+	 p != clients.end(); ) {
+      remove_from_client(p->second, f, out);
+      // k's own tags go too; in a shared class they are not k's
+      if (classes[p->first.first].per_client && p->first.second == k)
+	clients.erase(p++);
+      else
+	++p;
+    }
+    for (typename std::map<unsigned, std::list<std::pair<K, T> > >::iterator p =
+	   high_queue.begin();
+	 p != high_queue.end(); ) {
+      typename std::list<std::pair<K, T> >::iterator i = p->second.begin();
+      while (i != p->second.end()) {
+	if (i->first == k) {
+	  if (out)
+	    out->push_back(i->second);
+	  p->second.erase(i++);
+	  --high_count;
+	} else {
+	  ++i;
+	}
+      }
+      if (p->second.empty())
+	high_queue.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) {
+    high_queue[priority].push_back(std::make_pair(cl, item));
+    ++high_count;
+  }
+
+  void enqueue_strict_front(K cl, unsigned priority, T item) {
+    high_queue[priority].push_front(std::make_pair(cl, item));
+    ++high_count;
+  }
+
+  void enqueue(K cl, unsigned priority, unsigned cost, T item) {
+    client_t &c = get_client(get_key(cl, item));
+    c.requests.push_back(request_t(cl, item, get_units(cost), now()));
+    if (c.requests.size() == 1)
+      update_tags(c);
+    ++count;
+  }
+
+  /// a requeue: served next within its client, as soon as that is due
+  void enqueue_front(K cl, unsigned priority, unsigned cost, T item) {
+    client_t &c = get_client(get_key(cl, item));
+    c.requests.push_front(request_t(cl, item, get_units(cost), now()));
+    update_tags(c);
+    ++count;
+  }
+
+  T dequeue() {
+    assert(!empty());
+
+    if (!high_queue.empty()) {
+      std::list<std::pair<K, T> > &l = high_queue.rbegin()->second;
+      T ret = l.front().second;
+      l.pop_front();
+      if (l.empty())
+	high_queue.erase(high_queue.rbegin()->first);
+      --high_count;
+      return ret;
+    }
+
+    // one pass over the clients with queued items, for all three phases
+    double t = now();
+    typename client_map_t::iterator res = clients.end();
+    typename client_map_t::iterator wgt = clients.end();
+    typename client_map_t::iterator over = clients.end();
+    for (typename client_map_t::iterator p = clients.begin();
+	 p != clients.end();
+	 ++p) {
+      const client_t &c = p->second;
+      if (c.requests.empty())
+	continue;
+      if (c.r_tag <= t && (res == clients.end() || c.r_tag < res->second.r_tag))
+	res = p;
+      if (c.l_tag <= t) {
+	if (wgt == clients.end() || c.p_tag < wgt->second.p_tag)
+	  wgt = p;
+      } else if (over == clients.end() || c.l_tag < over->second.l_tag) {
+	over = p;
+      }
+    }
+
+    int phase;
+    typename client_map_t::iterator p;
+    if (res != clients.end()) {
+      p = res;
+      phase = PHASE_RESERVATION;
+    } else if (wgt != clients.end()) {
+      p = wgt;
+      phase = PHASE_WEIGHT;
+    } else {
+      assert(over != clients.end());
+      p = over;
+      phase = PHASE_OVER_LIMIT;
+    }
+
+    client_t &c = p->second;
+    T ret = c.requests.front().item;
+    c.requests.pop_front();
+    --count;
+    ++served[c.cls][phase];
+    if (classes[c.cls].reservation > 0)
+      c.r_prev = c.r_tag;
+    // what was served by reservation does not count against the weight
+    if (phase != PHASE_RESERVATION)
+      c.p_prev = c.p_tag;
+    if (classes[c.cls].limit > 0)
+      c.l_prev = c.l_tag;
+    if (!c.requests.empty())
+      update_tags(c);
+
+    if (++dequeues >= 1000) {
+      dequeues = 0;
+      trim_clients(t);
+    }
+    return ret;
+  }
+
+  /// items of class cls served in phase
+  uint64_t get_served(unsigned cls, int phase) const {
+    assert(cls < served.size());
+    return served[cls][phase];
+  }
+
+  void dump(Formatter *f) const {
+    f->dump_int("min_cost", min_cost);
+    f->dump_int("strict_queued", high_count);
+    f->dump_int("queued", count);
+    f->dump_int("clients", clients.size());
+    f->open_array_section("classes");
+    for (unsigned i = 0; i < classes.size(); ++i) {
+      const class_info_t &ci = classes[i];
+      f->open_object_section("class");
+      f->dump_string("name", ci.name);
+      f->dump_float("reservation", ci.reservation);
+      f->dump_float("weight", ci.weight);
+      f->dump_float("limit", ci.limit);
+      f->dump_bool("per_client", ci.per_client);
+      f->dump_unsigned("served_reservation", served[i][PHASE_RESERVATION]);
+      f->dump_unsigned("served_weight", served[i][PHASE_WEIGHT]);
+      f->dump_unsigned("served_over_limit", served[i][PHASE_OVER_LIMIT]);
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+#endif
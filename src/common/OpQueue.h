@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef OP_QUEUE_H
+#define OP_QUEUE_H
+
+#include "common/Formatter.h"
+
+#include <list>
+
+/**
+ * Abstract interface of the queues an OSD shard can schedule its ops
+ * with (PrioritizedQueue, MClockQueue).
+ *
+ * Items queued with enqueue_strict and enqueue_strict_front are served
+ * in strict priority order, before anything queued with enqueue and
+ * enqueue_front.  How the latter are ordered is up to the queue.  K is
+ * the client an item comes from.
+ */
+template <typename T, typename K>
+class OpQueue {
+public:
+  /// selects the items remove_by_filter removes
+  class Filter {
+  public:
+    virtual bool operator()(const T &item) = 0;
+    virtual ~Filter() {}
+  };
+
+  virtual ~OpQueue() {}
+
+  virtual unsigned length() const = 0;
+  virtual bool empty() const = 0;
+
+  /// remove the items f selects, appending them to removed in queue order
+  virtual void remove_by_filter(Filter &f, std::list<T> *removed = 0) = 0;
+  /// remove all of the items from client k
+  virtual void remove_by_class(K k, std::list<T> *out = 0) = 0;
+
+  virtual void enqueue_strict(K cl, unsigned priority, T item) = 0;
+  virtual void enqueue_strict_front(K cl, unsigned priority, T item) = 0;
+  virtual void enqueue(K cl, unsigned priority, unsigned cost, T item) = 0;
+  virtual void enqueue_front(K cl, unsigned priority, unsigned cost,
+			     T item) = 0;
+
+  /// the next item to serve; the queue must not be empty
+  virtual T dequeue() = 0;
+
+  virtual void dump(Formatter *f) const = 0;
+};
+
+#endif
@@ -87,6 +87,7 @@ SUBSYS(optracker, 0, 5)
 SUBSYS(objclass, 0, 5)
 SUBSYS(filestore, 1, 3)
 SUBSYS(keyvaluestore, 1, 3)
+SUBSYS(blockstore, 1, 3)
 SUBSYS(journal, 1, 3)
 SUBSYS(ms, 0, 5)
 SUBSYS(mon, 1, 5)
@@ -437,6 +438,7 @@ OPTION(osd_uuid, OPT_UUID, uuid_d())
 OPTION(osd_data, OPT_STR, "/var/lib/ceph/osd/$cluster-$id")
 OPTION(osd_journal, OPT_STR, "/var/lib/ceph/osd/$cluster-$id/journal")
 OPTION(osd_journal_size, OPT_INT, 5120)         // in mb
+OPTION(osd_journal_stripe_paths, OPT_STR, "")  // more journal files/devices to stripe entries over, along with osd_journal
 OPTION(osd_max_write_size, OPT_INT, 90)
 OPTION(osd_max_pgls, OPT_U64, 1024) // max number of pgls entries to return
 OPTION(osd_client_message_size_cap, OPT_U64, 500*1024L*1024L) // client data allowed in-memory (in bytes)
@@ -488,11 +490,30 @@ OPTION(osd_map_max_advance, OPT_INT, 200) // make this < cache_size!
 OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_map_share_max_epochs, OPT_INT, 100)  // cap on # of inc maps we send to peers, clients
+OPTION(osd_map_precompute_mappings, OPT_BOOL, false) // keep a pg -> osd table with the current osdmap
+OPTION(osd_map_precompute_threads, OPT_INT, 4) // to build it with
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
 OPTION(osd_peering_wq_batch_size, OPT_U64, 20)
+OPTION(osd_peering_batch_max_pgs, OPT_U64, 1000) // hold peering messages until the peering wq drains or this many pgs have some; 0 to send them after each batch
+OPTION(osd_peering_batch_max_delay, OPT_DOUBLE, .1) // seconds to hold peering messages for at most
+OPTION(osd_peering_latency_epochs, OPT_INT, 50) // epochs to keep a histogram of peering latencies for
 OPTION(osd_op_pq_max_tokens_per_priority, OPT_U64, 4194304)
 OPTION(osd_op_pq_min_cost, OPT_U64, 65536)
+// how each shard orders its ops: prioritized or mclock
+OPTION(osd_op_queue, OPT_STR, "prioritized")
+// mclock reservations and limits are in osd_op_pq_min_cost units per
+// second, 0 for none; the client ones apply to each client
+OPTION(osd_op_queue_mclock_client_op_res, OPT_DOUBLE, 100.0)
+OPTION(osd_op_queue_mclock_client_op_wgt, OPT_DOUBLE, 500.0)
+OPTION(osd_op_queue_mclock_client_op_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_osd_subop_res, OPT_DOUBLE, 1000.0)
+OPTION(osd_op_queue_mclock_osd_subop_wgt, OPT_DOUBLE, 500.0)
+OPTION(osd_op_queue_mclock_osd_subop_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_recovery_res, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_recovery_wgt, OPT_DOUBLE, 10.0)
+OPTION(osd_op_queue_mclock_recovery_lim, OPT_DOUBLE, 0.0)
 OPTION(osd_disk_threads, OPT_INT, 1)
+OPTION(osd_load_pg_threads, OPT_INT, 4) // to read pgs in with on startup
 OPTION(osd_disk_thread_ioprio_class, OPT_STR, "") // rt realtime be besteffort best effort idle
 OPTION(osd_disk_thread_ioprio_priority, OPT_INT, -1) // 0-7
 OPTION(osd_recovery_threads, OPT_INT, 1)
@@ -541,6 +562,7 @@ OPTION(osd_recovery_delay_start, OPT_FLOAT, 0)
 OPTION(osd_recovery_max_active, OPT_INT, 15)
 OPTION(osd_recovery_max_single_start, OPT_INT, 5)
 OPTION(osd_recovery_max_chunk, OPT_U64, 8<<20)  // max size of push chunk
+OPTION(osd_recovery_sparse_push, OPT_BOOL, true)  // leave holes out of pushes to peers that support it
 OPTION(osd_copyfrom_max_chunk, OPT_U64, 8<<20)   // max size of a COPYFROM chunk
 OPTION(osd_push_per_object_cost, OPT_U64, 1000)  // push cost per object
 OPTION(osd_max_push_cost, OPT_U64, 8<<20)  // max size of push message
@@ -596,6 +618,15 @@ OPTION(osd_failsafe_nearfull_ratio, OPT_FLOAT, .90) // what % full makes an OSD
 // determines whether PGLog::check() compares written out log to stored log
 OPTION(osd_debug_pg_log_writeout, OPT_BOOL, false)
 
+// compact the key ranges of leveldb/rocksdb stores that deletes left
+// slow to read, when the store is idle; see os/CompactionScheduler.h
+OPTION(kvdb_compact_interval, OPT_DOUBLE, 0) // seconds between passes, 0 to disable
+OPTION(kvdb_compact_max_ops, OPT_DOUBLE, 100) // store ops per second above which it is busy
+OPTION(kvdb_compact_load_threshold, OPT_DOUBLE, 0.5) // loadavg above which it is busy
+OPTION(kvdb_compact_min_tombstones, OPT_U64, 10000) // deletes before a range is considered
+OPTION(kvdb_compact_tombstone_ratio, OPT_DOUBLE, .3) // deletes per write that make a range worth it
+OPTION(kvdb_compact_read_amp, OPT_DOUBLE, 2) // or, seek time over the store average
+OPTION(kvdb_compact_max_ranges, OPT_INT, 4096) // ranges tracked
 OPTION(leveldb_write_buffer_size, OPT_U64, 8 *1024*1024) // leveldb write buffer size
 OPTION(leveldb_cache_size, OPT_U64, 128 *1024*1024) // leveldb cache size
 OPTION(leveldb_block_size, OPT_U64, 0) // leveldb block size
@@ -633,6 +664,9 @@ OPTION(rocksdb_disableWAL, OPT_BOOL, false)  // diable write ahead log
 OPTION(rocksdb_num_levels, OPT_INT, 0) // number of levels for this database
 OPTION(rocksdb_wal_dir, OPT_STR, "")  //  rocksdb write ahead log file
 OPTION(rocksdb_info_log_level, OPT_STR, "info")  // info log level : debug , info , warn, error, fatal
+// keep key prefixes in their own column families, e.g.
+// "omap=_USER_,_COMPLETE_/compaction=universal/cache=.5/bloom=10 hdr=_HOBJTOSEQ_"
+OPTION(rocksdb_column_families, OPT_STR, "")
 
 /**
  * osd_client_op_priority and osd_recovery_op_priority adjust the relative
@@ -688,6 +722,14 @@ OPTION(filestore_wbthrottle_xfs_inodes_start_flusher, OPT_U64, 500)
 OPTION(filestore_wbthrottle_btrfs_inodes_hard_limit, OPT_U64, 5000)
 OPTION(filestore_wbthrottle_xfs_inodes_hard_limit, OPT_U64, 5000)
 
+/// scale the limits above to keep per-object flush latency near a target
+OPTION(filestore_wbthrottle_adaptive, OPT_BOOL, false)
+OPTION(filestore_wbthrottle_adaptive_target_lat, OPT_DOUBLE, .02) // seconds per fsync/fdatasync
+OPTION(filestore_wbthrottle_adaptive_window, OPT_U64, 64) // flushes between adjustments
+OPTION(filestore_wbthrottle_adaptive_max_queue_depth, OPT_U64, 32) // don't raise limits with the device queue this deep
+OPTION(filestore_wbthrottle_adaptive_min_scale, OPT_DOUBLE, .0625)
+OPTION(filestore_wbthrottle_adaptive_max_scale, OPT_DOUBLE, 4)
+
 // Tests index failure paths
 OPTION(filestore_index_retry_probability, OPT_DOUBLE, 0)
 
@@ -696,6 +738,7 @@ OPTION(filestore_debug_inject_read_err, OPT_BOOL, false)
 
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
 OPTION(filestore_omap_header_cache_size, OPT_INT, 1024) 
+OPTION(filestore_omap_header_cache_shards, OPT_INT, 16) // header cache and header locks are split by object hash
 
 // Use omap for xattrs for attrs over
 // filestore_max_inline_xattr_size or
@@ -710,6 +753,10 @@ OPTION(filestore_max_inline_xattrs_xfs, OPT_U32, 10)
 OPTION(filestore_max_inline_xattrs_btrfs, OPT_U32, 10)
 OPTION(filestore_max_inline_xattrs_other, OPT_U32, 2)
 
+// keep the attrs read on every op ("_" and "snapset") together in one
+// xattr, so that getting both costs at most one getxattr
+OPTION(filestore_pack_hot_xattrs, OPT_BOOL, false)
+
 OPTION(filestore_sloppy_crc, OPT_BOOL, false)         // track sloppy crcs
 OPTION(filestore_sloppy_crc_block_size, OPT_INT, 65536)
 
@@ -722,6 +769,7 @@ OPTION(filestore_btrfs_clone_range, OPT_BOOL, true)
 OPTION(filestore_zfs_snap, OPT_BOOL, false) // zfsonlinux is still unstable
 OPTION(filestore_fsync_flushes_journal_data, OPT_BOOL, false)
 OPTION(filestore_fiemap, OPT_BOOL, false)     // (try to) use fiemap
+OPTION(filestore_seek_data_hole, OPT_BOOL, true)     // (try to) use SEEK_DATA/SEEK_HOLE to skip holes
 
 // (try to) use extsize for alloc hint
 // WARNING: extsize seems to trigger data corruption in xfs -- that is why it is
@@ -736,12 +784,17 @@ OPTION(filestore_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(filestore_queue_committing_max_ops, OPT_INT, 500)        // this is ON TOP of filestore_queue_max_*
 OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
+OPTION(filestore_io_uring, OPT_BOOL, false)   // batch op data writes through io_uring, if available
+OPTION(filestore_io_uring_depth, OPT_INT, 256)  // queue depth of each op thread's ring
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_index_async_split, OPT_BOOL, false) // split/merge collection dirs in a background thread
+OPTION(filestore_index_async_split_batch, OPT_INT, 64) // objects linked per index lock hold while staging a split
+OPTION(filestore_index_lfn_cache_size, OPT_INT, 256) // resolved long filenames cached per collection, 0 to disable
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_fd_cache_size, OPT_INT, 128)    // FD lru size
@@ -765,8 +818,21 @@ OPTION(keyvaluestore_op_thread_suicide_timeout, OPT_INT, 180)
 OPTION(keyvaluestore_default_strip_size, OPT_INT, 4096) // Only affect new object
 OPTION(keyvaluestore_max_expected_write_size, OPT_U64, 1ULL << 24) // bytes
 OPTION(keyvaluestore_header_cache_size, OPT_INT, 4096)    // Header cache size
+OPTION(keyvaluestore_strip_cache_size, OPT_INT, 4096)    // Strips kept in the strip cache
+OPTION(keyvaluestore_enable_tail_strips, OPT_BOOL, false) // Store short tail strips in a store made before them; older versions can then no longer mount it
+OPTION(keyvaluestore_group_commit_max_bytes, OPT_U64, 16 << 20) // commit at once when this much is waiting
+OPTION(keyvaluestore_group_commit_max_wait, OPT_DOUBLE, 0) // seconds to wait for more ops to share a sync
 OPTION(keyvaluestore_backend, OPT_STR, "leveldb")
 
+OPTION(memstore_page_size, OPT_U64, 64 << 10)  // MemStore object data is kept in pages of this size
+
+OPTION(blockstore_backend, OPT_STR, "leveldb")
+OPTION(blockstore_block_file_size, OPT_U64, 10ULL << 30) // size of the block file mkfs creates if there is no device
+OPTION(blockstore_block_size, OPT_U32, 4096)      // allocation unit
+OPTION(blockstore_direct_write_min_size, OPT_U32, 65536) // smaller overwrites of unshared extents go through the kv wal
+OPTION(blockstore_onode_cache_size, OPT_INT, 4096)
+OPTION(blockstore_wal_max_applied, OPT_INT, 64)   // applied wal records to accumulate before flushing the device and trimming
+
 // max bytes to search ahead in journal searching for corruption
 OPTION(journal_max_corrupt_search, OPT_U64, 10<<20)
 OPTION(journal_block_align, OPT_BOOL, true)
@@ -776,7 +842,9 @@ OPTION(journal_max_write_entries, OPT_INT, 100)
 OPTION(journal_queue_max_ops, OPT_INT, 300)
 OPTION(journal_queue_max_bytes, OPT_INT, 32 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
+OPTION(journal_align_all_data, OPT_BOOL, false)  // page-align every such payload; journal entries then need a ceph that decodes Transaction v8
 OPTION(journal_replay_from, OPT_INT, 0)
+OPTION(journal_replay_threads, OPT_INT, 4)  // apply journal entries touching disjoint objects/collections concurrently on replay
 OPTION(journal_zero_on_create, OPT_BOOL, false)
 OPTION(journal_ignore_corruption, OPT_BOOL, false) // assume journal is not corrupt
 
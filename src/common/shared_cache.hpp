@@ -193,7 +193,7 @@ public:
     return val;
   }
 
-  VPtr lookup(const K& key) {
+  VPtr lookup(const K& key, unsigned *evicted = NULL) {
     VPtr val;
     list<VPtr> to_release;
     {
@@ -216,6 +216,8 @@ public:
       } while (retry);
       --waiting;
     }
+    if (evicted)
+      *evicted = to_release.size();
     return val;
   }
 
@@ -229,9 +231,11 @@ public:
    * @param value The value that goes with the key
    * @param existed Set to true if the value was already in the
    * map, false otherwise
+   * @param evicted Set to the number of entries pushed out of the LRU
    * @return A reference to the map's value for the given key
    */
-  VPtr add(const K& key, V *value, bool *existed = NULL) {
+  VPtr add(const K& key, V *value, bool *existed = NULL,
+	   unsigned *evicted = NULL) {
     VPtr val;
     list<VPtr> to_release;
     {
@@ -241,6 +245,8 @@ public:
       if (actual != weak_refs.end() && actual->first == key) {
         if (existed) 
           *existed = true;
+        if (evicted)
+          *evicted = 0;
 
         return actual->second.first.lock();
       }
@@ -252,6 +258,8 @@ public:
       weak_refs.insert(actual, make_pair(key, make_pair(val, value)));
       lru_add(key, val, &to_release);
     }
+    if (evicted)
+      *evicted = to_release.size();
     return val;
   }
 
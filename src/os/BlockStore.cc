@@ -0,0 +1,3049 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2014 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "acconfig.h"
+
+#include "include/types.h"
+#include "include/compat.h"
+#include "include/stringify.h"
+#include "common/errno.h"
+#include "common/safe_io.h"
+#include "common/blkdev.h"
+#include "common/Formatter.h"
+#include "BlockStore.h"
+#include "GenericObjectMap.h"
+
+#define dout_subsys ceph_subsys_blockstore
+#undef dout_prefix
+#define dout_prefix *_dout << "blockstore(" << path << ") "
+
+/*
+ * kv key prefixes
+ *
+ *   S: superblock values (block_size, nid_max, ...)
+ *   C: collection -> xattrs
+ *   O: collection+object (see GenericObjectMap::header_key) -> bs_onode_t
+ *   M: nid + '.' + key -> omap value
+ *   B: physical offset -> length of a free extent
+ *   R: physical offset -> bs_ref_t
+ *   L: wal seq -> list<bs_wal_op_t>
+ *   D: release seq -> interval_set<uint64_t> released by a committed
+ *      transaction, not yet back in the free list
+ */
+static const string PREFIX_SUPER = "S";
+static const string PREFIX_COLL = "C";
+static const string PREFIX_OBJ = "O";
+static const string PREFIX_OMAP = "M";
+static const string PREFIX_FREE = "B";
+static const string PREFIX_REF = "R";
+static const string PREFIX_WAL = "L";
+static const string PREFIX_RELEASE = "D";
+
+/// largest extent we hand out in one piece
+static const uint64_t MAX_EXTENT = 1ull << 30;
+
+
+// ---------------
+// types
+
+void bs_extent_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("offset", offset);
+  f->dump_unsigned("length", length);
+  f->dump_unsigned("ref", ref);
+}
+
+ostream& operator<<(ostream& out, const bs_extent_t& e)
+{
+  out << e.offset << "~" << e.length;
+  if (e.ref != e.offset)
+    out << "(ref " << e.ref << ")";
+  return out;
+}
+
+void bs_onode_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(nid, bl);
+  ::encode(size, bl);
+  ::encode(attrs, bl);
+  ::encode(block_map, bl);
+  ::encode(omap_header, bl);
+  ::encode(expected_object_size, bl);
+  ::encode(expected_write_size, bl);
+  ENCODE_FINISH(bl);
+}
+
+void bs_onode_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  ::decode(nid, p);
+  ::decode(size, p);
+  ::decode(attrs, p);
+  ::decode(block_map, p);
+  ::decode(omap_header, p);
+  ::decode(expected_object_size, p);
+  ::decode(expected_write_size, p);
+  DECODE_FINISH(p);
+}
+
+void bs_onode_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("nid", nid);
+  f->dump_unsigned("size", size);
+  f->open_array_section("attrs");
+  for (map<string,bufferptr>::const_iterator p = attrs.begin();
+       p != attrs.end(); ++p) {
+    f->open_object_section("attr");
+    f->dump_string("name", p->first);
+    f->dump_unsigned("len", p->second.length());
+    f->close_section();
+  }
+  f->close_section();
+  f->open_array_section("block_map");
+  for (map<uint64_t,bs_extent_t>::const_iterator p = block_map.begin();
+       p != block_map.end(); ++p) {
+    f->open_object_section("extent");
+    f->dump_unsigned("logical_offset", p->first);
+    p->second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->dump_unsigned("omap_header_len", omap_header.length());
+}
+
+
+// ---------------
+// keys
+
+string BlockStore::u64_key(uint64_t v)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+  return string(buf);
+}
+
+string BlockStore::onode_key(coll_t cid, const ghobject_t& oid)
+{
+  return GenericObjectMap::header_key(cid, oid);
+}
+
+string BlockStore::omap_key(uint64_t nid, const string& key)
+{
+  return u64_key(nid) + "." + key;
+}
+
+
+// ---------------
+// omap iterator
+
+BlockStore::OmapIteratorImpl::OmapIteratorImpl(KeyValueDB::Iterator it,
+					       uint64_t nid)
+  : it(it)
+{
+  head = u64_key(nid) + ".";
+  tail = u64_key(nid) + "/";   // '/' sorts immediately after '.'
+  it->lower_bound(head);
+}
+
+int BlockStore::OmapIteratorImpl::seek_to_first()
+{
+  return it->lower_bound(head);
+}
+
+int BlockStore::OmapIteratorImpl::upper_bound(const string& after)
+{
+  return it->upper_bound(head + after);
+}
+
+int BlockStore::OmapIteratorImpl::lower_bound(const string& to)
+{
+  return it->lower_bound(head + to);
+}
+
+bool BlockStore::OmapIteratorImpl::valid()
+{
+  return it->valid() && it->key() < tail;
+}
+
+int BlockStore::OmapIteratorImpl::next()
+{
+  return it->next();
+}
+
+string BlockStore::OmapIteratorImpl::key()
+{
+  return it->key().substr(head.length());
+}
+
+bufferlist BlockStore::OmapIteratorImpl::value()
+{
+  return it->value();
+}
+
+
+// ---------------
+// setup
+
+BlockStore::BlockStore(CephContext *cct, const string& path)
+  : ObjectStore(path),
+    cct(cct),
+    db(NULL),
+    fsid_fd(-1),
+    dev_fd(-1),
+    dev_size(0),
+    block_size(cct->_conf->blockstore_block_size),
+    direct_min(cct->_conf->blockstore_direct_write_min_size),
+    mounted(false),
+    ext_db(NULL),
+    lock("BlockStore::lock"),
+    default_osr("default"),
+    onode_cache(cct->_conf->blockstore_onode_cache_size),
+    pending_lock("BlockStore::pending_lock"),
+    free_bytes(0),
+    alloc_cursor(0),
+    nid_max(0),
+    kv_lock("BlockStore::kv_lock"),
+    kv_seq(0),
+    kv_committed(0),
+    kv_trim_wal(false),
+    kv_stop(false),
+    kv_nid_max(0),
+    wal_seq(0),
+    release_seq(0),
+    kv_next_dirty(false),
+    kv_next_flush(false),
+    kv_sync_thread(this),
+    finisher(cct),
+    write_finisher(cct),
+    logger(NULL),
+    sharded(false)
+{
+  PerfCountersBuilder b(cct, "blockstore",
+			l_blockstore_first, l_blockstore_last);
+  b.add_u64_counter(l_blockstore_direct_bytes, "direct_bytes");
+  b.add_u64_counter(l_blockstore_wal_bytes, "wal_bytes");
+  b.add_u64_counter(l_blockstore_rmw_bytes, "rmw_bytes");
+  b.add_u64_counter(l_blockstore_kv_bytes, "kv_bytes");
+  b.add_u64_counter(l_blockstore_alloc_bytes, "alloc_bytes");
+  b.add_u64_counter(l_blockstore_release_bytes, "release_bytes");
+  b.add_time_avg(l_blockstore_dev_flush_lat, "dev_flush_lat");
+  b.add_time_avg(l_blockstore_kv_commit_lat, "kv_commit_lat");
+  b.add_u64_avg(l_blockstore_kv_batch_txcs, "kv_batch_txcs");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+BlockStore::~BlockStore()
+{
+  assert(!mounted);
+  assert(db == NULL);
+  assert(dev_fd < 0);
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+int BlockStore::peek_journal_fsid(uuid_d *fsid)
+{
+  *fsid = uuid_d();
+  return 0;
+}
+
+void BlockStore::set_fsid(uuid_d u)
+{
+  fsid = u;
+}
+
+uuid_d BlockStore::get_fsid()
+{
+  return fsid;
+}
+
+int BlockStore::_open_fsid(bool create)
+{
+  assert(fsid_fd < 0);
+  string fn = path + "/fsid";
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
+  fsid_fd = ::open(fn.c_str(), flags, 0644);
+  if (fsid_fd < 0) {
+    int r = -errno;
+    derr << __func__ << " " << fn << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+int BlockStore::_lock_fsid()
+{
+  struct flock l;
+  memset(&l, 0, sizeof(l));
+  l.l_type = F_WRLCK;
+  l.l_whence = SEEK_SET;
+  l.l_start = 0;
+  l.l_len = 0;
+  int r = ::fcntl(fsid_fd, F_SETLK, &l);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " failed to lock " << path
+	 << "/fsid, is another ceph-osd still running? "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+bool BlockStore::test_mount_in_use()
+{
+  if (_open_fsid(false) < 0)
+    return false;   // no fsid, ok.
+  bool inuse = _lock_fsid() < 0;
+  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
+  fsid_fd = -1;
+  return inuse;
+}
+
+int BlockStore::_open_dev(bool create)
+{
+  assert(dev_fd < 0);
+  string fn = path + "/block";
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
+  dev_fd = ::open(fn.c_str(), flags, 0644);
+  if (dev_fd < 0) {
+    int r = -errno;
+    derr << __func__ << " " << fn << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  struct stat st;
+  int r = ::fstat(dev_fd, &st);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fstat " << fn << ": " << cpp_strerror(r) << dendl;
+    goto out_fail;
+  }
+  if (S_ISBLK(st.st_mode)) {
+    int64_t s;
+    r = get_block_device_size(dev_fd, &s);
+    if (r < 0)
+      goto out_fail;
+    dev_size = s;
+  } else {
+    if (create && st.st_size == 0) {
+      uint64_t want = cct->_conf->blockstore_block_file_size;
+      r = ::ftruncate(dev_fd, want);
+      if (r < 0) {
+	r = -errno;
+	derr << __func__ << " failed to size " << fn << " to " << want
+	     << ": " << cpp_strerror(r) << dendl;
+	goto out_fail;
+      }
+      st.st_size = want;
+    }
+    dev_size = st.st_size;
+  }
+  dev_size -= dev_size % block_size;
+  dout(1) << __func__ << " " << fn << " size " << dev_size
+	  << " (" << pretty_si_t(dev_size) << "B)"
+	  << " block_size " << block_size << dendl;
+  return 0;
+
+ out_fail:
+  VOID_TEMP_FAILURE_RETRY(::close(dev_fd));
+  dev_fd = -1;
+  return r;
+}
+
+void BlockStore::_close_dev()
+{
+  assert(dev_fd >= 0);
+  VOID_TEMP_FAILURE_RETRY(::close(dev_fd));
+  dev_fd = -1;
+}
+
+int BlockStore::_open_db(bool create)
+{
+  assert(!db);
+  if (ext_db) {
+    db = ext_db;
+    return 0;
+  }
+  string fn = path + "/db";
+  if (create) {
+    int r = ::mkdir(fn.c_str(), 0755);
+    if (r < 0)
+      r = -errno;
+    if (r < 0 && r != -EEXIST) {
+      derr << __func__ << " failed to create " << fn << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  string backend;
+  if (read_meta("kv_backend", &backend) < 0 || backend.empty()) {
+    if (!create) {
+      derr << __func__ << " no kv_backend recorded in " << path << dendl;
+      return -EIO;
+    }
+    backend = cct->_conf->blockstore_backend;
+    int r = write_meta("kv_backend", backend);
+    if (r < 0)
+      return r;
+  }
+  db = KeyValueDB::create(cct, backend, fn);
+  if (!db) {
+    derr << __func__ << " error creating kv backend " << backend << dendl;
+    return -EIO;
+  }
+  db->init();
+  stringstream err;
+  int r;
+  if (create)
+    r = db->create_and_open(err);
+  else
+    r = db->open(err);
+  if (r) {
+    derr << __func__ << " error opening " << backend << " db: "
+	 << err.str() << dendl;
+    delete db;
+    db = NULL;
+    return -EIO;
+  }
+  dout(1) << __func__ << " opened " << backend << " db at " << fn << dendl;
+  return 0;
+}
+
+void BlockStore::_close_db()
+{
+  assert(db);
+  if (db != ext_db)
+    delete db;
+  db = NULL;
+}
+
+int BlockStore::mkfs()
+{
+  dout(1) << __func__ << " path " << path << dendl;
+  int r = _open_fsid(true);
+  if (r < 0)
+    return r;
+  r = _lock_fsid();
+  if (r < 0)
+    goto out_close_fsid;
+
+  {
+    uuid_d old_fsid;
+    char fsid_str[40];
+    memset(fsid_str, 0, sizeof(fsid_str));
+    r = safe_read(fsid_fd, fsid_str, sizeof(fsid_str) - 1);
+    if (r < 0)
+      goto out_close_fsid;
+    if (r > 36)
+      fsid_str[36] = 0;
+    if (!old_fsid.parse(fsid_str) || old_fsid.is_zero()) {
+      if (fsid.is_zero()) {
+	fsid.generate_random();
+	dout(1) << __func__ << " generated fsid " << fsid << dendl;
+      } else {
+	dout(1) << __func__ << " using provided fsid " << fsid << dendl;
+      }
+      fsid.print(fsid_str);
+      strcat(fsid_str, "\n");
+      r = ::ftruncate(fsid_fd, 0);
+      if (r < 0) {
+	r = -errno;
+	goto out_close_fsid;
+      }
+      r = safe_pwrite(fsid_fd, fsid_str, strlen(fsid_str), 0);
+      if (r < 0)
+	goto out_close_fsid;
+      r = ::fsync(fsid_fd);
+      if (r < 0) {
+	r = -errno;
+	goto out_close_fsid;
+      }
+    } else {
+      if (!fsid.is_zero() && fsid != old_fsid) {
+	derr << __func__ << " on-disk fsid " << old_fsid
+	     << " != provided " << fsid << dendl;
+	r = -EINVAL;
+	goto out_close_fsid;
+      }
+      fsid = old_fsid;
+      dout(1) << __func__ << " fsid is already set to " << fsid << dendl;
+    }
+  }
+
+  r = write_meta("type", "blockstore");
+  if (r < 0)
+    goto out_close_fsid;
+
+  r = _open_dev(true);
+  if (r < 0)
+    goto out_close_fsid;
+  r = _open_db(true);
+  if (r < 0)
+    goto out_close_dev;
+
+  {
+    set<string> keys;
+    map<string,bufferlist> out;
+    keys.insert("block_size");
+    db->get(PREFIX_SUPER, keys, &out);
+    if (!out.empty()) {
+      bufferlist::iterator p = out["block_size"].begin();
+      uint64_t bs;
+      ::decode(bs, p);
+      dout(1) << __func__ << " already formatted, block_size " << bs << dendl;
+    } else {
+      KeyValueDB::Transaction t = db->get_transaction();
+      bufferlist bl;
+      ::encode(block_size, bl);
+      t->set(PREFIX_SUPER, "block_size", bl);
+      bufferlist nbl;
+      ::encode((uint64_t)0, nbl);
+      t->set(PREFIX_SUPER, "nid_max", nbl);
+      // the first block is reserved for a label
+      bufferlist fbl;
+      ::encode(dev_size - block_size, fbl);
+      t->set(PREFIX_FREE, u64_key(block_size), fbl);
+      r = db->submit_transaction_sync(t);
+      if (r < 0)
+	goto out_close_db;
+      dout(1) << __func__ << " initialized " << dev_size - block_size
+	      << " bytes of free space" << dendl;
+    }
+  }
+  r = 0;
+
+ out_close_db:
+  _close_db();
+ out_close_dev:
+  _close_dev();
+ out_close_fsid:
+  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
+  fsid_fd = -1;
+  return r;
+}
+
+int BlockStore::_load_freelist()
+{
+  free_map.clear();
+  free_bytes = 0;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_FREE);
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    uint64_t offset = strtoull(it->key().c_str(), NULL, 16);
+    uint64_t length;
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    ::decode(length, p);
+    free_map[offset] = length;
+    free_bytes += length;
+  }
+  dout(10) << __func__ << " " << free_map.size() << " free extents, "
+	   << free_bytes << " bytes" << dendl;
+  return 0;
+}
+
+int BlockStore::_load_refs()
+{
+  ref_map.clear();
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_REF);
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    uint64_t offset = strtoull(it->key().c_str(), NULL, 16);
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    ::decode(ref_map[offset], p);
+  }
+  dout(10) << __func__ << " " << ref_map.size() << " allocations" << dendl;
+  return 0;
+}
+
+int BlockStore::_load_collections()
+{
+  coll_map.clear();
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_COLL);
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    CollectionRef c(new Collection);
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    ::decode(c->xattr, p);
+    coll_map[coll_t(it->key())] = c;
+  }
+  dout(10) << __func__ << " " << coll_map.size() << " collections" << dendl;
+  return 0;
+}
+
+int BlockStore::_replay_wal()
+{
+  KeyValueDB::Transaction t = db->get_transaction();
+  unsigned count = 0;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_WAL);
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    uint64_t seq = strtoull(it->key().c_str(), NULL, 16);
+    list<bs_wal_op_t> ops;
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    ::decode(ops, p);
+    dout(20) << __func__ << " replay wal " << seq << " (" << ops.size()
+	     << " ops)" << dendl;
+    for (list<bs_wal_op_t>::iterator q = ops.begin(); q != ops.end(); ++q) {
+      int r = _dev_write(q->offset, q->data);
+      if (r < 0)
+	return r;
+    }
+    t->rmkey(PREFIX_WAL, it->key());
+    if (seq > wal_seq)
+      wal_seq = seq;
+    ++count;
+  }
+  if (count) {
+    _flush_dev();
+    int r = db->submit_transaction_sync(t);
+    if (r < 0)
+      return r;
+  }
+  dout(10) << __func__ << " replayed " << count << " wal records" << dendl;
+  return 0;
+}
+
+int BlockStore::_replay_released()
+{
+  KeyValueDB::Transaction t = db->get_transaction();
+  unsigned count = 0;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_RELEASE);
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    uint64_t seq = strtoull(it->key().c_str(), NULL, 16);
+    interval_set<uint64_t> released;
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    ::decode(released, p);
+    dout(20) << __func__ << " release " << seq << " " << released << dendl;
+    for (interval_set<uint64_t>::iterator q = released.begin();
+	 q != released.end();
+	 ++q) {
+      _free_insert(free_map, t, q.get_start(), q.get_len());
+      free_bytes += q.get_len();
+    }
+    t->rmkey(PREFIX_RELEASE, it->key());
+    ++count;
+  }
+  if (count) {
+    int r = db->submit_transaction_sync(t);
+    if (r < 0)
+      return r;
+  }
+  dout(10) << __func__ << " released " << count << " records" << dendl;
+  return 0;
+}
+
+int BlockStore::mount()
+{
+  dout(1) << __func__ << " path " << path << dendl;
+
+  int r = _open_fsid(false);
+  if (r < 0)
+    return r;
+  r = _lock_fsid();
+  if (r < 0)
+    goto out_close_fsid;
+  {
+    char fsid_str[40];
+    memset(fsid_str, 0, sizeof(fsid_str));
+    r = safe_pread(fsid_fd, fsid_str, sizeof(fsid_str) - 1, 0);
+    if (r < 0)
+      goto out_close_fsid;
+    if (r > 36)
+      fsid_str[36] = 0;
+    if (!fsid.parse(fsid_str)) {
+      derr << __func__ << " unable to parse fsid" << dendl;
+      r = -EINVAL;
+      goto out_close_fsid;
+    }
+  }
+
+  r = _open_dev(false);
+  if (r < 0)
+    goto out_close_fsid;
+  r = _open_db(false);
+  if (r < 0)
+    goto out_close_dev;
+
+  {
+    set<string> keys;
+    map<string,bufferlist> out;
+    keys.insert("block_size");
+    keys.insert("nid_max");
+    db->get(PREFIX_SUPER, keys, &out);
+    if (out.size() != 2) {
+      derr << __func__ << " missing superblock, not formatted?" << dendl;
+      r = -EIO;
+      goto out_close_db;
+    }
+    bufferlist::iterator p = out["block_size"].begin();
+    ::decode(block_size, p);
+    p = out["nid_max"].begin();
+    ::decode(nid_max, p);
+  }
+
+  r = _load_freelist();
+  if (r < 0)
+    goto out_close_db;
+  r = _load_refs();
+  if (r < 0)
+    goto out_close_db;
+  r = _load_collections();
+  if (r < 0)
+    goto out_close_db;
+  r = _replay_wal();
+  if (r < 0)
+    goto out_close_db;
+  // after the wal: records we replayed may point into this space
+  r = _replay_released();
+  if (r < 0)
+    goto out_close_db;
+
+  kv_free_map = free_map;
+  kv_ref_map = ref_map;
+  kv_nid_max = nid_max;
+  kv_next = db->get_transaction();
+  kv_next_dirty = false;
+  kv_next_flush = false;
+  kv_seq = kv_committed = 0;
+  kv_trim_wal = false;
+  kv_stop = false;
+
+  finisher.start();
+  write_finisher.start();
+  kv_sync_thread.create();
+  mounted = true;
+  return 0;
+
+ out_close_db:
+  _close_db();
+ out_close_dev:
+  _close_dev();
+ out_close_fsid:
+  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
+  fsid_fd = -1;
+  return r;
+}
+
+int BlockStore::umount()
+{
+  assert(mounted);
+  dout(1) << __func__ << dendl;
+
+  sync();
+  kv_lock.Lock();
+  kv_stop = true;
+  kv_cond.SignalAll();
+  kv_lock.Unlock();
+  kv_sync_thread.join();
+  kv_next.reset();
+  assert(kv_queue.empty());
+  assert(pending_txcs.empty());
+
+  write_finisher.wait_for_empty();
+  write_finisher.stop();
+  finisher.wait_for_empty();
+  finisher.stop();
+
+  onode_cache.set_size(0);
+  coll_map.clear();
+  free_map.clear();
+  ref_map.clear();
+  kv_free_map.clear();
+  kv_ref_map.clear();
+  wal_applied.clear();
+  _close_db();
+  _close_dev();
+  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
+  fsid_fd = -1;
+  mounted = false;
+  onode_cache.set_size(cct->_conf->blockstore_onode_cache_size);
+  return 0;
+}
+
+int BlockStore::statfs(struct statfs *buf)
+{
+  memset(buf, 0, sizeof(*buf));
+  Mutex::Locker l(pending_lock);
+  buf->f_bsize = block_size;
+  buf->f_blocks = dev_size / block_size;
+  buf->f_bfree = free_bytes / block_size;
+  buf->f_bavail = free_bytes / block_size;
+  return 0;
+}
+
+void BlockStore::collect_metadata(map<string,string> *pm)
+{
+  string backend;
+  if (read_meta("kv_backend", &backend) == 0)
+    (*pm)["blockstore_backend"] = backend;
+  (*pm)["blockstore_block_size"] = stringify(block_size);
+  (*pm)["blockstore_dev_size"] = stringify(dev_size);
+}
+
+objectstore_perf_stat_t BlockStore::get_cur_stats()
+{
+  objectstore_perf_stat_t ret;
+  pair<uint64_t,uint64_t> lat = logger->get_tavg_ms(l_blockstore_kv_commit_lat);
+  if (lat.first)
+    ret.filestore_commit_latency = lat.second / lat.first;
+  // transactions are applied as soon as they commit
+  ret.filestore_apply_latency = ret.filestore_commit_latency;
+  return ret;
+}
+
+void BlockStore::sync(Context *onsync)
+{
+  sync();
+  finisher.queue(onsync);
+}
+
+void BlockStore::sync()
+{
+  {
+    // retire the applied wal records with the next commit
+    Mutex::Locker l(kv_lock);
+    kv_trim_wal = true;
+    ++kv_seq;
+    kv_cond.SignalAll();
+  }
+  _kv_wait_committed();
+}
+
+void BlockStore::flush()
+{
+  _kv_wait_committed();
+  finisher.wait_for_empty();
+}
+
+void BlockStore::_kv_wait_committed()
+{
+  Mutex::Locker l(kv_lock);
+  uint64_t seq = kv_seq;
+  while (kv_committed < seq)
+    kv_cond.Wait(kv_lock);
+}
+
+void BlockStore::sync_and_flush()
+{
+  sync();
+  flush();
+}
+
+
+// ---------------
+// device
+
+void BlockStore::_flush_dev()
+{
+  utime_t start = ceph_clock_now(cct);
+#ifdef HAVE_FDATASYNC
+  int r = ::fdatasync(dev_fd);
+#else
+  int r = ::fsync(dev_fd);
+#endif
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " flush failed: " << cpp_strerror(r) << dendl;
+    assert(0 == "device flush failed");
+  }
+  logger->tinc(l_blockstore_dev_flush_lat, ceph_clock_now(cct) - start);
+}
+
+int BlockStore::_dev_write(uint64_t offset, bufferlist& bl)
+{
+  dout(30) << __func__ << " " << offset << "~" << bl.length() << dendl;
+  assert(offset + bl.length() <= dev_size);
+  for (std::list<bufferptr>::const_iterator p = bl.buffers().begin();
+       p != bl.buffers().end();
+       ++p) {
+    int r = safe_pwrite(dev_fd, p->c_str(), p->length(), offset);
+    if (r < 0) {
+      derr << __func__ << " " << offset << "~" << p->length() << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    offset += p->length();
+  }
+  return 0;
+}
+
+/// copy the ops in @p from that touch [offset, offset+length) to @p out
+static void get_overlapping(const list<bs_wal_op_t>& from, uint64_t offset,
+			    uint64_t length, list<bs_wal_op_t> *out)
+{
+  for (list<bs_wal_op_t>::const_iterator p = from.begin();
+       p != from.end(); ++p) {
+    if (p->offset < offset + length &&
+	p->offset + p->data.length() > offset)
+      out->push_back(*p);
+  }
+}
+
+void BlockStore::_get_pending_writes(TransContext *txc, uint64_t offset,
+				     uint64_t length, list<bs_wal_op_t> *ops)
+{
+  // data for new extents first, then the small overwrites that may
+  // follow it; a queued transaction stays pending until its wal ops
+  // are applied
+  {
+    Mutex::Locker l(pending_lock);
+    for (list<TransContext*>::iterator p = pending_txcs.begin();
+	 p != pending_txcs.end();
+	 ++p) {
+      get_overlapping((*p)->writes, offset, length, ops);
+      get_overlapping((*p)->wal, offset, length, ops);
+    }
+  }
+  get_overlapping(txc->writes, offset, length, ops);
+  get_overlapping(txc->wal, offset, length, ops);
+}
+
+int BlockStore::_read_range(TransContext *txc, OnodeRef o,
+			    uint64_t offset, uint64_t length, bufferlist& bl)
+{
+  uint64_t pos = offset;
+  uint64_t end = offset + length;
+  map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(offset);
+  while (pos < end) {
+    if (p == o->onode.block_map.end() || p->first >= end) {
+      bufferptr z(end - pos);
+      z.zero();
+      bl.append(z);
+      break;
+    }
+    if (p->first > pos) {
+      bufferptr z(p->first - pos);
+      z.zero();
+      bl.append(z);
+      pos = p->first;
+    }
+    uint64_t x_off = pos - p->first;
+    uint64_t x_len = MIN(p->second.length - x_off, end - pos);
+    uint64_t poff = p->second.offset + x_off;
+    // before we read: once an op is no longer pending it is on the device
+    list<bs_wal_op_t> pending;
+    if (txc)
+      _get_pending_writes(txc, poff, x_len, &pending);
+    bufferptr bp = buffer::create_page_aligned(x_len);
+    int r = safe_pread_exact(dev_fd, bp.c_str(), x_len, poff);
+    if (r < 0) {
+      derr << __func__ << " pread " << poff << "~" << x_len << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    for (list<bs_wal_op_t>::iterator w = pending.begin();
+	 w != pending.end(); ++w) {
+      uint64_t ws = MAX(w->offset, poff);
+      uint64_t we = MIN(w->offset + w->data.length(), poff + x_len);
+      w->data.copy(ws - w->offset, we - ws, bp.c_str() + (ws - poff));
+    }
+    bl.append(bp);
+    pos += x_len;
+    ++p;
+  }
+  return 0;
+}
+
+
+// ---------------
+// space management
+
+void BlockStore::_free_remove(map<uint64_t,uint64_t>& fm,
+			      KeyValueDB::Transaction t,
+			      uint64_t offset, uint64_t length)
+{
+  // the kv copy of the free list sees allocations in commit order, so
+  // the range need not start where its free extent does
+  map<uint64_t,uint64_t>::iterator p = fm.upper_bound(offset);
+  assert(p != fm.begin());
+  --p;
+  uint64_t start = p->first;
+  uint64_t end = p->first + p->second;
+  assert(end >= offset + length);
+  fm.erase(p);
+  if (start < offset) {
+    fm[start] = offset - start;
+    if (t) {
+      bufferlist bl;
+      ::encode(offset - start, bl);
+      t->set(PREFIX_FREE, u64_key(start), bl);
+    }
+  } else if (t) {
+    t->rmkey(PREFIX_FREE, u64_key(start));
+  }
+  if (offset + length < end) {
+    fm[offset + length] = end - offset - length;
+    if (t) {
+      bufferlist bl;
+      ::encode(end - offset - length, bl);
+      t->set(PREFIX_FREE, u64_key(offset + length), bl);
+    }
+  }
+}
+
+void BlockStore::_free_insert(map<uint64_t,uint64_t>& fm,
+			      KeyValueDB::Transaction t,
+			      uint64_t offset, uint64_t length)
+{
+  map<uint64_t,uint64_t>::iterator n = fm.lower_bound(offset);
+  assert(n == fm.end() || n->first >= offset + length);
+  if (n != fm.end() && n->first == offset + length) {
+    length += n->second;
+    if (t)
+      t->rmkey(PREFIX_FREE, u64_key(n->first));
+    fm.erase(n++);
+  }
+  if (n != fm.begin()) {
+    map<uint64_t,uint64_t>::iterator p = n;
+    --p;
+    assert(p->first + p->second <= offset);
+    if (p->first + p->second == offset) {
+      if (t)
+	t->rmkey(PREFIX_FREE, u64_key(p->first));
+      offset = p->first;
+      length += p->second;
+      fm.erase(p);
+    }
+  }
+  fm[offset] = length;
+  if (t) {
+    bufferlist bl;
+    ::encode(length, bl);
+    t->set(PREFIX_FREE, u64_key(offset), bl);
+  }
+}
+
+int BlockStore::_allocate(TransContext *txc, uint64_t want,
+			  vector<bs_extent_t> *extents)
+{
+  assert(want % block_size == 0);
+  Mutex::Locker l(pending_lock);
+  if (want > free_bytes) {
+    derr << __func__ << " want " << want << " but only " << free_bytes
+	 << " free" << dendl;
+    return -ENOSPC;
+  }
+  uint64_t allocated = 0;
+  while (want > 0) {
+    map<uint64_t,uint64_t>::iterator p = free_map.lower_bound(alloc_cursor);
+    if (p != free_map.begin()) {
+      map<uint64_t,uint64_t>::iterator q = p;
+      --q;
+      if (q->first + q->second > alloc_cursor)
+	p = q;
+    }
+    if (p == free_map.end())
+      p = free_map.begin();
+    assert(p != free_map.end());
+    uint64_t offset = p->first;
+    uint64_t length = MIN(MIN(p->second, want), MAX_EXTENT);
+    // the kv sync thread writes the free list and refs when we commit
+    _free_remove(free_map, KeyValueDB::Transaction(), offset, length);
+    free_bytes -= length;
+    bs_extent_t e(offset, length, offset);
+    ref_map[offset] = bs_ref_t(length, 1);
+    txc->allocated[offset] = length;
+    ++txc->ref_deltas[offset];
+    extents->push_back(e);
+    dout(20) << __func__ << " " << e << dendl;
+    want -= length;
+    allocated += length;
+    alloc_cursor = offset + length;
+  }
+  logger->inc(l_blockstore_alloc_bytes, allocated);
+  return 0;
+}
+
+void BlockStore::_ref_get(TransContext *txc, uint64_t ref)
+{
+  Mutex::Locker l(pending_lock);
+  map<uint64_t,bs_ref_t>::iterator p = ref_map.find(ref);
+  assert(p != ref_map.end());
+  ++p->second.refs;
+  ++txc->ref_deltas[ref];
+}
+
+void BlockStore::_ref_put(TransContext *txc, uint64_t ref)
+{
+  Mutex::Locker l(pending_lock);
+  map<uint64_t,bs_ref_t>::iterator p = ref_map.find(ref);
+  assert(p != ref_map.end());
+  assert(p->second.refs > 0);
+  if (--p->second.refs == 0) {
+    dout(20) << __func__ << " release " << ref << "~" << p->second.length
+	     << dendl;
+    txc->released.insert(ref, p->second.length);
+    ref_map.erase(p);
+  }
+  --txc->ref_deltas[ref];
+}
+
+/// drop the logical range [offset, offset+length) from the block map
+void BlockStore::_punch(TransContext *txc, OnodeRef o,
+			uint64_t offset, uint64_t length)
+{
+  uint64_t end = offset + length;
+  map<uint64_t,bs_extent_t>& bm = o->onode.block_map;
+  map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(offset);
+  while (p != bm.end() && p->first < end) {
+    uint64_t lstart = p->first;
+    bs_extent_t e = p->second;
+    uint64_t lend = lstart + e.length;
+    if (lend > end) {
+      // keep the tail
+      uint64_t skip = end - lstart;
+      bm[end] = bs_extent_t(e.offset + skip, e.length - skip, e.ref);
+      if (lstart < offset)
+	_ref_get(txc, e.ref);   // head survives too; one more piece
+    }
+    if (lstart < offset) {
+      // keep the head
+      p->second.length = offset - lstart;
+      ++p;
+    } else {
+      if (lend <= end)
+	_ref_put(txc, e.ref);   // piece is gone entirely
+      bm.erase(p++);
+    }
+  }
+}
+
+void BlockStore::_trim_wal(KeyValueDB::Transaction t)
+{
+  for (set<uint64_t>::iterator p = wal_applied.begin();
+       p != wal_applied.end();
+       ++p)
+    t->rmkey(PREFIX_WAL, u64_key(*p));
+  wal_applied.clear();
+}
+
+void BlockStore::_txc_finalize(TransContext *txc)
+{
+  dout(20) << __func__ << " " << txc->onodes.size() << " onodes, "
+	   << txc->wal.size() << " wal ops, " << txc->released.size()
+	   << " released" << dendl;
+
+  if (!txc->released.empty()) {
+    // don't apply (or replay) our own wal ops into space we just freed
+    list<bs_wal_op_t>::iterator p = txc->wal.begin();
+    while (p != txc->wal.end()) {
+      if (txc->released.intersects(p->offset, p->data.length()))
+	txc->wal.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  logger->inc(l_blockstore_direct_bytes, txc->direct_bytes);
+  logger->inc(l_blockstore_wal_bytes, txc->wal_bytes);
+  logger->inc(l_blockstore_rmw_bytes, txc->rmw_bytes);
+}
+
+void BlockStore::_txc_queue(TransContext *txc)
+{
+  Mutex::Locker l(pending_lock);
+  // what we changed is where the transactions after us start from
+  for (set<string>::iterator p = txc->dirty_onodes.begin();
+       p != txc->dirty_onodes.end();
+       ++p) {
+    pair<OnodeRef, unsigned>& po = pending_onodes[*p];
+    po.first = txc->onodes[*p];
+    ++po.second;
+  }
+  for (map<coll_t,CollectionRef>::iterator p = txc->colls.begin();
+       p != txc->colls.end();
+       ++p) {
+    pair<CollectionRef, unsigned>& pc = pending_colls[p->first];
+    pc.first = p->second;
+    ++pc.second;
+  }
+  for (map<uint64_t,omap_changes_t>::iterator p = txc->omap.begin();
+       p != txc->omap.end();
+       ++p) {
+    pair<omap_changes_t, unsigned>& pm = pending_omap[p->first];
+    for (omap_changes_t::iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q)
+      pm.first[q->first] = q->second;
+    ++pm.second;
+  }
+  pending_txcs.push_back(txc);
+
+  Mutex::Locker k(kv_lock);
+  txc->written = txc->writes.empty();
+  kv_queue.push_back(txc);
+  ++kv_seq;
+  kv_cond.SignalAll();
+}
+
+void BlockStore::_txc_write_data(TransContext *txc)
+{
+  // the writes stay in txc; they overlay reads until we are finished
+  for (list<bs_wal_op_t>::iterator p = txc->writes.begin();
+       p != txc->writes.end();
+       ++p) {
+    int r = _dev_write(p->offset, p->data);
+    assert(r == 0);
+  }
+
+  Mutex::Locker l(kv_lock);
+  txc->written = true;
+  kv_cond.SignalAll();
+}
+
+void BlockStore::_txc_encode(TransContext *txc, KeyValueDB::Transaction t,
+			     map<uint64_t,int> *ref_deltas)
+{
+  uint64_t kv_bytes = 0;
+
+  for (map<uint64_t,uint32_t>::iterator p = txc->allocated.begin();
+       p != txc->allocated.end();
+       ++p) {
+    _free_remove(kv_free_map, t, p->first, p->second);
+    kv_ref_map[p->first] = bs_ref_t(p->second, 0);
+  }
+  for (map<uint64_t,int>::iterator p = txc->ref_deltas.begin();
+       p != txc->ref_deltas.end();
+       ++p)
+    (*ref_deltas)[p->first] += p->second;
+
+  if (!txc->released.empty()) {
+    // the space goes back to the free list after we commit, when
+    // nothing can read it through the old onodes any more
+    txc->release_seq = ++release_seq;
+    bufferlist bl;
+    ::encode(txc->released, bl);
+    kv_bytes += bl.length();
+    t->set(PREFIX_RELEASE, u64_key(txc->release_seq), bl);
+  }
+
+  for (set<string>::iterator p = txc->dirty_onodes.begin();
+       p != txc->dirty_onodes.end();
+       ++p) {
+    OnodeRef o = txc->onodes[*p];
+    if (o->exists) {
+      bufferlist bl;
+      ::encode(o->onode, bl);
+      kv_bytes += bl.length();
+      t->set(PREFIX_OBJ, o->key, bl);
+    } else {
+      t->rmkey(PREFIX_OBJ, o->key);
+    }
+  }
+
+  for (map<uint64_t,omap_changes_t>::iterator p = txc->omap.begin();
+       p != txc->omap.end();
+       ++p) {
+    for (omap_changes_t::iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q) {
+      if (q->second.first) {
+	kv_bytes += q->second.second.length();
+	t->set(PREFIX_OMAP, omap_key(p->first, q->first), q->second.second);
+      } else {
+	t->rmkey(PREFIX_OMAP, omap_key(p->first, q->first));
+      }
+    }
+  }
+
+  for (map<coll_t,CollectionRef>::iterator p = txc->colls.begin();
+       p != txc->colls.end();
+       ++p) {
+    if (p->second) {
+      bufferlist bl;
+      ::encode(p->second->xattr, bl);
+      kv_bytes += bl.length();
+      t->set(PREFIX_COLL, stringify(p->first), bl);
+    } else {
+      t->rmkey(PREFIX_COLL, stringify(p->first));
+    }
+  }
+
+  if (!txc->wal.empty()) {
+    txc->wal_seq = ++wal_seq;
+    bufferlist bl;
+    ::encode(txc->wal, bl);
+    kv_bytes += bl.length();
+    t->set(PREFIX_WAL, u64_key(txc->wal_seq), bl);
+  }
+
+  logger->inc(l_blockstore_kv_bytes, kv_bytes);
+}
+
+/**
+ * Apply the refcount changes of everything in a commit at once: the
+ * transactions were queued in the order they finished preparing, not
+ * necessarily the order in which they took their refs.
+ */
+void BlockStore::_encode_refs(KeyValueDB::Transaction t,
+			      const map<uint64_t,int>& ref_deltas)
+{
+  for (map<uint64_t,int>::const_iterator p = ref_deltas.begin();
+       p != ref_deltas.end();
+       ++p) {
+    map<uint64_t,bs_ref_t>::iterator q = kv_ref_map.find(p->first);
+    assert(q != kv_ref_map.end());
+    int64_t refs = (int64_t)q->second.refs + p->second;
+    assert(refs >= 0);
+    if (refs == 0) {
+      t->rmkey(PREFIX_REF, u64_key(p->first));
+      kv_ref_map.erase(q);
+    } else {
+      q->second.refs = refs;
+      bufferlist bl;
+      ::encode(q->second, bl);
+      t->set(PREFIX_REF, u64_key(p->first), bl);
+    }
+  }
+}
+
+void BlockStore::_txc_finish(TransContext *txc)
+{
+  dout(20) << __func__ << " " << txc << " seq " << txc->seq << dendl;
+
+  // the wal record is stable; apply it in place
+  for (list<bs_wal_op_t>::iterator p = txc->wal.begin();
+       p != txc->wal.end();
+       ++p) {
+    int r = _dev_write(p->offset, p->data);
+    assert(r == 0);
+  }
+
+  {
+    RWLock::WLocker l(lock);
+    for (set<string>::iterator p = txc->dirty_onodes.begin();
+	 p != txc->dirty_onodes.end();
+	 ++p) {
+      OnodeRef o = txc->onodes[*p];
+      if (o->exists)
+	onode_cache.add(o->key, o);
+      else
+	onode_cache.clear(o->key);
+    }
+    for (map<coll_t,CollectionRef>::iterator p = txc->colls.begin();
+	 p != txc->colls.end();
+	 ++p) {
+      if (p->second)
+	coll_map[p->first] = p->second;
+      else
+	coll_map.erase(p->first);
+    }
+
+    // transactions prepared from now on find the committed versions
+    Mutex::Locker k(pending_lock);
+    for (set<string>::iterator p = txc->dirty_onodes.begin();
+	 p != txc->dirty_onodes.end();
+	 ++p) {
+      map<string, pair<OnodeRef, unsigned> >::iterator q =
+	pending_onodes.find(*p);
+      assert(q != pending_onodes.end());
+      if (--q->second.second == 0)
+	pending_onodes.erase(q);
+    }
+    for (map<coll_t,CollectionRef>::iterator p = txc->colls.begin();
+	 p != txc->colls.end();
+	 ++p) {
+      map<coll_t, pair<CollectionRef, unsigned> >::iterator q =
+	pending_colls.find(p->first);
+      assert(q != pending_colls.end());
+      if (--q->second.second == 0)
+	pending_colls.erase(q);
+    }
+    for (map<uint64_t,omap_changes_t>::iterator p = txc->omap.begin();
+	 p != txc->omap.end();
+	 ++p) {
+      map<uint64_t, pair<omap_changes_t, unsigned> >::iterator q =
+	pending_omap.find(p->first);
+      assert(q != pending_omap.end());
+      if (--q->second.second == 0)
+	pending_omap.erase(q);
+    }
+    assert(pending_txcs.front() == txc);
+    pending_txcs.pop_front();
+
+    uint64_t released = 0;
+    for (interval_set<uint64_t>::iterator p = txc->released.begin();
+	 p != txc->released.end();
+	 ++p) {
+      _free_insert(free_map, KeyValueDB::Transaction(),
+		   p.get_start(), p.get_len());
+      released += p.get_len();
+    }
+    if (released) {
+      free_bytes += released;
+      logger->inc(l_blockstore_release_bytes, released);
+    }
+  }
+
+  // and the same for kv, with the next commit
+  if (txc->wal_seq)
+    wal_applied.insert(txc->wal_seq);
+  if (!txc->released.empty()) {
+    // wal records that could still be replayed into the released
+    // space must be stable and retired before it can be reused
+    if (!wal_applied.empty()) {
+      _trim_wal(kv_next);
+      kv_next_flush = true;
+    }
+    for (interval_set<uint64_t>::iterator p = txc->released.begin();
+	 p != txc->released.end();
+	 ++p)
+      _free_insert(kv_free_map, kv_next, p.get_start(), p.get_len());
+    kv_next->rmkey(PREFIX_RELEASE, u64_key(txc->release_seq));
+    kv_next_dirty = true;
+  }
+  if (wal_applied.size() >=
+      (unsigned)cct->_conf->blockstore_wal_max_applied) {
+    _trim_wal(kv_next);
+    kv_next_flush = true;
+    kv_next_dirty = true;
+  }
+
+  if (txc->on_apply_sync)
+    txc->on_apply_sync->complete(0);
+  if (txc->on_apply)
+    finisher.queue(txc->on_apply);
+  if (txc->on_commit)
+    finisher.queue(txc->on_commit);
+
+  OpSequencer *osr = txc->osr;
+  osr->lock.Lock();
+  osr->applied = txc->seq;
+  while (!osr->commit_waiters.empty() &&
+	 osr->commit_waiters.begin()->first <= txc->seq) {
+    finisher.queue(osr->commit_waiters.begin()->second);
+    osr->commit_waiters.erase(osr->commit_waiters.begin());
+  }
+  osr->cond.SignalAll();
+  osr->lock.Unlock();
+  delete txc;
+}
+
+void BlockStore::_kv_sync_thread()
+{
+  kv_lock.Lock();
+  while (true) {
+    if (kv_queue.empty() && !kv_trim_wal && !kv_next_dirty) {
+      if (kv_stop)
+	break;
+      kv_cond.Wait(kv_lock);
+      continue;
+    }
+
+    // whatever is queued from now on goes to the next commit
+    list<TransContext*> txcs;
+    txcs.swap(kv_queue);
+    uint64_t seq = kv_seq;
+    bool trim = kv_trim_wal;
+    kv_trim_wal = false;
+    for (list<TransContext*>::iterator p = txcs.begin(); p != txcs.end(); ++p)
+      while (!(*p)->written)
+	kv_cond.Wait(kv_lock);
+    kv_lock.Unlock();
+
+    KeyValueDB::Transaction t = kv_next;
+    bool dirty = kv_next_dirty;
+    bool need_dev_flush = kv_next_flush;
+    kv_next = db->get_transaction();
+    kv_next_dirty = false;
+    kv_next_flush = false;
+    if (trim && !wal_applied.empty()) {
+      _trim_wal(t);
+      need_dev_flush = true;
+      dirty = true;
+    }
+    if (!txcs.empty()) {
+      map<uint64_t,int> ref_deltas;
+      for (list<TransContext*>::iterator p = txcs.begin();
+	   p != txcs.end();
+	   ++p) {
+	_txc_encode(*p, t, &ref_deltas);
+	if ((*p)->need_dev_flush)
+	  need_dev_flush = true;
+      }
+      _encode_refs(t, ref_deltas);
+      uint64_t nid;
+      {
+	Mutex::Locker l(pending_lock);
+	nid = nid_max;
+      }
+      if (nid != kv_nid_max) {
+	bufferlist bl;
+	::encode(nid, bl);
+	t->set(PREFIX_SUPER, "nid_max", bl);
+	kv_nid_max = nid;
+      }
+      if (need_dev_flush) {
+	// the device is flushed anyway; retire the wal records applied
+	// so far along with us
+	_trim_wal(t);
+      }
+      dirty = true;
+    }
+
+    if (dirty) {
+      // data written to new extents must be stable before kv points at it
+      if (need_dev_flush)
+	_flush_dev();
+      utime_t start = ceph_clock_now(cct);
+      int r = db->submit_transaction_sync(t);
+      if (r < 0) {
+	derr << __func__ << " kv commit failed: " << cpp_strerror(r) << dendl;
+	assert(0 == "kv commit failed");
+      }
+      logger->tinc(l_blockstore_kv_commit_lat, ceph_clock_now(cct) - start);
+      logger->inc(l_blockstore_kv_batch_txcs, txcs.size());
+      dout(20) << __func__ << " committed " << txcs.size()
+	       << " transactions" << dendl;
+    }
+
+    for (list<TransContext*>::iterator p = txcs.begin(); p != txcs.end(); ++p)
+      _txc_finish(*p);
+
+    kv_lock.Lock();
+    kv_committed = seq;
+    kv_cond.SignalAll();
+  }
+  kv_lock.Unlock();
+}
+
+
+// ---------------
+// lookup
+
+BlockStore::CollectionRef BlockStore::_get_collection(TransContext *txc,
+						      coll_t cid)
+{
+  if (txc) {
+    map<coll_t,CollectionRef>::iterator p = txc->colls.find(cid);
+    if (p != txc->colls.end())
+      return p->second;
+    {
+      // an uncommitted transaction before us may have changed it
+      Mutex::Locker l(pending_lock);
+      map<coll_t, pair<CollectionRef, unsigned> >::iterator q =
+	pending_colls.find(cid);
+      if (q != pending_colls.end())
+	return q->second.first;
+    }
+    // readers come in with it held already
+    RWLock::RLocker l(lock);
+    return _get_collection(NULL, cid);
+  }
+  ceph::unordered_map<coll_t,CollectionRef>::iterator cp = coll_map.find(cid);
+  if (cp == coll_map.end())
+    return CollectionRef();
+  return cp->second;
+}
+
+BlockStore::CollectionRef BlockStore::_get_collection_copy(TransContext *txc,
+							   coll_t cid)
+{
+  map<coll_t,CollectionRef>::iterator p = txc->colls.find(cid);
+  if (p != txc->colls.end())
+    return p->second;
+  CollectionRef c = _get_collection(txc, cid);
+  if (!c)
+    return c;
+  // ours to change until we commit; readers keep the old one
+  c.reset(new Collection(*c));
+  txc->colls[cid] = c;
+  return c;
+}
+
+BlockStore::OnodeRef BlockStore::_get_onode(TransContext *txc, coll_t cid,
+					    const ghobject_t& oid, bool create)
+{
+  string key = onode_key(cid, oid);
+  OnodeRef o;
+  if (txc) {
+    map<string,OnodeRef>::iterator p = txc->onodes.find(key);
+    if (p != txc->onodes.end()) {
+      o = p->second;
+      if (!o->exists) {
+	if (!create)
+	  return OnodeRef();
+	// removed earlier in this transaction; start over
+	o->onode = bs_onode_t();
+	o->onode.nid = _new_nid();
+	o->exists = true;
+	_dirty_onode(txc, o);
+      }
+      return o;
+    }
+    // an uncommitted transaction before us may have changed it; look
+    // there first, it is in the cache or kv by the time it is not
+    Mutex::Locker l(pending_lock);
+    map<string, pair<OnodeRef, unsigned> >::iterator q =
+      pending_onodes.find(key);
+    if (q != pending_onodes.end())
+      o = q->second.first;
+  }
+
+  if (!o && !onode_cache.lookup(key, &o)) {
+    set<string> keys;
+    map<string,bufferlist> out;
+    keys.insert(key);
+    db->get(PREFIX_OBJ, keys, &out);
+    if (!out.empty()) {
+      o.reset(new Onode(key, cid, oid));
+      bufferlist::iterator p = out.begin()->second.begin();
+      ::decode(o->onode, p);
+      o->exists = true;
+      onode_cache.add(key, o);
+    }
+  }
+
+  if (!o || !o->exists) {
+    if (!create)
+      return OnodeRef();
+    assert(txc);
+    o.reset(new Onode(key, cid, oid));
+    o->onode.nid = _new_nid();
+    o->exists = true;
+    _dirty_onode(txc, o);
+    dout(20) << __func__ << " new " << cid << " " << oid << " nid "
+	     << o->onode.nid << dendl;
+    return o;
+  }
+  if (txc) {
+    // ours to change until we commit; readers keep the cached one
+    o.reset(new Onode(*o));
+    txc->onodes[key] = o;
+  }
+  return o;
+}
+
+void BlockStore::_dirty_onode(TransContext *txc, OnodeRef o)
+{
+  txc->onodes[o->key] = o;
+  txc->dirty_onodes.insert(o->key);
+}
+
+uint64_t BlockStore::_new_nid()
+{
+  Mutex::Locker l(pending_lock);
+  return ++nid_max;
+}
+
+
+// ---------------
+// read operations
+
+bool BlockStore::exists(coll_t cid, const ghobject_t& oid)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return false;
+  return (bool)_get_onode(NULL, cid, oid, false);
+}
+
+int BlockStore::stat(
+    coll_t cid,
+    const ghobject_t& oid,
+    struct stat *st,
+    bool allow_eio)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  memset(st, 0, sizeof(*st));
+  st->st_size = o->onode.size;
+  st->st_blksize = block_size;
+  st->st_blocks = (st->st_size + st->st_blksize - 1) / st->st_blksize;
+  st->st_nlink = 1;
+  return 0;
+}
+
+int BlockStore::read(
+    coll_t cid,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl,
+    bool allow_eio)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << " "
+	   << offset << "~" << len << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  bl.clear();
+  if (offset >= o->onode.size)
+    return 0;
+  size_t length = len;
+  if (length == 0 || offset + length > o->onode.size)
+    length = o->onode.size - offset;
+  int r = _read_range(NULL, o, offset, length, bl);
+  if (r < 0)
+    return r;
+  return bl.length();
+}
+
+int BlockStore::fiemap(coll_t cid, const ghobject_t& oid,
+		       uint64_t offset, size_t len, bufferlist& bl)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << " " << offset << "~"
+	   << len << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  map<uint64_t, uint64_t> m;
+  if (offset < o->onode.size) {
+    uint64_t end = MIN(offset + len, o->onode.size);
+    map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(offset);
+    for (; p != o->onode.block_map.end() && p->first < end; ++p) {
+      uint64_t s = MAX(p->first, offset);
+      uint64_t e = MIN(p->first + p->second.length, end);
+      if (!m.empty()) {
+	map<uint64_t,uint64_t>::reverse_iterator last = m.rbegin();
+	if (last->first + last->second == s) {
+	  last->second += e - s;
+	  continue;
+	}
+      }
+      m[s] = e - s;
+    }
+  }
+  ::encode(m, bl);
+  return 0;
+}
+
+int BlockStore::getattr(coll_t cid, const ghobject_t& oid,
+			const char *name, bufferptr& value)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << " " << name << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  map<string,bufferptr>::iterator p = o->onode.attrs.find(name);
+  if (p == o->onode.attrs.end())
+    return -ENODATA;
+  value = p->second;
+  return 0;
+}
+
+int BlockStore::getattrs(coll_t cid, const ghobject_t& oid,
+			 map<string,bufferptr>& aset)
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  aset = o->onode.attrs;
+  return 0;
+}
+
+int BlockStore::list_collections(vector<coll_t>& ls)
+{
+  RWLock::RLocker l(lock);
+  for (ceph::unordered_map<coll_t,CollectionRef>::iterator p = coll_map.begin();
+       p != coll_map.end();
+       ++p)
+    ls.push_back(p->first);
+  return 0;
+}
+
+bool BlockStore::collection_exists(coll_t c)
+{
+  RWLock::RLocker l(lock);
+  return coll_map.count(c);
+}
+
+int BlockStore::collection_getattr(coll_t cid, const char *name,
+				   void *value, size_t size)
+{
+  dout(10) << __func__ << " " << cid << " " << name << dendl;
+  RWLock::RLocker l(lock);
+  CollectionRef c = _get_collection(NULL, cid);
+  if (!c)
+    return -ENOENT;
+  map<string,bufferptr>::iterator p = c->xattr.find(name);
+  if (p == c->xattr.end())
+    return -ENOENT;
+  size_t l2 = MIN(size, p->second.length());
+  memcpy(value, p->second.c_str(), l2);
+  return l2;
+}
+
+int BlockStore::collection_getattr(coll_t cid, const char *name,
+				   bufferlist& bl)
+{
+  dout(10) << __func__ << " " << cid << " " << name << dendl;
+  RWLock::RLocker l(lock);
+  CollectionRef c = _get_collection(NULL, cid);
+  if (!c)
+    return -ENOENT;
+  map<string,bufferptr>::iterator p = c->xattr.find(name);
+  if (p == c->xattr.end())
+    return -ENOENT;
+  bl.clear();
+  bl.append(p->second);
+  return bl.length();
+}
+
+int BlockStore::collection_getattrs(coll_t cid, map<string,bufferptr>& aset)
+{
+  dout(10) << __func__ << " " << cid << dendl;
+  RWLock::RLocker l(lock);
+  CollectionRef c = _get_collection(NULL, cid);
+  if (!c)
+    return -ENOENT;
+  aset = c->xattr;
+  return 0;
+}
+
+int BlockStore::_collection_list(TransContext *txc, coll_t cid,
+				 ghobject_t start, ghobject_t end,
+				 int max, vector<ghobject_t> *ls,
+				 ghobject_t *pnext)
+{
+  // the pending overlay can't honor a limit; only used unbounded
+  assert(!txc || max < 0);
+  string prefix = GenericObjectMap::header_key(cid);
+  map<ghobject_t,bool> pending;   ///< oid -> exists
+  if (txc) {
+    // before kv: what commits meanwhile is there by the time it is not
+    // pending any more
+    {
+      Mutex::Locker l(pending_lock);
+      for (map<string, pair<OnodeRef, unsigned> >::iterator p =
+	     pending_onodes.lower_bound(prefix);
+	   p != pending_onodes.end() &&
+	     p->first.compare(0, prefix.length(), prefix) == 0;
+	   ++p)
+	pending[p->second.first->oid] = p->second.first->exists;
+    }
+    for (map<string,OnodeRef>::iterator p = txc->onodes.lower_bound(prefix);
+	 p != txc->onodes.end() &&
+	   p->first.compare(0, prefix.length(), prefix) == 0;
+	 ++p)
+      pending[p->second->oid] = p->second->exists;
+  }
+  set<ghobject_t> found;
+  ghobject_t next = ghobject_t::get_max();
+  if (start.is_max())
+    goto out;
+  {
+    string end_key;
+    if (!end.is_max())
+      end_key = onode_key(cid, end);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OBJ);
+    if (start == ghobject_t())
+      it->lower_bound(prefix);
+    else
+      it->lower_bound(onode_key(cid, start));
+    for (; it->valid(); it->next()) {
+      string k = it->key();
+      if (k.compare(0, prefix.length(), prefix) != 0)
+	break;
+      if (end_key.length() && k >= end_key)
+	break;
+      coll_t c;
+      ghobject_t oid;
+      bool ok = GenericObjectMap::parse_header_key(k, &c, &oid);
+      assert(ok);
+      if (max >= 0 && (int)found.size() >= max) {
+	next = oid;
+	break;
+      }
+      found.insert(oid);
+    }
+  }
+  for (map<ghobject_t,bool>::iterator p = pending.begin();
+       p != pending.end();
+       ++p) {
+    if (p->second)
+      found.insert(p->first);
+    else
+      found.erase(p->first);
+  }
+ out:
+  ls->insert(ls->end(), found.begin(), found.end());
+  if (pnext)
+    *pnext = next;
+  return 0;
+}
+
+bool BlockStore::collection_empty(coll_t cid)
+{
+  dout(10) << __func__ << " " << cid << dendl;
+  RWLock::RLocker l(lock);
+  vector<ghobject_t> ls;
+  _collection_list(NULL, cid, ghobject_t(), ghobject_t::get_max(), 1,
+		   &ls, NULL);
+  return ls.empty();
+}
+
+int BlockStore::collection_list(coll_t cid, vector<ghobject_t>& o)
+{
+  dout(10) << __func__ << " " << cid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  return _collection_list(NULL, cid, ghobject_t(), ghobject_t::get_max(), -1,
+			  &o, NULL);
+}
+
+int BlockStore::collection_list_partial(coll_t cid, ghobject_t start,
+					int min, int max, snapid_t snap,
+					vector<ghobject_t> *ls,
+					ghobject_t *next)
+{
+  dout(10) << __func__ << " " << cid << " " << start << " " << min << "-"
+	   << max << " " << snap << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  return _collection_list(NULL, cid, start, ghobject_t::get_max(), max,
+			  ls, next);
+}
+
+int BlockStore::collection_list_range(coll_t cid,
+				      ghobject_t start, ghobject_t end,
+				      snapid_t seq, vector<ghobject_t> *ls)
+{
+  dout(10) << __func__ << " " << cid << " " << start << " " << end
+	   << " " << seq << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  return _collection_list(NULL, cid, start, end, -1, ls, NULL);
+}
+
+void BlockStore::_omap_list(TransContext *txc, uint64_t nid,
+			    map<string,bufferlist> *out)
+{
+  // pending changes before kv, as in _collection_list
+  omap_changes_t changes;
+  if (txc) {
+    {
+      Mutex::Locker l(pending_lock);
+      map<uint64_t, pair<omap_changes_t, unsigned> >::iterator p =
+	pending_omap.find(nid);
+      if (p != pending_omap.end())
+	changes = p->second.first;
+    }
+    map<uint64_t,omap_changes_t>::iterator p = txc->omap.find(nid);
+    if (p != txc->omap.end()) {
+      for (omap_changes_t::iterator q = p->second.begin();
+	   q != p->second.end();
+	   ++q)
+	changes[q->first] = q->second;
+    }
+  }
+  ObjectMap::ObjectMapIterator it(
+    new OmapIteratorImpl(db->get_iterator(PREFIX_OMAP), nid));
+  for (it->seek_to_first(); it->valid(); it->next())
+    (*out)[it->key()] = it->value();
+  for (omap_changes_t::iterator p = changes.begin(); p != changes.end(); ++p) {
+    if (p->second.first)
+      (*out)[p->first] = p->second.second;
+    else
+      out->erase(p->first);
+  }
+}
+
+int BlockStore::omap_get(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    bufferlist *header,      ///< [out] omap header
+    map<string, bufferlist> *out /// < [out] Key to value map
+    )
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  *header = o->onode.omap_header;
+  _omap_list(NULL, o->onode.nid, out);
+  return 0;
+}
+
+int BlockStore::omap_get_header(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    bufferlist *header,      ///< [out] omap header
+    bool allow_eio ///< [in] don't assert on eio
+    )
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  *header = o->onode.omap_header;
+  return 0;
+}
+
+int BlockStore::omap_get_keys(
+    coll_t cid,              ///< [in] Collection containing oid
+    const ghobject_t &oid, ///< [in] Object containing omap
+    set<string> *keys      ///< [out] Keys defined on oid
+    )
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  ObjectMap::ObjectMapIterator it(
+    new OmapIteratorImpl(db->get_iterator(PREFIX_OMAP), o->onode.nid));
+  for (it->seek_to_first(); it->valid(); it->next())
+    keys->insert(it->key());
+  return 0;
+}
+
+int BlockStore::omap_get_values(
+    coll_t cid,                    ///< [in] Collection containing oid
+    const ghobject_t &oid,       ///< [in] Object containing omap
+    const set<string> &keys,     ///< [in] Keys to get
+    map<string, bufferlist> *out ///< [out] Returned keys and values
+    )
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  set<string> to_get;
+  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p)
+    to_get.insert(omap_key(o->onode.nid, *p));
+  map<string,bufferlist> got;
+  db->get(PREFIX_OMAP, to_get, &got);
+  size_t skip = omap_key(o->onode.nid, string()).length();
+  for (map<string,bufferlist>::iterator p = got.begin(); p != got.end(); ++p)
+    (*out)[p->first.substr(skip)] = p->second;
+  return 0;
+}
+
+int BlockStore::omap_check_keys(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    const set<string> &keys, ///< [in] Keys to check
+    set<string> *out         ///< [out] Subset of keys defined on oid
+    )
+{
+  map<string,bufferlist> got;
+  int r = omap_get_values(cid, oid, keys, &got);
+  if (r < 0)
+    return r;
+  for (map<string,bufferlist>::iterator p = got.begin(); p != got.end(); ++p)
+    out->insert(p->first);
+  return 0;
+}
+
+ObjectMap::ObjectMapIterator BlockStore::get_omap_iterator(
+  coll_t cid,              ///< [in] collection
+  const ghobject_t &oid  ///< [in] object
+  )
+{
+  dout(10) << __func__ << " " << cid << " " << oid << dendl;
+  RWLock::RLocker l(lock);
+  if (!_get_collection(NULL, cid))
+    return ObjectMap::ObjectMapIterator();
+  OnodeRef o = _get_onode(NULL, cid, oid, false);
+  if (!o)
+    return ObjectMap::ObjectMapIterator();
+  return ObjectMap::ObjectMapIterator(
+    new OmapIteratorImpl(db->get_iterator(PREFIX_OMAP), o->onode.nid));
+}
+
+
+// ---------------
+// write operations
+
+int BlockStore::queue_transactions(Sequencer *posr,
+				   list<Transaction*>& tls,
+				   TrackedOpRef op,
+				   ThreadPool::TPHandle *handle)
+{
+  if (!posr)
+    posr = &default_osr;
+  OpSequencer *osr;
+  if (posr->p) {
+    osr = static_cast<OpSequencer *>(posr->p);
+  } else {
+    osr = new OpSequencer(&finisher);
+    posr->p = osr;
+  }
+
+  TransContext *txc = new TransContext(osr);
+  ObjectStore::Transaction::collect_contexts(tls, &txc->on_apply,
+					     &txc->on_commit,
+					     &txc->on_apply_sync);
+
+  osr->lock.Lock();
+  txc->seq = ++osr->queued;
+  osr->lock.Unlock();
+
+  // we start from what the transactions before us left pending; none
+  // of this waits for them to commit
+  for (list<Transaction*>::iterator p = tls.begin(); p != tls.end(); ++p) {
+    if (handle)
+      handle->reset_tp_timeout();
+    _do_transaction(**p, txc);
+  }
+  _txc_finalize(txc);
+
+  // once it is queued txc may be committed and gone at any time
+  bool have_writes = !txc->writes.empty();
+  _txc_queue(txc);
+  if (have_writes)
+    write_finisher.queue(new C_WriteData(this, txc));
+  return 0;
+}
+
+void BlockStore::_do_transaction(Transaction& t, TransContext *txc)
+{
+  Transaction::iterator i = t.begin();
+  int pos = 0;
+
+  while (i.have_op()) {
+    int op = i.decode_op();
+    int r = 0;
+
+    switch (op) {
+    case Transaction::OP_NOP:
+      break;
+    case Transaction::OP_TOUCH:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	r = _touch(txc, cid, oid);
+      }
+      break;
+
+    case Transaction::OP_WRITE:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	uint64_t off = i.decode_length();
+	uint64_t len = i.decode_length();
+	bufferlist bl;
+	i.decode_bl(bl);
+	r = _write(txc, cid, oid, off, len, bl);
+      }
+      break;
+
+    case Transaction::OP_ZERO:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	uint64_t off = i.decode_length();
+	uint64_t len = i.decode_length();
+	r = _zero(txc, cid, oid, off, len);
+      }
+      break;
+
+    case Transaction::OP_TRIMCACHE:
+      {
+	i.decode_cid();
+	i.decode_oid();
+	i.decode_length();
+	i.decode_length();
+	// deprecated, no-op
+      }
+      break;
+
+    case Transaction::OP_TRUNCATE:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	uint64_t off = i.decode_length();
+	r = _truncate(txc, cid, oid, off);
+      }
+      break;
+
+    case Transaction::OP_REMOVE:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	r = _remove(txc, cid, oid);
+      }
+      break;
+
+    case Transaction::OP_SETATTR:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	string name = i.decode_attrname();
+	bufferlist bl;
+	i.decode_bl(bl);
+	map<string, bufferptr> to_set;
+	to_set[name] = bufferptr(bl.c_str(), bl.length());
+	r = _setattrs(txc, cid, oid, to_set);
+      }
+      break;
+
+    case Transaction::OP_SETATTRS:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	map<string, bufferptr> aset;
+	i.decode_attrset(aset);
+	r = _setattrs(txc, cid, oid, aset);
+      }
+      break;
+
+    case Transaction::OP_RMATTR:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	string name = i.decode_attrname();
+	r = _rmattr(txc, cid, oid, name.c_str());
+      }
+      break;
+
+    case Transaction::OP_RMATTRS:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	r = _rmattrs(txc, cid, oid);
+      }
+      break;
+
+    case Transaction::OP_CLONE:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	ghobject_t noid = i.decode_oid();
+	r = _clone(txc, cid, oid, cid, noid);
+      }
+      break;
+
+    case Transaction::OP_CLONERANGE:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	ghobject_t noid = i.decode_oid();
+	uint64_t off = i.decode_length();
+	uint64_t len = i.decode_length();
+	r = _clone_range(txc, cid, oid, noid, off, len, off);
+      }
+      break;
+
+    case Transaction::OP_CLONERANGE2:
+      {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	ghobject_t noid = i.decode_oid();
+	uint64_t srcoff = i.decode_length();
+	uint64_t len = i.decode_length();
+	uint64_t dstoff = i.decode_length();
+	r = _clone_range(txc, cid, oid, noid, srcoff, len, dstoff);
+      }
+      break;
+
+    case Transaction::OP_MKCOLL:
+      {
+	coll_t cid = i.decode_cid();
+	r = _create_collection(txc, cid);
+      }
+      break;
+
+    case Transaction::OP_COLL_HINT:
+      {
+	coll_t cid = i.decode_cid();
+	uint32_t type = i.decode_u32();
+	bufferlist hint;
+	i.decode_bl(hint);
+	// the block map has no directory structure to pre-split
+	dout(10) << "ignoring collection hint type " << type << " on "
+		 << cid << dendl;
+      }
+      break;
+
+    case Transaction::OP_RMCOLL:
+      {
+	coll_t cid = i.decode_cid();
+	r = _destroy_collection(txc, cid);
+      }
+      break;
+
+    case Transaction::OP_COLL_ADD:
+      {
+	coll_t ncid = i.decode_cid();
+	coll_t ocid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	r = _collection_add(txc, ncid, ocid, oid);
+      }
+      break;
+
+    case Transaction::OP_COLL_REMOVE:
+       {
+	coll_t cid = i.decode_cid();
+	ghobject_t oid = i.decode_oid();
+	r = _remove(txc, cid, oid);
+       }
+      break;
+
+    case Transaction::OP_COLL_MOVE:
+      assert(0 == "deprecated");
+      break;
+
+    case Transaction::OP_COLL_MOVE_RENAME:
+      {
+	coll_t oldcid = i.decode_cid();
+	ghobject_t oldoid = i.decode_oid();
+	coll_t newcid = i.decode_cid();
+	ghobject_t newoid = i.decode_oid();
+	r = _collection_move_rename(txc, oldcid, oldoid, newcid, newoid);
+      }
+      break;
+
+    case Transaction::OP_COLL_SETATTR:
+      {
+	coll_t cid = i.decode_cid();
+	string name = i.decode_attrname();
+	bufferlist bl;
+	i.decode_bl(bl);
+	r = _collection_setattr(txc, cid, name.c_str(), bl.c_str(),
+				bl.length());
+      }
+      break;
+
+    case Transaction::OP_COLL_RMATTR:
+      {
+	coll_t cid = i.decode_cid();
+	string name = i.decode_attrname();
+	r = _collection_rmattr(txc, cid, name.c_str());
+      }
+      break;
+
+    case Transaction::OP_COLL_RENAME:
+      {
+	coll_t cid(i.decode_cid());
+	coll_t ncid(i.decode_cid());
+	r = -EOPNOTSUPP;
+      }
+      break;
+
+    case Transaction::OP_OMAP_CLEAR:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	r = _omap_clear(txc, cid, oid);
+      }
+      break;
+    case Transaction::OP_OMAP_SETKEYS:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	map<string, bufferlist> aset;
+	i.decode_attrset(aset);
+	r = _omap_setkeys(txc, cid, oid, aset);
+      }
+      break;
+    case Transaction::OP_OMAP_RMKEYS:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	set<string> keys;
+	i.decode_keyset(keys);
+	r = _omap_rmkeys(txc, cid, oid, keys);
+      }
+      break;
+    case Transaction::OP_OMAP_RMKEYRANGE:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	string first, last;
+	first = i.decode_key();
+	last = i.decode_key();
+	r = _omap_rmkeyrange(txc, cid, oid, first, last);
+      }
+      break;
+    case Transaction::OP_OMAP_SETHEADER:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	bufferlist bl;
+	i.decode_bl(bl);
+	r = _omap_setheader(txc, cid, oid, bl);
+      }
+      break;
+    case Transaction::OP_SPLIT_COLLECTION:
+      assert(0 == "deprecated");
+      break;
+    case Transaction::OP_SPLIT_COLLECTION2:
+      {
+	coll_t cid(i.decode_cid());
+	uint32_t bits(i.decode_u32());
+	uint32_t rem(i.decode_u32());
+	coll_t dest(i.decode_cid());
+	r = _split_collection(txc, cid, bits, rem, dest);
+      }
+      break;
+
+    case Transaction::OP_SETALLOCHINT:
+      {
+	coll_t cid(i.decode_cid());
+	ghobject_t oid = i.decode_oid();
+	uint64_t expected_object_size = i.decode_length();
+	uint64_t expected_write_size = i.decode_length();
+	r = _set_alloc_hint(txc, cid, oid, expected_object_size,
+			    expected_write_size);
+      }
+      break;
+
+    default:
+      derr << "bad op " << op << dendl;
+      assert(0);
+    }
+
+    if (r < 0) {
+      bool ok = false;
+
+      if (r == -ENOENT && !(op == Transaction::OP_CLONERANGE ||
+			    op == Transaction::OP_CLONE ||
+			    op == Transaction::OP_CLONERANGE2 ||
+			    op == Transaction::OP_COLL_ADD))
+	// -ENOENT is usually okay
+	ok = true;
+      if (r == -ENODATA)
+	ok = true;
+
+      if (!ok) {
+	const char *msg = "unexpected error code";
+
+	if (r == -ENOENT && (op == Transaction::OP_CLONERANGE ||
+			     op == Transaction::OP_CLONE ||
+			     op == Transaction::OP_CLONERANGE2))
+	  msg = "ENOENT on clone suggests osd bug";
+
+	if (r == -ENOSPC)
+	  // For now, if we hit _any_ ENOSPC, crash, before we do any damage
+	  // by partially applying transactions.
+	  msg = "ENOSPC handling not implemented";
+
+	if (r == -ENOTEMPTY)
+	  msg = "ENOTEMPTY suggests garbage data in osd data dir";
+
+	dout(0) << " error " << cpp_strerror(r) << " not handled on operation " << op
+		<< " (op " << pos << ", counting from 0)" << dendl;
+	dout(0) << msg << dendl;
+	dout(0) << " transaction dump:\n";
+	JSONFormatter f(true);
+	f.open_object_section("transaction");
+	t.dump(&f);
+	f.close_section();
+	f.flush(*_dout);
+	*_dout << dendl;
+	assert(0 == "unexpected error");
+      }
+    }
+
+    ++pos;
+  }
+}
+
+int BlockStore::_touch(TransContext *txc, coll_t cid, const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, true);
+  assert(o);
+  return 0;
+}
+
+bool BlockStore::_can_wal(OnodeRef o, uint64_t offset, size_t length)
+{
+  if (length >= direct_min)
+    return false;
+  // every byte must already map to an extent we don't share with a clone
+  uint64_t pos = offset;
+  uint64_t end = offset + length;
+  map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(offset);
+  while (pos < end) {
+    if (p == o->onode.block_map.end() || p->first > pos)
+      return false;
+    {
+      Mutex::Locker l(pending_lock);
+      map<uint64_t,bs_ref_t>::iterator r = ref_map.find(p->second.ref);
+      assert(r != ref_map.end());
+      if (r->second.refs > 1)
+	return false;
+    }
+    pos = p->first + p->second.length;
+    ++p;
+  }
+  return true;
+}
+
+int BlockStore::_do_write(TransContext *txc, OnodeRef o,
+			  uint64_t offset, size_t length, bufferlist& bl)
+{
+  dout(20) << __func__ << " " << o->oid << " " << offset << "~" << length
+	   << " size " << o->onode.size << dendl;
+  assert(length == bl.length());
+  if (length == 0)
+    return 0;
+
+  if (_can_wal(o, offset, length)) {
+    // small overwrite: log it in kv and apply in place after commit
+    uint64_t pos = offset;
+    uint64_t end = offset + length;
+    map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(offset);
+    while (pos < end) {
+      uint64_t x_off = pos - p->first;
+      uint64_t x_len = MIN(p->second.length - x_off, end - pos);
+      bs_wal_op_t w;
+      w.offset = p->second.offset + x_off;
+      w.data.substr_of(bl, pos - offset, x_len);
+      txc->wal.push_back(w);
+      pos += x_len;
+      ++p;
+    }
+    txc->wal_bytes += length;
+  } else {
+    // copy-on-write into freshly allocated extents
+    uint64_t b_off = offset - offset % block_size;
+    uint64_t end = offset + length;
+    uint64_t b_end = ROUND_UP_TO(end, block_size);
+    bufferlist data;
+    if (b_off < offset) {
+      int r = _read_range(txc, o, b_off, offset - b_off, data);
+      if (r < 0)
+	return r;
+      txc->rmw_bytes += offset - b_off;
+    }
+    data.append(bl);
+    if (end < b_end) {
+      bufferlist tail;
+      int r = _read_range(txc, o, end, b_end - end, tail);
+      if (r < 0)
+	return r;
+      data.claim_append(tail);
+      txc->rmw_bytes += b_end - end;
+    }
+    assert(data.length() == b_end - b_off);
+
+    vector<bs_extent_t> extents;
+    int r = _allocate(txc, b_end - b_off, &extents);
+    if (r < 0)
+      return r;
+    _punch(txc, o, b_off, b_end - b_off);
+    uint64_t lpos = b_off;
+    for (vector<bs_extent_t>::iterator p = extents.begin();
+	 p != extents.end();
+	 ++p) {
+      // written by the write finisher; nobody else can see them yet
+      bs_wal_op_t w;
+      w.offset = p->offset;
+      w.data.substr_of(data, lpos - b_off, p->length);
+      txc->writes.push_back(w);
+      o->onode.block_map[lpos] = *p;
+      lpos += p->length;
+    }
+    txc->direct_bytes += data.length();
+    txc->need_dev_flush = true;
+  }
+
+  if (offset + length > o->onode.size)
+    o->onode.size = offset + length;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_write(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		       uint64_t offset, size_t length, bufferlist& bl)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << " "
+	   << offset << "~" << length << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, true);
+  int r = _do_write(txc, o, offset, length, bl);
+  if (length == 0)
+    _dirty_onode(txc, o);
+  return r;
+}
+
+int BlockStore::_zero(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		      uint64_t offset, size_t length)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << " "
+	   << offset << "~" << length << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, true);
+  uint64_t end = offset + length;
+  uint64_t b_off = ROUND_UP_TO(offset, block_size);
+  uint64_t b_end = end - end % block_size;
+  if (b_off < b_end) {
+    // whole blocks become holes
+    _punch(txc, o, b_off, b_end - b_off);
+  } else {
+    b_off = b_end = end;
+  }
+  // partial blocks at either edge need zeros written, if they are mapped
+  pair<uint64_t,uint64_t> edges[2] = {
+    make_pair(offset, b_off),
+    make_pair(MAX(b_end, b_off), end)
+  };
+  for (int i = 0; i < 2; ++i) {
+    uint64_t s = edges[i].first, e = edges[i].second;
+    if (s >= e || s >= o->onode.size)
+      continue;
+    map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(s);
+    if (p == o->onode.block_map.end() || p->first >= e)
+      continue;
+    bufferptr z(e - s);
+    z.zero();
+    bufferlist zbl;
+    zbl.append(z);
+    int r = _do_write(txc, o, s, e - s, zbl);
+    if (r < 0)
+      return r;
+  }
+  if (end > o->onode.size)
+    o->onode.size = end;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_truncate(TransContext *txc, coll_t cid, const ghobject_t& oid,
+			  uint64_t size)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << " " << size << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  if (size < o->onode.size) {
+    uint64_t b_size = ROUND_UP_TO(size, block_size);
+    uint64_t zend = MIN(b_size, o->onode.size);
+    if (size < zend) {
+      // zero the tail of the last block so a later extension reads zeros
+      map<uint64_t,bs_extent_t>::iterator p = o->onode.find_extent(size);
+      if (p != o->onode.block_map.end() && p->first < zend) {
+	bufferptr z(zend - size);
+	z.zero();
+	bufferlist zbl;
+	zbl.append(z);
+	int r = _do_write(txc, o, size, zend - size, zbl);
+	if (r < 0)
+	  return r;
+      }
+    }
+    if (!o->onode.block_map.empty()) {
+      map<uint64_t,bs_extent_t>::reverse_iterator last =
+	o->onode.block_map.rbegin();
+      uint64_t mapped_end = last->first + last->second.length;
+      if (mapped_end > b_size)
+	_punch(txc, o, b_size, mapped_end - b_size);
+    }
+  }
+  o->onode.size = size;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+void BlockStore::_omap_set(TransContext *txc, uint64_t nid,
+			   const string& key, const bufferlist& bl)
+{
+  txc->omap[nid][key] = make_pair(true, bl);
+}
+
+void BlockStore::_omap_rm(TransContext *txc, uint64_t nid, const string& key)
+{
+  txc->omap[nid][key] = make_pair(false, bufferlist());
+}
+
+void BlockStore::_omap_clear_nid(TransContext *txc, uint64_t nid)
+{
+  map<string,bufferlist> keys;
+  _omap_list(txc, nid, &keys);
+  for (map<string,bufferlist>::iterator p = keys.begin(); p != keys.end(); ++p)
+    _omap_rm(txc, nid, p->first);
+}
+
+int BlockStore::_do_remove(TransContext *txc, OnodeRef o)
+{
+  _punch(txc, o, 0, (uint64_t)-1);
+  _omap_clear_nid(txc, o->onode.nid);
+  o->exists = false;
+  o->onode = bs_onode_t();
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_remove(TransContext *txc, coll_t cid, const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  return _do_remove(txc, o);
+}
+
+int BlockStore::_setattrs(TransContext *txc, coll_t cid, const ghobject_t& oid,
+			  const map<string,bufferptr>& aset)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  for (map<string,bufferptr>::const_iterator p = aset.begin();
+       p != aset.end(); ++p) {
+    // copy so we don't pin the (much larger) transaction buffer
+    o->onode.attrs[p->first] = bufferptr(p->second.c_str(),
+					 p->second.length());
+  }
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_rmattr(TransContext *txc, coll_t cid, const ghobject_t& oid,
+			const char *name)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << " " << name << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  if (o->onode.attrs.erase(name) == 0)
+    return -ENODATA;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_rmattrs(TransContext *txc, coll_t cid, const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  o->onode.attrs.clear();
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_clone(TransContext *txc, coll_t cid,
+		       const ghobject_t& oldoid,
+		       coll_t ncid, const ghobject_t& newoid)
+{
+  dout(15) << __func__ << " " << cid << " " << oldoid << " -> "
+	   << ncid << " " << newoid << dendl;
+  if (!_get_collection(txc, cid) || !_get_collection(txc, ncid))
+    return -ENOENT;
+  OnodeRef oo = _get_onode(txc, cid, oldoid, false);
+  if (!oo)
+    return -ENOENT;
+  OnodeRef no = _get_onode(txc, ncid, newoid, true);
+  if (no == oo)
+    return 0;
+
+  // drop whatever the target had
+  _punch(txc, no, 0, (uint64_t)-1);
+  _omap_clear_nid(txc, no->onode.nid);
+
+  // share the source extents; later writes to either copy will cow
+  no->onode.size = oo->onode.size;
+  no->onode.block_map = oo->onode.block_map;
+  for (map<uint64_t,bs_extent_t>::iterator p = no->onode.block_map.begin();
+       p != no->onode.block_map.end();
+       ++p)
+    _ref_get(txc, p->second.ref);
+  no->onode.attrs = oo->onode.attrs;
+  no->onode.omap_header = oo->onode.omap_header;
+
+  map<string,bufferlist> omap;
+  _omap_list(txc, oo->onode.nid, &omap);
+  for (map<string,bufferlist>::iterator p = omap.begin(); p != omap.end(); ++p)
+    _omap_set(txc, no->onode.nid, p->first, p->second);
+
+  _dirty_onode(txc, no);
+  return 0;
+}
+
+int BlockStore::_clone_range(TransContext *txc, coll_t cid,
+			     const ghobject_t& oldoid,
+			     const ghobject_t& newoid,
+			     uint64_t srcoff, uint64_t length, uint64_t dstoff)
+{
+  dout(15) << __func__ << " " << cid << " " << oldoid << " -> " << newoid
+	   << " " << srcoff << "~" << length << " -> " << dstoff << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef oo = _get_onode(txc, cid, oldoid, false);
+  if (!oo)
+    return -ENOENT;
+  OnodeRef no = _get_onode(txc, cid, newoid, true);
+  if (srcoff >= oo->onode.size)
+    return 0;
+  if (srcoff + length >= oo->onode.size)
+    length = oo->onode.size - srcoff;
+  bufferlist bl;
+  int r = _read_range(txc, oo, srcoff, length, bl);
+  if (r < 0)
+    return r;
+  r = _do_write(txc, no, dstoff, bl.length(), bl);
+  if (r < 0)
+    return r;
+  return 0;
+}
+
+int BlockStore::_set_alloc_hint(TransContext *txc, coll_t cid,
+				const ghobject_t& oid,
+				uint64_t expected_object_size,
+				uint64_t expected_write_size)
+{
+  dout(15) << __func__ << " " << cid << " " << oid
+	   << " object_size " << expected_object_size
+	   << " write_size " << expected_write_size << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  o->onode.expected_object_size = expected_object_size;
+  o->onode.expected_write_size = expected_write_size;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_omap_clear(TransContext *txc, coll_t cid,
+			    const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  _omap_clear_nid(txc, o->onode.nid);
+  o->onode.omap_header.clear();
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_omap_setkeys(TransContext *txc, coll_t cid,
+			      const ghobject_t& oid,
+			      const map<string, bufferlist>& aset)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  for (map<string,bufferlist>::const_iterator p = aset.begin();
+       p != aset.end(); ++p)
+    _omap_set(txc, o->onode.nid, p->first, p->second);
+  return 0;
+}
+
+int BlockStore::_omap_rmkeys(TransContext *txc, coll_t cid,
+			     const ghobject_t& oid, const set<string>& keys)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p)
+    _omap_rm(txc, o->onode.nid, *p);
+  return 0;
+}
+
+int BlockStore::_omap_rmkeyrange(TransContext *txc, coll_t cid,
+				 const ghobject_t& oid,
+				 const string& first, const string& last)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << " [" << first
+	   << ", " << last << ")" << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  map<string,bufferlist> keys;
+  _omap_list(txc, o->onode.nid, &keys);
+  map<string,bufferlist>::iterator p = keys.lower_bound(first);
+  map<string,bufferlist>::iterator e = keys.lower_bound(last);
+  for (; p != e; ++p)
+    _omap_rm(txc, o->onode.nid, p->first);
+  return 0;
+}
+
+int BlockStore::_omap_setheader(TransContext *txc, coll_t cid,
+				const ghobject_t& oid, const bufferlist& bl)
+{
+  dout(15) << __func__ << " " << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  OnodeRef o = _get_onode(txc, cid, oid, false);
+  if (!o)
+    return -ENOENT;
+  o->onode.omap_header = bl;
+  _dirty_onode(txc, o);
+  return 0;
+}
+
+int BlockStore::_create_collection(TransContext *txc, coll_t cid)
+{
+  dout(15) << __func__ << " " << cid << dendl;
+  if (_get_collection(txc, cid))
+    return -EEXIST;
+  txc->colls[cid] = CollectionRef(new Collection);
+  return 0;
+}
+
+int BlockStore::_destroy_collection(TransContext *txc, coll_t cid)
+{
+  dout(15) << __func__ << " " << cid << dendl;
+  if (!_get_collection(txc, cid))
+    return -ENOENT;
+  vector<ghobject_t> ls;
+  _collection_list(txc, cid, ghobject_t(), ghobject_t::get_max(), -1,
+		   &ls, NULL);
+  if (!ls.empty())
+    return -ENOTEMPTY;
+  txc->colls[cid] = CollectionRef();
+  return 0;
+}
+
+int BlockStore::_collection_add(TransContext *txc, coll_t cid, coll_t ocid,
+				const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << cid << " " << ocid << " " << oid << dendl;
+  if (!_get_collection(txc, cid) || !_get_collection(txc, ocid))
+    return -ENOENT;
+  if (_get_onode(txc, cid, oid, false))
+    return -EEXIST;
+  // there are no hard links; the new name gets a clone that shares extents
+  return _clone(txc, ocid, oid, cid, oid);
+}
+
+int BlockStore::_collection_move_rename(TransContext *txc, coll_t oldcid,
+					const ghobject_t& oldoid,
+					coll_t cid, const ghobject_t& oid)
+{
+  dout(15) << __func__ << " " << oldcid << " " << oldoid << " -> "
+	   << cid << " " << oid << dendl;
+  if (!_get_collection(txc, cid) || !_get_collection(txc, oldcid))
+    return -ENOENT;
+  OnodeRef oo = _get_onode(txc, oldcid, oldoid, false);
+  if (!oo)
+    return -ENOENT;
+  if (_get_onode(txc, cid, oid, false))
+    return -EEXIST;
+  OnodeRef no = _get_onode(txc, cid, oid, true);
+  // the nid moves with the onode, so the omap keys stay where they are
+  no->onode = oo->onode;
+  oo->exists = false;
+  oo->onode = bs_onode_t();
+  _dirty_onode(txc, oo);
+  _dirty_onode(txc, no);
+  return 0;
+}
+
+int BlockStore::_collection_setattr(TransContext *txc, coll_t cid,
+				    const char *name, const void *value,
+				    size_t size)
+{
+  dout(15) << __func__ << " " << cid << " " << name << dendl;
+  CollectionRef c = _get_collection_copy(txc, cid);
+  if (!c)
+    return -ENOENT;
+  c->xattr[name] = bufferptr((const char *)value, size);
+  return 0;
+}
+
+int BlockStore::_collection_rmattr(TransContext *txc, coll_t cid,
+				   const char *name)
+{
+  dout(15) << __func__ << " " << cid << " " << name << dendl;
+  CollectionRef c = _get_collection(txc, cid);
+  if (!c)
+    return -ENOENT;
+  if (!c->xattr.count(name))
+    return -ENODATA;
+  c = _get_collection_copy(txc, cid);
+  c->xattr.erase(name);
+  return 0;
+}
+
+int BlockStore::_split_collection(TransContext *txc, coll_t cid,
+				  uint32_t bits, uint32_t match, coll_t dest)
+{
+  dout(15) << __func__ << " " << cid << " " << bits << " " << match << " "
+	   << dest << dendl;
+  if (!_get_collection(txc, cid) || !_get_collection(txc, dest))
+    return -ENOENT;
+  vector<ghobject_t> ls;
+  _collection_list(txc, cid, ghobject_t(), ghobject_t::get_max(), -1,
+		   &ls, NULL);
+  for (vector<ghobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    if (!p->match(bits, match))
+      continue;
+    dout(20) << " moving " << *p << dendl;
+    int r = _collection_move_rename(txc, cid, *p, dest, *p);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
@@ -0,0 +1,629 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2014 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_BLOCKSTORE_H
+#define CEPH_OSD_BLOCKSTORE_H
+
+#include "include/assert.h"
+#include "include/interval_set.h"
+#include "include/unordered_map.h"
+#include "include/memory.h"
+#include "include/uuid.h"
+#include "common/Cond.h"
+#include "common/Finisher.h"
+#include "common/Mutex.h"
+#include "common/RWLock.h"
+#include "common/Thread.h"
+#include "common/simple_cache.hpp"
+#include "common/perf_counters.h"
+#include "KeyValueDB.h"
+#include "ObjectStore.h"
+
+enum {
+  l_blockstore_first = 84200,
+  l_blockstore_direct_bytes,   ///< data written once, in place, to new extents
+  l_blockstore_wal_bytes,      ///< data written to the kv wal, then the device
+  l_blockstore_rmw_bytes,      ///< partial-block bytes read back for cow writes
+  l_blockstore_kv_bytes,       ///< estimated metadata bytes submitted to kv
+  l_blockstore_alloc_bytes,
+  l_blockstore_release_bytes,
+  l_blockstore_dev_flush_lat,
+  l_blockstore_kv_commit_lat,
+  l_blockstore_kv_batch_txcs,  ///< transactions committed by one kv sync
+  l_blockstore_last,
+};
+
+/// a physical extent on the block device
+struct bs_extent_t {
+  uint64_t offset;     ///< physical byte offset
+  uint32_t length;     ///< length in bytes
+  uint64_t ref;        ///< offset of the refcounted allocation we came from
+
+  bs_extent_t(uint64_t o = 0, uint32_t l = 0, uint64_t r = 0)
+    : offset(o), length(l), ref(r) {}
+
+  uint64_t end() const {
+    return offset + length;
+  }
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(offset, bl);
+    ::encode(length, bl);
+    ::encode(ref, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(offset, p);
+    ::decode(length, p);
+    ::decode(ref, p);
+    DECODE_FINISH(p);
+  }
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(bs_extent_t)
+
+ostream& operator<<(ostream& out, const bs_extent_t& e);
+
+/// reference count for an allocation shared by clones
+struct bs_ref_t {
+  uint32_t length;
+  uint32_t refs;
+
+  bs_ref_t(uint32_t l = 0, uint32_t r = 0) : length(l), refs(r) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(length, bl);
+    ::encode(refs, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(length, p);
+    ::decode(refs, p);
+    DECODE_FINISH(p);
+  }
+};
+WRITE_CLASS_ENCODER(bs_ref_t)
+
+/// on-disk object metadata
+struct bs_onode_t {
+  uint64_t nid;                        ///< numeric id, used for omap keys
+  uint64_t size;                       ///< object size
+  map<string, bufferptr> attrs;        ///< xattrs
+  map<uint64_t, bs_extent_t> block_map; ///< logical offset -> extent
+  bufferlist omap_header;
+  uint64_t expected_object_size;
+  uint64_t expected_write_size;
+
+  bs_onode_t()
+    : nid(0), size(0), expected_object_size(0), expected_write_size(0) {}
+
+  /// find the extent containing or following logical offset @p off
+  map<uint64_t,bs_extent_t>::iterator find_extent(uint64_t off) {
+    map<uint64_t,bs_extent_t>::iterator p = block_map.lower_bound(off);
+    if (p != block_map.begin()) {
+      map<uint64_t,bs_extent_t>::iterator q = p;
+      --q;
+      if (q->first + q->second.length > off)
+	return q;
+    }
+    return p;
+  }
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(bs_onode_t)
+
+/// a deferred small overwrite, committed to kv before it is applied
+struct bs_wal_op_t {
+  uint64_t offset;   ///< physical offset
+  bufferlist data;
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(offset, bl);
+    ::encode(data, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(offset, p);
+    ::decode(data, p);
+    DECODE_FINISH(p);
+  }
+};
+WRITE_CLASS_ENCODER(bs_wal_op_t)
+
+/**
+ * BlockStore
+ *
+ * An ObjectStore that manages a raw block device (or a large
+ * preallocated file) directly.  All metadata (onodes, omap,
+ * collections, the free list and extent refcounts) lives in a
+ * KeyValueDB; object data lives in extents on the device.
+ *
+ * Writes are copy-on-write: data for large or aligned writes is
+ * written once to freshly allocated extents and made durable before
+ * the kv transaction that points the onode at them commits, so there
+ * is no separate journal for the data.  Small overwrites of extents
+ * that are not shared with a clone are instead logged in the kv
+ * transaction (the wal) and applied in place after it commits.
+ *
+ * A transaction is prepared against what the uncommitted transactions
+ * before it left pending (their onodes, omap keys, collections and
+ * not yet applied writes) and queued for the kv sync thread; preparing
+ * never waits for a commit.  Data for new extents is written by the
+ * write finisher.  The kv sync thread turns everything queued into one
+ * kv transaction, commits it with a single sync once that data is on
+ * the device, and only then makes the changes readable.  Space freed
+ * by a transaction is reused only after that.
+ *
+ * Layout under the data path:
+ *   block   - the device, or a symlink to it, or a sparse file
+ *   db/     - the KeyValueDB
+ */
+class BlockStore : public ObjectStore {
+public:
+  struct Onode {
+    string key;            ///< kv key (collection + object)
+    coll_t cid;
+    ghobject_t oid;
+    bool exists;
+    bs_onode_t onode;
+
+    Onode(const string& k, coll_t c, const ghobject_t& o)
+      : key(k), cid(c), oid(o), exists(false) {}
+  };
+  typedef ceph::shared_ptr<Onode> OnodeRef;
+
+  struct Collection {
+    map<string,bufferptr> xattr;
+  };
+  typedef ceph::shared_ptr<Collection> CollectionRef;
+
+  struct OpSequencer;
+
+  /// kv changes to an omap: key -> (set?, value)
+  typedef map<string, pair<bool, bufferlist> > omap_changes_t;
+
+  /**
+   * per-queue_transactions state
+   *
+   * Everything here is private to the transaction while it is prepared.
+   * The kv sync thread encodes it into the kv transaction it commits.
+   */
+  struct TransContext {
+    OpSequencer *osr;
+    uint64_t seq;                      ///< in osr
+    map<string, OnodeRef> onodes;      ///< onodes touched, by key
+    set<string> dirty_onodes;
+    map<coll_t, CollectionRef> colls;  ///< changed collections; NULL if removed
+    map<uint64_t, omap_changes_t> omap; ///< by nid
+    map<uint64_t, uint32_t> allocated; ///< new extents, offset -> length
+    map<uint64_t, int> ref_deltas;     ///< by ref, including allocated
+    interval_set<uint64_t> released;
+    uint64_t release_seq;              ///< assigned by the kv sync thread
+    list<bs_wal_op_t> wal;
+    uint64_t wal_seq;                  ///< assigned by the kv sync thread
+    list<bs_wal_op_t> writes;          ///< data for new extents
+    bool written;                      ///< writes are on the device
+    bool need_dev_flush;
+    uint64_t direct_bytes, wal_bytes, rmw_bytes;
+    Context *on_apply, *on_apply_sync, *on_commit;
+
+    TransContext(OpSequencer *o)
+      : osr(o), seq(0), release_seq(0), wal_seq(0),
+	written(false), need_dev_flush(false),
+	direct_bytes(0), wal_bytes(0), rmw_bytes(0),
+	on_apply(NULL), on_apply_sync(NULL), on_commit(NULL) {}
+  };
+
+  /**
+   * Transactions of a sequencer are prepared one after the other, each
+   * against what the ones before it left pending, and are committed and
+   * made readable in that order.  Sequencers don't wait for each other;
+   * their transactions share kv commits.  Objects that share extents
+   * are expected to be changed through one sequencer at a time.
+   */
+  struct OpSequencer : public Sequencer_impl {
+    Mutex lock;
+    Cond cond;
+    uint64_t queued;     ///< transactions handed to us
+    uint64_t applied;    ///< committed and readable
+    map<uint64_t, list<Context*> > commit_waiters;  ///< by seq
+    Finisher *finisher;
+
+    OpSequencer(Finisher *f)
+      : lock("BlockStore::OpSequencer::lock"),
+	queued(0), applied(0), finisher(f) {}
+
+    void flush() {
+      Mutex::Locker l(lock);
+      while (applied < queued)
+	cond.Wait(lock);
+    }
+    bool flush_commit(Context *c) {
+      Mutex::Locker l(lock);
+      if (applied == queued) {
+	delete c;
+	return true;
+      }
+      commit_waiters[queued].push_back(c);
+      return false;
+    }
+  };
+
+private:
+  class OmapIteratorImpl : public ObjectMap::ObjectMapIteratorImpl {
+    KeyValueDB::Iterator it;
+    string head, tail;
+  public:
+    OmapIteratorImpl(KeyValueDB::Iterator it, uint64_t nid);
+    int seek_to_first();
+    int upper_bound(const string &after);
+    int lower_bound(const string &to);
+    bool valid();
+    int next();
+    string key();
+    bufferlist value();
+    int status() {
+      return 0;
+    }
+  };
+
+  CephContext *cct;
+  KeyValueDB *db;
+  uuid_d fsid;
+  int fsid_fd;
+  int dev_fd;
+  uint64_t dev_size;
+  uint64_t block_size;
+  uint64_t direct_min;
+  bool mounted;
+  KeyValueDB *ext_db;                ///< set_kvdb(); not ours
+
+  /**
+   * Protects the committed state readers see (coll_map and what goes
+   * into onode_cache).  Readers take it shared; making a committed
+   * transaction readable takes it exclusive.  Preparing a transaction
+   * only takes it around collection lookups.
+   */
+  RWLock lock;
+  Sequencer default_osr;
+
+  ceph::unordered_map<coll_t, CollectionRef> coll_map;
+  SimpleLRU<string, OnodeRef> onode_cache;
+
+  /**
+   * Protects what preparing transactions share: the allocator, the
+   * refcounts and the newest uncommitted version of everything changed
+   * by a queued transaction.  Only held for short stretches; nests
+   * inside lock.
+   */
+  Mutex pending_lock;
+  map<uint64_t, uint64_t> free_map;  ///< free space on the device
+  uint64_t free_bytes;
+  uint64_t alloc_cursor;             ///< first-fit search starts here
+  map<uint64_t, bs_ref_t> ref_map;   ///< shared allocation refcounts
+  uint64_t nid_max;
+  /// pending versions, with the number of queued txcs that changed them
+  map<string, pair<OnodeRef, unsigned> > pending_onodes;
+  map<coll_t, pair<CollectionRef, unsigned> > pending_colls;
+  map<uint64_t, pair<omap_changes_t, unsigned> > pending_omap;
+  list<TransContext*> pending_txcs;  ///< queued, in order, until finished
+
+  // -- kv commit --
+  Mutex kv_lock;                     ///< nests inside pending_lock
+  Cond kv_cond;
+  list<TransContext*> kv_queue;      ///< prepared, for the next commit
+  uint64_t kv_seq;                   ///< bumped for everything queued
+  uint64_t kv_committed;             ///< kv_seq covered by the last commit
+  bool kv_trim_wal;                  ///< sync() wants the wal trimmed
+  bool kv_stop;
+
+  // only the kv sync thread uses these
+  map<uint64_t, uint64_t> kv_free_map;  ///< free list as last committed
+  map<uint64_t, bs_ref_t> kv_ref_map;   ///< refcounts as last committed
+  uint64_t kv_nid_max;
+  uint64_t wal_seq;
+  set<uint64_t> wal_applied;         ///< applied, not yet flushed and trimmed
+  uint64_t release_seq;
+  KeyValueDB::Transaction kv_next;   ///< changes for the next commit
+  bool kv_next_dirty;
+  bool kv_next_flush;
+
+  void _kv_sync_thread();
+  struct KVSyncThread : public Thread {
+    BlockStore *store;
+    KVSyncThread(BlockStore *s) : store(s) {}
+    void *entry() {
+      store->_kv_sync_thread();
+      return NULL;
+    }
+  } kv_sync_thread;
+
+  /// wait until everything queued so far has committed
+  void _kv_wait_committed();
+
+  Finisher finisher;
+  Finisher write_finisher;           ///< writes the data of new extents
+
+  struct C_WriteData : public Context {
+    BlockStore *store;
+    TransContext *txc;
+    C_WriteData(BlockStore *s, TransContext *t) : store(s), txc(t) {}
+    void finish(int r) {
+      store->_txc_write_data(txc);
+    }
+  };
+
+  PerfCounters *logger;
+
+  int _open_fsid(bool create);
+  int _lock_fsid();
+  int _open_dev(bool create);
+  void _close_dev();
+  int _open_db(bool create);
+  void _close_db();
+  int _load_freelist();
+  int _load_refs();
+  int _load_collections();
+  int _replay_wal();
+  int _replay_released();
+  void _flush_dev();
+
+  static string onode_key(coll_t cid, const ghobject_t& oid);
+  static string omap_key(uint64_t nid, const string& key);
+  static string u64_key(uint64_t v);
+
+  /// look cid up as of txc, or as committed if txc is NULL
+  CollectionRef _get_collection(TransContext *txc, coll_t cid);
+  /// txc's own copy of collection cid, to change; NULL if there is none
+  CollectionRef _get_collection_copy(TransContext *txc, coll_t cid);
+  OnodeRef _get_onode(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		      bool create);
+  void _dirty_onode(TransContext *txc, OnodeRef o);
+  uint64_t _new_nid();
+
+  // space management
+  int _allocate(TransContext *txc, uint64_t want,
+		vector<bs_extent_t> *extents);
+  void _free_insert(map<uint64_t,uint64_t>& fm, KeyValueDB::Transaction t,
+		    uint64_t offset, uint64_t length);
+  void _free_remove(map<uint64_t,uint64_t>& fm, KeyValueDB::Transaction t,
+		    uint64_t offset, uint64_t length);
+  void _ref_get(TransContext *txc, uint64_t ref);
+  void _ref_put(TransContext *txc, uint64_t ref);
+  void _punch(TransContext *txc, OnodeRef o, uint64_t offset, uint64_t length);
+  void _txc_finalize(TransContext *txc);
+  void _txc_queue(TransContext *txc);
+  void _txc_write_data(TransContext *txc);
+  void _txc_encode(TransContext *txc, KeyValueDB::Transaction t,
+		   map<uint64_t,int> *ref_deltas);
+  void _encode_refs(KeyValueDB::Transaction t,
+		    const map<uint64_t,int>& ref_deltas);
+  void _txc_finish(TransContext *txc);
+  void _trim_wal(KeyValueDB::Transaction t);
+
+  // data path
+  /// writes to [offset, offset+length) not applied yet, oldest first
+  void _get_pending_writes(TransContext *txc, uint64_t offset,
+			   uint64_t length, list<bs_wal_op_t> *ops);
+  int _read_range(TransContext *txc, OnodeRef o, uint64_t offset,
+		  uint64_t length, bufferlist& bl);
+  int _dev_write(uint64_t offset, bufferlist& bl);
+  bool _can_wal(OnodeRef o, uint64_t offset, size_t length);
+  int _do_write(TransContext *txc, OnodeRef o, uint64_t offset, size_t length,
+		bufferlist& bl);
+
+  // omap, with the changes pending from queued transactions and txc
+  void _omap_set(TransContext *txc, uint64_t nid, const string& key,
+		 const bufferlist& bl);
+  void _omap_rm(TransContext *txc, uint64_t nid, const string& key);
+  void _omap_list(TransContext *txc, uint64_t nid,
+		  map<string,bufferlist> *out);
+  void _omap_clear_nid(TransContext *txc, uint64_t nid);
+
+  void _do_transaction(Transaction& t, TransContext *txc);
+
+  int _touch(TransContext *txc, coll_t cid, const ghobject_t& oid);
+  int _write(TransContext *txc, coll_t cid, const ghobject_t& oid,
+	     uint64_t offset, size_t len, bufferlist& bl);
+  int _zero(TransContext *txc, coll_t cid, const ghobject_t& oid,
+	    uint64_t offset, size_t len);
+  int _truncate(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		uint64_t size);
+  int _do_remove(TransContext *txc, OnodeRef o);
+  int _remove(TransContext *txc, coll_t cid, const ghobject_t& oid);
+  int _setattrs(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		const map<string,bufferptr>& aset);
+  int _rmattr(TransContext *txc, coll_t cid, const ghobject_t& oid,
+	      const char *name);
+  int _rmattrs(TransContext *txc, coll_t cid, const ghobject_t& oid);
+  int _clone(TransContext *txc, coll_t cid, const ghobject_t& oldoid,
+	     coll_t ncid, const ghobject_t& newoid);
+  int _clone_range(TransContext *txc, coll_t cid, const ghobject_t& oldoid,
+		   const ghobject_t& newoid,
+		   uint64_t srcoff, uint64_t len, uint64_t dstoff);
+  int _set_alloc_hint(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		      uint64_t expected_object_size,
+		      uint64_t expected_write_size);
+  int _omap_clear(TransContext *txc, coll_t cid, const ghobject_t& oid);
+  int _omap_setkeys(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		    const map<string, bufferlist>& aset);
+  int _omap_rmkeys(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		   const set<string>& keys);
+  int _omap_rmkeyrange(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		       const string& first, const string& last);
+  int _omap_setheader(TransContext *txc, coll_t cid, const ghobject_t& oid,
+		      const bufferlist& bl);
+
+  int _create_collection(TransContext *txc, coll_t cid);
+  int _destroy_collection(TransContext *txc, coll_t cid);
+  int _collection_add(TransContext *txc, coll_t cid, coll_t ocid,
+		      const ghobject_t& oid);
+  int _collection_move_rename(TransContext *txc, coll_t oldcid,
+			      const ghobject_t& oldoid,
+			      coll_t cid, const ghobject_t& oid);
+  int _collection_setattr(TransContext *txc, coll_t cid, const char *name,
+			  const void *value, size_t size);
+  int _collection_rmattr(TransContext *txc, coll_t cid, const char *name);
+  int _split_collection(TransContext *txc, coll_t cid, uint32_t bits,
+			uint32_t rem, coll_t dest);
+
+  /// list objects in cid from kv, including changes pending as of txc
+  int _collection_list(TransContext *txc, coll_t cid, ghobject_t start,
+		       ghobject_t end, int max, vector<ghobject_t> *ls,
+		       ghobject_t *next);
+
+public:
+  BlockStore(CephContext *cct, const string& path);
+  ~BlockStore();
+
+  /**
+   * Keep the metadata in @p kvdb instead of under path/db.  It is not
+   * ours and must outlive every mount; for tests.
+   */
+  void set_kvdb(KeyValueDB *kvdb) {
+    assert(!mounted);
+    ext_db = kvdb;
+  }
+
+  bool need_journal() { return false; };
+  int peek_journal_fsid(uuid_d *fsid);
+
+  bool test_mount_in_use();
+
+  int mount();
+  int umount();
+
+  unsigned get_max_object_name_length() {
+    return 4096;
+  }
+  unsigned get_max_attr_name_length() {
+    return 256;  // arbitrary; there is no real limit internally
+  }
+
+  int mkfs();
+  int mkjournal() {
+    return 0;
+  }
+
+  bool sharded;
+  void set_allow_sharded_objects() {
+    sharded = true;
+  }
+  bool get_allow_sharded_objects() {
+    return sharded;
+  }
+
+  int statfs(struct statfs *buf);
+  void collect_metadata(map<string,string> *pm);
+
+  bool exists(coll_t cid, const ghobject_t& oid);
+  int stat(
+    coll_t cid,
+    const ghobject_t& oid,
+    struct stat *st,
+    bool allow_eio = false); // struct stat?
+  int read(
+    coll_t cid,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl,
+    bool allow_eio = false);
+  int fiemap(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int getattr(coll_t cid, const ghobject_t& oid, const char *name, bufferptr& value);
+  int getattrs(coll_t cid, const ghobject_t& oid, map<string,bufferptr>& aset);
+
+  int list_collections(vector<coll_t>& ls);
+  bool collection_exists(coll_t c);
+  int collection_getattr(coll_t cid, const char *name,
+			 void *value, size_t size);
+  int collection_getattr(coll_t cid, const char *name, bufferlist& bl);
+  int collection_getattrs(coll_t cid, map<string,bufferptr> &aset);
+  bool collection_empty(coll_t c);
+  int collection_list(coll_t cid, vector<ghobject_t>& o);
+  int collection_list_partial(coll_t cid, ghobject_t start,
+			      int min, int max, snapid_t snap,
+			      vector<ghobject_t> *ls, ghobject_t *next);
+  int collection_list_range(coll_t cid, ghobject_t start, ghobject_t end,
+			    snapid_t seq, vector<ghobject_t> *ls);
+
+  int omap_get(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    bufferlist *header,      ///< [out] omap header
+    map<string, bufferlist> *out /// < [out] Key to value map
+    );
+
+  /// Get omap header
+  int omap_get_header(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    bufferlist *header,      ///< [out] omap header
+    bool allow_eio = false ///< [in] don't assert on eio
+    );
+
+  /// Get keys defined on oid
+  int omap_get_keys(
+    coll_t cid,              ///< [in] Collection containing oid
+    const ghobject_t &oid, ///< [in] Object containing omap
+    set<string> *keys      ///< [out] Keys defined on oid
+    );
+
+  /// Get key values
+  int omap_get_values(
+    coll_t cid,                    ///< [in] Collection containing oid
+    const ghobject_t &oid,       ///< [in] Object containing omap
+    const set<string> &keys,     ///< [in] Keys to get
+    map<string, bufferlist> *out ///< [out] Returned keys and values
+    );
+
+  /// Filters keys into out which are defined on oid
+  int omap_check_keys(
+    coll_t cid,                ///< [in] Collection containing oid
+    const ghobject_t &oid,   ///< [in] Object containing omap
+    const set<string> &keys, ///< [in] Keys to check
+    set<string> *out         ///< [out] Subset of keys defined on oid
+    );
+
+  ObjectMap::ObjectMapIterator get_omap_iterator(
+    coll_t cid,              ///< [in] collection
+    const ghobject_t &oid  ///< [in] object
+    );
+
+  void sync(Context *onsync);
+  void sync();
+  void flush();
+  void sync_and_flush();
+
+  void set_fsid(uuid_d u);
+  uuid_d get_fsid();
+
+  objectstore_perf_stat_t get_cur_stats();
+
+  int queue_transactions(
+    Sequencer *osr, list<Transaction*>& tls,
+    TrackedOpRef op = TrackedOpRef(),
+    ThreadPool::TPHandle *handle = NULL);
+};
+
+#endif
@@ -181,6 +181,19 @@ protected:
   /// Call prior to removing directory
   virtual int prep_delete() { return 0; }
 
+  /**
+   * Hard links to an object file held by the index itself
+   *
+   * An index may temporarily link object files into a private area,
+   * e.g. while preparing a directory split in the background.  Callers
+   * deciding whether an object is still linked from another collection
+   * must discount these.  Call with access_lock held for write.
+   *
+   * @param [in] ino inode of the object file
+   * @return number of internal links to ino
+   */
+  virtual int get_index_links(ino_t ino) { return 0; }
+
   CollectionIndex(coll_t collection):
     access_lock_name ("CollectionIndex::access_lock::" + collection.to_str()), 
     access_lock(access_lock_name.c_str()) {}
@@ -0,0 +1,288 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+
+#include "CompactionScheduler.h"
+#include "KeyValueDB.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "common/perf_counters.h"
+#include "include/hash.h"
+#include "include/assert.h"
+
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "compaction_scheduler "
+
+CompactionScheduler::CompactionScheduler(CephContext *cct, KeyValueDB *db,
+					 const std::string &name)
+  : cct(cct), db(db), logger(NULL),
+    ops(0),
+    total_seeks(0),
+    total_seek_usec(0),
+    lock("CompactionScheduler::lock"),
+    stop(false),
+    compacting(0)
+{
+  for (unsigned i = 0; i < num_shards; ++i)
+    shards.push_back(new shard_t);
+  PerfCountersBuilder b(cct, name, l_kvcompact_first, l_kvcompact_last);
+  b.add_u64_counter(l_kvcompact_ranges, "ranges");
+  b.add_time_avg(l_kvcompact_lat, "range_latency");
+  b.add_u64_counter(l_kvcompact_tombstones, "tombstones");
+  b.add_u64_counter(l_kvcompact_deferred, "deferred");
+  b.add_u64(l_kvcompact_pending, "pending");
+  b.add_u64(l_kvcompact_tracked, "tracked");
+  b.add_time(l_kvcompact_stall, "stall");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+CompactionScheduler::~CompactionScheduler()
+{
+  assert(!is_started());
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  for (std::vector<shard_t*>::iterator p = shards.begin();
+       p != shards.end();
+       ++p)
+    delete *p;
+}
+
+void CompactionScheduler::start()
+{
+  last_pass = ceph_clock_now(cct);
+  create();
+}
+
+void CompactionScheduler::shutdown()
+{
+  lock.Lock();
+  stop = true;
+  cond.Signal();
+  lock.Unlock();
+  join();
+}
+
+CompactionScheduler::shard_t *CompactionScheduler::get_shard()
+{
+  return shards[rjhash64((uint64_t)pthread_self()) % num_shards];
+}
+
+void CompactionScheduler::note_commit(const txn_stats_t &t)
+{
+  size_t max_ranges = cct->_conf->kvdb_compact_max_ranges;
+  uint64_t n = 0;
+  shard_t *shard = get_shard();
+  shard->lock.Lock();
+  for (range_map_t::const_iterator p = t.ranges.begin();
+       p != t.ranges.end();
+       ++p) {
+    n += p->second.writes + p->second.deletes;
+    range_map_t::iterator q = shard->ranges.find(p->first);
+    if (q != shard->ranges.end()) {
+      q->second.add(p->second);
+    } else if (p->second.deletes || shard->ranges.size() < max_ranges) {
+      // writes alone only count for ranges that have deletes
+      shard->ranges.insert(*p);
+    }
+  }
+  shard->lock.Unlock();
+  ops.add(n);
+}
+
+void CompactionScheduler::note_seeks(const std::string &prefix, uint64_t n,
+				     utime_t lat)
+{
+  ops.add(n);
+  total_seeks.add(n);
+  total_seek_usec.add(lat.to_nsec() / 1000);
+  shard_t *shard = get_shard();
+  Mutex::Locker l(shard->lock);
+  range_map_t::iterator p = shard->ranges.find(prefix);
+  if (p == shard->ranges.end()) {
+    if (shard->ranges.size() >= (size_t)cct->_conf->kvdb_compact_max_ranges)
+      return;
+    p = shard->ranges.insert(make_pair(prefix, range_stats_t())).first;
+  }
+  p->second.seeks += n;
+  p->second.seek_time += lat;
+}
+
+void CompactionScheduler::note_submit(utime_t lat)
+{
+  if (compacting.read())
+    logger->tinc(l_kvcompact_stall, lat);
+}
+
+void CompactionScheduler::fold_shards()
+{
+  assert(lock.is_locked());
+  for (std::vector<shard_t*>::iterator p = shards.begin();
+       p != shards.end();
+       ++p) {
+    range_map_t seen;
+    (*p)->lock.Lock();
+    seen.swap((*p)->ranges);
+    (*p)->lock.Unlock();
+    for (range_map_t::iterator q = seen.begin(); q != seen.end(); ++q) {
+      range_map_t::iterator r = ranges.find(q->first);
+      if (r != ranges.end())
+	r->second.add(q->second);
+      else if (q->second.deletes)
+	ranges.insert(*q);
+    }
+  }
+  if (ranges.size() > (size_t)cct->_conf->kvdb_compact_max_ranges)
+    trim_ranges();
+}
+
+void CompactionScheduler::trim_ranges()
+{
+  assert(lock.is_locked());
+  // down to 3/4 of the limit, so that this is not done on every delete
+  size_t keep = cct->_conf->kvdb_compact_max_ranges * 3 / 4;
+  if (!keep) {
+    ranges.clear();
+    return;
+  }
+  std::vector<uint64_t> deletes;
+  deletes.reserve(ranges.size());
+  for (range_map_t::iterator p = ranges.begin(); p != ranges.end(); ++p)
+    deletes.push_back(p->second.deletes);
+  std::vector<uint64_t>::iterator nth = deletes.end() - keep;
+  std::nth_element(deletes.begin(), nth, deletes.end());
+  uint64_t min = *nth;
+  range_map_t::iterator p = ranges.begin();
+  while (p != ranges.end() && ranges.size() > keep) {
+    if (p->second.deletes < min)
+      ranges.erase(p++);
+    else
+      ++p;
+  }
+  dout(20) << __func__ << " kept " << ranges.size() << " ranges with >= "
+	   << min << " deletes" << dendl;
+}
+
+double CompactionScheduler::get_read_amp(const range_stats_t &s) const
+{
+  uint64_t seeks = total_seeks.read();
+  uint64_t usec = total_seek_usec.read();
+  if (!s.seeks || !seeks || !usec)
+    return 0;
+  return ((double)s.seek_time / s.seeks) / ((double)usec / 1000000 / seeks);
+}
+
+double CompactionScheduler::get_score(const range_stats_t &s) const
+{
+  if (s.deletes < cct->_conf->kvdb_compact_min_tombstones)
+    return 0;
+  double ratio = (double)s.deletes / (s.writes + s.deletes);
+  double read_amp = get_read_amp(s);
+  if (ratio < cct->_conf->kvdb_compact_tombstone_ratio &&
+      read_amp < cct->_conf->kvdb_compact_read_amp)
+    return 0;
+  return s.deletes * std::max(read_amp, 1.0);
+}
+
+bool CompactionScheduler::is_idle(utime_t now, uint64_t ops)
+{
+  assert(lock.is_locked());
+  double elapsed = now - last_pass;
+  double rate = elapsed > 0 ? ops / elapsed : 0;
+  if (rate >= cct->_conf->kvdb_compact_max_ops) {
+    dout(20) << __func__ << " " << rate << " ops/s >= max "
+	     << cct->_conf->kvdb_compact_max_ops << dendl;
+    return false;
+  }
+
+  double loadavgs[1];
+  if (getloadavg(loadavgs, 1) != 1) {
+    dout(10) << __func__ << " couldn't read loadavgs" << dendl;
+    return false;
+  }
+  if (loadavgs[0] >= cct->_conf->kvdb_compact_load_threshold) {
+    dout(20) << __func__ << " loadavg " << loadavgs[0] << " >= max "
+	     << cct->_conf->kvdb_compact_load_threshold << dendl;
+    return false;
+  }
+  return true;
+}
+
+void *CompactionScheduler::entry()
+{
+  lock.Lock();
+  while (!stop) {
+    utime_t interval;
+    interval.set_from_double(std::max(cct->_conf->kvdb_compact_interval, 1.0));
+    cond.WaitInterval(cct, lock, interval);
+    if (stop)
+      break;
+
+    utime_t now = ceph_clock_now(cct);
+    uint64_t n = ops.read();
+    ops.sub(n);
+    bool idle = is_idle(now, n);
+    last_pass = now;
+    fold_shards();
+
+    range_map_t::iterator best = ranges.end();
+    double best_score = 0;
+    uint64_t pending = 0;
+    for (range_map_t::iterator p = ranges.begin();
+	 p != ranges.end();
+	 ++p) {
+      double score = get_score(p->second);
+      if (score <= 0)
+	continue;
+      ++pending;
+      if (score > best_score) {
+	best = p;
+	best_score = score;
+      }
+    }
+    logger->set(l_kvcompact_pending, pending);
+    logger->set(l_kvcompact_tracked, ranges.size());
+    if (best == ranges.end())
+      continue;
+    if (!idle) {
+      logger->inc(l_kvcompact_deferred);
+      continue;
+    }
+
+    std::string prefix = best->first;
+    uint64_t deletes = best->second.deletes;
+    dout(10) << "compacting '" << prefix << "' with " << deletes
+	     << " deletes, read amp " << get_read_amp(best->second) << dendl;
+    ranges.erase(best);
+    compacting.set(1);
+    lock.Unlock();
+
+    utime_t start = ceph_clock_now(cct);
+    db->compact_prefix(prefix);
+    utime_t lat = ceph_clock_now(cct) - start;
+
+    lock.Lock();
+    compacting.set(0);
+    logger->inc(l_kvcompact_ranges);
+    logger->tinc(l_kvcompact_lat, lat);
+    logger->inc(l_kvcompact_tombstones, deletes);
+    dout(10) << "compacted '" << prefix << "' in " << lat << dendl;
+  }
+  lock.Unlock();
+  return NULL;
+}
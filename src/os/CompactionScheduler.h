@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_COMPACTIONSCHEDULER_H
+#define CEPH_OS_COMPACTIONSCHEDULER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "include/atomic.h"
+#include "include/utime.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+
+class CephContext;
+class KeyValueDB;
+class PerfCounters;
+
+enum {
+  l_kvcompact_first = 34500,
+  l_kvcompact_ranges,          ///< range compactions run
+  l_kvcompact_lat,             ///< how long they took
+  l_kvcompact_tombstones,      ///< deletes they were run for
+  l_kvcompact_deferred,        ///< passes that left a range for later, busy
+  l_kvcompact_pending,         ///< ranges worth compacting
+  l_kvcompact_tracked,         ///< ranges being tracked
+  l_kvcompact_stall,           ///< transaction time spent during compactions
+  l_kvcompact_last
+};
+
+/**
+ * CompactionScheduler
+ *
+ * Picks the key ranges (prefixes) of a KeyValueDB that are worth
+ * compacting, and compacts them while the store is otherwise idle.
+ *
+ * A range is worth compacting once it has seen enough deletes
+ * (tombstones, e.g. after pg log trims or object removals) that
+ * either they make up a large part of its writes, or seeks in it are
+ * slower than in the rest of the store (read amplification).  Every
+ * kvdb_compact_interval seconds, if there is such a range and both the
+ * rate of operations on the store and the system load are under their
+ * thresholds, the one with the most to gain is compacted.
+ *
+ * Writes and deletes are counted by the transaction and reported when
+ * it commits, seeks by the iterator when it goes away.  Reports go to
+ * a shard picked by thread and are folded in on each pass, so the
+ * threads using the store do not serialize on the scheduler.
+ */
+class CompactionScheduler : public Thread {
+public:
+  struct range_stats_t {
+    uint64_t writes;
+    uint64_t deletes;
+    uint64_t seeks;
+    utime_t seek_time;
+    range_stats_t() : writes(0), deletes(0), seeks(0) {}
+    void add(const range_stats_t &o) {
+      writes += o.writes;
+      deletes += o.deletes;
+      seeks += o.seeks;
+      seek_time += o.seek_time;
+    }
+  };
+  typedef std::map<std::string, range_stats_t> range_map_t;
+
+  /// what a transaction does to each range; see note_commit()
+  struct txn_stats_t {
+    range_map_t ranges;
+    void note_write(const std::string &prefix) {
+      ++ranges[prefix].writes;
+    }
+    void note_delete(const std::string &prefix, uint64_t n = 1) {
+      ranges[prefix].deletes += n;
+    }
+  };
+
+private:
+  struct shard_t {
+    Mutex lock;
+    range_map_t ranges;  ///< since the last pass
+    shard_t() : lock("CompactionScheduler::shard_t::lock") {}
+  };
+  static const unsigned num_shards = 16;
+
+  CephContext *cct;
+  KeyValueDB *db;
+  PerfCounters *logger;
+
+  std::vector<shard_t*> shards;
+  atomic_t ops;                   ///< since the last pass
+  atomic_t total_seeks;           ///< store wide
+  atomic_t total_seek_usec;
+
+  Mutex lock;
+  Cond cond;
+  bool stop;
+  range_map_t ranges;             ///< only ranges with deletes
+  utime_t last_pass;
+  atomic_t compacting;
+
+  shard_t *get_shard();
+  /// add what the shards saw to ranges
+  void fold_shards();
+  /// seek time in a range relative to the store average
+  double get_read_amp(const range_stats_t &s) const;
+  /// whether a range is worth compacting, and how much
+  double get_score(const range_stats_t &s) const;
+  /// whether the store and the system are quiet enough
+  bool is_idle(utime_t now, uint64_t ops);
+  /// drop the ranges with the fewest deletes
+  void trim_ranges();
+
+  void *entry();
+
+public:
+  CompactionScheduler(CephContext *cct, KeyValueDB *db,
+		      const std::string &name);
+  ~CompactionScheduler();
+
+  void start();
+  void shutdown();
+
+  /// a transaction counted in t was applied
+  void note_commit(const txn_stats_t &t);
+  /// an iterator on prefix did n seeks, taking lat in all
+  void note_seeks(const std::string &prefix, uint64_t n, utime_t lat);
+  /// a transaction was submitted, taking lat
+  void note_submit(utime_t lat);
+};
+
+#endif
@@ -328,6 +328,81 @@ ObjectMap::ObjectMapIterator DBObjectMap::get_iterator(
   return iter;
 }
 
+void DBObjectMap::get_values_batch(vector<OmapRead> &reads)
+{
+  // one iterator, and one view of the store, for the whole batch
+  RangeReader reader(db->get_snapshot_iterator());
+  for (vector<OmapRead>::iterator p = reads.begin(); p != reads.end(); ++p) {
+    MapHeaderLock hl(this, p->oid);
+    Header header = lookup_map_header(hl, p->oid);
+    if (!header) {
+      p->r = 0;
+      continue;
+    }
+    if (header->parent) {
+      // keys may come from the parent, which the iterator sorts out
+      p->r = read_range(_get_iterator(header), &*p);
+    } else {
+      p->r = reader.read(user_prefix(header), &*p);
+    }
+  }
+  dout(20) << "get_values_batch: " << reads.size() << " reads, "
+	   << reader.get_seeks() << " seeks" << dendl;
+}
+
+bool DBObjectMap::RangeReader::in_range(const OmapRead &read,
+					const string &key)
+{
+  // as in ObjectMap::read_range()
+  if (read.filter_prefix >= read.start_after)
+    return key >= read.filter_prefix;
+  return key > read.start_after;
+}
+
+int DBObjectMap::RangeReader::read(const string &prefix, OmapRead *read)
+{
+  bool cont = false;
+  if (positioned && iter->valid()) {
+    pair<string,string> raw = iter->raw_key();
+    if (raw.first == prefix && in_range(*read, raw.second)) {
+      // nothing in range may lie between where we were and where we are
+      if (pos_exhausted)
+	cont = pos_prefix < prefix;
+      else
+	cont = pos_prefix == prefix && !in_range(*read, pos_key);
+    }
+  }
+  if (!cont) {
+    ++seeks;
+    if (read->filter_prefix >= read->start_after)
+      iter->lower_bound(prefix, read->filter_prefix);
+    else
+      iter->upper_bound(prefix, read->start_after);
+  }
+
+  positioned = true;
+  pos_prefix = prefix;
+  pos_exhausted = false;
+  bool stepped = false;
+  for (uint64_t i = 0; i < read->max_return; ++i) {
+    pair<string,string> raw;
+    if (!iter->valid() || (raw = iter->raw_key()).first != prefix) {
+      pos_exhausted = true;
+      break;
+    }
+    if (raw.second.compare(0, read->filter_prefix.size(),
+			   read->filter_prefix))
+      break;
+    read->out.insert(make_pair(raw.second, iter->value()));
+    pos_key.swap(raw.second);
+    stepped = true;
+    iter->next();
+  }
+  if (!pos_exhausted && !stepped)
+    positioned = false;  // only know that we are somewhere past the bound
+  return iter->status();
+}
+
 int DBObjectMap::DBObjectMapIteratorImpl::seek_to_first()
 {
   init();
@@ -1076,6 +1151,29 @@ int DBObjectMap::upgrade()
   return 0;
 }
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db), header_lock("DBOBjectMap")
+{
+  unsigned shards = MAX(1, g_conf->filestore_omap_header_cache_shards);
+  // filestore_omap_header_cache_size is the total over all shards
+  size_t cache_size = MAX(1, (g_conf->filestore_omap_header_cache_size +
+			      shards - 1) / shards);
+  for (unsigned i = 0; i < shards; ++i) {
+    in_use_shards.push_back(new InUseShard);
+    map_header_shards.push_back(new MapHeaderShard);
+    caches.push_back(new SimpleLRU<ghobject_t, _Header>(cache_size));
+  }
+}
+
+DBObjectMap::~DBObjectMap()
+{
+  for (unsigned i = 0; i < caches.size(); ++i) {
+    delete in_use_shards[i];
+    delete map_header_shards[i];
+    delete caches[i];
+  }
+}
+
 int DBObjectMap::init(bool do_upgrade)
 {
   map<string, bufferlist> result;
@@ -1138,20 +1236,17 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(
+DBObjectMap::Header DBObjectMap::lookup_map_header(
   const MapHeaderLock &l,
   const ghobject_t &oid)
 {
   assert(l.get_locked() == oid);
 
+  SimpleLRU<ghobject_t, _Header> *cache = caches[get_object_shard(oid)];
   _Header *header = new _Header();
-  {
-    Mutex::Locker l(cache_lock);
-    if (caches.lookup(oid, header)) {
-      assert(!in_use.count(header->seq));
-      in_use.insert(header->seq);
-      return Header(header, RemoveOnDelete(this));
-    }
+  if (cache->lookup(oid, header)) {
+    mark_in_use(header->seq);
+    return Header(header, RemoveOnDelete(this));
   }
 
   map<string, bufferlist> out;
@@ -1166,19 +1261,16 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(
   Header ret(header, RemoveOnDelete(this));
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, *ret);
-  }
+  cache->add(oid, *ret);
 
-  assert(!in_use.count(header->seq));
-  in_use.insert(header->seq);
+  mark_in_use(header->seq);
   return ret;
 }
 
-DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
-						      Header parent)
+DBObjectMap::Header DBObjectMap::generate_new_header(const ghobject_t &oid,
+						     Header parent)
 {
+  Mutex::Locker l(header_lock);
   Header header = Header(new _Header(), RemoveOnDelete(this));
   header->seq = state.seq++;
   if (parent) {
@@ -1187,8 +1279,7 @@ DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
   }
   header->num_children = 1;
   header->oid = oid;
-  assert(!in_use.count(header->seq));
-  in_use.insert(header->seq);
+  mark_in_use(header->seq);
 
   write_state();
   return header;
@@ -1196,9 +1287,14 @@ DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
 
 DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
 {
-  Mutex::Locker l(header_lock);
-  while (in_use.count(input->parent))
-    header_cond.Wait(header_lock);
+  {
+    // parents are shared between clones, so wait for our turn
+    InUseShard *shard = get_in_use_shard(input->parent);
+    Mutex::Locker l(shard->lock);
+    while (shard->in_use.count(input->parent))
+      shard->cond.Wait(shard->lock);
+    shard->in_use.insert(input->parent);
+  }
   map<string, bufferlist> out;
   set<string> keys;
   keys.insert(HEADER_KEY);
@@ -1221,7 +1317,6 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
   header->decode(iter);
   dout(20) << "lookup_parent: parent seq is " << header->seq << " with parent "
        << header->parent << dendl;
-  in_use.insert(header->seq);
   return header;
 }
 
@@ -1230,10 +1325,9 @@ DBObjectMap::Header DBObjectMap::lookup_create_map_header(
   const ghobject_t &oid,
   KeyValueDB::Transaction t)
 {
-  Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hl, oid);
+  Header header = lookup_map_header(hl, oid);
   if (!header) {
-    header = _generate_new_header(oid, Header());
+    header = generate_new_header(oid, Header());
     set_map_header(hl, oid, *header, t);
   }
   return header;
@@ -1271,10 +1365,7 @@ void DBObjectMap::remove_map_header(
   set<string> to_remove;
   to_remove.insert(map_header_key(oid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.clear(oid);
-  }
+  caches[get_object_shard(oid)]->clear(oid);
 }
 
 void DBObjectMap::set_map_header(
@@ -1289,10 +1380,7 @@ void DBObjectMap::set_map_header(
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(oid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, header);
-  }
+  caches[get_object_shard(oid)]->add(oid, header);
 }
 
 bool DBObjectMap::check_spos(const ghobject_t &oid,
@@ -58,17 +58,37 @@ public:
   boost::scoped_ptr<KeyValueDB> db;
 
   /**
-   * Serializes access to next_seq as well as the in_use set
+   * Serializes access to next_seq
    */
   Mutex header_lock;
-  Cond header_cond;
-  Cond map_header_cond;
 
   /**
-   * Set of headers currently in use
+   * Headers currently in use, by seq, and objects whose map header is
+   * locked (@see MapHeaderLock).  Both are split into shards, by seq and
+   * by object hash, so that operations on unrelated objects do not
+   * contend.  The header cache is sharded the same way as the objects.
    */
-  set<uint64_t> in_use;
-  set<ghobject_t> map_header_in_use;
+  struct InUseShard {
+    Mutex lock;
+    Cond cond;
+    set<uint64_t> in_use;
+    InUseShard() : lock("DBObjectMap::InUseShard::lock") {}
+  };
+  struct MapHeaderShard {
+    Mutex lock;
+    Cond cond;
+    set<ghobject_t> map_header_in_use;
+    MapHeaderShard() : lock("DBObjectMap::MapHeaderShard::lock") {}
+  };
+  vector<InUseShard*> in_use_shards;
+  vector<MapHeaderShard*> map_header_shards;
+
+  InUseShard *get_in_use_shard(uint64_t seq) {
+    return in_use_shards[seq % in_use_shards.size()];
+  }
+  unsigned get_object_shard(const ghobject_t &oid) const {
+    return oid.hobj.hash % map_header_shards.size();
+  }
 
   /**
    * Takes the map_header_in_use entry in constructor, releases in
@@ -83,10 +103,11 @@ public:
   public:
     MapHeaderLock(DBObjectMap *db) : db(db) {}
     MapHeaderLock(DBObjectMap *db, const ghobject_t &oid) : db(db), locked(oid) {
-      Mutex::Locker l(db->header_lock);
-      while (db->map_header_in_use.count(*locked))
-	db->map_header_cond.Wait(db->header_lock);
-      db->map_header_in_use.insert(*locked);
+      MapHeaderShard *shard = db->map_header_shards[db->get_object_shard(oid)];
+      Mutex::Locker l(shard->lock);
+      while (shard->map_header_in_use.count(*locked))
+	shard->cond.Wait(shard->lock);
+      shard->map_header_in_use.insert(*locked);
     }
 
     const ghobject_t &get_locked() const {
@@ -105,18 +126,18 @@ public:
 
     ~MapHeaderLock() {
       if (locked) {
-	Mutex::Locker l(db->header_lock);
-	assert(db->map_header_in_use.count(*locked));
-	db->map_header_cond.Signal();
-	db->map_header_in_use.erase(*locked);
+	MapHeaderShard *shard =
+	  db->map_header_shards[db->get_object_shard(*locked)];
+	Mutex::Locker l(shard->lock);
+	assert(shard->map_header_in_use.count(*locked));
+	shard->cond.SignalAll();
+	shard->map_header_in_use.erase(*locked);
       }
     }
   };
 
-  DBObjectMap(KeyValueDB *db) : db(db), header_lock("DBOBjectMap"),
-                                cache_lock("DBObjectMap::CacheLock"),
-                                caches(g_conf->filestore_omap_header_cache_size)
-    {}
+  DBObjectMap(KeyValueDB *db);
+  ~DBObjectMap();
 
   int set_keys(
     const ghobject_t &oid,
@@ -221,6 +242,35 @@ public:
 
   ObjectMapIterator get_iterator(const ghobject_t &oid);
 
+  void get_values_batch(vector<OmapRead> &reads);
+
+  /**
+   * Serves OmapRead reads under any number of key prefixes off a
+   * single KeyValueDB iterator.  A read that picks up where the
+   * iterator already is -- the rest of a key range that was cut short,
+   * or the next prefix after one that was read to its end -- continues
+   * from there instead of seeking again.  GenericObjectMap uses it too.
+   */
+  class RangeReader {
+    KeyValueDB::WholeSpaceIterator iter;
+    bool positioned;     ///< the iterator position is described below
+    string pos_prefix;
+    bool pos_exhausted;  ///< iter is past every key under pos_prefix
+    string pos_key;      ///< else, iter is at the first key after this one
+    uint64_t seeks;
+
+    static bool in_range(const OmapRead &read, const string &key);
+  public:
+    explicit RangeReader(KeyValueDB::WholeSpaceIterator iter)
+      : iter(iter), positioned(false), pos_exhausted(false), seeks(0) {}
+
+    /// fill in read with the keys under prefix
+    int read(const string &prefix, OmapRead *read);
+    uint64_t get_seeks() const {
+      return seeks;
+    }
+  };
+
   static const string USER_PREFIX;
   static const string XATTR_PREFIX;
   static const string SYS_PREFIX;
@@ -327,8 +377,8 @@ public:
 private:
   /// Implicit lock on Header->seq
   typedef ceph::shared_ptr<_Header> Header;
-  Mutex cache_lock;
-  SimpleLRU<ghobject_t, _Header> caches;
+  /// map header cache, one per object shard
+  vector<SimpleLRU<ghobject_t, _Header>*> caches;
 
   string map_header_key(const ghobject_t &oid);
   string header_key(uint64_t seq);
@@ -452,21 +502,19 @@ private:
    *
    * Has the side effect of syncronously saving the new DBObjectMap state
    */
-  Header _generate_new_header(const ghobject_t &oid, Header parent);
-  Header generate_new_header(const ghobject_t &oid, Header parent) {
-    Mutex::Locker l(header_lock);
-    return _generate_new_header(oid, parent);
-  }
+  Header generate_new_header(const ghobject_t &oid, Header parent);
 
   /// Lookup leaf header for c oid
-  Header _lookup_map_header(
+  Header lookup_map_header(
     const MapHeaderLock &l,
     const ghobject_t &oid);
-  Header lookup_map_header(
-    const MapHeaderLock &l2,
-    const ghobject_t &oid) {
-    Mutex::Locker l(header_lock);
-    return _lookup_map_header(l2, oid);
+
+  /// Mark seq in use; the caller must own it (no waiting)
+  void mark_in_use(uint64_t seq) {
+    InUseShard *shard = get_in_use_shard(seq);
+    Mutex::Locker l(shard->lock);
+    assert(!shard->in_use.count(seq));
+    shard->in_use.insert(seq);
   }
 
   /// Lookup header node for input
@@ -518,10 +566,13 @@ private:
     RemoveOnDelete(DBObjectMap *db) :
       db(db) {}
     void operator() (_Header *header) {
-      Mutex::Locker l(db->header_lock);
-      assert(db->in_use.count(header->seq));
-      db->in_use.erase(header->seq);
-      db->header_cond.Signal();
+      InUseShard *shard = db->get_in_use_shard(header->seq);
+      {
+	Mutex::Locker l(shard->lock);
+	assert(shard->in_use.count(header->seq));
+	shard->in_use.erase(header->seq);
+	shard->cond.SignalAll();
+      }
       delete header;
     }
   };
@@ -22,11 +22,26 @@
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/shared_cache.hpp"
+#include "common/perf_counters.h"
+#include "include/buffer.h"
 #include "include/compat.h"
 #include "include/intarith.h"
 
+enum {
+  l_fdcache_first = 84300,
+  l_fdcache_hit,
+  l_fdcache_miss,
+  l_fdcache_add_race,   ///< fd opened concurrently by another thread
+  l_fdcache_evict,
+  l_fdcache_last,
+};
+
 /**
  * FD Cache
+ *
+ * Objects are spread over filestore_fd_cache_shards independently
+ * locked LRUs.  Each shard gets its own perf counters ("fdcache-<n>")
+ * so that skew between shards is visible.
  */
 class FDCache : public md_config_obs_t {
 public:
@@ -34,11 +49,23 @@ public:
    * FD
    *
    * Wrapper for an fd.  Destructor closes the fd.
+   *
+   * Also caches the object's packed hot xattrs, decoded (see
+   * FileStore::_load_hot_attrs).  There is only ever one FD per object
+   * while anyone holds a reference to it, and every change to those
+   * xattrs goes through it, so the copy stays valid for as long as the
+   * FD lives -- unless the inode has other links, which get FDs of
+   * their own.  Those FDs reread the xattr every time.
    */
   class FD {
   public:
     const int fd;
-    FD(int _fd) : fd(_fd) {
+    Mutex attr_lock;              ///< protects the below
+    bool attrs_loaded;            ///< attrs matches the packed xattr
+    bool attrs_cacheable;         ///< false once the inode has other links
+    map<string, bufferptr> attrs;
+    FD(int _fd) : fd(_fd), attr_lock("FDCache::FD::attr_lock"),
+		  attrs_loaded(false), attrs_cacheable(true) {
       assert(_fd >= 0);
     }
     int operator*() const {
@@ -53,10 +80,20 @@ private:
   CephContext *cct;
   const int registry_shards;
   SharedLRU<ghobject_t, FD> *registry;
+  vector<PerfCounters*> loggers;
+
+  /**
+   * The low bits of the hash are the pg bits, so every object in a pg
+   * would land in the same shard.  Use the nibble-reversed hash (the
+   * order HashIndex uses) so the objects of a busy pg are spread out.
+   */
+  int get_shard(const ghobject_t &hoid) const {
+    return hoid.hobj.get_filestore_key() % registry_shards;
+  }
 
 public:
   FDCache(CephContext *cct) : cct(cct),
-  registry_shards(cct->_conf->filestore_fd_cache_shards) {
+  registry_shards(MAX(cct->_conf->filestore_fd_cache_shards, 1)) {
     assert(cct);
     cct->_conf->add_observer(this);
     registry = new SharedLRU<ghobject_t, FD>[registry_shards];
@@ -64,27 +101,61 @@ public:
       registry[i].set_cct(cct);
       registry[i].set_size(
           MAX((cct->_conf->filestore_fd_cache_size / registry_shards), 1));
+
+      char name[32];
+      snprintf(name, sizeof(name), "fdcache-%d", i);
+      PerfCountersBuilder b(cct, name, l_fdcache_first, l_fdcache_last);
+      b.add_u64_counter(l_fdcache_hit, "hit");
+      b.add_u64_counter(l_fdcache_miss, "miss");
+      b.add_u64_counter(l_fdcache_add_race, "add_race");
+      b.add_u64_counter(l_fdcache_evict, "evict");
+      PerfCounters *logger = b.create_perf_counters();
+      cct->get_perfcounters_collection()->add(logger);
+      loggers.push_back(logger);
     }
   }
   ~FDCache() {
     cct->_conf->remove_observer(this);
+    for (vector<PerfCounters*>::iterator p = loggers.begin();
+	 p != loggers.end();
+	 ++p) {
+      cct->get_perfcounters_collection()->remove(*p);
+      delete *p;
+    }
     delete[] registry;
   }
   typedef ceph::shared_ptr<FD> FDRef;
 
   FDRef lookup(const ghobject_t &hoid) {
-    int registry_id = hoid.hobj.hash % registry_shards;
-    return registry[registry_id].lookup(hoid);
+    int registry_id = get_shard(hoid);
+    unsigned evicted;
+    FDRef ret = registry[registry_id].lookup(hoid, &evicted);
+    PerfCounters *logger = loggers[registry_id];
+    logger->inc(ret ? l_fdcache_hit : l_fdcache_miss);
+    if (evicted)
+      logger->inc(l_fdcache_evict, evicted);
+    return ret;
   }
 
+  /// add fd for hoid; if another thread got there first, fd is closed
   FDRef add(const ghobject_t &hoid, int fd, bool *existed) {
-    int registry_id = hoid.hobj.hash % registry_shards;
-    return registry[registry_id].add(hoid, new FD(fd), existed);
+    int registry_id = get_shard(hoid);
+    unsigned evicted;
+    FD *val = new FD(fd);
+    FDRef ret = registry[registry_id].add(hoid, val, existed, &evicted);
+    PerfCounters *logger = loggers[registry_id];
+    if (*existed) {
+      delete val;
+      logger->inc(l_fdcache_add_race);
+    }
+    if (evicted)
+      logger->inc(l_fdcache_evict, evicted);
+    return ret;
   }
 
   /// clear cached fd for hoid, subsequent lookups will get an empty FD
   void clear(const ghobject_t &hoid) {
-    int registry_id = hoid.hobj.hash % registry_shards;
+    int registry_id = get_shard(hoid);
     registry[registry_id].purge(hoid);
   }
 
@@ -374,6 +374,10 @@ int FileJournal::create()
 
   header.start = get_top();
   header.start_seq = 0;
+  header.stripe_index = stripe_index;
+  header.stripe_width = stripe_width;
+  header.incarnation = 0;
+  header.incarnation_seq = 0;
 
   print_header();
 
@@ -523,6 +527,15 @@ int FileJournal::open(uint64_t fs_op_seq)
       dout(10) << "open reached end of journal." << dendl;
       break;
     }
+    if (header.stripe_width > 1 && seq >= next_seq) {
+      // the other members hold the seqs we skip over; the caller
+      // checks the merged stream for gaps
+      dout(10) << "open reached seq " << seq << " (stripe "
+	       << header.stripe_index << "/" << header.stripe_width << ")"
+	       << dendl;
+      read_pos = old_pos;
+      break;
+    }
     if (seq > next_seq) {
       dout(10) << "open entry " << seq << " len " << bl.length() << " > next_seq " << next_seq
 	       << ", ignoring journal contents"
@@ -559,9 +572,8 @@ void FileJournal::close()
 }
 
 
-int FileJournal::dump(ostream& out)
+int FileJournal::open_for_dump()
 {
-  dout(10) << "dump" << dendl;
   _open(false, false);
 
   int err = read_header();
@@ -569,6 +581,37 @@ int FileJournal::dump(ostream& out)
     return err;
 
   read_pos = header.start;
+  return 0;
+}
+
+void FileJournal::dump_entry(Formatter *f, off64_t pos, uint64_t seq,
+			     bufferlist& bl)
+{
+  f->open_object_section("entry");
+  f->dump_unsigned("offset", pos);
+  f->dump_unsigned("seq", seq);
+  f->open_array_section("transactions");
+  bufferlist::iterator p = bl.begin();
+  int trans_num = 0;
+  while (!p.end()) {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction(p);
+    f->open_object_section("transaction");
+    f->dump_unsigned("trans_num", trans_num);
+    t->dump(f);
+    f->close_section();
+    delete t;
+    trans_num++;
+  }
+  f->close_section();
+  f->close_section();
+}
+
+int FileJournal::dump(ostream& out)
+{
+  dout(10) << "dump" << dendl;
+  int err = open_for_dump();
+  if (err < 0)
+    return err;
 
   JSONFormatter f(true);
 
@@ -582,23 +625,7 @@ int FileJournal::dump(ostream& out)
       break;
     }
 
-    f.open_object_section("entry");
-    f.dump_unsigned("offset", pos);
-    f.dump_unsigned("seq", seq);
-    f.open_array_section("transactions");
-    bufferlist::iterator p = bl.begin();
-    int trans_num = 0;
-    while (!p.end()) {
-      ObjectStore::Transaction *t = new ObjectStore::Transaction(p);
-      f.open_object_section("transaction");
-      f.dump_unsigned("trans_num", trans_num);
-      t->dump(&f);
-      f.close_section();
-      delete t;
-      trans_num++;
-    }
-    f.close_section();
-    f.close_section();
+    dump_entry(&f, pos, seq, bl);
     f.flush(cout);
   }
 
@@ -645,12 +672,35 @@ void FileJournal::stop_writer()
 
 
 
+int FileJournal::write_header_sync()
+{
+  Mutex::Locker locker(write_lock);
+  bufferptr bp = prepare_header();
+  if (TEMP_FAILURE_RETRY(::pwrite(fd, bp.c_str(), bp.length(), 0)) < 0) {
+    int err = errno;
+    derr << "FileJournal::write_header_sync: pwrite error "
+	 << cpp_strerror(err) << dendl;
+    return -err;
+  }
+  if (::fsync(fd) < 0) {
+    int err = errno;
+    derr << "FileJournal::write_header_sync: fsync error "
+	 << cpp_strerror(err) << dendl;
+    return -err;
+  }
+  return 0;
+}
+
 void FileJournal::print_header()
 {
   dout(10) << "header: block_size " << header.block_size
 	   << " alignment " << header.alignment
 	   << " max_size " << header.max_size
 	   << dendl;
+  if (header.stripe_width > 1)
+    dout(10) << "header: stripe " << header.stripe_index << "/"
+	     << header.stripe_width << " incarnation " << header.incarnation
+	     << " from seq " << header.incarnation_seq << dendl;
   dout(10) << "header: start " << header.start << dendl;
   dout(10) << " write_pos " << write_pos << dendl;
 }
@@ -897,7 +947,7 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   h.pre_pad = pre_pad;
   h.len = ebl.length();
   h.post_pad = post_pad;
-  h.make_magic(queue_pos, header.get_fsid64());
+  h.make_magic(queue_pos, header.get_fsid64(), header.incarnation);
   h.crc32c = ebl.crc32c(0);
 
   bl.append((const char*)&h, sizeof(h));
@@ -1722,7 +1772,7 @@ FileJournal::read_entry_result FileJournal::do_read_entry(
   wrap_read_bl(pos, sizeof(*h), &hbl, &_next_pos);
   h = reinterpret_cast<entry_header_t *>(hbl.c_str());
 
-  if (!h->check_magic(pos, header.get_fsid64())) {
+  if (!h->check_magic(pos, header.get_fsid64(), header)) {
     dout(25) << "read_entry " << pos
 	     << " : bad header magic, end of journal" << dendl;
     if (ss)
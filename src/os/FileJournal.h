@@ -21,6 +21,7 @@ using std::deque;
 
 #include "Journal.h"
 #include "common/Cond.h"
+#include "common/Formatter.h"
 #include "common/Mutex.h"
 #include "common/Thread.h"
 #include "common/Throttle.h"
@@ -126,9 +127,38 @@ public:
      */
     uint64_t start_seq;
 
+    /**
+     * stripe_index, stripe_width
+     *
+     * A striped journal spreads entries over stripe_width journals;
+     * this one is member stripe_index.  Members hold disjoint subsets
+     * of the sequence numbers, so seqs within one member have gaps.
+     * Headers older than v5 are single-file journals (0, 1).
+     */
+    __u32 stripe_index;
+    __u32 stripe_width;
+
+    /**
+     * incarnation, incarnation_seq
+     *
+     * Replay of a striped journal stops at the first missing seq, but
+     * the other members may hold complete (never acked) entries past
+     * it.  Writing resumes over them, and one that the new entries
+     * happen to line up with would be replayed after the next crash.
+     * So each time a striped journal is made writeable it starts a new
+     * incarnation, which is mixed into the magic of every entry.
+     * Entries from incarnation_seq on must be of the current
+     * incarnation; earlier ones, written before the restart and maybe
+     * not yet applied, may be of an older one.  Always 0 for single
+     * file journals, whose entry magic is thus unchanged.
+     */
+    uint64_t incarnation;
+    uint64_t incarnation_seq;
+
     header_t() :
       flags(0), block_size(0), alignment(0), max_size(0), start(0),
-      committed_up_to(0), start_seq(0) {}
+      committed_up_to(0), start_seq(0), stripe_index(0), stripe_width(1),
+      incarnation(0), incarnation_seq(0) {}
 
     void clear() {
       start = block_size;
@@ -139,7 +169,7 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      __u32 v = 4;
+      __u32 v = 6;
       ::encode(v, bl);
       bufferlist em;
       {
@@ -151,6 +181,10 @@ public:
 	::encode(start, em);
 	::encode(committed_up_to, em);
 	::encode(start_seq, em);
+	::encode(stripe_index, em);
+	::encode(stripe_width, em);
+	::encode(incarnation, em);
+	::encode(incarnation_seq, em);
       }
       ::encode(em, bl);
     }
@@ -171,6 +205,10 @@ public:
 	::decode(start, bl);
 	committed_up_to = 0;
 	start_seq = 0;
+	stripe_index = 0;
+	stripe_width = 1;
+	incarnation = 0;
+	incarnation_seq = 0;
 	return;
       }
       bufferlist em;
@@ -192,6 +230,22 @@ public:
 	::decode(start_seq, t);
       else
 	start_seq = 0;
+
+      if (v > 4) {
+	::decode(stripe_index, t);
+	::decode(stripe_width, t);
+      } else {
+	stripe_index = 0;
+	stripe_width = 1;
+      }
+
+      if (v > 5) {
+	::decode(incarnation, t);
+	::decode(incarnation_seq, t);
+      } else {
+	incarnation = 0;
+	incarnation_seq = 0;
+      }
     }
   } header;
 
@@ -203,14 +257,16 @@ public:
     uint64_t magic1;
     uint64_t magic2;
     
-    void make_magic(off64_t pos, uint64_t fsid) {
+    void make_magic(off64_t pos, uint64_t fsid, uint64_t incarnation) {
       magic1 = pos;
-      magic2 = fsid ^ seq ^ len;
+      magic2 = fsid ^ seq ^ len ^ incarnation;
     }
-    bool check_magic(off64_t pos, uint64_t fsid) {
+    bool check_magic(off64_t pos, uint64_t fsid, const header_t &hdr) {
+      uint64_t incarnation = magic2 ^ fsid ^ seq ^ len;
       return
 	magic1 == (uint64_t)pos &&
-	magic2 == (fsid ^ seq ^ len);
+	(incarnation == hdr.incarnation ||
+	 (incarnation < hdr.incarnation && seq < hdr.incarnation_seq));
     }
   } __attribute__((__packed__, aligned(4)));
 
@@ -222,6 +278,7 @@ private:
   off64_t max_size;
   size_t block_size;
   bool directio, aio, force_aio;
+  __u32 stripe_index, stripe_width;  ///< stamped into the header by create()
   bool must_write_header;
   off64_t write_pos;      // byte where the next entry to be written will go
   off64_t read_pos;       // 
@@ -363,6 +420,7 @@ private:
     zero_buf(NULL),
     max_size(0), block_size(0),
     directio(dio), aio(ai), force_aio(faio),
+    stripe_index(0), stripe_width(1),
     must_write_header(false),
     write_pos(0), read_pos(0),
 #ifdef HAVE_LIBAIO
@@ -393,6 +451,31 @@ private:
   int peek_fsid(uuid_d& fsid);
 
   int dump(ostream& out);
+  int open_for_dump();
+  static void dump_entry(Formatter *f, off64_t pos, uint64_t seq,
+			 bufferlist& bl);
+
+  /// set the stripe position used by create(), and by the next header write
+  void set_stripe(unsigned index, unsigned width) {
+    stripe_index = header.stripe_index = index;
+    stripe_width = header.stripe_width = width;
+  }
+  unsigned get_stripe_index() const { return header.stripe_index; }
+  unsigned get_stripe_width() const { return header.stripe_width; }
+
+  /// start a new incarnation at seq, @see header_t::incarnation
+  void set_incarnation(uint64_t incarnation, uint64_t seq) {
+    header.incarnation = incarnation;
+    header.incarnation_seq = seq;
+  }
+  uint64_t get_incarnation() const { return header.incarnation; }
+
+  const string& get_path() const { return fn; }
+  int write_header_sync();
+
+  /// position of the next read_entry(); lets a caller give back an entry
+  off64_t get_read_pos() const { return read_pos; }
+  void set_read_pos(off64_t pos) { read_pos = pos; }
 
   void flush();
 
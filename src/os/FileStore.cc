@@ -53,6 +53,7 @@
 #include "common/BackTrace.h"
 #include "include/types.h"
 #include "FileJournal.h"
+#include "StripedJournal.h"
 
 #include "osd/osd_types.h"
 #include "include/color.h"
@@ -66,6 +67,7 @@
 #include "common/perf_counters.h"
 #include "common/sync_filesystem.h"
 #include "common/fd.h"
+#include "include/str_list.h"
 #include "HashIndex.h"
 #include "DBObjectMap.h"
 #include "KeyValueDB.h"
@@ -98,6 +100,19 @@ using ceph::crypto::SHA1;
 #define XATTR_NO_SPILL_OUT "0"
 #define XATTR_SPILL_OUT "1"
 
+// XATTR_HOT_NAME holds the attrs that are read on every op (the object
+// info and the snapset), encoded as a map<string,bufferptr>, when
+// filestore_pack_hot_xattrs is set.  A copy of it is kept in the FDCache
+// entry.  Objects written before are still read from the plain xattrs.
+// The first packed write marks the superblock; until then nothing looks
+// for it.
+#define XATTR_HOT_NAME "user.cephos.hot"
+
+static bool is_hot_attr(const char *name)
+{
+  return strcmp(name, "_") == 0 || strcmp(name, "snapset") == 0;
+}
+
 //Initial features in new superblock.
 static CompatSet get_fs_initial_compat_set() {
   CompatSet::FeatureSet ceph_osd_feature_compat;
@@ -112,6 +127,7 @@ static CompatSet get_fs_supported_compat_set() {
   CompatSet compat =  get_fs_initial_compat_set();
   //Any features here can be set in code, but not in initial superblock
   compat.incompat.insert(CEPH_FS_FEATURE_INCOMPAT_SHARDS);
+  compat.incompat.insert(CEPH_FS_FEATURE_INCOMPAT_HOT_XATTRS);
   return compat;
 }
 
@@ -236,6 +252,18 @@ int FileStore::lfn_open(coll_t cid,
   if (create)
     flags |= O_CREAT;
 
+  // A cached fd is always valid: unlink clears the cache entry under
+  // the index lock, and we only add to the cache while holding it.  If
+  // the caller does not need the index, skip both the index lookup and
+  // its lock on a hit.
+  bool cache_checked = false;
+  if (!index && !replaying) {
+    *outfd = fdcache.lookup(oid);
+    if (*outfd)
+      return 0;
+    cache_checked = true;
+  }
+
   Index index2;
   if (!index) {
     index = &index2;
@@ -251,7 +279,7 @@ int FileStore::lfn_open(coll_t cid,
   if (need_lock) {
     ((*index).index)->access_lock.get_write();
   }
-  if (!replaying) {
+  if (!replaying && !cache_checked) {
     *outfd = fdcache.lookup(oid);
     if (*outfd) {
       if (need_lock) {
@@ -305,9 +333,6 @@ int FileStore::lfn_open(coll_t cid,
   if (!replaying) {
     bool existed;
     *outfd = fdcache.add(oid, fd, &existed);
-    if (existed) {
-      TEMP_FAILURE_RETRY(::close(fd));
-    }
   } else {
     *outfd = FDRef(new FDCache::FD(fd));
   }
@@ -428,6 +453,15 @@ int FileStore::lfn_link(coll_t c, coll_t newcid, const ghobject_t& o, const ghob
       return r;
     }
   }    
+  if (hot_attrs_in_use() && !replaying) {
+    // the old name's FD no longer sees every change to its inode
+    FDRef fd = fdcache.lookup(o);
+    if (fd) {
+      Mutex::Locker l(fd->attr_lock);
+      fd->attrs_loaded = false;
+      fd->attrs_cacheable = false;
+    }
+  }
   return 0;
 }
 
@@ -464,7 +498,8 @@ int FileStore::lfn_unlink(coll_t cid, const ghobject_t& o,
 	  assert(!m_filestore_fail_eio || r != -EIO);
 	}
 	return r;
-      } else if (st.st_nlink == 1) {
+      } else if (st.st_nlink ==
+		 1 + (nlink_t)index->get_index_links(st.st_ino)) {
 	force_clear_omap = true;
       }
     }
@@ -545,7 +580,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   m_filestore_max_alloc_hint_size(g_conf->filestore_max_alloc_hint_size),
   m_fs_type(0),
   m_filestore_max_inline_xattr_size(0),
-  m_filestore_max_inline_xattrs(0)
+  m_filestore_max_inline_xattrs(0),
+  superblock_lock("FileStore::superblock_lock")
 {
   m_filestore_kill_at.set(g_conf->filestore_kill_at);
 
@@ -586,6 +622,17 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   plb.add_time_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_time_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64(l_os_index_split_pending, "index_split_pending");
+  plb.add_u64_counter(l_os_index_split_objects, "index_split_objects");
+  plb.add_u64_counter(l_os_index_splits, "index_splits");
+  plb.add_u64_counter(l_os_index_merges, "index_merges");
+  plb.add_time_avg(l_os_index_split_stall_lat, "index_split_stall_latency");
+  plb.add_u64(l_os_j_replay_entries, "journal_replay_entries");
+  plb.add_u64(l_os_j_replay_bytes, "journal_replay_bytes");
+  plb.add_u64(l_os_j_replay_threads, "journal_replay_threads");
+  plb.add_time(l_os_j_replay_time, "journal_replay_time");
+  plb.add_u64_avg(l_os_uring_batch, "io_uring_batch_writes");
+  plb.add_time_avg(l_os_uring_lat, "io_uring_batch_latency");
   plb.add_time_avg(l_os_queue_lat, "queue_transaction_latency_avg");
 
   logger = plb.create_perf_counters();
@@ -643,12 +690,26 @@ int FileStore::statfs(struct statfs *buf)
 }
 
 
+Journal *FileStore::new_journal(bool aio, bool force_aio)
+{
+  list<string> stripes;
+  get_str_list(g_conf->osd_journal_stripe_paths, stripes);
+  if (stripes.empty())
+    return new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(),
+			   m_journal_dio, aio, force_aio);
+
+  vector<string> paths(1, journalpath);
+  paths.insert(paths.end(), stripes.begin(), stripes.end());
+  dout(10) << "journal striped over " << paths << dendl;
+  return new StripedJournal(fsid, &finisher, &sync_cond, paths,
+			    m_journal_dio, aio, force_aio);
+}
+
 int FileStore::open_journal()
 {
   if (journalpath.length()) {
     dout(10) << "open_journal at " << journalpath << dendl;
-    journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(),
-			      m_journal_dio, m_journal_aio, m_journal_force_aio);
+    journal = new_journal(m_journal_aio, m_journal_force_aio);
     if (journal)
       journal->logger = logger;
   }
@@ -662,7 +723,7 @@ int FileStore::dump_journal(ostream& out)
   if (!journalpath.length())
     return -EINVAL;
 
-  FileJournal *journal = new FileJournal(fsid, &finisher, &sync_cond, journalpath.c_str(), m_journal_dio);
+  Journal *journal = new_journal(true, false);
   r = journal->dump(out);
   delete journal;
   return r;
@@ -1116,6 +1177,7 @@ int FileStore::read_superblock()
 
 void FileStore::set_allow_sharded_objects()
 {
+  Mutex::Locker l(superblock_lock);
   if (!get_allow_sharded_objects()) {
     superblock.compat_features.incompat.insert(CEPH_FS_FEATURE_INCOMPAT_SHARDS);
     int ret = write_superblock();
@@ -1290,6 +1352,9 @@ int FileStore::mount()
     ret = -EINVAL;
     goto close_fsid_fd;
   }
+  hot_attrs_enabled.set(
+    superblock.compat_features.incompat.contains(
+      CEPH_FS_FEATURE_INCOMPAT_HOT_XATTRS));
 
   // open some dir handles
   basedir_fd = ::open(basedir.c_str(), O_RDONLY);
@@ -1309,6 +1374,13 @@ int FileStore::mount()
     goto close_basedir_fd;
   }
 
+  {
+    // lets the adaptive wbthrottle watch the device queue
+    struct stat st;
+    if (::fstat(basedir_fd, &st) == 0)
+      wbthrottle.set_dev(st.st_dev);
+  }
+
   {
     list<string> ls;
     ret = backend->list_checkpoints(ls);
@@ -1539,6 +1611,17 @@ int FileStore::mount()
     }
   }
 
+  if (g_conf->filestore_io_uring) {
+    // one ring per op thread; journal replay borrows them, too
+    ret = io_rings.init(MAX(g_conf->filestore_op_threads, 1),
+			g_conf->filestore_io_uring_depth);
+    if (ret < 0) {
+      dout(0) << "mount: io_uring unavailable (" << cpp_strerror(ret)
+	      << "), using synchronous writes" << dendl;
+      ret = 0;
+    }
+  }
+
   wbthrottle.start();
   sync_thread.create();
 
@@ -1559,9 +1642,14 @@ int FileStore::mount()
       sync_thread.join();
 
       wbthrottle.stop();
+      io_rings.shutdown();
 
       goto close_current_fd;
     }
+    logger->set(l_os_j_replay_entries, replay_stats.entries);
+    logger->set(l_os_j_replay_bytes, replay_stats.bytes);
+    logger->set(l_os_j_replay_threads, replay_stats.threads);
+    logger->tset(l_os_j_replay_time, replay_stats.duration);
   }
 
   {
@@ -1578,6 +1666,8 @@ int FileStore::mount()
   op_tp.start();
   op_finisher.start();
   ondisk_finisher.start();
+  // splits during replay above were done inline
+  index_manager.start_split_thread(logger);
 
   timer.init();
 
@@ -1621,6 +1711,8 @@ int FileStore::umount()
   sync_thread.join();
   wbthrottle.stop();
   op_tp.stop();
+  io_rings.shutdown();
+  index_manager.stop_split_thread();
 
   journal_stop();
   if (!(generic_flags & SKIP_JOURNAL_REPLAY))
@@ -1968,20 +2060,80 @@ int FileStore::_do_transactions(
 {
   int r = 0;
   int trans_num = 0;
+  WriteBatch batch;
+  WriteBatch *pbatch = io_rings.is_enabled() ? &batch : NULL;
 
   for (list<Transaction*>::iterator p = tls.begin();
        p != tls.end();
        ++p, trans_num++) {
-    r = _do_transaction(**p, op_seq, trans_num, handle);
+    r = _do_transaction(**p, op_seq, trans_num, handle, pbatch);
     if (r < 0)
       break;
     if (handle)
       handle->reset_tp_timeout();
   }
+  if (pbatch)
+    _flush_write_batch(pbatch);
   
   return r;
 }
 
+bool FileStore::_op_is_batchable(int op)
+{
+  switch (op) {
+  case Transaction::OP_NOP:
+  case Transaction::OP_TOUCH:
+  case Transaction::OP_WRITE:
+  case Transaction::OP_SETATTR:
+  case Transaction::OP_SETATTRS:
+  case Transaction::OP_RMATTR:
+  case Transaction::OP_RMATTRS:
+  case Transaction::OP_COLL_SETATTR:
+  case Transaction::OP_COLL_RMATTR:
+  case Transaction::OP_OMAP_CLEAR:
+  case Transaction::OP_OMAP_SETKEYS:
+  case Transaction::OP_OMAP_RMKEYS:
+  case Transaction::OP_OMAP_RMKEYRANGE:
+  case Transaction::OP_OMAP_SETHEADER:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void FileStore::_flush_write_batch(WriteBatch *batch)
+{
+  if (batch->empty())
+    return;
+  dout(15) << "flush_write_batch " << batch->items.size() << " writes" << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  io_rings.write(batch->writes);
+  logger->inc(l_os_uring_batch, batch->items.size());
+  logger->tinc(l_os_uring_lat, ceph_clock_now(g_ceph_context) - start);
+
+  for (unsigned i = 0; i < batch->items.size(); ++i) {
+    WriteBatch::item_t &item = batch->items[i];
+    int r = batch->writes[i].r;
+    dout(10) << "write " << item.oid << " " << item.offset << "~" << item.len
+	     << " = " << r << dendl;
+    if (r < 0) {
+      // same as a failed synchronous write in _do_transaction
+      derr << "write " << item.oid << " " << item.offset << "~" << item.len
+	   << " error " << cpp_strerror(r) << dendl;
+      if (r == -ENOSPC)
+	assert(0 == "ENOSPC handling not implemented");
+      assert(0 == "unexpected error");
+    }
+    if (!replaying &&
+	g_conf->filestore_wbthrottle_enable)
+      wbthrottle.queue_wb(item.fd, item.oid, item.offset, item.len,
+			  item.replica);
+  }
+  batch->items.clear();
+  batch->writes.clear();
+  batch->extents.clear();
+}
+
 void FileStore::_set_global_replay_guard(coll_t cid,
 					 const SequencerPosition &spos)
 {
@@ -2236,7 +2388,7 @@ int FileStore::_check_replay_guard(int fd, const SequencerPosition& spos)
 
 unsigned FileStore::_do_transaction(
   Transaction& t, uint64_t op_seq, int trans_num,
-  ThreadPool::TPHandle *handle)
+  ThreadPool::TPHandle *handle, WriteBatch *batch)
 {
   dout(10) << "_do_transaction on " << &t << dendl;
 
@@ -2254,6 +2406,9 @@ unsigned FileStore::_do_transaction(
     int op = i.decode_op();
     int r = 0;
 
+    if (batch && !_op_is_batchable(op))
+      _flush_write_batch(batch);
+
     _inject_failure();
 
     switch (op) {
@@ -2281,7 +2436,7 @@ unsigned FileStore::_do_transaction(
 	i.decode_bl(bl);
         tracepoint(objectstore, write_enter, osr_name, off, len);
 	if (_check_replay_guard(cid, oid, spos) > 0)
-	  r = _write(cid, oid, off, len, bl, replica);
+	  r = _write(cid, oid, off, len, bl, replica, batch);
         tracepoint(objectstore, write_exit, r);
       }
       break;
@@ -2820,16 +2975,23 @@ int FileStore::read(
     len = st.st_size;
   }
 
-  bufferptr bptr(len);  // prealloc space for entire read
-  got = safe_pread(**fd, bptr.c_str(), len, offset);
+  if (backend->has_seek_data_hole() &&
+      len > (size_t)m_filestore_fiemap_threshold) {
+    got = _sparse_read(**fd, offset, len, bl);
+  } else {
+    bufferptr bptr(len);  // prealloc space for entire read
+    got = safe_pread(**fd, bptr.c_str(), len, offset);
+    if (got >= 0) {
+      bptr.set_length(got);   // properly size the buffer
+      bl.push_back(bptr);   // put it in the target bufferlist
+    }
+  }
   if (got < 0) {
     dout(10) << "FileStore::read(" << cid << "/" << oid << ") pread error: " << cpp_strerror(got) << dendl;
     lfn_close(fd);
     assert(allow_eio || !m_filestore_fail_eio || got != -EIO);
     return got;
   }
-  bptr.set_length(got);   // properly size the buffer
-  bl.push_back(bptr);   // put it in the target bufferlist
 
   if (m_filestore_sloppy_crc && (!replaying || backend->can_checkpoint())) {
     ostringstream ss;
@@ -2854,21 +3016,107 @@ int FileStore::read(
   }
 }
 
+int FileStore::_sparse_read(int fd, uint64_t offset, size_t len, bufferlist& bl)
+{
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0)
+    return -errno;
+  if ((uint64_t)st.st_size <= offset)
+    return 0;
+  uint64_t end = MIN(offset + len, (uint64_t)st.st_size);
+
+  map<uint64_t, uint64_t> m;
+  r = backend->do_seek_data_hole(fd, offset, end - offset, &m);
+  if (r < 0)
+    return r;
+
+  // holes come back as zeros without touching the disk
+  uint64_t pos = offset;
+  for (map<uint64_t, uint64_t>::iterator p = m.begin(); p != m.end(); ++p) {
+    if (p->first > pos)
+      bl.append_zero(p->first - pos);
+    bufferptr bptr(p->second);
+    r = safe_pread(fd, bptr.c_str(), p->second, p->first);
+    if (r < 0)
+      return r;
+    bptr.set_length(r);
+    bl.push_back(bptr);
+    pos = p->first + r;
+    if ((uint64_t)r < p->second)
+      return pos - offset;   // truncated under us
+  }
+  if (pos < end)
+    bl.append_zero(end - pos);
+  return end - offset;
+}
+
+int FileStore::_get_data_extents(int fd, uint64_t offset, uint64_t len,
+				 map<uint64_t, uint64_t> *m)
+{
+  if (backend->has_seek_data_hole())
+    return backend->do_seek_data_hole(fd, offset, len, m);
+
+  struct fiemap *fiemap = NULL;
+  int r = backend->do_fiemap(fd, offset, len, &fiemap);
+  if (r < 0)
+    return r;
+
+  if (fiemap->fm_mapped_extents == 0) {
+    free(fiemap);
+    return 0;
+  }
+
+  struct fiemap_extent *extent = &fiemap->fm_extents[0];
+
+  /* start where we were asked to start */
+  if (extent->fe_logical < offset) {
+    extent->fe_length -= offset - extent->fe_logical;
+    extent->fe_logical = offset;
+  }
+
+  uint64_t i = 0;
+
+  while (i < fiemap->fm_mapped_extents) {
+    struct fiemap_extent *next = extent + 1;
+
+    dout(10) << "FileStore::fiemap() fm_mapped_extents=" << fiemap->fm_mapped_extents
+	     << " fe_logical=" << extent->fe_logical << " fe_length=" << extent->fe_length << dendl;
+
+    /* try to merge extents */
+    while ((i < fiemap->fm_mapped_extents - 1) &&
+           (extent->fe_logical + extent->fe_length == next->fe_logical)) {
+        next->fe_length += extent->fe_length;
+        next->fe_logical = extent->fe_logical;
+        extent = next;
+        next = extent + 1;
+        i++;
+    }
+
+    if (extent->fe_logical + extent->fe_length > offset + len)
+      extent->fe_length = offset + len - extent->fe_logical;
+    (*m)[extent->fe_logical] = extent->fe_length;
+    i++;
+    extent++;
+  }
+  free(fiemap);
+  return 0;
+}
+
 int FileStore::fiemap(coll_t cid, const ghobject_t& oid,
                     uint64_t offset, size_t len,
                     bufferlist& bl)
 {
   tracepoint(objectstore, fiemap_enter, cid.c_str(), offset, len);
 
-  if (!backend->has_fiemap() || len <= (size_t)m_filestore_fiemap_threshold) {
+  if ((!backend->has_fiemap() && !backend->has_seek_data_hole()) ||
+      len <= (size_t)m_filestore_fiemap_threshold) {
     map<uint64_t, uint64_t> m;
     m[offset] = len;
     ::encode(m, bl);
     return 0;
   }
 
-
-  struct fiemap *fiemap = NULL;
   map<uint64_t, uint64_t> exomap;
 
   dout(15) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << dendl;
@@ -2878,56 +3126,10 @@ int FileStore::fiemap(coll_t cid, const ghobject_t& oid,
   if (r < 0) {
     dout(10) << "read couldn't open " << cid << "/" << oid << ": " << cpp_strerror(r) << dendl;
   } else {
-    uint64_t i;
-
-    r = backend->do_fiemap(**fd, offset, len, &fiemap);
-    if (r < 0)
-      goto done;
-
-    if (fiemap->fm_mapped_extents == 0) {
-      free(fiemap);
-      goto done;
-    }
-
-    struct fiemap_extent *extent = &fiemap->fm_extents[0];
-
-    /* start where we were asked to start */
-    if (extent->fe_logical < offset) {
-      extent->fe_length -= offset - extent->fe_logical;
-      extent->fe_logical = offset;
-    }
-
-    i = 0;
-
-    while (i < fiemap->fm_mapped_extents) {
-      struct fiemap_extent *next = extent + 1;
-
-      dout(10) << "FileStore::fiemap() fm_mapped_extents=" << fiemap->fm_mapped_extents
-	       << " fe_logical=" << extent->fe_logical << " fe_length=" << extent->fe_length << dendl;
-
-      /* try to merge extents */
-      while ((i < fiemap->fm_mapped_extents - 1) &&
-             (extent->fe_logical + extent->fe_length == next->fe_logical)) {
-          next->fe_length += extent->fe_length;
-          next->fe_logical = extent->fe_logical;
-          extent = next;
-          next = extent + 1;
-          i++;
-      }
-
-      if (extent->fe_logical + extent->fe_length > offset + len)
-        extent->fe_length = offset + len - extent->fe_logical;
-      exomap[extent->fe_logical] = extent->fe_length;
-      i++;
-      extent++;
-    }
-    free(fiemap);
-  }
-
-done:
-  if (r >= 0) {
+    r = _get_data_extents(**fd, offset, len, &exomap);
     lfn_close(fd);
-    ::encode(exomap, bl);
+    if (r >= 0)
+      ::encode(exomap, bl);
   }
 
   dout(10) << "fiemap " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << " num_extents=" << exomap.size() << " " << exomap << dendl;
@@ -2972,13 +3174,12 @@ int FileStore::_touch(coll_t cid, const ghobject_t& oid)
 
 int FileStore::_write(coll_t cid, const ghobject_t& oid,
                      uint64_t offset, size_t len,
-                     const bufferlist& bl, bool replica)
+                     const bufferlist& bl, bool replica,
+                     WriteBatch *batch)
 {
   dout(15) << "write " << cid << "/" << oid << " " << offset << "~" << len << dendl;
   int r;
 
-  int64_t actual;
-
   FDRef fd;
   r = lfn_open(cid, oid, true, &fd);
   if (r < 0) {
@@ -2987,24 +3188,37 @@ int FileStore::_write(coll_t cid, const ghobject_t& oid,
 	    << cpp_strerror(r) << dendl;
     goto out;
   }
-    
-  // seek
-  actual = ::lseek64(**fd, offset, SEEK_SET);
-  if (actual < 0) {
-    r = -errno;
-    dout(0) << "write lseek64 to " << offset << " failed: " << cpp_strerror(r) << dendl;
-    lfn_close(fd);
-    goto out;
-  }
-  if (actual != (int64_t)offset) {
-    dout(0) << "write lseek64 to " << offset << " gave bad offset " << actual << dendl;
-    r = -EIO;
+
+  if (batch && bl.length()) {
+    // keep overlapping writes in order
+    if (batch->extents[**fd].intersects(offset, bl.length()))
+      _flush_write_batch(batch);
+    interval_set<uint64_t> mine;
+    mine.insert(offset, bl.length());
+    batch->extents[**fd].union_of(mine);
+
+    WriteBatch::item_t item;
+    item.fd = fd;
+    item.oid = oid;
+    item.offset = offset;
+    item.len = len;
+    item.replica = replica;
+    batch->items.push_back(item);
+    batch->writes.push_back(IOUringSet::write_t(**fd, offset, bl));
+    r = bl.length();
+
+    if (m_filestore_sloppy_crc) {
+      int rc = backend->_crc_update_write(**fd, offset, len, bl);
+      assert(rc >= 0);
+    }
+    // queued for writeback once the batch is written
     lfn_close(fd);
     goto out;
   }
 
-  // write
-  r = bl.write_fd(**fd);
+  // write.  the fd may be shared through the FDCache, so don't rely on
+  // (or move) its file offset.
+  r = bl.write_fd(**fd, offset);
   if (r == 0)
     r = bl.length();
 
@@ -3138,6 +3352,23 @@ int FileStore::_clone(coll_t cid, const ghobject_t& oldoid, const ghobject_t& ne
     r = _fsetattrs(**n, aset);
     if (r < 0)
       goto out3;
+
+    if (hot_attrs_in_use()) {
+      map<string, bufferptr> hot;
+      {
+	Mutex::Locker l(o->attr_lock);
+	r = _load_hot_attrs(*o);
+	if (r < 0)
+	  goto out3;
+	hot = o->attrs;
+      }
+      Mutex::Locker l(n->attr_lock);
+      n->attrs.swap(hot);
+      n->attrs_loaded = true;
+      r = _store_hot_attrs(*n);
+      if (r < 0)
+	goto out3;
+    }
   }
 
   // clone is non-idempotent; record our work.
@@ -3163,110 +3394,61 @@ int FileStore::_do_sparse_copy_range(int from, int to, uint64_t srcoff, uint64_t
 {
   dout(20) << __func__ << " " << srcoff << "~" << len << " to " << dstoff << dendl;
   int r = 0;
-  struct fiemap *fiemap = NULL;
 
   // fiemap doesn't allow zero length
   if (len == 0)
     return 0;
 
-  r = backend->do_fiemap(from, srcoff, len, &fiemap);
+  struct stat st;
+  r = ::fstat(from, &st);
   if (r < 0) {
-    derr << "do_fiemap failed:" << srcoff << "~" << len << " = " << r << dendl;
+    r = -errno;
+    derr << __func__ << ": fstat error on fd " << from << ": " << cpp_strerror(r) << dendl;
     return r;
   }
-
-  // No need to copy
-  if (fiemap->fm_mapped_extents == 0)
+  uint64_t src_end = MIN(srcoff + len, (uint64_t)MAX(st.st_size, (off_t)srcoff));
+  r = ::fstat(to, &st);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << ": fstat error on fd " << to << ": " << cpp_strerror(r) << dendl;
     return r;
-
-  int buflen = 4096*32;
-  char buf[buflen];
-  struct fiemap_extent *extent = &fiemap->fm_extents[0];
-
-  /* start where we were asked to start */
-  if (extent->fe_logical < srcoff) {
-    extent->fe_length -= srcoff - extent->fe_logical;
-    extent->fe_logical = srcoff;
   }
+  uint64_t dst_size = st.st_size;
 
-  uint64_t i = 0;
-
-  while (i < fiemap->fm_mapped_extents) {
-    struct fiemap_extent *next = extent + 1;
-
-    dout(10) << __func__ << " fm_mapped_extents=" << fiemap->fm_mapped_extents
-             << " fe_logical=" << extent->fe_logical << " fe_length="
-             << extent->fe_length << dendl;
-
-    /* try to merge extents */
-    while ((i < fiemap->fm_mapped_extents - 1) &&
-           (extent->fe_logical + extent->fe_length == next->fe_logical)) {
-        next->fe_length += extent->fe_length;
-        next->fe_logical = extent->fe_logical;
-        extent = next;
-        next = extent + 1;
-        i++;
-    }
-
-    if (extent->fe_logical + extent->fe_length > srcoff + len)
-      extent->fe_length = srcoff + len - extent->fe_logical;
-
-    int64_t actual;
+  map<uint64_t, uint64_t> m;
+  r = _get_data_extents(from, srcoff, len, &m);
+  if (r < 0) {
+    derr << "get_data_extents failed:" << srcoff << "~" << len << " = " << r << dendl;
+    return r;
+  }
 
-    actual = ::lseek64(from, extent->fe_logical, SEEK_SET);
-    if (actual != (int64_t)extent->fe_logical) {
-      r = errno;
-      derr << "lseek64 to " << srcoff << " got " << cpp_strerror(r) << dendl;
-      return r;
-    }
-    actual = ::lseek64(to, extent->fe_logical - srcoff + dstoff, SEEK_SET);
-    if (actual != (int64_t)(extent->fe_logical - srcoff + dstoff)) {
-      r = errno;
-      derr << "lseek64 to " << dstoff << " got " << cpp_strerror(r) << dendl;
-      return r;
+  // holes in the source must read back as zeros from the target, too
+  uint64_t pos = srcoff;
+  map<uint64_t, uint64_t>::iterator p = m.begin();
+  while (r >= 0 && pos < src_end) {
+    uint64_t hole_end = p == m.end() ? src_end : MIN(p->first, src_end);
+    if (hole_end > pos && pos - srcoff + dstoff < dst_size) {
+      uint64_t zlen = MIN(hole_end - pos, dst_size - (pos - srcoff + dstoff));
+      dout(10) << __func__ << " zero " << (pos - srcoff + dstoff) << "~" << zlen << dendl;
+      r = _do_zero_extent(to, pos - srcoff + dstoff, zlen);
+      if (r < 0)
+	break;
     }
+    if (p == m.end())
+      break;
+    dout(10) << __func__ << " extent " << p->first << "~" << p->second << dendl;
+    r = _do_copy_extent(from, to, p->first, p->second, p->first - srcoff + dstoff);
+    pos = p->first + p->second;
+    ++p;
+  }
 
-    loff_t pos = 0;
-    loff_t end = extent->fe_length;
-    while (pos < end) {
-      int l = MIN(end-pos, buflen);
-      r = ::read(from, buf, l);
-      dout(25) << "  read from " << pos << "~" << l << " got " << r << dendl;
-      if (r < 0) {
-        if (errno == EINTR) {
-          continue;
-        } else {
-          r = -errno;
-          derr << __func__ << ": read error at " << pos << "~" << len
-              << ", " << cpp_strerror(r) << dendl;
-          break;
-        }
-      }
-      if (r == 0) {
-        r = -ERANGE;
-        derr << __func__ << " got short read result at " << pos
-             << " of fd " << from << " len " << len << dendl;
-        break;
-      }
-      int op = 0;
-      while (op < r) {
-        int r2 = safe_write(to, buf+op, r-op);
-        dout(25) << " write to " << to << " len " << (r-op)
-                 << " got " << r2 << dendl;
-        if (r2 < 0) {
-          r = r2;
-          derr << __func__ << ": write error at " << pos << "~"
-               << r-op << ", " << cpp_strerror(r) << dendl;
-          break;
-        }
-        op += (r-op);
-      }
-      if (r < 0)
-        break;
-      pos += r;
+  // a trailing hole still has to extend the target
+  if (r >= 0 && src_end > srcoff && dst_size < src_end - srcoff + dstoff) {
+    r = ::ftruncate(to, src_end - srcoff + dstoff);
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << ": ftruncate error on fd " << to << ": " << cpp_strerror(r) << dendl;
     }
-    i++;
-    extent++;
   }
 
   if (r >= 0 && m_filestore_sloppy_crc) {
@@ -3278,68 +3460,69 @@ int FileStore::_do_sparse_copy_range(int from, int to, uint64_t srcoff, uint64_t
   return r;
 }
 
-int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff)
+int FileStore::_do_zero_extent(int to, uint64_t off, uint64_t len)
 {
-  dout(20) << "_do_copy_range " << srcoff << "~" << len << " to " << dstoff << dendl;
-  int r = 0;
-  int64_t actual;
-
-  actual = ::lseek64(from, srcoff, SEEK_SET);
-  if (actual != (int64_t)srcoff) {
-    r = errno;
-    derr << "lseek64 to " << srcoff << " got " << cpp_strerror(r) << dendl;
-    return r;
-  }
-  actual = ::lseek64(to, dstoff, SEEK_SET);
-  if (actual != (int64_t)dstoff) {
-    r = errno;
-    derr << "lseek64 to " << dstoff << " got " << cpp_strerror(r) << dendl;
-    return r;
+  int buflen = 4096*32;
+  char buf[buflen];
+  memset(buf, 0, buflen);
+  uint64_t pos = 0;
+  while (pos < len) {
+    int l = MIN(len - pos, (uint64_t)buflen);
+    int r = safe_pwrite(to, buf, l, off + pos);
+    if (r < 0) {
+      derr << __func__ << ": write error at " << (off + pos) << "~" << l
+	   << ", " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    pos += l;
   }
+  return 0;
+}
 
-  loff_t pos = srcoff;
-  loff_t end = srcoff + len;
+/*
+ * Copy with pread/pwrite: the fds come from the FDCache and may be in
+ * use by other threads, so the file offsets are not ours to move.
+ */
+int FileStore::_do_copy_extent(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff)
+{
+  int r = 0;
+  uint64_t pos = 0;
   int buflen = 4096*32;
   char buf[buflen];
-  while (pos < end) {
-    int l = MIN(end-pos, buflen);
-    r = ::read(from, buf, l);
-    dout(25) << "  read from " << pos << "~" << l << " got " << r << dendl;
+  while (pos < len) {
+    int l = MIN(len - pos, (uint64_t)buflen);
+    r = safe_pread(from, buf, l, srcoff + pos);
+    dout(25) << "  read from " << (srcoff + pos) << "~" << l << " got " << r << dendl;
     if (r < 0) {
-      if (errno == EINTR) {
-	continue;
-      } else {
-	r = -errno;
-	derr << "FileStore::_do_copy_range: read error at " << pos << "~" << len
-	     << ", " << cpp_strerror(r) << dendl;
-	break;
-      }
+      derr << "FileStore::_do_copy_extent: read error at " << (srcoff + pos) << "~" << l
+	   << ", " << cpp_strerror(r) << dendl;
+      break;
     }
     if (r == 0) {
       // hrm, bad source range, wtf.
       r = -ERANGE;
-      derr << "FileStore::_do_copy_range got short read result at " << pos
+      derr << "FileStore::_do_copy_extent got short read result at " << (srcoff + pos)
 	      << " of fd " << from << " len " << len << dendl;
       break;
     }
-    int op = 0;
-    while (op < r) {
-      int r2 = safe_write(to, buf+op, r-op);
-      dout(25) << " write to " << to << " len " << (r-op)
-	       << " got " << r2 << dendl;
-      if (r2 < 0) {
-	r = r2;
-	derr << "FileStore::_do_copy_range: write error at " << pos << "~"
-	     << r-op << ", " << cpp_strerror(r) << dendl;
-
-	break;
-      }
-      op += (r-op);
-    }
-    if (r < 0)
+    int r2 = safe_pwrite(to, buf, r, dstoff + pos);
+    dout(25) << " write to " << to << " at " << (dstoff + pos) << " len " << r
+	     << " got " << r2 << dendl;
+    if (r2 < 0) {
+      derr << "FileStore::_do_copy_extent: write error at " << (dstoff + pos) << "~"
+	   << r << ", " << cpp_strerror(r2) << dendl;
+      r = r2;
       break;
+    }
     pos += r;
   }
+  return r < 0 ? r : 0;
+}
+
+int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff)
+{
+  dout(20) << "_do_copy_range " << srcoff << "~" << len << " to " << dstoff << dendl;
+  int r = _do_copy_extent(from, to, srcoff, len, dstoff);
   if (r >= 0 && m_filestore_sloppy_crc) {
     int rc = backend->_crc_update_clone_range(from, to, srcoff, len, dstoff);
     assert(rc >= 0);
@@ -3782,6 +3965,95 @@ int FileStore::_fsetattrs(int fd, map<string, bufferptr> &aset)
   return 0;
 }
 
+int FileStore::_enable_hot_attrs()
+{
+  Mutex::Locker l(superblock_lock);
+  if (hot_attrs_in_use())
+    return 0;
+  dout(0) << "enabling packed hot xattrs" << dendl;
+  superblock.compat_features.incompat.insert(
+    CEPH_FS_FEATURE_INCOMPAT_HOT_XATTRS);
+  int r = write_superblock();
+  if (r < 0) {
+    derr << __func__ << " write_superblock: " << cpp_strerror(r) << dendl;
+    superblock.compat_features.incompat.remove(
+      CEPH_FS_FEATURE_INCOMPAT_HOT_XATTRS);
+    return r;
+  }
+  hot_attrs_enabled.set(1);
+  return 0;
+}
+
+int FileStore::_load_hot_attrs(FDCache::FD &fd)
+{
+  assert(fd.attr_lock.is_locked());
+  if (!hot_attrs_in_use()) {
+    // nothing has ever been packed
+    fd.attrs.clear();
+    return 0;
+  }
+  if (fd.attrs_loaded && fd.attrs_cacheable)
+    return 0;
+  if (!fd.attrs_loaded && fd.attrs_cacheable) {
+    // another link to the inode has its own FD and its own copy
+    struct stat st;
+    if (::fstat(*fd, &st) < 0 || st.st_nlink > 1)
+      fd.attrs_cacheable = false;
+  }
+
+  // big enough for the usual packed attrs, so that this is one syscall
+  char val[CHAIN_XATTR_MAX_BLOCK_LEN * 2];
+  bufferlist bl;
+  int r = chain_fgetxattr(*fd, XATTR_HOT_NAME, val, sizeof(val));
+  if (r >= 0) {
+    bl.append(val, r);
+  } else if (r == -ERANGE) {
+    bufferptr bp;
+    r = _fgetattr(*fd, XATTR_HOT_NAME, bp);
+    if (r >= 0)
+      bl.append(bp);
+  }
+  if (r == -ENODATA) {
+    fd.attrs.clear();
+  } else if (r < 0) {
+    assert(!m_filestore_fail_eio || r != -EIO);
+    return r;
+  } else {
+    bufferlist::iterator p = bl.begin();
+    try {
+      ::decode(fd.attrs, p);
+    } catch (buffer::error& e) {
+      derr << __func__ << " unable to decode " << XATTR_HOT_NAME
+	   << " on fd " << *fd << dendl;
+      return -EIO;
+    }
+  }
+  fd.attrs_loaded = true;
+  return 0;
+}
+
+int FileStore::_store_hot_attrs(FDCache::FD &fd)
+{
+  assert(fd.attr_lock.is_locked());
+  assert(fd.attrs_loaded);
+  int r;
+  if (fd.attrs.empty()) {
+    r = chain_fremovexattr(*fd, XATTR_HOT_NAME);
+    if (r == -ENODATA)
+      r = 0;
+  } else {
+    bufferlist bl;
+    ::encode(fd.attrs, bl);
+    r = chain_fsetxattr(*fd, XATTR_HOT_NAME, bl.c_str(), bl.length());
+  }
+  if (r < 0) {
+    derr << __func__ << " returned " << r << dendl;
+    // leave it to the next reader to find out what is there
+    fd.attrs_loaded = false;
+  }
+  return r;
+}
+
 // debug EIO injection
 void FileStore::inject_data_error(const ghobject_t &oid) {
   Mutex::Locker l(read_error_lock);
@@ -3830,6 +4102,18 @@ int FileStore::getattr(coll_t cid, const ghobject_t& oid, const char *name, buff
   if (r < 0) {
     goto out;
   }
+  if (is_hot_attr(name)) {
+    Mutex::Locker l(fd->attr_lock);
+    r = _load_hot_attrs(*fd);
+    if (r < 0)
+      goto out;
+    map<string, bufferptr>::iterator p = fd->attrs.find(name);
+    if (p != fd->attrs.end()) {
+      bp = p->second;
+      r = bp.length();
+      goto out;
+    }
+  }
   char n[CHAIN_XATTR_MAX_NAME_LEN];
   get_attrname(name, n, CHAIN_XATTR_MAX_NAME_LEN);
   r = _fgetattr(**fd, n, bp);
@@ -3893,6 +4177,17 @@ int FileStore::getattrs(coll_t cid, const ghobject_t& oid, map<string,bufferptr>
   if (r < 0) {
     goto out;
   }
+  {
+    // the packed copies win over any left over from before they were packed
+    Mutex::Locker l(fd->attr_lock);
+    r = _load_hot_attrs(*fd);
+    if (r < 0)
+      goto out;
+    for (map<string, bufferptr>::iterator p = fd->attrs.begin();
+	 p != fd->attrs.end();
+	 ++p)
+      aset[p->first] = p->second;
+  }
   lfn_close(fd);
 
   if (!spill_out) {
@@ -3948,6 +4243,7 @@ int FileStore::_setattrs(coll_t cid, const ghobject_t& oid, map<string,bufferptr
   set<string> omap_remove;
   map<string, bufferptr> inline_set;
   map<string, bufferptr> inline_to_set;
+  set<string> packed;
   FDRef fd;
   int spill_out = -1;
   bool incomplete_inline = false;
@@ -3957,6 +4253,56 @@ int FileStore::_setattrs(coll_t cid, const ghobject_t& oid, map<string,bufferptr
     goto out;
   }
 
+  if (g_conf->filestore_pack_hot_xattrs && !hot_attrs_in_use()) {
+    for (map<string, bufferptr>::iterator p = aset.begin();
+	 p != aset.end();
+	 ++p) {
+      if (is_hot_attr(p->first.c_str())) {
+	r = _enable_hot_attrs();
+	if (r < 0)
+	  goto out_close;
+	break;
+      }
+    }
+  }
+
+  if (hot_attrs_in_use()) {
+    // hot attrs that are already packed stay packed whatever the
+    // setting, or the stale packed copy would hide the new value
+    Mutex::Locker l(fd->attr_lock);
+    r = _load_hot_attrs(*fd);
+    if (r < 0)
+      goto out_close;
+    map<string, bufferptr> hot = fd->attrs;
+    for (map<string, bufferptr>::iterator p = aset.begin();
+	 p != aset.end();
+	 ++p) {
+      if (!is_hot_attr(p->first.c_str()))
+	continue;
+      if (hot.count(p->first) || g_conf->filestore_pack_hot_xattrs) {
+	hot[p->first] = p->second;
+	packed.insert(p->first);
+      }
+    }
+    if (!packed.empty()) {
+      bufferlist bl;
+      ::encode(hot, bl);
+      if (bl.length() > m_filestore_max_inline_xattr_size) {
+	// too big to be worth it: store them like any other attr
+	dout(15) << "setattrs " << cid << "/" << oid << " packed attrs are "
+		 << bl.length() << " bytes, unpacking" << dendl;
+	for (set<string>::iterator p = packed.begin(); p != packed.end(); ++p)
+	  fd->attrs.erase(*p);
+	packed.clear();
+      } else {
+	fd->attrs.swap(hot);
+      }
+      r = _store_hot_attrs(*fd);
+      if (r < 0)
+	goto out_close;
+    }
+  }
+
   char buf[2];
   r = chain_fgetxattr(**fd, XATTR_SPILL_OUT_NAME, buf, sizeof(buf));
   if (r >= 0 && !strncmp(buf, XATTR_NO_SPILL_OUT, sizeof(XATTR_NO_SPILL_OUT)))
@@ -3977,6 +4323,18 @@ int FileStore::_setattrs(coll_t cid, const ghobject_t& oid, map<string,bufferptr
     char n[CHAIN_XATTR_MAX_NAME_LEN];
     get_attrname(p->first.c_str(), n, CHAIN_XATTR_MAX_NAME_LEN);
 
+    if (packed.count(p->first)) {
+      // drop any copy from before it was packed
+      if (inline_set.count(p->first)) {
+	inline_set.erase(p->first);
+	r = chain_fremovexattr(**fd, n);
+	if (r < 0)
+	  goto out_close;
+      }
+      omap_remove.insert(p->first);
+      continue;
+    }
+
     if (incomplete_inline) {
       chain_fremovexattr(**fd, n); // ignore any error
       omap_set[p->first].push_back(p->second);
@@ -4047,6 +4405,7 @@ int FileStore::_rmattr(coll_t cid, const ghobject_t& oid, const char *name,
   dout(15) << "rmattr " << cid << "/" << oid << " '" << name << "'" << dendl;
   FDRef fd;
   bool spill_out = true;
+  bool was_packed = false;
   bufferptr bp;
 
   int r = lfn_open(cid, oid, false, &fd);
@@ -4054,6 +4413,19 @@ int FileStore::_rmattr(coll_t cid, const ghobject_t& oid, const char *name,
     goto out;
   }
 
+  if (is_hot_attr(name)) {
+    Mutex::Locker l(fd->attr_lock);
+    r = _load_hot_attrs(*fd);
+    if (r < 0)
+      goto out_close;
+    if (fd->attrs.erase(name)) {
+      was_packed = true;
+      r = _store_hot_attrs(*fd);
+      if (r < 0)
+	goto out_close;
+    }
+  }
+
   char buf[2];
   r = chain_fgetxattr(**fd, XATTR_SPILL_OUT_NAME, buf, sizeof(buf));
   if (r >= 0 && !strncmp(buf, XATTR_NO_SPILL_OUT, sizeof(XATTR_NO_SPILL_OUT))) {
@@ -4079,6 +4451,8 @@ int FileStore::_rmattr(coll_t cid, const ghobject_t& oid, const char *name,
       goto out_close;
     }
   }
+  if (was_packed && (r == -ENODATA || r == -ENOENT))
+    r = 0;
  out_close:
   lfn_close(fd);
  out:
@@ -4118,6 +4492,12 @@ int FileStore::_rmattrs(coll_t cid, const ghobject_t& oid,
 	break;
     }
   }
+  if (r >= 0 && hot_attrs_in_use()) {
+    Mutex::Locker l(fd->attr_lock);
+    fd->attrs.clear();
+    fd->attrs_loaded = true;
+    r = _store_hot_attrs(*fd);
+  }
 
   if (!spill_out) {
     dout(10) << __func__ << " no xattr exists in object_map r = " << r << dendl;
@@ -4681,6 +5061,43 @@ ObjectMap::ObjectMapIterator FileStore::get_omap_iterator(coll_t c,
   return object_map->get_iterator(hoid);
 }
 
+void FileStore::omap_get_values_batch(coll_t c,
+				      vector<ObjectMap::OmapRead> &reads)
+{
+  dout(15) << __func__ << " " << c << " " << reads.size() << " reads" << dendl;
+  Index index;
+  int r = get_index(c, &index);
+  if (r < 0) {
+    for (vector<ObjectMap::OmapRead>::iterator p = reads.begin();
+	 p != reads.end();
+	 ++p)
+      p->r = r;
+    return;
+  }
+
+  // only the objects that exist go to the object map
+  vector<ObjectMap::OmapRead> found;
+  vector<unsigned> pos;
+  {
+    assert(NULL != index.index);
+    RWLock::RLocker l((index.index)->access_lock);
+    for (unsigned i = 0; i < reads.size(); ++i) {
+      r = lfn_find(reads[i].oid, index);
+      if (r < 0) {
+	reads[i].r = r;
+	continue;
+      }
+      found.push_back(reads[i]);
+      pos.push_back(i);
+    }
+  }
+  object_map->get_values_batch(found);
+  for (unsigned i = 0; i < found.size(); ++i) {
+    reads[pos[i]].r = found[i].r;
+    reads[pos[i]].out.swap(found[i].out);
+  }
+}
+
 int FileStore::_collection_hint_expected_num_objs(coll_t c, uint32_t pg_num,
     uint64_t expected_num_objs,
     const SequencerPosition &spos)
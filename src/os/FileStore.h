@@ -41,6 +41,7 @@ using namespace std;
 #include "SequencerPosition.h"
 #include "FDCache.h"
 #include "WBThrottle.h"
+#include "IOUring.h"
 
 #include "include/uuid.h"
 
@@ -66,6 +67,7 @@ static const __SWORD_TYPE ZFS_SUPER_MAGIC(0x2fc12fc1);
 class FileStoreBackend;
 
 #define CEPH_FS_FEATURE_INCOMPAT_SHARDS CompatSet::Feature(1, "sharded objects")
+#define CEPH_FS_FEATURE_INCOMPAT_HOT_XATTRS CompatSet::Feature(2, "packed hot xattrs")
 
 class FSSuperblock {
 public:
@@ -326,6 +328,31 @@ private:
   FDCache fdcache;
   WBThrottle wbthrottle;
 
+  /**
+   * With filestore_io_uring, the data writes of an op are queued here
+   * and submitted together.  Ops that could observe the data (clones,
+   * truncates, removes, ...) and overlapping writes flush the batch
+   * first; the rest of the op is applied while the writes are queued.
+   */
+  IOUringSet io_rings;
+  struct WriteBatch {
+    struct item_t {
+      FDRef fd;
+      ghobject_t oid;
+      uint64_t offset, len;
+      bool replica;
+    };
+    vector<item_t> items;
+    vector<IOUringSet::write_t> writes;
+    map<int, interval_set<uint64_t> > extents;  ///< fd -> queued extents
+
+    bool empty() const {
+      return items.empty();
+    }
+  };
+  void _flush_write_batch(WriteBatch *batch);
+  static bool _op_is_batchable(int op);
+
   Sequencer default_osr;
   deque<OpSequencer*> op_queue;
   uint64_t op_queue_len, op_queue_bytes;
@@ -378,6 +405,7 @@ private:
   void _journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk);
   friend struct C_JournaledAhead;
 
+  Journal *new_journal(bool aio, bool force_aio);
   int open_journal();
 
   PerfCounters *logger;
@@ -458,7 +486,7 @@ public:
   }
   unsigned _do_transaction(
     Transaction& t, uint64_t op_seq, int trans_num,
-    ThreadPool::TPHandle *handle);
+    ThreadPool::TPHandle *handle, WriteBatch *batch = NULL);
 
   int queue_transactions(Sequencer *osr, list<Transaction*>& tls,
 			 TrackedOpRef op = TrackedOpRef(),
@@ -527,10 +555,14 @@ public:
     bufferlist& bl,
     bool allow_eio = false);
   int fiemap(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int _sparse_read(int fd, uint64_t offset, size_t len, bufferlist& bl);
+  /// map the allocated extents of fd in offset~len, via SEEK_DATA or FIEMAP
+  int _get_data_extents(int fd, uint64_t offset, uint64_t len,
+			map<uint64_t, uint64_t> *m);
 
   int _touch(coll_t cid, const ghobject_t& oid);
   int _write(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl,
-      bool replica = false);
+      bool replica = false, WriteBatch *batch = NULL);
   int _zero(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len);
   int _truncate(coll_t cid, const ghobject_t& oid, uint64_t size);
   int _clone(coll_t cid, const ghobject_t& oldoid, const ghobject_t& newoid,
@@ -541,11 +573,20 @@ public:
   int _do_clone_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff);
   int _do_sparse_copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff);
   int _do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff);
+  int _do_copy_extent(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff);
+  int _do_zero_extent(int to, uint64_t off, uint64_t len);
   int _remove(coll_t cid, const ghobject_t& oid, const SequencerPosition &spos);
 
   int _fgetattr(int fd, const char *name, bufferptr& bp);
   int _fgetattrs(int fd, map<string,bufferptr>& aset);
   int _fsetattrs(int fd, map<string, bufferptr> &aset);
+  int _load_hot_attrs(FDCache::FD &fd);
+  int _store_hot_attrs(FDCache::FD &fd);
+  int _enable_hot_attrs();
+  /// any object in the store may have packed hot xattrs
+  bool hot_attrs_in_use() {
+    return hot_attrs_enabled.read();
+  }
 
   void _start_sync();
 
@@ -623,6 +664,7 @@ public:
   int omap_check_keys(coll_t c, const ghobject_t &oid, const set<string> &keys,
 		      set<string> *out);
   ObjectMap::ObjectMapIterator get_omap_iterator(coll_t c, const ghobject_t &oid);
+  void omap_get_values_batch(coll_t c, vector<ObjectMap::OmapRead> &reads);
 
   int _create_collection(coll_t c);
   int _create_collection(coll_t c, const SequencerPosition &spos);
@@ -711,6 +753,8 @@ private:
   uint32_t m_filestore_max_inline_xattrs;
 
   FSSuperblock superblock;
+  Mutex superblock_lock;   ///< serializes feature updates to superblock
+  atomic_t hot_attrs_enabled;
 
   /**
    * write_superblock()
@@ -761,7 +805,7 @@ protected:
     return filestore->current_fn;
   }
   int _copy_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff) {
-    if (has_fiemap()) {
+    if (has_fiemap() || has_seek_data_hole()) {
       return filestore->_do_sparse_copy_range(from, to, srcoff, len, dstoff);
     } else {
       return filestore->_do_copy_range(from, to, srcoff, len, dstoff);
@@ -789,6 +833,10 @@ public:
   virtual int syncfs() = 0;
   virtual bool has_fiemap() = 0;
   virtual int do_fiemap(int fd, off_t start, size_t len, struct fiemap **pfiemap) = 0;
+  virtual bool has_seek_data_hole() = 0;
+  /// map the data (non-hole) extents of fd in offset~len
+  virtual int do_seek_data_hole(int fd, uint64_t offset, uint64_t len,
+				map<uint64_t, uint64_t> *m) = 0;
   virtual int clone_range(int from, int to, uint64_t srcoff, uint64_t len, uint64_t dstoff) = 0;
   virtual int set_alloc_hint(int fd, uint64_t hint) = 0;
 
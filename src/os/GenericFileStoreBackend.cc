@@ -57,7 +57,9 @@
 GenericFileStoreBackend::GenericFileStoreBackend(FileStore *fs):
   FileStoreBackend(fs),
   ioctl_fiemap(false),
+  seek_data_hole(false),
   m_filestore_fiemap(g_conf->filestore_fiemap),
+  m_filestore_seek_data_hole(g_conf->filestore_seek_data_hole),
   m_filestore_fsync_flushes_journal_data(g_conf->filestore_fsync_flushes_journal_data) {}
 
 int GenericFileStoreBackend::detect_features()
@@ -130,6 +132,34 @@ int GenericFileStoreBackend::detect_features()
     ioctl_fiemap = false;
   }
 
+  // the layout above starts with a hole up to 0x16000, then has data
+  // through 0x1d000.  the data is still dirty in the page cache, which
+  // some kernels ignore when looking for data.
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  {
+    off_t data = ::lseek(fd, 0, SEEK_DATA);
+    off_t hole = data < 0 ? data : ::lseek(fd, data, SEEK_HOLE);
+    if (data < 0 || hole < 0) {
+      dout(0) << "detect_features: SEEK_DATA/SEEK_HOLE is NOT supported" << dendl;
+      seek_data_hole = false;
+    } else if (data == 0 || data > 0x16000 || hole < 0x1d000 || hole > 0x4a000) {
+      dout(0) << "detect_features: SEEK_DATA/SEEK_HOLE is supported, but does not report holes"
+	      << " (data at " << data << ", hole at " << hole << ")" << dendl;
+      seek_data_hole = false;
+    } else {
+      dout(0) << "detect_features: SEEK_DATA/SEEK_HOLE is supported and appears to work" << dendl;
+      seek_data_hole = true;
+    }
+  }
+#else
+  dout(0) << "detect_features: SEEK_DATA/SEEK_HOLE is not available at build time" << dendl;
+  seek_data_hole = false;
+#endif
+  if (!m_filestore_seek_data_hole) {
+    dout(0) << "detect_features: SEEK_DATA/SEEK_HOLE is disabled via 'filestore seek data hole' config option" << dendl;
+    seek_data_hole = false;
+  }
+
   ::unlink(fn);
   VOID_TEMP_FAILURE_RETRY(::close(fd));
 
@@ -262,6 +292,40 @@ done_err:
   return ret;
 }
 
+int GenericFileStoreBackend::do_seek_data_hole(int fd, uint64_t offset,
+					       uint64_t len,
+					       map<uint64_t, uint64_t> *m)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  uint64_t end = offset + len;
+  uint64_t pos = offset;
+  while (pos < end) {
+    off64_t data = ::lseek64(fd, pos, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO)   // no data past pos
+	break;
+      return -errno;
+    }
+    if ((uint64_t)data >= end)
+      break;
+    off64_t hole = ::lseek64(fd, data, SEEK_HOLE);
+    if (hole < 0) {
+      if (errno != ENXIO)
+	return -errno;
+      hole = end;  // truncated under us; take the rest
+    }
+    uint64_t extent_end = MIN((uint64_t)hole, end);
+    if (extent_end <= (uint64_t)data)
+      break;
+    (*m)[data] = extent_end - data;
+    pos = extent_end;
+  }
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
 
 int GenericFileStoreBackend::_crc_load_or_init(int fd, SloppyCRCMap *cm)
 {
@@ -26,6 +26,7 @@
 #include <errno.h>
 
 #include "GenericObjectMap.h"
+#include "DBObjectMap.h"
 #include "common/debug.h"
 #include "common/config.h"
 #include "include/assert.h"
@@ -44,6 +45,27 @@ const string GenericObjectMap::PARENT_KEY = "_PARENT_HEADER_";
 const string GenericObjectMap::GHOBJECT_KEY_SEP_S = "!";
 const char GenericObjectMap::GHOBJECT_KEY_SEP_C = '!';
 
+// Applies every update to two transactions
+class TeeTransactionImpl : public KeyValueDB::TransactionImpl {
+  KeyValueDB::Transaction a, b;
+
+public:
+  TeeTransactionImpl(KeyValueDB::Transaction a, KeyValueDB::Transaction b)
+    : a(a), b(b) {}
+  void set(const string &prefix, const string &k, const bufferlist &bl) {
+    a->set(prefix, k, bl);
+    b->set(prefix, k, bl);
+  }
+  void rmkey(const string &prefix, const string &k) {
+    a->rmkey(prefix, k);
+    b->rmkey(prefix, k);
+  }
+  void rmkeys_by_prefix(const string &prefix) {
+    a->rmkeys_by_prefix(prefix);
+    b->rmkeys_by_prefix(prefix);
+  }
+};
+
 // ============== GenericObjectMap Key Function =================
 
 static void append_escaped(const string &in, string *out)
@@ -319,6 +341,30 @@ ObjectMap::ObjectMapIterator GenericObjectMap::get_iterator(
   return _get_iterator(header, prefix);
 }
 
+void GenericObjectMap::get_values_batch(const coll_t &cid,
+                                        vector<ObjectMap::OmapRead> &reads,
+                                        const string &prefix)
+{
+  // one iterator, and one view of the store, for the whole batch
+  DBObjectMap::RangeReader reader(db->get_snapshot_iterator());
+  for (vector<ObjectMap::OmapRead>::iterator p = reads.begin();
+       p != reads.end(); ++p) {
+    Header header = lookup_header(cid, p->oid);
+    if (!header) {
+      p->r = 0;
+      continue;
+    }
+    if (header->parent) {
+      // keys may come from the parent, which the iterator sorts out
+      p->r = ObjectMap::read_range(_get_iterator(header, prefix), &*p);
+    } else {
+      p->r = reader.read(user_prefix(header, prefix), &*p);
+    }
+  }
+  dout(20) << __func__ << " " << reads.size() << " reads, "
+           << reader.get_seeks() << " seeks" << dendl;
+}
+
 int GenericObjectMap::GenericObjectMapIteratorImpl::seek_to_first()
 {
   init();
@@ -614,7 +660,7 @@ int GenericObjectMap::get_keys(const coll_t &cid, const ghobject_t &oid,
     return -ENOENT;
 
   ObjectMap::ObjectMapIterator iter = _get_iterator(header, prefix);
-  for (; iter->valid(); iter->next()) {
+  for (iter->seek_to_first(); iter->valid(); iter->next()) {
     if (iter->status())
       return iter->status();
     keys->insert(iter->key());
@@ -646,9 +692,18 @@ int GenericObjectMap::check_keys(const coll_t &cid, const ghobject_t &oid,
 
 void GenericObjectMap::clone(const Header parent, const coll_t &cid,
                              const ghobject_t &target,
-                             KeyValueDB::Transaction t,
+                             KeyValueDB::Transaction op_t,
                              Header *old_header, Header *new_header)
 {
+  // Clone sets the parent header, and an rm_keys later in the same
+  // transaction will lookup_parent, which reads it from the db, so the
+  // clone has to be synced before we return.  op_t may only be recording
+  // the op's updates until the whole op commits (KeyValueStore group
+  // commit), so sync a backend transaction of our own, and keep the
+  // updates in op_t as well so that they stay ordered with the rest of
+  // the op.
+  KeyValueDB::Transaction sync_t = get_transaction();
+  KeyValueDB::Transaction t(new TeeTransactionImpl(op_t, sync_t));
   {
     Header destination = lookup_header(cid, target);
     if (destination) {
@@ -674,11 +729,7 @@ void GenericObjectMap::clone(const Header parent, const coll_t &cid,
   if (new_header)
     *new_header = destination;
 
-  // Clone will set parent header and rm_keys wll lookup_parent which will try
-  // to find parent header. So it will let lookup_parent fail when "clone" and
-  // "rm_keys" in one transaction. Here have to sync transaction to make
-  // visiable for lookup_parent
-  int r = submit_transaction_sync(t);
+  int r = submit_transaction_sync(sync_t);
   assert(r == 0);
 }
 
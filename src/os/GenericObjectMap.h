@@ -125,6 +125,11 @@ class GenericObjectMap {
                                             const ghobject_t &oid,
                                             const string &prefix);
 
+  /// @see ObjectMap::get_values_batch
+  void get_values_batch(const coll_t &cid,
+                        vector<ObjectMap::OmapRead> &reads,
+                        const string &prefix);
+
   KeyValueDB::Transaction get_transaction() { return db->get_transaction(); }
   int submit_transaction(KeyValueDB::Transaction t) {
     return db->submit_transaction(t);
@@ -275,13 +280,14 @@ class GenericObjectMap {
   static const string GHOBJECT_KEY_SEP_S;
   static const char GHOBJECT_KEY_SEP_C;
 
-private:
-  /// Implicit lock on Header->seq
-
+  /// keys sort in ghobject_t order within a collection
   static string header_key(const coll_t &cid);
   static string header_key(const coll_t &cid, const ghobject_t &oid);
   static bool parse_header_key(const string &in, coll_t *c, ghobject_t *oid);
 
+private:
+  /// Implicit lock on Header->seq
+
   string seq_key(uint64_t seq) {
     char buf[100];
     snprintf(buf, sizeof(buf), "%.*" PRId64, (int)(2*sizeof(seq)), seq);
@@ -17,17 +17,30 @@
 #include "osd/osd_types.h"
 #include <errno.h>
 
+#include <dirent.h>
+
 #include "HashIndex.h"
+#include "IndexManager.h"
+#include "ObjectStore.h"
 
 #include "common/debug.h"
+#include "common/errno.h"
+#include "common/Clock.h"
 #define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "HashIndex(" << get_base_path() << ") "
 
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
+const string HashIndex::STAGING_DIR = ".split";
 
 int HashIndex::cleanup() {
+  // a split that was still being staged is simply redone later
+  int r = remove_staging();
+  if (r < 0)
+    return r;
   bufferlist bl;
-  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
   if (r < 0) {
     // No in progress operations!
     return 0;
@@ -230,6 +243,10 @@ int HashIndex::_split(
   uint32_t bits,
   CollectionIndex* dest) {
   assert(collection_version() == dest->collection_version());
+  // staged links would go stale as objects and subdirs move between
+  // collections; the split is requeued by the next create if needed
+  abort_async_split();
+  static_cast<HashIndex*>(dest)->abort_async_split();
   unsigned mkdirred = 0;
   return col_split_level(
     *this,
@@ -261,6 +278,10 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    if (async_split && !async_split->aborted && async_split->path == path)
+      return 0; // already being split, picked up at the switch-over
+    if (queue_async_op(InProgressOp::SPLIT, path))
+      return 0;
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -286,6 +307,8 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (queue_async_op(InProgressOp::MERGE, path))
+      return 0;
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -341,9 +364,439 @@ int HashIndex::_collection_list_partial(const ghobject_t &start,
 }
 
 int HashIndex::prep_delete() {
+  abort_async_split();
+  async_ops.clear();
   return recursive_remove(vector<string>());
 }
 
+int HashIndex::get_index_links(ino_t ino) {
+  if (async_split && async_split->inos.count(ino))
+    return 1;
+  return 0;
+}
+
+bool HashIndex::queue_async_op(int op, const vector<string> &path) {
+  // older layouts keep object info in a different place, split those inline
+  if (!manager || index_version != HOBJECT_WITH_POOL)
+    return false;
+  bool found = false;
+  for (list<InProgressOp>::iterator i = async_ops.begin();
+       i != async_ops.end();
+       ++i) {
+    if (i->op == op && i->path == path) {
+      found = true;
+      break;
+    }
+  }
+  if (!found)
+    async_ops.push_back(InProgressOp(op, path));
+  if (!manager->queue_split(this)) {
+    if (!found)
+      async_ops.pop_back();
+    return false;
+  }
+  return true;
+}
+
+void HashIndex::run_async_ops(PerfCounters *logger) {
+  while (!manager->split_stopping()) {
+    InProgressOp op(InProgressOp::SPLIT, vector<string>());
+    {
+      RWLock::WLocker l(access_lock);
+      if (async_ops.empty())
+	return;
+      op = async_ops.front();
+      async_ops.pop_front();
+      if (op.is_merge()) {
+	// merges only move a handful of objects, just do it
+	int r = async_merge(op.path);
+	if (r < 0)
+	  derr << __func__ << " merge of " << op.path << " failed: "
+	       << cpp_strerror(r) << dendl;
+	else if (logger)
+	  logger->inc(l_os_index_merges);
+	continue;
+      }
+    }
+    int r = async_split_path(op.path, logger);
+    if (r < 0)
+      derr << __func__ << " split of " << op.path << " failed: "
+	   << cpp_strerror(r) << dendl;
+  }
+}
+
+int HashIndex::async_merge(const vector<string> &path) {
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r == -ENOENT)
+    return 0; // merged away or moved by a collection split
+  if (r < 0)
+    return r;
+  if (!must_merge(info))
+    return 0;
+  r = initiate_merge(path, info);
+  if (r < 0)
+    return r;
+  return complete_merge(path, info);
+}
+
+int HashIndex::async_split_path(const vector<string> &path,
+				PerfCounters *logger) {
+  HashIndex stage(coll(), get_staging_path().c_str(),
+		  merge_threshold, split_multiplier, index_version);
+  AsyncSplit *s = NULL;
+  int r = prepare_async_split(path, stage, &s);
+  if (r < 0)
+    return r;
+
+  if (r > 0) {
+    // a partial layout already exists; rare enough to just split inline
+    RWLock::WLocker l(access_lock);
+    utime_t start = ceph_clock_now(NULL);
+    subdir_info_s info;
+    r = get_info(path, &info);
+    if (r < 0)
+      return r == -ENOENT ? 0 : r;
+    if (!must_split(info))
+      return 0;
+    r = initiate_split(path, info);
+    if (r < 0)
+      return r;
+    r = complete_split(path, info);
+    if (r < 0)
+      return r;
+    if (logger) {
+      logger->inc(l_os_index_splits);
+      logger->tinc(l_os_index_split_stall_lat, ceph_clock_now(NULL) - start);
+    }
+    return 0;
+  }
+  if (!s)
+    return 0;
+
+  int batch = MAX(g_conf->filestore_index_async_split_batch, 1);
+  do {
+    r = stage_async_split(stage, s, batch, logger);
+  } while (r > 0 && !manager->split_stopping());
+  if (r == 0)
+    r = sync_async_split(stage, s);
+  bool finish = r == 0 && !manager->split_stopping();
+  int rc = complete_async_split(stage, s, finish, logger);
+  return r < 0 ? r : rc;
+}
+
+int HashIndex::prepare_async_split(const vector<string> &path,
+				   HashIndex &stage,
+				   AsyncSplit **ps) {
+  RWLock::RLocker l(access_lock);
+  unsigned level = path.size();
+  *ps = NULL;
+
+  // snapshot the directory and lay out the new subdirs in the staging area
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r == -ENOENT)
+    return 0;
+  if (r < 0)
+    return r;
+  if (!must_split(info))
+    return 0;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  if (!subdirs.empty())
+    return 1;
+
+  AsyncSplit *s = new AsyncSplit(path);
+  r = list_objects_ino(path, NULL, &s->objects);
+  if (r < 0) {
+    delete s;
+    return r;
+  }
+  map<string, unsigned> counts;
+  for (map<string, pair<ghobject_t, ino_t> >::iterator i = s->objects.begin();
+       i != s->objects.end();
+       ++i) {
+    vector<string> comp;
+    get_path_components(i->second.first, &comp);
+    counts[comp[level]]++;
+  }
+  for (map<string, unsigned>::iterator i = counts.begin();
+       i != counts.end();
+       ++i) {
+    subdir_info_s info_new;
+    info_new.objs = i->second;
+    info_new.hash_level = level + 1;
+    if (!must_merge(info_new))
+      s->subdirs.insert(i->first);
+  }
+  if (s->subdirs.empty()) {
+    delete s;
+    return 0;
+  }
+
+  r = remove_staging();
+  if (r >= 0) {
+    r = ::mkdir(stage.get_base_path().c_str(), 0777);
+    if (r < 0)
+      r = -errno;
+  }
+  for (unsigned i = 1; r >= 0 && i <= level; ++i)
+    r = stage.create_path(vector<string>(path.begin(), path.begin() + i));
+  for (set<string>::iterator i = s->subdirs.begin();
+       r >= 0 && i != s->subdirs.end();
+       ++i) {
+    vector<string> dst(path);
+    dst.push_back(*i);
+    r = stage.create_path(dst);
+  }
+  if (r < 0) {
+    delete s;
+    remove_staging();
+    return r;
+  }
+  s->next = s->objects.begin();
+  assert(!async_split);
+  async_split = s;
+  *ps = s;
+  dout(10) << __func__ << " staging split of " << path << " ("
+	   << s->objects.size() << " objects) into " << s->subdirs << dendl;
+  return 0;
+}
+
+int HashIndex::stage_async_split(HashIndex &stage, AsyncSplit *s, int batch,
+				 PerfCounters *logger) {
+  // holding access_lock for read keeps unlinks (which consult
+  // get_index_links) from racing with us while still allowing lookups
+  RWLock::RLocker l(access_lock);
+  const vector<string> &path = s->path;
+  unsigned level = path.size();
+  if (s->aborted)
+    return 0;
+  for (int n = 0; n < batch && s->next != s->objects.end(); ++n, ++s->next) {
+    vector<string> comp;
+    get_path_components(s->next->second.first, &comp);
+    if (!s->subdirs.count(comp[level]))
+      continue;
+    vector<string> dst(path);
+    dst.push_back(comp[level]);
+    string to_name;
+    ino_t ino;
+    int r = link_object(*this, stage, path, dst,
+			make_pair(s->next->first, s->next->second.first),
+			&to_name, &ino);
+    if (r == -ENOENT)
+      continue; // removed since we listed it, caught up when finishing
+    if (r < 0)
+      return r;
+    s->staged[comp[level]][to_name] = make_pair(s->next->second.first, ino);
+    s->inos.insert(ino);
+    if (logger)
+      logger->inc(l_os_index_split_objects);
+  }
+  return s->next == s->objects.end() ? 0 : 1;
+}
+
+int HashIndex::sync_async_split(HashIndex &stage, AsyncSplit *s) {
+  if (s->aborted)
+    return 0;
+  for (set<string>::iterator i = s->subdirs.begin();
+       i != s->subdirs.end();
+       ++i) {
+    vector<string> dst(s->path);
+    dst.push_back(*i);
+    int r = stage.fsync_dir(dst);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int HashIndex::complete_async_split(HashIndex &stage, AsyncSplit *s,
+				    bool finish, PerfCounters *logger) {
+  RWLock::WLocker l(access_lock);
+  int r = 0;
+  if (finish && !s->aborted) {
+    utime_t start = ceph_clock_now(NULL);
+    r = finish_async_split(stage, s);
+    utime_t lat = ceph_clock_now(NULL) - start;
+    dout(10) << __func__ << " split of " << s->path << " finished, r = " << r
+	     << ", collection was blocked for " << lat << dendl;
+    if (r >= 0 && logger) {
+      logger->inc(l_os_index_splits);
+      logger->tinc(l_os_index_split_stall_lat, lat);
+    }
+  } else {
+    dout(10) << __func__ << " abandoning split of " << s->path << dendl;
+  }
+  if (!s->aborted)
+    remove_staging();
+  assert(async_split == s);
+  delete s;
+  async_split = NULL;
+  return r;
+}
+
+int HashIndex::finish_async_split(HashIndex &stage, AsyncSplit *s) {
+  const vector<string> &path = s->path;
+  unsigned level = path.size();
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r == -ENOENT ? 0 : r;  // path went away under us
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  if (!subdirs.empty())
+    return 0;
+
+  // catch up with creates and removes made while we were staging
+  map<string, pair<ghobject_t, ino_t> > objects;
+  r = list_objects_ino(path, &s->objects, &objects);
+  if (r < 0)
+    return r;
+  map<string, map<ino_t, pair<string, ghobject_t> > > want;
+  map<string, ghobject_t> moved, remaining;
+  for (map<string, pair<ghobject_t, ino_t> >::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> comp;
+    get_path_components(i->second.first, &comp);
+    if (s->subdirs.count(comp[level])) {
+      want[comp[level]][i->second.second] =
+	make_pair(i->first, i->second.first);
+      moved[i->first] = i->second.first;
+    } else {
+      remaining[i->first] = i->second.first;
+    }
+  }
+
+  for (set<string>::iterator sub = s->subdirs.begin();
+       sub != s->subdirs.end();
+       ++sub) {
+    vector<string> dst(path);
+    dst.push_back(*sub);
+    map<ino_t, pair<string, ghobject_t> > &w = want[*sub];
+    map<string, pair<ghobject_t, ino_t> > &staged = s->staged[*sub];
+    set<ino_t> have;
+    for (map<string, pair<ghobject_t, ino_t> >::iterator i = staged.begin();
+	 i != staged.end();
+	 ++i) {
+      if (w.count(i->second.second)) {
+	have.insert(i->second.second);
+	continue;
+      }
+      r = stage.remove_object(dst, i->second.first);
+      if (r < 0 && r != -ENOENT)
+	return r;
+    }
+    for (map<ino_t, pair<string, ghobject_t> >::iterator i = w.begin();
+	 i != w.end();
+	 ++i) {
+      if (have.count(i->first))
+	continue;
+      string to_name;
+      ino_t ino;
+      r = link_object(*this, stage, path, dst, i->second, &to_name, &ino);
+      if (r < 0)
+	return r;
+    }
+    // presence of info implies that all objects have been linked
+    subdir_info_s info_new;
+    info_new.objs = w.size();
+    info_new.hash_level = level + 1;
+    r = stage.set_info(dst, info_new);
+    if (r < 0)
+      return r;
+    r = stage.fsync_dir(dst);
+    if (r < 0)
+      return r;
+  }
+
+  // from here on an interrupted split is completed by cleanup()
+  r = start_split(path);
+  if (r < 0)
+    return r;
+  for (set<string>::iterator sub = s->subdirs.begin();
+       sub != s->subdirs.end();
+       ++sub) {
+    vector<string> dst(path);
+    dst.push_back(*sub);
+    r = ::rename(stage.get_full_path_subdir(dst).c_str(),
+		 get_full_path_subdir(dst).c_str());
+    if (r < 0)
+      return -errno;
+  }
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  r = remove_objects(path, moved, &remaining);
+  if (r < 0)
+    return r;
+  r = reset_attr(path);
+  if (r < 0)
+    return r;
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  return end_split_or_merge(path);
+}
+
+void HashIndex::abort_async_split() {
+  if (!async_split || async_split->aborted)
+    return;
+  // the split thread is between batches; it notices the flag and
+  // releases the state itself
+  dout(10) << __func__ << " " << async_split->path << dendl;
+  async_split->aborted = true;
+  async_split->inos.clear();
+  int r = remove_staging();
+  if (r < 0)
+    derr << __func__ << " failed to remove staging dir: "
+	 << cpp_strerror(r) << dendl;
+}
+
+static int remove_tree(const string &dir_path) {
+  DIR *dir = ::opendir(dir_path.c_str());
+  if (!dir)
+    return errno == ENOENT ? 0 : -errno;
+  char buf[offsetof(struct dirent, d_name) + PATH_MAX + 1];
+  struct dirent *de;
+  int r = 0;
+  while (!::readdir_r(dir, reinterpret_cast<struct dirent*>(buf), &de)) {
+    if (!de)
+      break;
+    string name(de->d_name);
+    if (name == "." || name == "..")
+      continue;
+    string child = dir_path + "/" + name;
+    struct stat st;
+    r = ::lstat(child.c_str(), &st);
+    if (r < 0) {
+      r = -errno;
+      break;
+    }
+    if (S_ISDIR(st.st_mode))
+      r = remove_tree(child);
+    else if (::unlink(child.c_str()) < 0)
+      r = -errno;
+    if (r < 0)
+      break;
+  }
+  ::closedir(dir);
+  if (r < 0)
+    return r;
+  if (::rmdir(dir_path.c_str()) < 0)
+    return -errno;
+  return 0;
+}
+
+int HashIndex::remove_staging() {
+  return remove_tree(get_staging_path());
+}
+
 int HashIndex::_pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs) {
   int ret;
   vector<string> path;
@@ -17,8 +17,11 @@
 
 #include "include/buffer.h"
 #include "include/encoding.h"
+#include "common/perf_counters.h"
 #include "LFNIndex.h"
 
+class IndexManager;
+
 
 /**
  * Implements collection prehashing.
@@ -45,6 +48,17 @@
  * Subdirectories are created when the number of objects in a directory
  * exceed (abs(merge_threshhold)) * 16 * split_multiplier.  The number of objects in a directory 
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * When attached to an IndexManager, splits and merges are not done in
+ * the op path.  They are queued and carried out by the manager's split
+ * thread (see run_async_ops).  A split first hard links the objects
+ * into the new subdirectories under a hidden staging directory
+ * (STAGING_DIR) while lookups and creates continue to use the old
+ * directory, then takes access_lock for write just long enough to
+ * catch up with changes made in the meantime, write the usual
+ * in-progress split tag and rename the staged subdirectories into
+ * place.  An interrupted switch-over is completed by cleanup() like
+ * any other split; an interrupted staging pass is simply discarded.
  */
 class HashIndex : public LFNIndex {
 private:
@@ -52,6 +66,8 @@ private:
   static const string SUBDIR_ATTR;
   /// Attribute name for storing in progress op tag
   static const string IN_PROGRESS_OP_TAG;
+  /// Directory (under the collection root) in which splits are staged
+  static const string STAGING_DIR;
   /// Size (bits) in object hash
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
@@ -128,8 +144,38 @@ private:
       ::decode(path, bl);
     }
   };
-    
-    
+
+  /// Set when splits and merges are deferred to the IndexManager
+  IndexManager *manager;
+
+  /// Queued splits and merges, protected by access_lock
+  list<InProgressOp> async_ops;
+
+protected:
+  /// A split being staged by the split thread
+  struct AsyncSplit {
+    vector<string> path;     ///< directory being split
+    set<string> subdirs;     ///< new subdirs being staged
+    /// objects in path at the start of staging: filename -> (oid, inode)
+    map<string, pair<ghobject_t, ino_t> > objects;
+    /// next entry of objects to stage
+    map<string, pair<ghobject_t, ino_t> >::iterator next;
+    /// staged subdir -> staged filename -> (oid, inode)
+    map<string, map<string, pair<ghobject_t, ino_t> > > staged;
+    set<ino_t> inos;         ///< inodes linked into the staging area
+    bool aborted;            ///< staging area was removed underneath us
+
+    AsyncSplit(const vector<string> &path) : path(path), aborted(false) {}
+  };
+
+private:
+  /**
+   * Split in progress, if any.  Modified by the split thread with
+   * access_lock held for read, and by anyone else only with access_lock
+   * held for write.
+   */
+  AsyncSplit *async_split;
+
 public:
   /// Constructor.
   HashIndex(
@@ -141,7 +187,29 @@ public:
     double retry_probability=0) ///< [in] retry probability
     : LFNIndex(collection, base_path, index_version, retry_probability),
       merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple),
+      manager(NULL),
+      async_split(NULL) {}
+
+  ~HashIndex() {
+    delete async_split;
+  }
+
+  /// Defer splits and merges to manager's split thread
+  void set_manager(IndexManager *m) {
+    manager = m;
+  }
+
+  /**
+   * Run queued splits and merges
+   *
+   * Called from the IndexManager split thread without access_lock held.
+   * Returns early, discarding a partially staged split, if the manager
+   * is stopping.
+   */
+  void run_async_ops(
+    PerfCounters *logger ///< [in] FileStore counters, may be NULL
+    );
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
@@ -152,6 +220,9 @@ public:
   /// @see CollectionIndex
   int prep_delete();
 
+  /// @see CollectionIndex
+  int get_index_links(ino_t ino);
+
   /// @see CollectionIndex
   int _split(
     uint32_t match,
@@ -199,6 +270,47 @@ protected:
     vector<ghobject_t> *ls,
     ghobject_t *next
     );
+
+  /**
+   * The steps of async_split_path, each taking access_lock itself
+   *
+   * prepare_async_split lays out the new subdirs under STAGING_DIR,
+   * stage_async_split links the next batch of objects into them,
+   * sync_async_split makes the staged subdirs stable and
+   * complete_async_split switches them into place (or, if finish is
+   * false, throws them away) and releases s.
+   */
+  int prepare_async_split(
+    const vector<string> &path, ///< [in] path to split
+    HashIndex &stage,           ///< [in] index rooted at STAGING_DIR
+    AsyncSplit **s              ///< [out] split to stage, NULL if none
+    ); ///< @return 1 if path must be split inline, else Error Code
+  int stage_async_split(
+    HashIndex &stage,           ///< [in] index rooted at STAGING_DIR
+    AsyncSplit *s,              ///< [in] split being staged
+    int batch,                  ///< [in] max objects to link
+    PerfCounters *logger        ///< [in] counters, may be NULL
+    ); ///< @return 1 if more objects remain, else Error Code
+  int sync_async_split(
+    HashIndex &stage,           ///< [in] index rooted at STAGING_DIR
+    AsyncSplit *s               ///< [in] staged split
+    ); ///< @return Error Code, 0 on success
+  int complete_async_split(
+    HashIndex &stage,           ///< [in] index rooted at STAGING_DIR
+    AsyncSplit *s,              ///< [in] staged split, freed
+    bool finish,                ///< [in] false to abandon the split
+    PerfCounters *logger        ///< [in] counters, may be NULL
+    ); ///< @return Error Code, 0 on success
+
+  /// Path of STAGING_DIR
+  string get_staging_path() {
+    return get_base_path() + "/" + STAGING_DIR;
+  }
+
+  /// Tag root directory at beginning of split
+  int start_split(
+    const vector<string> &path ///< [in] path to split
+    ); ///< @return Error Code, 0 on success
 private:
   /// Recursively remove path and its subdirs
   int recursive_remove(
@@ -209,10 +321,6 @@ private:
     const vector<string> &path ///< [in] path to split
     ); ///< @return Error Code, 0 on success
   /// Tag root directory at beginning of split
-  int start_split(
-    const vector<string> &path ///< [in] path to split
-    ); ///< @return Error Code, 0 on success
-  /// Tag root directory at beginning of split
   int start_merge(
     const vector<string> &path ///< [in] path to merge
     ); ///< @return Error Code, 0 on success
@@ -285,6 +393,35 @@ private:
   /// level and number of its subdirs.
   int init_split_folder(vector<string> &path, uint32_t hash_level);
 
+  /// Queue op on path for the split thread
+  bool queue_async_op(
+    int op,                    ///< [in] InProgressOp::SPLIT or MERGE
+    const vector<string> &path ///< [in] path to split or merge
+    ); ///< @return False if ops cannot be deferred, true if queued
+
+  /// Merge path if it still needs it, access_lock must be held for write
+  int async_merge(
+    const vector<string> &path ///< [in] path to merge
+    ); ///< @return Error Code, 0 on success
+
+  /// Split path if it still needs it, without blocking the collection
+  int async_split_path(
+    const vector<string> &path, ///< [in] path to split
+    PerfCounters *logger        ///< [in] counters, may be NULL
+    ); ///< @return Error Code, 0 on success
+
+  /// Catch up the staged split and rename it into place
+  int finish_async_split(
+    HashIndex &stage,           ///< [in] index rooted at STAGING_DIR
+    AsyncSplit *s               ///< [in] staged split
+    ); ///< @return Error Code, 0 on success
+
+  /// Drop an in-progress async split, access_lock must be held for write
+  void abort_async_split();
+
+  /// Remove STAGING_DIR and everything below it
+  int remove_staging();
+
   /// do collection split for path
   static int col_split_level(
     HashIndex &from,            ///< [in] from index
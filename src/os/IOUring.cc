@@ -0,0 +1,269 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include "IOUring.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/assert.h"
+
+#ifdef HAVE_LIBURING
+# include <liburing.h>
+#endif
+
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "io_uring "
+
+struct IOUringSet::Ring {
+#ifdef HAVE_LIBURING
+  struct io_uring ring;
+#endif
+  bool dead;  ///< could not be reset after a failed submit; pwrite only
+  /// buffers and iovecs of writes whose completions were lost; the
+  /// kernel may still be reading them
+  std::list<bufferlist> pinned;
+  std::list<std::vector<iovec> > pinned_iov;
+  Ring() : dead(false) {}
+};
+
+IOUringSet::IOUringSet()
+  : lock("IOUringSet::lock"),
+    depth(0)
+{}
+
+IOUringSet::~IOUringSet()
+{
+  shutdown();
+}
+
+int IOUringSet::init(unsigned nr, unsigned d)
+{
+  assert(rings.empty());
+#ifdef HAVE_LIBURING
+  depth = d;
+  for (unsigned i = 0; i < nr; ++i) {
+    Ring *r = new Ring;
+    int ret = io_uring_queue_init(depth, &r->ring, 0);
+    if (ret < 0) {
+      derr << "io_uring_queue_init failed: " << cpp_strerror(ret) << dendl;
+      delete r;
+      shutdown();
+      return ret;
+    }
+    rings.push_back(r);
+    free_rings.push_back(r);
+  }
+  dout(1) << "init " << nr << " rings of depth " << depth << dendl;
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
+void IOUringSet::shutdown()
+{
+  Mutex::Locker l(lock);
+  assert(free_rings.size() == rings.size());
+  for (std::vector<Ring*>::iterator p = rings.begin(); p != rings.end(); ++p) {
+#ifdef HAVE_LIBURING
+    if (!(*p)->dead)
+      io_uring_queue_exit(&(*p)->ring);
+#endif
+    delete *p;
+  }
+  rings.clear();
+  free_rings.clear();
+}
+
+IOUringSet::Ring *IOUringSet::get_ring()
+{
+  Mutex::Locker l(lock);
+  while (free_rings.empty())
+    cond.Wait(lock);
+  Ring *r = free_rings.front();
+  free_rings.pop_front();
+  return r;
+}
+
+void IOUringSet::put_ring(Ring *r)
+{
+  Mutex::Locker l(lock);
+  free_rings.push_back(r);
+  cond.Signal();
+}
+
+int IOUringSet::write(std::vector<write_t>& writes)
+{
+  if (writes.empty())
+    return 0;
+  Ring *ring = get_ring();
+  do_write(ring, writes);
+  put_ring(ring);
+
+  for (std::vector<write_t>::iterator p = writes.begin();
+       p != writes.end();
+       ++p)
+    if (p->r < 0)
+      return p->r;
+  return 0;
+}
+
+#ifdef HAVE_LIBURING
+namespace {
+  /// one writev sqe: at most IOV_MAX buffers of a write_t
+  struct req_t {
+    unsigned w;
+    uint64_t offset;
+    bufferlist bl;
+    std::vector<iovec> iov;
+    bool done;  ///< completion reaped
+    req_t() : w(0), offset(0), done(false) {}
+  };
+}
+#endif
+
+void IOUringSet::do_write(Ring *ring, std::vector<write_t>& writes)
+{
+#ifdef HAVE_LIBURING
+  std::vector<req_t> reqs;
+  for (unsigned w = 0; w < writes.size(); ++w) {
+    const std::list<bufferptr>& buffers = writes[w].bl.buffers();
+    uint64_t off = writes[w].offset;
+    for (std::list<bufferptr>::const_iterator p = buffers.begin();
+	 p != buffers.end();
+	 ++p) {
+      if (p->length() == 0)
+	continue;
+      if (reqs.empty() || reqs.back().w != w ||
+	  reqs.back().iov.size() >= IOV_MAX) {
+	reqs.push_back(req_t());
+	reqs.back().w = w;
+	reqs.back().offset = off;
+      }
+      iovec v;
+      v.iov_base = (void*)p->c_str();
+      v.iov_len = p->length();
+      reqs.back().iov.push_back(v);
+      reqs.back().bl.push_back(*p);
+      off += p->length();
+    }
+  }
+
+  // sqes are taken from the ring in order: reqs [next - unsubmitted,
+  // next) are queued but not yet accepted by the kernel
+  unsigned next = 0, unsubmitted = 0, inflight = 0;
+  bool broken = ring->dead;
+  while (inflight > 0 ||
+	 (!broken && (next < reqs.size() || unsubmitted > 0))) {
+    if (!broken) {
+      // fill the submission queue
+      while (next < reqs.size()) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ring->ring);
+	if (!sqe)
+	  break;
+	req_t &req = reqs[next++];
+	io_uring_prep_writev(sqe, writes[req.w].fd, &req.iov[0],
+			     req.iov.size(), req.offset);
+	io_uring_sqe_set_data(sqe, &req);
+	++unsubmitted;
+      }
+      if (unsubmitted > 0) {
+	// a short submit leaves the rest queued for the next round
+	int r = io_uring_submit(&ring->ring);
+	if (r >= 0) {
+	  assert((unsigned)r <= unsubmitted);
+	  unsubmitted -= r;
+	  inflight += r;
+	} else if (r == -EINTR ||
+		   ((r == -EAGAIN || r == -EBUSY) && inflight > 0)) {
+	  // retry once a completion has been reaped
+	} else {
+	  derr << "io_uring_submit failed: " << cpp_strerror(r) << dendl;
+	  broken = true;
+	}
+      }
+    }
+    if (!inflight)
+      continue;
+
+    struct io_uring_cqe *cqe;
+    int r = io_uring_wait_cqe(&ring->ring, &cqe);
+    if (r == -EINTR)
+      continue;
+    if (r < 0) {
+      derr << "io_uring_wait_cqe failed: " << cpp_strerror(r)
+	   << " with " << inflight << " writes in flight" << dendl;
+      broken = true;
+      break;
+    }
+    req_t *req = (req_t*)io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring->ring, cqe);
+    req->done = true;
+    --inflight;
+
+    write_t &w = writes[req->w];
+    if (res >= 0 && (unsigned)res < req->bl.length()) {
+      // short write; finish it synchronously
+      dout(10) << "short write " << res << " of " << req->bl.length()
+	       << " at " << req->offset << " on fd " << w.fd << dendl;
+      bufferlist rest;
+      rest.substr_of(req->bl, res, req->bl.length() - res);
+      res = rest.write_fd(w.fd, req->offset + res);
+    }
+    if (res < 0 && w.r == 0) {
+      derr << "write " << req->offset << "~" << req->bl.length()
+	   << " on fd " << w.fd << ": " << cpp_strerror(res) << dendl;
+      w.r = res;
+    }
+  }
+
+  if (broken) {
+    // the unsubmitted sqes are still in the ring and would go out with
+    // the next batch; start over with a fresh ring, and write whatever
+    // did not make it in the old way.  That includes writes whose
+    // completions we could not reap; the kernel may still be reading
+    // their buffers, so keep those for as long as the ring lives.
+    if (inflight > 0) {
+      for (unsigned i = 0; i < next - unsubmitted; ++i) {
+	if (reqs[i].done)
+	  continue;
+	ring->pinned.push_back(reqs[i].bl);
+	ring->pinned_iov.push_back(std::vector<iovec>());
+	ring->pinned_iov.back().swap(reqs[i].iov);
+      }
+    }
+    if (!ring->dead) {
+      io_uring_queue_exit(&ring->ring);
+      int r = io_uring_queue_init(depth, &ring->ring, 0);
+      if (r < 0) {
+	derr << "io_uring_queue_init failed: " << cpp_strerror(r)
+	     << ", ring falls back to pwrite" << dendl;
+	ring->dead = true;
+      }
+    }
+    for (unsigned i = 0; i < reqs.size(); ++i) {
+      if (reqs[i].done)
+	continue;
+      int rw = reqs[i].bl.write_fd(writes[reqs[i].w].fd, reqs[i].offset);
+      if (rw < 0 && writes[reqs[i].w].r == 0)
+	writes[reqs[i].w].r = rw;
+    }
+  }
+#else
+  assert(0 == "io_uring support not built");
+#endif
+}
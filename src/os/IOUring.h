@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_IOURING_H
+#define CEPH_OS_IOURING_H
+
+#include <list>
+#include <vector>
+
+#include "acconfig.h"
+#include "include/buffer.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+
+/**
+ * A small set of io_uring instances for submitting a batch of
+ * positional writes at once and waiting for all of them.
+ *
+ * A caller owns a whole ring for the duration of its batch, so the
+ * submission and completion queues need no locking; with fewer rings
+ * than callers the extra callers wait for one to come free.
+ *
+ * Without liburing, or on a kernel without io_uring, init() fails and
+ * the caller is expected to stick to plain pwrite.
+ */
+class IOUringSet {
+public:
+  struct write_t {
+    int fd;
+    uint64_t offset;
+    bufferlist bl;
+    int r;          ///< 0 or -errno once written
+
+    write_t(int f, uint64_t o, const bufferlist& b)
+      : fd(f), offset(o), bl(b), r(0) {}
+  };
+
+private:
+  struct Ring;
+
+  Mutex lock;
+  Cond cond;
+  std::vector<Ring*> rings;
+  std::list<Ring*> free_rings;
+  unsigned depth;
+
+  Ring *get_ring();
+  void put_ring(Ring *ring);
+  void do_write(Ring *ring, std::vector<write_t>& writes);
+
+public:
+  IOUringSet();
+  ~IOUringSet();
+
+  /// set up nr rings of the given queue depth; -EOPNOTSUPP if unavailable
+  int init(unsigned nr, unsigned depth);
+  void shutdown();
+
+  bool is_enabled() const {
+    return !rings.empty();
+  }
+
+  /// write all entries, setting each one's r; returns the first error
+  int write(std::vector<write_t>& writes);
+};
+
+#endif
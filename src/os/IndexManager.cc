@@ -28,12 +28,17 @@
 #include "include/buffer.h"
 
 #include "IndexManager.h"
+#include "ObjectStore.h"
 #include "FlatIndex.h"
 #include "HashIndex.h"
 #include "CollectionIndex.h"
 
 #include "chain_xattr.h"
 
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "IndexManager "
+
 static int set_version(const char *path, uint32_t version) {
   bufferlist bl;
   ::encode(version, bl);
@@ -62,6 +67,7 @@ static int get_version(const char *path, uint32_t *version) {
 }
 
 IndexManager::~IndexManager() {
+  assert(!split_started);
 
   for (map<coll_t, CollectionIndex* > ::iterator it = col_indices.begin(); 
        it != col_indices.end(); ++it) {
@@ -103,8 +109,12 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
     case CollectionIndex::HASH_INDEX_TAG_2: // fall through
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
-      *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version);
+      HashIndex *hindex = new HashIndex(c, path,
+					g_conf->filestore_merge_threshold,
+					g_conf->filestore_split_multiple,
+					version);
+      hindex->set_manager(this);
+      *index = hindex;
       return 0;
     }
     default: assert(0);
@@ -112,10 +122,13 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
 
   } else {
     // No need to check
-    *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL,
-				 g_conf->filestore_index_retry_probability);
+    HashIndex *hindex = new HashIndex(c, path,
+				      g_conf->filestore_merge_threshold,
+				      g_conf->filestore_split_multiple,
+				      CollectionIndex::HOBJECT_WITH_POOL,
+				      g_conf->filestore_index_retry_probability);
+    hindex->set_manager(this);
+    *index = hindex;
     return 0;
   }
 }
@@ -138,3 +151,74 @@ int IndexManager::get_index(coll_t c, const string& baseDir, Index *index) {
   }
   return 0;
 }
+
+void IndexManager::start_split_thread(PerfCounters *counters)
+{
+  if (!g_conf->filestore_index_async_split)
+    return;
+  Mutex::Locker l(split_lock);
+  assert(!split_started);
+  logger = counters;
+  split_stop = false;
+  split_started = true;
+  split_thread.create();
+}
+
+void IndexManager::stop_split_thread()
+{
+  {
+    Mutex::Locker l(split_lock);
+    if (!split_started)
+      return;
+    split_stop = true;
+    split_cond.Signal();
+  }
+  split_thread.join();
+  Mutex::Locker l(split_lock);
+  split_started = false;
+  split_queue.clear();
+  split_queued.clear();
+  if (logger)
+    logger->set(l_os_index_split_pending, 0);
+}
+
+bool IndexManager::queue_split(HashIndex *index)
+{
+  Mutex::Locker l(split_lock);
+  if (!split_started || split_stop)
+    return false;
+  if (split_queued.insert(index).second) {
+    split_queue.push_back(index);
+    if (logger)
+      logger->set(l_os_index_split_pending, split_queue.size());
+    split_cond.Signal();
+  }
+  return true;
+}
+
+bool IndexManager::split_stopping()
+{
+  Mutex::Locker l(split_lock);
+  return split_stop;
+}
+
+void IndexManager::split_entry()
+{
+  split_lock.Lock();
+  while (!split_stop) {
+    if (split_queue.empty()) {
+      split_cond.Wait(split_lock);
+      continue;
+    }
+    HashIndex *index = split_queue.front();
+    split_queue.pop_front();
+    split_queued.erase(index);
+    if (logger)
+      logger->set(l_os_index_split_pending, split_queue.size());
+    split_lock.Unlock();
+    dout(20) << __func__ << " running ops on " << index->coll() << dendl;
+    index->run_async_ops(logger);
+    split_lock.Lock();
+  }
+  split_lock.Unlock();
+}
@@ -19,8 +19,10 @@
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/config.h"
 #include "common/debug.h"
+#include "common/perf_counters.h"
 
 #include "CollectionIndex.h"
 #include "HashIndex.h"
@@ -66,10 +68,35 @@ class IndexManager {
    * @return error code
    */
   int build_index(coll_t c, const char *path, CollectionIndex **index);
+
+  /// Runs deferred HashIndex splits and merges
+  class SplitThread : public Thread {
+    IndexManager *im;
+  public:
+    SplitThread(IndexManager *im) : im(im) {}
+    void *entry() {
+      im->split_entry();
+      return 0;
+    }
+  } split_thread;
+  Mutex split_lock;            ///< protects the members below
+  Cond split_cond;
+  bool split_started;
+  bool split_stop;
+  list<HashIndex*> split_queue; ///< indexes with queued ops
+  set<HashIndex*> split_queued; ///< members of split_queue
+  PerfCounters *logger;
+
+  void split_entry();
 public:
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade),
+			       split_thread(this),
+			       split_lock("IndexManager::split_lock"),
+			       split_started(false),
+			       split_stop(false),
+			       logger(NULL) {}
 
   ~IndexManager();
 
@@ -92,6 +119,30 @@ public:
    * @return error code
    */
   int init_index(coll_t c, const char *path, uint32_t filestore_version);
+
+  /**
+   * Start running HashIndex splits and merges in the background
+   *
+   * Until this is called (and after stop_split_thread) they are done
+   * inline.  A no-op unless filestore_index_async_split is set.
+   *
+   * @param [in] logger FileStore perf counters to update
+   */
+  void start_split_thread(PerfCounters *logger);
+
+  /// Stop the split thread, discarding any partially staged split
+  void stop_split_thread();
+
+  /**
+   * Queue index for the split thread
+   *
+   * @param [in] index Index with queued ops
+   * @return false if the split thread is not running
+   */
+  bool queue_split(HashIndex *index);
+
+  /// True once stop_split_thread has been called
+  bool split_stopping();
 };
 
 #endif
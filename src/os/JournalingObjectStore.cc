@@ -4,12 +4,181 @@
 
 #include "common/errno.h"
 #include "common/debug.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
 
 #define dout_subsys ceph_subsys_journal
 #undef dout_prefix
 #define dout_prefix *_dout << "journal "
 
 
+// ------------------------------------
+// parallel replay
+
+/**
+ * A journal entry and what it touches.  Two entries may be applied
+ * concurrently if neither touches an object the other does, and
+ * neither changes a collection (create, remove, split, attrs...) that
+ * the other uses.  Objects are compared without their collection: a
+ * name linked into several collections is one inode with one omap.
+ * The replay guards are per object or per collection, so applying
+ * such entries out of order with respect to each other is safe.
+ */
+struct ReplayEntry {
+  uint64_t seq;
+  list<ObjectStore::Transaction*> tls;
+  set<ghobject_t> objects;
+  set<coll_t> colls;     ///< collections holding objects we touch
+  set<coll_t> coll_ops;  ///< collections we change
+  bool barrier;          ///< unclassified op; run alone
+
+  ReplayEntry(uint64_t s) : seq(s), barrier(false) {}
+  ~ReplayEntry() {
+    while (!tls.empty()) {
+      delete tls.front();
+      tls.pop_front();
+    }
+  }
+};
+
+template <typename T>
+static bool sets_intersect(const set<T> &a, const set<T> &b)
+{
+  typename set<T>::const_iterator p = a.begin(), q = b.begin();
+  while (p != a.end() && q != b.end()) {
+    if (*p < *q)
+      ++p;
+    else if (*q < *p)
+      ++q;
+    else
+      return true;
+  }
+  return false;
+}
+
+static bool replay_conflicts(const ReplayEntry *a, const ReplayEntry *b)
+{
+  return a->barrier || b->barrier ||
+    sets_intersect(a->objects, b->objects) ||
+    sets_intersect(a->coll_ops, b->coll_ops) ||
+    sets_intersect(a->coll_ops, b->colls) ||
+    sets_intersect(a->colls, b->coll_ops);
+}
+
+/**
+ * Entries are handed over in journal order.  queue() waits until the
+ * entry conflicts with nothing still in flight, then calls
+ * op_apply_start() before a worker picks it up.  Everything started
+ * before a commit_start() is therefore a prefix of the journal, and
+ * commit_start() waits for all of it to be applied, so the committed
+ * seq never skips an entry that has not been applied.
+ */
+class JournalingObjectStore::ReplayDispatcher {
+  class Worker : public Thread {
+    ReplayDispatcher *d;
+  public:
+    Worker(ReplayDispatcher *d) : d(d) {}
+    void *entry() {
+      d->worker();
+      return 0;
+    }
+  };
+
+  JournalingObjectStore *store;
+  Mutex lock;
+  Cond work_cond, done_cond;
+  list<ReplayEntry*> queued;     ///< started, waiting for a worker
+  list<ReplayEntry*> in_flight;  ///< started, not yet applied
+  unsigned max_in_flight;
+  bool stopping;
+  vector<Worker*> workers;
+
+  void worker() {
+    lock.Lock();
+    while (true) {
+      if (queued.empty()) {
+	if (stopping)
+	  break;
+	work_cond.Wait(lock);
+	continue;
+      }
+      ReplayEntry *e = queued.front();
+      queued.pop_front();
+      lock.Unlock();
+
+      int r = store->do_transactions(e->tls, e->seq);
+      store->apply_manager.op_apply_finish(e->seq);
+      dout(3) << "journal_replay: applied op seq " << e->seq
+	      << ", r = " << r << dendl;
+
+      lock.Lock();
+      in_flight.remove(e);
+      delete e;
+      done_cond.Signal();
+    }
+    lock.Unlock();
+  }
+
+public:
+  ReplayDispatcher(JournalingObjectStore *s, int threads)
+    : store(s), lock("JOS::ReplayDispatcher::lock"),
+      max_in_flight(threads * 4), stopping(false) {
+    for (int i = 0; i < threads; ++i)
+      workers.push_back(new Worker(this));
+  }
+  ~ReplayDispatcher() {
+    assert(in_flight.empty());
+    for (vector<Worker*>::iterator p = workers.begin();
+	 p != workers.end();
+	 ++p)
+      delete *p;
+  }
+
+  void start() {
+    for (vector<Worker*>::iterator p = workers.begin();
+	 p != workers.end();
+	 ++p)
+      (*p)->create();
+  }
+
+  void queue(ReplayEntry *e) {
+    {
+      Mutex::Locker l(lock);
+      while (true) {
+	bool conflict = in_flight.size() >= max_in_flight;
+	for (list<ReplayEntry*>::iterator p = in_flight.begin();
+	     !conflict && p != in_flight.end();
+	     ++p)
+	  conflict = replay_conflicts(e, *p);
+	if (!conflict)
+	  break;
+	done_cond.Wait(lock);
+      }
+    }
+    // may block behind a commit, which waits for in-flight entries;
+    // don't hold our lock
+    store->apply_manager.op_apply_start(e->seq);
+    Mutex::Locker l(lock);
+    in_flight.push_back(e);
+    queued.push_back(e);
+    work_cond.Signal();
+  }
+
+  /// wait for everything queued to be applied, and stop the workers
+  void stop() {
+    {
+      Mutex::Locker l(lock);
+      stopping = true;
+      work_cond.SignalAll();
+    }
+    for (vector<Worker*>::iterator p = workers.begin();
+	 p != workers.end();
+	 ++p)
+      (*p)->join();
+  }
+};
+
+
 
 void JournalingObjectStore::journal_start()
 {
@@ -64,6 +233,15 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
 
   replaying = true;
 
+  int threads = MAX(g_conf->journal_replay_threads, 1);
+  ReplayDispatcher *dispatcher = NULL;
+  if (threads > 1) {
+    dispatcher = new ReplayDispatcher(this, threads);
+    dispatcher->start();
+  }
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint64_t bytes = 0;
+
   int count = 0;
   while (1) {
     bufferlist bl;
@@ -80,27 +258,51 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
     assert(op_seq == seq-1);
     
     dout(3) << "journal_replay: applying op seq " << seq << dendl;
+    ++count;
+    bytes += bl.length();
+    ReplayEntry *e = new ReplayEntry(seq);
     bufferlist::iterator p = bl.begin();
-    list<Transaction*> tls;
     while (!p.end()) {
       Transaction *t = new Transaction(p);
-      tls.push_back(t);
+      e->tls.push_back(t);
+      if (dispatcher && !e->barrier &&
+	  !t->get_touched(&e->objects, &e->colls, &e->coll_ops))
+	e->barrier = true;
     }
 
-    apply_manager.op_apply_start(seq);
-    int r = do_transactions(tls, seq);
-    apply_manager.op_apply_finish(seq);
-
     op_seq = seq;
 
-    while (!tls.empty()) {
-      delete tls.front(); 
-      tls.pop_front();
+    if (dispatcher) {
+      dispatcher->queue(e);
+      continue;
     }
 
+    apply_manager.op_apply_start(seq);
+    int r = do_transactions(e->tls, seq);
+    apply_manager.op_apply_finish(seq);
+    delete e;
+
     dout(3) << "journal_replay: r = " << r << ", op_seq now " << op_seq << dendl;
   }
 
+  if (dispatcher) {
+    dispatcher->stop();
+    delete dispatcher;
+  }
+
+  replay_stats.entries = count;
+  replay_stats.bytes = bytes;
+  replay_stats.threads = threads;
+  replay_stats.duration = ceph_clock_now(g_ceph_context) - start;
+  if (count) {
+    double secs = MAX((double)replay_stats.duration, 0.000001);
+    dout(1) << "journal_replay: applied " << count << " entries ("
+	    << prettybyte_t(bytes) << ") with " << threads << " threads in "
+	    << replay_stats.duration << " s, " << (uint64_t)(count / secs)
+	    << " entries/s, " << prettybyte_t((uint64_t)(bytes / secs))
+	    << "/s" << dendl;
+  }
+
   replaying = false;
 
   submit_manager.set_op_seq(op_seq);
@@ -260,9 +462,16 @@ void JournalingObjectStore::_op_journal_transactions(
     bufferlist tbl;
     unsigned data_len = 0;
     int data_align = -1; // -1 indicates that we don't care about the alignment
+    bool aligned = false;
     for (list<ObjectStore::Transaction*>::iterator p = tls.begin();
 	 p != tls.end(); ++p) {
       ObjectStore::Transaction *t = *p;
+      // pages of the large payloads are aligned relative to the entry
+      if (g_conf->journal_align_all_data &&
+	  t->encode_journal(tbl, g_conf->journal_align_min_size)) {
+	aligned = true;
+	continue;
+      }
       if (t->get_data_length() > data_len &&
 	(int)t->get_data_length() >= g_conf->journal_align_min_size) {
 	data_len = t->get_data_length();
@@ -270,6 +479,8 @@ void JournalingObjectStore::_op_journal_transactions(
       }
       ::encode(*t, tbl);
     }
+    if (aligned)
+      data_align = 0;
     journal->submit_entry(op, tbl, data_align, onjournal, osd_op);
   } else if (onjournal) {
     apply_manager.add_waiter(op, onjournal);
@@ -108,6 +108,19 @@ protected:
 
   bool replaying;
 
+  /// what the last journal_replay() did
+  struct replay_stats_t {
+    uint64_t entries;   ///< journal entries applied
+    uint64_t bytes;     ///< encoded size of those entries
+    int threads;        ///< apply threads used
+    utime_t duration;   ///< wall time, including reading the journal
+
+    replay_stats_t() : entries(0), bytes(0), threads(0) {}
+  } replay_stats;
+
+  /// applies independent journal entries concurrently during replay
+  class ReplayDispatcher;
+
 protected:
   void journal_start();
   void journal_stop();
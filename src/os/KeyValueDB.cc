@@ -26,6 +26,24 @@ KeyValueDB *KeyValueDB::create(CephContext *cct, const string& type,
   return NULL;
 }
 
+void KeyValueDB::start_compaction_sched(CephContext *cct, const string &name)
+{
+  assert(!compaction_sched);
+  if (cct->_conf->kvdb_compact_interval <= 0)
+    return;
+  compaction_sched = new CompactionScheduler(cct, this, name);
+  compaction_sched->start();
+}
+
+void KeyValueDB::stop_compaction_sched()
+{
+  if (!compaction_sched)
+    return;
+  compaction_sched->shutdown();
+  delete compaction_sched;
+  compaction_sched = NULL;
+}
+
 int KeyValueDB::test_init(const string& type, const string& dir)
 {
   if (type == "leveldb"){
@@ -9,7 +9,8 @@
 #include <string>
 #include "include/memory.h"
 #include <boost/scoped_ptr.hpp>
-#include "ObjectMap.h"
+#include "CompactionScheduler.h"
+#include "common/Clock.h"
 
 using std::string;
 /**
@@ -87,6 +88,20 @@ public:
     std::map<string, bufferlist> *out ///< [out] Key value retrieved
     ) = 0;
 
+  /// the part of an iterator that ObjectMap iterators share
+  class SimplestIteratorImpl {
+  public:
+    virtual int seek_to_first() = 0;
+    virtual int upper_bound(const string &after) = 0;
+    virtual int lower_bound(const string &to) = 0;
+    virtual bool valid() = 0;
+    virtual int next() = 0;
+    virtual string key() = 0;
+    virtual bufferlist value() = 0;
+    virtual int status() = 0;
+    virtual ~SimplestIteratorImpl() {}
+  };
+
   class WholeSpaceIteratorImpl {
   public:
     virtual int seek_to_first() = 0;
@@ -106,25 +121,49 @@ public:
   };
   typedef ceph::shared_ptr< WholeSpaceIteratorImpl > WholeSpaceIterator;
 
-  class IteratorImpl : public ObjectMap::ObjectMapIteratorImpl {
+  class IteratorImpl : public SimplestIteratorImpl {
     const string prefix;
     WholeSpaceIterator generic_iter;
+    CompactionScheduler *compaction_sched;  ///< told how long seeks take
+    uint64_t seeks;
+    utime_t seek_start, seek_time;
+
+    void start_seek() {
+      if (compaction_sched)
+	seek_start = ceph_clock_now(NULL);
+    }
+    int finish_seek(int r) {
+      if (compaction_sched) {
+	++seeks;
+	seek_time += ceph_clock_now(NULL) - seek_start;
+      }
+      return r;
+    }
   public:
-    IteratorImpl(const string &prefix, WholeSpaceIterator iter) :
-      prefix(prefix), generic_iter(iter) { }
-    virtual ~IteratorImpl() { }
+    IteratorImpl(const string &prefix, WholeSpaceIterator iter,
+		 CompactionScheduler *compaction_sched = NULL) :
+      prefix(prefix), generic_iter(iter),
+      compaction_sched(compaction_sched), seeks(0) { }
+    virtual ~IteratorImpl() {
+      if (seeks)
+	compaction_sched->note_seeks(prefix, seeks, seek_time);
+    }
 
     int seek_to_first() {
-      return generic_iter->seek_to_first(prefix);
+      start_seek();
+      return finish_seek(generic_iter->seek_to_first(prefix));
     }
     int seek_to_last() {
-      return generic_iter->seek_to_last(prefix);
+      start_seek();
+      return finish_seek(generic_iter->seek_to_last(prefix));
     }
     int upper_bound(const string &after) {
-      return generic_iter->upper_bound(prefix, after);
+      start_seek();
+      return finish_seek(generic_iter->upper_bound(prefix, after));
     }
     int lower_bound(const string &to) {
-      return generic_iter->lower_bound(prefix, to);
+      start_seek();
+      return finish_seek(generic_iter->lower_bound(prefix, to));
     }
     bool valid() {
       if (!generic_iter->valid())
@@ -161,7 +200,7 @@ public:
 
   Iterator get_iterator(const string &prefix) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_iterator())
+      new IteratorImpl(prefix, _get_prefix_iterator(prefix), compaction_sched)
     );
   }
 
@@ -171,13 +210,17 @@ public:
 
   Iterator get_snapshot_iterator(const string &prefix) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_snapshot_iterator())
+      new IteratorImpl(prefix, _get_prefix_snapshot_iterator(prefix),
+		       compaction_sched)
     );
   }
 
   virtual uint64_t get_estimated_size(map<string,uint64_t> &extra) = 0;
 
-  virtual ~KeyValueDB() {}
+  KeyValueDB() : compaction_sched(NULL) {}
+  virtual ~KeyValueDB() {
+    assert(!compaction_sched);
+  }
 
   /// compact the underlying store
   virtual void compact() {}
@@ -192,8 +235,28 @@ public:
 				   const string& start, const string& end) {}
 
 protected:
+  /// set while kvdb_compact_interval is; stores tell it what they see
+  CompactionScheduler *compaction_sched;
+
+  /// start and stop the compaction scheduler, on open and close
+  void start_compaction_sched(CephContext *cct, const string &name);
+  void stop_compaction_sched();
+
   virtual WholeSpaceIterator _get_iterator() = 0;
   virtual WholeSpaceIterator _get_snapshot_iterator() = 0;
+
+  /**
+   * A whole space iterator that only needs to be good for the keys
+   * under prefix.  Stores that keep some prefixes apart (see
+   * RocksDBStore column families) can skip looking at the rest.
+   */
+  virtual WholeSpaceIterator _get_prefix_iterator(const string &prefix) {
+    return _get_iterator();
+  }
+  virtual WholeSpaceIterator _get_prefix_snapshot_iterator(
+    const string &prefix) {
+    return _get_snapshot_iterator();
+  }
 };
 
 #endif
@@ -76,6 +76,7 @@ static CompatSet get_kv_initial_compat_set() {
   CompatSet::FeatureSet ceph_osd_feature_compat;
   CompatSet::FeatureSet ceph_osd_feature_ro_compat;
   CompatSet::FeatureSet ceph_osd_feature_incompat;
+  ceph_osd_feature_incompat.insert(CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS);
   return CompatSet(ceph_osd_feature_compat, ceph_osd_feature_ro_compat,
 		   ceph_osd_feature_incompat);
 }
@@ -268,7 +269,7 @@ int StripObjectMap::get_keys_with_header(const StripObjectHeaderRef header,
                                          set<string> *keys)
 {
   ObjectMap::ObjectMapIterator iter = _get_iterator(header->header, prefix);
-  for (; iter->valid(); iter->next()) {
+  for (iter->seek_to_first(); iter->valid(); iter->next()) {
     if (iter->status())
       return iter->status();
     keys->insert(iter->key());
@@ -276,6 +277,69 @@ int StripObjectMap::get_keys_with_header(const StripObjectHeaderRef header,
   return 0;
 }
 
+int StripObjectMap::get_strips_with_header(const StripObjectHeaderRef header,
+                                           const string &prefix,
+                                           const set<string> &keys,
+                                           map<string, bufferlist> *out)
+{
+  uint64_t seq = header->header->seq;
+  set<string> misses;
+  uint64_t gen;
+  {
+    Mutex::Locker l(lock);
+    for (set<string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+      if (!strip_cache.lookup(make_pair(seq, *it), &(*out)[*it])) {
+        out->erase(*it);
+        misses.insert(*it);
+      }
+    }
+    if (misses.empty())
+      return 0;
+    strip_fill_t &fill = strip_fills[seq];
+    ++fill.readers;
+    gen = fill.gen;
+  }
+
+  map<string, bufferlist> got;
+  int r = get_values_with_header(header, prefix, misses, &got);
+
+  Mutex::Locker l(lock);
+  map<uint64_t, strip_fill_t>::iterator fill = strip_fills.find(seq);
+  assert(fill != strip_fills.end());
+  bool fresh = fill->second.gen == gen;
+  if (--fill->second.readers == 0)
+    strip_fills.erase(fill);
+  if (r < 0)
+    return r;
+  for (map<string, bufferlist>::iterator it = got.begin(); it != got.end(); ++it) {
+    if (fresh)
+      strip_cache.add(make_pair(seq, it->first), it->second);
+    (*out)[it->first].swap(it->second);
+  }
+  return 0;
+}
+
+void StripObjectMap::update_strip_cache(
+  const map<pair<uint64_t, string>, bufferlist> &written,
+  const set<pair<uint64_t, string> > &removed)
+{
+  Mutex::Locker l(lock);
+  for (set<pair<uint64_t, string> >::const_iterator it = removed.begin();
+       it != removed.end(); ++it) {
+    strip_cache.clear(*it);
+    map<uint64_t, strip_fill_t>::iterator fill = strip_fills.find(it->first);
+    if (fill != strip_fills.end())
+      ++fill->second.gen;
+  }
+  for (map<pair<uint64_t, string>, bufferlist>::const_iterator it = written.begin();
+       it != written.end(); ++it) {
+    strip_cache.add(it->first, it->second);
+    map<uint64_t, strip_fill_t>::iterator fill = strip_fills.find(it->first.first);
+    if (fill != strip_fills.end())
+      ++fill->second.gen;
+  }
+}
+
 int StripObjectMap::get_with_header(const StripObjectHeaderRef header,
                         const string &prefix, map<string, bufferlist> *out)
 {
@@ -356,8 +420,13 @@ int KeyValueStore::BufferTransaction::get_buffer_keys(
   }
 
   if (!need_lookup.empty()) {
-    int r = store->backend->get_values_with_header(strip_header, prefix,
-                                                   need_lookup, out);
+    int r;
+    if (prefix == OBJECT_STRIP_PREFIX)
+      r = store->backend->get_strips_with_header(strip_header, prefix,
+                                                 need_lookup, out);
+    else
+      r = store->backend->get_values_with_header(strip_header, prefix,
+                                                 need_lookup, out);
     if (r < 0) {
       dout(10) << __func__  << " " << strip_header->cid << "/"
                << strip_header->oid << " " << " r = " << r << dendl;
@@ -377,6 +446,12 @@ void KeyValueStore::BufferTransaction::set_buffer_keys(
   uniq_id uid = make_pair(strip_header->cid, strip_header->oid);
   for (map<string, bufferlist>::iterator iter = values.begin();
        iter != values.end(); ++iter) {
+    if (prefix == OBJECT_STRIP_PREFIX) {
+      pair<uint64_t, string> k = make_pair(strip_header->header->seq,
+                                           iter->first);
+      strips_removed.erase(k);
+      strips_written[k] = iter->second;
+    }
     buffers[uid][make_pair(prefix, iter->first)].swap(iter->second);
   }
 }
@@ -392,6 +467,13 @@ int KeyValueStore::BufferTransaction::remove_buffer_keys(
       obj_it->second[make_pair(prefix, *iter)] = bufferlist();
     }
   }
+  if (prefix == OBJECT_STRIP_PREFIX) {
+    for (set<string>::iterator iter = keys.begin(); iter != keys.end(); ++iter) {
+      pair<uint64_t, string> k = make_pair(strip_header->header->seq, *iter);
+      strips_written.erase(k);
+      strips_removed.insert(k);
+    }
+  }
 
   return store->backend->rm_keys(strip_header->header, prefix, keys, t);
 }
@@ -451,7 +533,7 @@ void KeyValueStore::BufferTransaction::rename_buffer(
   strip_headers[make_pair(cid, oid)] = new_header;
 }
 
-int KeyValueStore::BufferTransaction::submit_transaction()
+int KeyValueStore::BufferTransaction::submit_transaction(uint64_t bytes)
 {
   int r = 0;
 
@@ -470,7 +552,11 @@ int KeyValueStore::BufferTransaction::submit_transaction()
     }
   }
 
-  r = store->backend->submit_transaction_sync(t);
+  // made durable by the commit thread, together with whatever else is
+  // waiting for it
+  r = store->commit_and_wait(t, bytes);
+  if (r == 0)
+    store->backend->update_strip_cache(strips_written, strips_removed);
   for (list<Context*>::iterator it = finishes.begin(); it != finishes.end(); ++it) {
     (*it)->complete(r);
   }
@@ -530,12 +616,20 @@ KeyValueStore::KeyValueStore(const std::string &base,
         g_conf->keyvaluestore_op_threads, "keyvaluestore_op_threads"),
   op_wq(this, g_conf->keyvaluestore_op_thread_timeout,
         g_conf->keyvaluestore_op_thread_suicide_timeout, &op_tp),
+  commit_lock("KeyValueStore::commit_lock"),
+  commit_queue_bytes(0),
+  commit_stop(false),
+  commit_thread(this),
   perf_logger(NULL),
+  commit_logger(NULL),
   m_keyvaluestore_queue_max_ops(g_conf->keyvaluestore_queue_max_ops),
   m_keyvaluestore_queue_max_bytes(g_conf->keyvaluestore_queue_max_bytes),
   m_keyvaluestore_strip_size(g_conf->keyvaluestore_default_strip_size),
   m_keyvaluestore_max_expected_write_size(g_conf->keyvaluestore_max_expected_write_size),
-  do_update(do_update)
+  m_keyvaluestore_group_commit_max_bytes(g_conf->keyvaluestore_group_commit_max_bytes),
+  m_keyvaluestore_group_commit_max_wait(g_conf->keyvaluestore_group_commit_max_wait),
+  do_update(do_update),
+  tail_strips(false)
 {
   ostringstream oss;
   oss << basedir << "/current";
@@ -560,7 +654,15 @@ KeyValueStore::KeyValueStore(const std::string &base,
 
   perf_logger = plb.create_perf_counters();
 
+  PerfCountersBuilder cplb(g_ceph_context, internal_name + "-commit",
+			   l_kvs_commit_first, l_kvs_commit_last);
+  cplb.add_u64_avg(l_kvs_commit_batch_ops, "batch_ops");
+  cplb.add_u64_avg(l_kvs_commit_batch_bytes, "batch_bytes");
+  cplb.add_time_avg(l_kvs_commit_sync_lat, "sync_latency");
+  commit_logger = cplb.create_perf_counters();
+
   g_ceph_context->get_perfcounters_collection()->add(perf_logger);
+  g_ceph_context->get_perfcounters_collection()->add(commit_logger);
   g_ceph_context->_conf->add_observer(this);
 
   superblock.compat_features = get_kv_initial_compat_set();
@@ -570,8 +672,10 @@ KeyValueStore::~KeyValueStore()
 {
   g_ceph_context->_conf->remove_observer(this);
   g_ceph_context->get_perfcounters_collection()->remove(perf_logger);
+  g_ceph_context->get_perfcounters_collection()->remove(commit_logger);
 
   delete perf_logger;
+  delete commit_logger;
 }
 
 int KeyValueStore::statfs(struct statfs *buf)
@@ -886,6 +990,25 @@ int KeyValueStore::mount()
     goto close_fsid_fd;
   }
 
+  if (!superblock.compat_features.incompat.contains(
+	CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS) &&
+      g_conf->keyvaluestore_enable_tail_strips) {
+    // older versions expect every strip to be strip_size long, and
+    // can no longer mount the store after this
+    dout(0) << "KeyValueStore::mount : enabling variable length strips"
+            << dendl;
+    superblock.compat_features.incompat.insert(
+      CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS);
+    ret = write_superblock();
+    if (ret < 0) {
+      derr << "KeyValueStore::mount : write_superblock() failed: "
+           << cpp_strerror(ret) << dendl;
+      goto close_fsid_fd;
+    }
+  }
+  tail_strips = superblock.compat_features.incompat.contains(
+    CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS);
+
   current_fd = ::open(current_fn.c_str(), O_RDONLY);
   if (current_fd < 0) {
     ret = -errno;
@@ -944,6 +1067,8 @@ int KeyValueStore::mount()
   op_tp.start();
   op_finisher.start();
   ondisk_finisher.start();
+  commit_stop = false;
+  commit_thread.create();
 
   // all okay.
   return 0;
@@ -963,6 +1088,14 @@ int KeyValueStore::umount()
   dout(5) << "umount " << basedir << dendl;
 
   op_tp.stop();
+
+  // commit whatever the op threads left behind
+  commit_lock.Lock();
+  commit_stop = true;
+  commit_cond.Signal();
+  commit_lock.Unlock();
+  commit_thread.join();
+
   op_finisher.stop();
   ondisk_finisher.stop();
 
@@ -1116,13 +1249,9 @@ void KeyValueStore::_do_op(OpSequencer *osr, ThreadPool::TPHandle &handle)
   dout(10) << "_do_op " << o << " seq " << o->op << " r = " << r
            << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
 
-  if (o->ondisk) {
-    if (r < 0) {
-      delete o->ondisk;
-      o->ondisk = 0;
-    } else {
-      ondisk_finisher.queue(o->ondisk, r);
-    }
+  if (o->ondisk && r < 0) {
+    delete o->ondisk;
+    o->ondisk = 0;
   }
 }
 
@@ -1132,22 +1261,122 @@ void KeyValueStore::_finish_op(OpSequencer *osr)
   Op *o = osr->dequeue(&to_queue);
 
   dout(10) << "_finish_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << dendl;
+  // committed in _do_op; flush_commit waiters go after the op they
+  // waited for
+  if (o->ondisk)
+    ondisk_finisher.queue(o->ondisk);
+  ondisk_finisher.queue(to_queue);
   osr->apply_lock.Unlock();  // locked in _do_op
   op_queue_release_throttle(o);
 
   utime_t lat = ceph_clock_now(g_ceph_context);
   lat -= o->start;
-  perf_logger->tinc(l_os_commit_lat, lat);
   perf_logger->tinc(l_os_apply_lat, lat);
+  perf_logger->tinc(l_os_commit_lat, lat);
 
   if (o->onreadable_sync) {
     o->onreadable_sync->complete(0);
   }
   op_finisher.queue(o->onreadable);
-  op_finisher.queue(to_queue);
   delete o;
 }
 
+void KeyValueStore::OpTransactionImpl::replay(KeyValueDB::Transaction t) const
+{
+  for (list<op_t>::const_iterator p = ops.begin(); p != ops.end(); ++p) {
+    switch (p->op) {
+    case OP_SET:
+      t->set(p->prefix, p->key, p->bl);
+      break;
+    case OP_RMKEY:
+      t->rmkey(p->prefix, p->key);
+      break;
+    case OP_RMKEYS_BY_PREFIX:
+      t->rmkeys_by_prefix(p->prefix);
+      break;
+    default:
+      assert(0 == "unknown op");
+    }
+  }
+}
+
+int KeyValueStore::commit_and_wait(KeyValueDB::Transaction t, uint64_t bytes)
+{
+  PendingCommit c(t, bytes, ceph_clock_now(g_ceph_context));
+  Mutex::Locker l(commit_lock);
+  commit_queue.push_back(&c);
+  commit_queue_bytes += bytes;
+  commit_cond.Signal();
+  while (!c.done)
+    commit_done_cond.Wait(commit_lock);
+  return c.r;
+}
+
+void KeyValueStore::commit_entry()
+{
+  commit_lock.Lock();
+  while (true) {
+    if (commit_queue.empty()) {
+      if (commit_stop)
+	break;
+      commit_cond.Wait(commit_lock);
+      continue;
+    }
+
+    // hold the sync back for a while, so that more ops can share it
+    if (!commit_stop && m_keyvaluestore_group_commit_max_wait > 0 &&
+	commit_queue_bytes < m_keyvaluestore_group_commit_max_bytes) {
+      utime_t until = commit_queue.front()->queued;
+      until += m_keyvaluestore_group_commit_max_wait;
+      if (ceph_clock_now(g_ceph_context) < until) {
+	commit_cond.WaitUntil(commit_lock, until);
+	continue;
+      }
+    }
+
+    list<PendingCommit*> batch;
+    batch.swap(commit_queue);
+    uint64_t bytes = commit_queue_bytes;
+    commit_queue_bytes = 0;
+    commit_lock.Unlock();
+
+    // one sync write for the whole batch, so that none of it can be
+    // lost once it is acked, whatever the backend does with unsynced
+    // writes
+    utime_t start = ceph_clock_now(g_ceph_context);
+    KeyValueDB::Transaction t = backend->get_transaction();
+    for (list<PendingCommit*>::iterator p = batch.begin();
+	 p != batch.end();
+	 ++p)
+      static_cast<OpTransactionImpl*>((*p)->t.get())->replay(t);
+    // each op recorded the object map state as of when it ran, and
+    // clones sync theirs right away; finish with the current state so
+    // that the stored next seq never goes backwards
+    backend->sync(GenericObjectMap::Header(), t);
+    int r = backend->submit_transaction_sync(t);
+    utime_t done = ceph_clock_now(g_ceph_context);
+    if (r < 0)
+      derr << "commit_entry failed to commit " << batch.size() << " ops: "
+	   << cpp_strerror(r) << dendl;
+    dout(10) << "commit_entry " << batch.size() << " ops " << bytes
+	     << " bytes in " << (done - start) << dendl;
+
+    commit_logger->inc(l_kvs_commit_batch_ops, batch.size());
+    commit_logger->inc(l_kvs_commit_batch_bytes, bytes);
+    commit_logger->tinc(l_kvs_commit_sync_lat, done - start);
+
+    commit_lock.Lock();
+    for (list<PendingCommit*>::iterator p = batch.begin();
+	 p != batch.end();
+	 ++p) {
+      (*p)->r = r;
+      (*p)->done = true;
+    }
+    commit_done_cond.SignalAll();
+  }
+  commit_lock.Unlock();
+}
+
 // Combine all the ops in the same transaction using "BufferTransaction" and
 // cache the middle results in order to make visible to the following ops.
 //
@@ -1181,10 +1410,10 @@ int KeyValueStore::_do_transactions(list<Transaction*> &tls, uint64_t op_seq,
       handle->reset_tp_timeout();
   }
 
-  r = bt.submit_transaction();
-  if (r < 0) {
-    assert(0 == "unexpected error");  // FIXME
-  }
+  r = bt.submit_transaction(bytes);
+  if (r < 0)
+    derr << "_do_transactions op " << op_seq << " failed to commit: "
+         << cpp_strerror(r) << dendl;
 
   return r;
 }
@@ -1666,7 +1895,7 @@ int KeyValueStore::_generic_read(StripObjectMap::StripObjectHeaderRef header,
   }
 
 
-  int r = backend->get_values_with_header(header, OBJECT_STRIP_PREFIX, keys, &out);
+  int r = backend->get_strips_with_header(header, OBJECT_STRIP_PREFIX, keys, &out);
   if (r < 0) {
     dout(10) << __func__ << " " << header->cid << "/" << header->oid << " "
              << offset << "~" << len << " = " << r << dendl;
@@ -1683,11 +1912,17 @@ int KeyValueStore::_generic_read(StripObjectMap::StripObjectHeaderRef header,
     string key = strip_object_key(iter->no);
 
     if (header->bits[iter->no]) {
-      if (iter->len == header->strip_size) {
-        bl.claim_append(out[key]);
-      } else {
-        out[key].copy(iter->offset, iter->len, bl);
-      }
+      // the strip may be short; the rest of it reads as zeros
+      bufferlist &value = out[key];
+      uint64_t n = 0;
+      if (iter->offset < value.length())
+        n = MIN(iter->len, value.length() - iter->offset);
+      if (iter->offset == 0 && n == value.length())
+        bl.claim_append(value);
+      else if (n)
+        value.copy(iter->offset, n, bl);
+      if (n < iter->len)
+        bl.append_zero(iter->len - n);
     } else {
       bl.append_zero(iter->len);
     }
@@ -1819,12 +2054,14 @@ int KeyValueStore::_truncate(coll_t cid, const ghobject_t& oid, uint64_t size,
         return -EBADF;
       }
 
-      values[key].copy(0, iter->offset, value);
-      value.append_zero(header->strip_size-iter->offset);
-      assert(value.length() == header->strip_size);
-      value.swap(values[key]);
-
-      t.set_buffer_keys(header, OBJECT_STRIP_PREFIX, values);
+      // cut the strip at the new end; anything past it reads as zeros
+      if (values[key].length() > iter->offset) {
+        values[key].copy(0, iter->offset, value);
+        if (!tail_strips)
+          value.append_zero(header->strip_size - iter->offset);
+        value.swap(values[key]);
+        t.set_buffer_keys(header, OBJECT_STRIP_PREFIX, values);
+      }
       ++iter;
     }
 
@@ -1918,33 +2155,32 @@ int KeyValueStore::_generic_write(StripObjectMap::StripObjectHeaderRef header,
        iter != extents.end(); ++iter) {
     bufferlist value;
     string key = strip_object_key(iter->no);
-    if (header->bits[iter->no]) {
-      if (iter->offset == 0 && iter->len == header->strip_size) {
-        bl.copy(bl_offset, iter->len, value);
-        bl_offset += iter->len;
-      } else {
-        assert(out[key].length() == header->strip_size);
-
-        out[key].copy(0, iter->offset, value);
-        bl.copy(bl_offset, iter->len, value);
-        bl_offset += iter->len;
+    // strips are only as long as their last written byte, so an append
+    // to a short tail strip rewrites just what is there
+    if (header->bits[iter->no] &&
+        !(iter->offset == 0 && iter->len == header->strip_size)) {
+      bufferlist &old = out[key];
+      assert(old.length() <= header->strip_size);
+
+      old.copy(0, MIN(iter->offset, old.length()), value);
+      if (value.length() < iter->offset)
+        value.append_zero(iter->offset - value.length());
+      bl.copy(bl_offset, iter->len, value);
+      bl_offset += iter->len;
 
-        if (value.length() != header->strip_size)
-          out[key].copy(value.length(), header->strip_size-value.length(),
-                        value);
-      }
+      if (old.length() > value.length())
+        old.copy(value.length(), old.length() - value.length(), value);
     } else {
       if (iter->offset)
         value.append_zero(iter->offset);
       bl.copy(bl_offset, iter->len, value);
       bl_offset += iter->len;
 
-      if (value.length() < header->strip_size)
-        value.append_zero(header->strip_size-value.length());
-
       header->bits[iter->no] = 1;
     }
-    assert(value.length() == header->strip_size);
+    if (!tail_strips && value.length() < header->strip_size)
+      value.append_zero(header->strip_size - value.length());
+    assert(value.length() <= header->strip_size);
     values[key].swap(value);
   }
   assert(bl_offset == len);
@@ -2814,6 +3050,13 @@ ObjectMap::ObjectMapIterator KeyValueStore::get_omap_iterator(
   return backend->get_iterator(c, hoid, OBJECT_OMAP);
 }
 
+void KeyValueStore::omap_get_values_batch(coll_t c,
+                                          vector<ObjectMap::OmapRead> &reads)
+{
+  dout(15) << __func__ << " " << c << " " << reads.size() << " reads" << dendl;
+  backend->get_values_batch(c, reads, OBJECT_OMAP);
+}
+
 int KeyValueStore::_omap_clear(coll_t cid, const ghobject_t &hoid,
                                BufferTransaction &t)
 {
@@ -3078,6 +3321,8 @@ const char** KeyValueStore::get_tracked_conf_keys() const
     "keyvaluestore_queue_max_ops",
     "keyvaluestore_queue_max_bytes",
     "keyvaluestore_strip_size",
+    "keyvaluestore_group_commit_max_bytes",
+    "keyvaluestore_group_commit_max_wait",
     NULL
   };
   return KEYS;
@@ -3093,6 +3338,13 @@ void KeyValueStore::handle_conf_change(const struct md_config_t *conf,
     m_keyvaluestore_queue_max_bytes = conf->keyvaluestore_queue_max_bytes;
     m_keyvaluestore_max_expected_write_size = conf->keyvaluestore_max_expected_write_size;
   }
+  if (changed.count("keyvaluestore_group_commit_max_bytes") ||
+      changed.count("keyvaluestore_group_commit_max_wait")) {
+    Mutex::Locker l(commit_lock);
+    m_keyvaluestore_group_commit_max_bytes = conf->keyvaluestore_group_commit_max_bytes;
+    m_keyvaluestore_group_commit_max_wait = conf->keyvaluestore_group_commit_max_wait;
+    commit_cond.Signal();
+  }
   if (changed.count("keyvaluestore_default_strip_size")) {
     m_keyvaluestore_strip_size = conf->keyvaluestore_default_strip_size;
     default_strip_size = m_keyvaluestore_strip_size;
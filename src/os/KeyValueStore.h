@@ -35,14 +35,19 @@ using namespace std;
 #include "common/fd.h"
 
 #include "common/Mutex.h"
+#include "common/Thread.h"
 #include "GenericObjectMap.h"
 #include "KeyValueDB.h"
 #include "common/random_cache.hpp"
+#include "common/simple_cache.hpp"
 
 #include "include/uuid.h"
 
 static uint64_t default_strip_size = 1024;
 
+// strips may be shorter than strip_size; the rest reads as zeros
+#define CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS CompatSet::Feature(1, "variable length strips")
+
 class StripObjectMap: public GenericObjectMap {
  public:
 
@@ -123,6 +128,19 @@ class StripObjectMap: public GenericObjectMap {
     set<string> *keys
     );
 
+  /// get_values_with_header() for strips, through the strip cache
+  int get_strips_with_header(
+    const StripObjectHeaderRef header,
+    const string &prefix,
+    const set<string> &keys,
+    map<string, bufferlist> *out
+    );
+  /// make committed strip updates visible in the strip cache
+  void update_strip_cache(
+    const map<pair<uint64_t, string>, bufferlist> &written,
+    const set<pair<uint64_t, string> > &removed
+    );
+
   Mutex lock;
   void invalidate_cache(const coll_t &c, const ghobject_t &oid) {
     Mutex::Locker l(lock);
@@ -130,9 +148,36 @@ class StripObjectMap: public GenericObjectMap {
   }
 
   RandomCache<ghobject_t, pair<coll_t, StripObjectHeaderRef> > caches;
+
+  /**
+   * Strip values by (header seq, strip key).
+   *
+   * Seqs are never reused and a header's strips only change through
+   * its own seq (clones get new seqs), so entries never need to be
+   * invalidated for clones, renames or removals; they just age out.
+   * Updates are written through once their transaction has committed.
+   */
+  SimpleLRU<pair<uint64_t, string>, bufferlist> strip_cache;
+
+  /**
+   * Reads filling the strip cache, by header seq.
+   *
+   * An update to a seq bumps its gen (under lock), so that a read of
+   * that object which raced with the update does not put a stale value
+   * back; reads of other objects still fill.  Entries only live while
+   * a read of that seq is in flight.
+   */
+  struct strip_fill_t {
+    unsigned readers;
+    uint64_t gen;
+    strip_fill_t() : readers(0), gen(0) {}
+  };
+  map<uint64_t, strip_fill_t> strip_fills;
+
   StripObjectMap(KeyValueDB *db): GenericObjectMap(db),
                                   lock("StripObjectMap::lock"),
-                                  caches(g_conf->keyvaluestore_header_cache_size)
+                                  caches(g_conf->keyvaluestore_header_cache_size),
+                                  strip_cache(g_conf->keyvaluestore_strip_cache_size)
   {}
 };
 
@@ -158,6 +203,14 @@ inline ostream& operator<<(ostream& out, const KVSuperblock& sb)
 }
 
 
+enum {
+  l_kvs_commit_first = 84400,
+  l_kvs_commit_batch_ops,    ///< ops made durable by one sync
+  l_kvs_commit_batch_bytes,
+  l_kvs_commit_sync_lat,     ///< time spent in the sync itself
+  l_kvs_commit_last,
+};
+
 class KeyValueStore : public ObjectStore,
                       public md_config_obs_t {
  public:
@@ -234,6 +287,40 @@ class KeyValueStore : public ObjectStore,
     return ghobject_t(hobject_t(sobject_t(col.to_str(), CEPH_NOSNAP)));
   }
 
+  /**
+   * The backend updates of an op, recorded while it is applied and
+   * replayed by the commit thread into the backend transaction of its
+   * batch.
+   */
+  class OpTransactionImpl : public KeyValueDB::TransactionImpl {
+    enum {
+      OP_SET,
+      OP_RMKEY,
+      OP_RMKEYS_BY_PREFIX
+    };
+    struct op_t {
+      int op;
+      string prefix, key;
+      bufferlist bl;
+      op_t(int o, const string &p, const string &k = string())
+        : op(o), prefix(p), key(k) {}
+    };
+    list<op_t> ops;
+
+  public:
+    void set(const string &prefix, const string &k, const bufferlist &bl) {
+      ops.push_back(op_t(OP_SET, prefix, k));
+      ops.back().bl = bl;
+    }
+    void rmkey(const string &prefix, const string &k) {
+      ops.push_back(op_t(OP_RMKEY, prefix, k));
+    }
+    void rmkeys_by_prefix(const string &prefix) {
+      ops.push_back(op_t(OP_RMKEYS_BY_PREFIX, prefix));
+    }
+    void replay(KeyValueDB::Transaction t) const;
+  };
+
   // Each transaction has side effect which may influent the following
   // operations, we need to make it visible for the following within
   // transaction by caching middle result.
@@ -250,6 +337,10 @@ class KeyValueStore : public ObjectStore,
     StripHeaderMap strip_headers;
     map< uniq_id, map<pair<string, string>, bufferlist> > buffers;  // pair(prefix, key),to buffer updated data in one transaction
 
+    // strip updates by (header seq, key), for the strip cache on commit
+    map<pair<uint64_t, string>, bufferlist> strips_written;
+    set<pair<uint64_t, string> > strips_removed;
+
     list<Context*> finishes;
 
     KeyValueStore *store;
@@ -273,10 +364,10 @@ class KeyValueStore : public ObjectStore,
                       const coll_t &cid, const ghobject_t &oid);
     void rename_buffer(StripObjectMap::StripObjectHeaderRef old_header,
                        const coll_t &cid, const ghobject_t &oid);
-    int submit_transaction();
+    int submit_transaction(uint64_t bytes);
 
     BufferTransaction(KeyValueStore *store): store(store) {
-      t = store->backend->get_transaction();
+      t = KeyValueDB::Transaction(new OpTransactionImpl);
     }
 
     struct InvalidateCacheContext : public Context {
@@ -377,19 +468,25 @@ class KeyValueStore : public ObjectStore,
     }
 
     void flush() {
-      Mutex::Locker l(qlock);
-
-      // get max for journal _or_ op queues
-      uint64_t seq = 0;
-      if (!q.empty())
-        seq = q.back()->op;
-
-      if (seq) {
-        // everything prior to our watermark to drain through either/both
-        // queues
-        while (!q.empty() && q.front()->op <= seq)
-          cond.Wait(qlock);
+      {
+	Mutex::Locker l(qlock);
+
+	// get max for journal _or_ op queues
+	uint64_t seq = 0;
+	if (!q.empty())
+	  seq = q.back()->op;
+
+	if (seq) {
+	  // everything prior to our watermark to drain through either/both
+	  // queues
+	  while (!q.empty() && q.front()->op <= seq)
+	    cond.Wait(qlock);
+	}
       }
+      // _finish_op dequeues (and queues the commit callbacks) before it
+      // drops apply_lock; wait for that so the caller may free us
+      apply_lock.Lock();
+      apply_lock.Unlock();
     }
     bool flush_commit(Context *c) {
       Mutex::Locker l(qlock);
@@ -470,7 +567,45 @@ class KeyValueStore : public ObjectStore,
   void op_queue_release_throttle(Op *o);
   void _finish_op(OpSequencer *osr);
 
+  // -- group commit --
+  /**
+   * An op records its backend updates (OpTransactionImpl) and queues
+   * them here.  The commit thread replays everything queued so far,
+   * no matter which sequencer it came from, into a single backend
+   * transaction and submits it with sync, so that the batch becomes
+   * durable as a whole.  The op thread waits for that before the op
+   * counts as applied; the next op of the sequencer thus reads what
+   * it wrote, and its ondisk callback can be queued right away.
+   */
+  struct PendingCommit {
+    KeyValueDB::Transaction t;
+    uint64_t bytes;
+    utime_t queued;   ///< when it was queued for commit
+    bool done;
+    int r;
+    PendingCommit(KeyValueDB::Transaction t, uint64_t bytes, utime_t queued)
+      : t(t), bytes(bytes), queued(queued), done(false), r(0) {}
+  };
+  Mutex commit_lock;
+  Cond commit_cond;       ///< wakes the commit thread
+  Cond commit_done_cond;  ///< wakes ops whose batch has been submitted
+  list<PendingCommit*> commit_queue;
+  uint64_t commit_queue_bytes;
+  bool commit_stop;
+
+  int commit_and_wait(KeyValueDB::Transaction t, uint64_t bytes);
+  void commit_entry();
+  struct CommitThread : public Thread {
+    KeyValueStore *store;
+    CommitThread(KeyValueStore *s) : store(s) {}
+    void *entry() {
+      store->commit_entry();
+      return 0;
+    }
+  } commit_thread;
+
   PerfCounters *perf_logger;
+  PerfCounters *commit_logger;
 
  public:
 
@@ -637,6 +772,7 @@ class KeyValueStore : public ObjectStore,
                       set<string> *out);
   ObjectMap::ObjectMapIterator get_omap_iterator(coll_t c,
                                                  const ghobject_t &oid);
+  void omap_get_values_batch(coll_t c, vector<ObjectMap::OmapRead> &reads);
 
   void dump_transactions(list<ObjectStore::Transaction*>& ls, uint64_t seq,
                          OpSequencer *osr);
@@ -673,8 +809,14 @@ class KeyValueStore : public ObjectStore,
   int m_keyvaluestore_queue_max_bytes;
   int m_keyvaluestore_strip_size;
   uint64_t m_keyvaluestore_max_expected_write_size;
+  uint64_t m_keyvaluestore_group_commit_max_bytes;
+  double m_keyvaluestore_group_commit_max_wait;
   int do_update;
 
+  /// strips are stored only up to their last written byte; set at
+  /// mount from CEPH_KVSTORE_FEATURE_INCOMPAT_TAIL_STRIPS
+  bool tail_strips;
+
   static const string OBJECT_STRIP_PREFIX;
   static const string OBJECT_XATTR;
   static const string OBJECT_OMAP;
@@ -207,6 +207,7 @@ int LFNIndex::remove_objects(const vector<string> &dir,
 			     const map<string, ghobject_t> &to_remove,
 			     map<string, ghobject_t> *remaining)
 {
+  lfn_cache_clear();
   set<string> clean_chains;
   for (map<string, ghobject_t>::const_iterator to_clean = to_remove.begin();
        to_clean != to_remove.end();
@@ -270,6 +271,7 @@ int LFNIndex::remove_objects(const vector<string> &dir,
 int LFNIndex::move_objects(const vector<string> &from,
 			   const vector<string> &to)
 {
+  lfn_cache_clear();
   map<string, ghobject_t> to_move;
   int r;
   r = list_objects(from, 0, NULL, &to_move);
@@ -339,6 +341,8 @@ int LFNIndex::move_subdir(
   sub_path.push_back(dir);
   string from_path(from.get_full_path_subdir(sub_path));
   string to_path(dest.get_full_path_subdir(sub_path));
+  from.lfn_cache_clear();
+  dest.lfn_cache_clear();
   int r = ::rename(from_path.c_str(), to_path.c_str());
   if (r < 0)
     return -errno;
@@ -376,6 +380,81 @@ int LFNIndex::move_object(
   return from.fsync_dir(path);
 }
 
+int LFNIndex::link_object(
+  LFNIndex &from,
+  LFNIndex &dest,
+  const vector<string> &from_path,
+  const vector<string> &to_path,
+  const pair<string, ghobject_t> &obj,
+  string *to_name,
+  ino_t *ino
+  )
+{
+  string from_full(from.get_full_path(from_path, obj.first));
+  string to_full;
+  int exists;
+  int r = dest.lfn_get_name(to_path, obj.second, to_name, &to_full, &exists);
+  if (r < 0)
+    return r;
+  if (!exists) {
+    r = ::link(from_full.c_str(), to_full.c_str());
+    if (r < 0)
+      return -errno;
+  }
+  r = dest.lfn_created(to_path, obj.second, *to_name);
+  if (r < 0)
+    return r;
+  struct stat st;
+  r = ::stat(to_full.c_str(), &st);
+  if (r < 0)
+    return -errno;
+  *ino = st.st_ino;
+  return 0;
+}
+
+int LFNIndex::list_objects_ino(
+  const vector<string> &to_list,
+  const map<string, pair<ghobject_t, ino_t> > *known,
+  map<string, pair<ghobject_t, ino_t> > *out)
+{
+  string to_list_path = get_full_path_subdir(to_list);
+  DIR *dir = ::opendir(to_list_path.c_str());
+  char buf[offsetof(struct dirent, d_name) + PATH_MAX + 1];
+  if (!dir)
+    return -errno;
+
+  int r = 0;
+  struct dirent *de;
+  while (!::readdir_r(dir, reinterpret_cast<struct dirent*>(buf), &de)) {
+    if (!de)
+      break;
+    if (de->d_name[0] == '.')
+      continue;
+    string short_name(de->d_name);
+    if (!lfn_is_object(short_name))
+      continue;
+    if (known) {
+      map<string, pair<ghobject_t, ino_t> >::const_iterator p =
+	known->find(short_name);
+      if (p != known->end() && p->second.second == de->d_ino) {
+	out->insert(*p);
+	continue;
+      }
+    }
+    ghobject_t obj;
+    r = lfn_translate(to_list, short_name, &obj);
+    if (r == -ENOENT)
+      continue;   // raced with an unlink
+    if (r < 0)
+      goto cleanup;
+    if (r > 0)
+      (*out)[short_name] = make_pair(obj, (ino_t)de->d_ino);
+  }
+  r = 0;
+ cleanup:
+  ::closedir(dir);
+  return r;
+}
 
 static int get_hobject_from_oinfo(const char *dir, const char *file, 
 				  ghobject_t *o)
@@ -495,6 +574,7 @@ int LFNIndex::create_path(const vector<string> &to_create)
 
 int LFNIndex::remove_path(const vector<string> &to_remove)
 {
+  lfn_cache_clear();
   maybe_inject_failure();
   int r = ::rmdir(get_full_path_subdir(to_remove).c_str());
   maybe_inject_failure();
@@ -758,6 +838,21 @@ int LFNIndex::lfn_get_name(const vector<string> &path,
     return 0;
   }
 
+  string cache_key;
+  if (lfn_cache_enabled) {
+    cache_key = get_full_path(path, full_name);
+    string cached;
+    if (lfn_cache.lookup(cache_key, &cached)) {
+      if (mangled_name)
+	*mangled_name = cached;
+      if (out_path)
+	*out_path = get_full_path(path, cached);
+      if (exists)
+	*exists = 1;
+      return 0;
+    }
+  }
+
   int i = 0;
   string candidate;
   string candidate_path;
@@ -789,6 +884,8 @@ int LFNIndex::lfn_get_name(const vector<string> &path,
     assert(r > 0);
     buf[MIN((int)sizeof(buf) - 1, r)] = '\0';
     if (!strcmp(buf, full_name.c_str())) {
+      if (lfn_cache_enabled)
+	lfn_cache.add(cache_key, candidate);
       if (mangled_name)
 	*mangled_name = candidate;
       if (out_path)
@@ -854,14 +951,20 @@ int LFNIndex::lfn_created(const vector<string> &path,
 	     << " moving old name to alt attr "
 	     << string(buf, r)
 	     << ", new name is " << full_name << dendl;
+    lfn_cache_clear();
     r = chain_setxattr(full_path.c_str(), get_alt_lfn_attr().c_str(),
 		       buf, r);
     if (r < 0)
       return r;
   }
 
-  return chain_setxattr(full_path.c_str(), get_lfn_attr().c_str(),
+  r = chain_setxattr(full_path.c_str(), get_lfn_attr().c_str(),
 		     full_name.c_str(), full_name.size());
+  if (r < 0)
+    return r;
+  if (lfn_cache_enabled)
+    lfn_cache.add(get_full_path(path, full_name), mangled_name);
+  return r;
 }
 
 int LFNIndex::lfn_unlink(const vector<string> &path,
@@ -878,7 +981,8 @@ int LFNIndex::lfn_unlink(const vector<string> &path,
     return 0;
   }
   string subdir_path = get_full_path_subdir(path);
-  
+  if (lfn_cache_enabled)
+    lfn_cache.clear(get_full_path(path, lfn_generate_object_name(oid)));
   
   int i = 0;
   for ( ; ; ++i) {
@@ -913,6 +1017,8 @@ int LFNIndex::lfn_unlink(const vector<string> &path,
     if (r < 0)
       return -errno;
   } else {
+    // the last object in the chain takes over the removed name
+    lfn_cache_clear();
     string& rename_to = full_path;
     string rename_from = get_full_path(path, lfn_get_short_name(oid, i - 1));
     maybe_inject_failure();
@@ -26,6 +26,7 @@
 #include "osd/osd_types.h"
 #include "include/object.h"
 #include "common/ceph_crypto.h"
+#include "common/simple_cache.hpp"
 
 #include "CollectionIndex.h"
 
@@ -124,6 +125,21 @@ private:
   string lfn_attribute, lfn_alt_attribute;
   coll_t collection;
 
+  /**
+   * Resolved hashed (long) filenames, keyed by the full path the object
+   * would have if its name were not hashed, mapping to the short name.
+   * Only names found through the primary lfn attr are cached.  Entries
+   * are dropped before the file is unlinked; anything that moves or
+   * renames files within a chain, or whole directories, clears the
+   * cache.  SimpleLRU has its own lock, and lfn_get_name() fills entries
+   * with access_lock held only for read: what it found on disk cannot
+   * change until it is released, since files are only created, unlinked
+   * or renamed with access_lock held for write, and those paths drop
+   * the entries they invalidate.
+   */
+  SimpleLRU<string, string> lfn_cache;
+  const bool lfn_cache_enabled;
+
 public:
   /// Constructor
   LFNIndex(
@@ -138,7 +154,9 @@ public:
       error_injection_on(_error_injection_probability != 0),
       error_injection_probability(_error_injection_probability),
       last_failure(0), current_failure(0),
-      collection(collection) {
+      collection(collection),
+      lfn_cache(MAX(g_conf->filestore_index_lfn_cache_size, 0)),
+      lfn_cache_enabled(g_conf->filestore_index_lfn_cache_size > 0) {
     if (index_version == HASH_INDEX_TAG) {
       lfn_attribute = LFN_ATTR;
     } else {
@@ -365,6 +383,35 @@ protected:
     const pair<string, ghobject_t> &obj ///< [in] obj to move
     );
 
+  /// hard link object from from into dest without removing it
+  static int link_object(
+    LFNIndex &from,                ///< [in] from index
+    LFNIndex &dest,                ///< [in] to index
+    const vector<string> &from_path, ///< [in] path containing obj in from
+    const vector<string> &to_path, ///< [in] path to link into in dest
+    const pair<string, ghobject_t> &obj, ///< [in] obj to link
+    string *to_name,               ///< [out] filename in dest
+    ino_t *ino                     ///< [out] inode linked
+    ); ///< @return Error Code, 0 on success, -ENOENT if obj is gone
+
+  /**
+   * Lists objects in to_list along with their inode numbers.
+   *
+   * Entries in known with the same filename and inode are not
+   * translated again, which avoids the lfn xattr reads when
+   * re-listing a directory.
+   *
+   * @param [in] to_list Directory to list.
+   * @param [in] known Previous listing of to_list, may be NULL.
+   * @param [out] out Mapping of filenames to objects and inodes.
+   * @return Error code on failure, 0 on success
+   */
+  int list_objects_ino(
+    const vector<string> &to_list,
+    const map<string, pair<ghobject_t, ino_t> > *known,
+    map<string, pair<ghobject_t, ino_t> > *out
+    );
+
   /**
    * Lists objects in to_list.
    *
@@ -470,6 +517,12 @@ private:
     const string &mangled_name	///< [in] Filename of object to remove.
     );
 
+  /// Drop every cached long filename resolution.
+  void lfn_cache_clear() {
+    if (lfn_cache_enabled)
+      lfn_cache.clear();
+  }
+
   ///Transate a file into and ghobject_t.
   int lfn_translate(
     const vector<string> &path, ///< [in] Path containing the file.
@@ -538,6 +591,7 @@ private:
     int i		   ///< [in] Index of hashed name to generate.
     ); ///< @return Hashed filename.
 
+protected:
   /* other common methods */
   /// Gets the base path
   const string &get_base_path(); ///< @return Index base_path
@@ -553,6 +607,7 @@ private:
     const string &name	       ///< [in] Filename of object.
     ); ///< @return Fullpath to object at name in rel.
 
+private:
   /// Get mangled path component
   string mangle_path_component(
     const string &component ///< [in] Component to mangle
@@ -87,8 +87,17 @@ int LevelDBStore::do_open(ostream &out, bool create_if_missing)
   plb.add_u64_counter(l_leveldb_compact_range, "leveldb_compact_range");
   plb.add_u64_counter(l_leveldb_compact_queue_merge, "leveldb_compact_queue_merge");
   plb.add_u64(l_leveldb_compact_queue_len, "leveldb_compact_queue_len");
+  plb.add_time_avg(l_leveldb_get_latency, "leveldb_get_latency");
+  plb.add_time_avg(l_leveldb_submit_latency, "leveldb_submit_latency");
+  plb.add_time_avg(l_leveldb_submit_sync_latency, "leveldb_submit_sync_latency");
+  plb.add_u64_avg(l_leveldb_txn_ops, "leveldb_transaction_ops");
+  plb.add_u64_avg(l_leveldb_txn_bytes, "leveldb_transaction_bytes");
+  plb.add_u64_counter(l_leveldb_iter_seeks, "leveldb_iterator_seeks");
+  plb.add_u64_counter(l_leveldb_iter_nexts, "leveldb_iterator_nexts");
+  plb.add_u64_counter(l_leveldb_iter_bytes, "leveldb_iterator_bytes");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
+  start_compaction_sched(cct, "leveldb-compaction");
   return 0;
 }
 
@@ -113,6 +122,8 @@ LevelDBStore::~LevelDBStore()
 
 void LevelDBStore::close()
 {
+  stop_compaction_sched();
+
   // stop compaction thread
   compact_queue_lock.Lock();
   if (compact_thread.is_started()) {
@@ -130,21 +141,41 @@ void LevelDBStore::close()
 
 int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   LevelDBTransactionImpl * _t =
     static_cast<LevelDBTransactionImpl *>(t.get());
   leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
+  logger->tinc(l_leveldb_submit_latency, lat);
+  logger->inc(l_leveldb_txn_ops, _t->ops);
+  logger->inc(l_leveldb_txn_bytes, _t->bytes);
+  if (compaction_sched) {
+    compaction_sched->note_submit(lat);
+    if (s.ok())
+      compaction_sched->note_commit(_t->stats);
+  }
   return s.ok() ? 0 : -1;
 }
 
 int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   LevelDBTransactionImpl * _t =
     static_cast<LevelDBTransactionImpl *>(t.get());
   leveldb::WriteOptions options;
   options.sync = true;
   leveldb::Status s = db->Write(options, &(_t->bat));
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
+  logger->tinc(l_leveldb_submit_sync_latency, lat);
+  logger->inc(l_leveldb_txn_ops, _t->ops);
+  logger->inc(l_leveldb_txn_bytes, _t->bytes);
+  if (compaction_sched) {
+    compaction_sched->note_submit(lat);
+    if (s.ok())
+      compaction_sched->note_commit(_t->stats);
+  }
   return s.ok() ? 0 : -1;
 }
 
@@ -157,9 +188,13 @@ void LevelDBStore::LevelDBTransactionImpl::set(
   bufferlist &bl = *(buffers.rbegin());
   string key = combine_strings(prefix, k);
   keys.push_back(key);
+  ++ops;
+  bytes += key.length() + bl.length();
   bat.Delete(leveldb::Slice(*(keys.rbegin())));
   bat.Put(leveldb::Slice(*(keys.rbegin())),
 	  leveldb::Slice(bl.c_str(), bl.length()));
+  if (db->compaction_sched)
+    stats.note_write(prefix);
 }
 
 void LevelDBStore::LevelDBTransactionImpl::rmkey(const string &prefix,
@@ -167,19 +202,29 @@ void LevelDBStore::LevelDBTransactionImpl::rmkey(const string &prefix,
 {
   string key = combine_strings(prefix, k);
   keys.push_back(key);
+  ++ops;
+  bytes += key.length();
   bat.Delete(leveldb::Slice(*(keys.rbegin())));
+  if (db->compaction_sched)
+    stats.note_delete(prefix);
 }
 
 void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
   KeyValueDB::Iterator it = db->get_iterator(prefix);
+  uint64_t removed = 0;
   for (it->seek_to_first();
        it->valid();
        it->next()) {
+    ++removed;
     string key = combine_strings(prefix, it->key());
     keys.push_back(key);
+    ++ops;
+    bytes += key.length();
     bat.Delete(*(keys.rbegin()));
   }
+  if (db->compaction_sched && removed)
+    stats.note_delete(prefix, removed);
 }
 
 int LevelDBStore::get(
@@ -187,6 +232,7 @@ int LevelDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   KeyValueDB::Iterator it = get_iterator(prefix);
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
@@ -198,6 +244,7 @@ int LevelDBStore::get(
       break;
   }
   logger->inc(l_leveldb_gets);
+  logger->tinc(l_leveldb_get_latency, ceph_clock_now(g_ceph_context) - start);
   return 0;
 }
 
@@ -25,6 +25,7 @@
 #include "common/dout.h"
 #include "include/assert.h"
 #include "common/Formatter.h"
+#include "common/perf_counters.h"
 
 #include "common/ceph_context.h"
 
@@ -38,6 +39,14 @@ enum {
   l_leveldb_compact_range,
   l_leveldb_compact_queue_merge,
   l_leveldb_compact_queue_len,
+  l_leveldb_get_latency,
+  l_leveldb_submit_latency,
+  l_leveldb_submit_sync_latency,
+  l_leveldb_txn_ops,
+  l_leveldb_txn_bytes,
+  l_leveldb_iter_seeks,
+  l_leveldb_iter_nexts,
+  l_leveldb_iter_bytes,
   l_leveldb_last,
 };
 
@@ -176,9 +185,11 @@ public:
     leveldb::WriteBatch bat;
     list<bufferlist> buffers;
     list<string> keys;
+    uint64_t ops, bytes;  ///< keys set or removed, and their size
+    CompactionScheduler::txn_stats_t stats;  ///< for compaction_sched
     LevelDBStore *db;
 
-    LevelDBTransactionImpl(LevelDBStore *db) : db(db) {}
+    LevelDBTransactionImpl(LevelDBStore *db) : ops(0), bytes(0), db(db) {}
     void set(
       const string &prefix,
       const string &k,
@@ -208,25 +219,36 @@ public:
     public KeyValueDB::WholeSpaceIteratorImpl {
   protected:
     boost::scoped_ptr<leveldb::Iterator> dbiter;
+    PerfCounters *logger;
+    uint64_t seeks, nexts, bytes;  ///< added to logger when we are done
   public:
-    LevelDBWholeSpaceIteratorImpl(leveldb::Iterator *iter) :
-      dbiter(iter) { }
-    virtual ~LevelDBWholeSpaceIteratorImpl() { }
+    LevelDBWholeSpaceIteratorImpl(leveldb::Iterator *iter,
+				  PerfCounters *logger) :
+      dbiter(iter), logger(logger), seeks(0), nexts(0), bytes(0) { }
+    virtual ~LevelDBWholeSpaceIteratorImpl() {
+      logger->inc(l_leveldb_iter_seeks, seeks);
+      logger->inc(l_leveldb_iter_nexts, nexts);
+      logger->inc(l_leveldb_iter_bytes, bytes);
+    }
 
     int seek_to_first() {
+      ++seeks;
       dbiter->SeekToFirst();
       return dbiter->status().ok() ? 0 : -1;
     }
     int seek_to_first(const string &prefix) {
+      ++seeks;
       leveldb::Slice slice_prefix(prefix);
       dbiter->Seek(slice_prefix);
       return dbiter->status().ok() ? 0 : -1;
     }
     int seek_to_last() {
+      ++seeks;
       dbiter->SeekToLast();
       return dbiter->status().ok() ? 0 : -1;
     }
     int seek_to_last(const string &prefix) {
+      ++seeks;
       string limit = past_prefix(prefix);
       leveldb::Slice slice_limit(limit);
       dbiter->Seek(slice_limit);
@@ -248,6 +270,7 @@ public:
       return dbiter->status().ok() ? 0 : -1;
     }
     int lower_bound(const string &prefix, const string &to) {
+      ++seeks;
       string bound = combine_strings(prefix, to);
       leveldb::Slice slice_bound(bound);
       dbiter->Seek(slice_bound);
@@ -257,11 +280,13 @@ public:
       return dbiter->Valid();
     }
     int next() {
+      ++nexts;
       if (valid())
 	dbiter->Next();
       return dbiter->status().ok() ? 0 : -1;
     }
     int prev() {
+      ++nexts;
       if (valid())
 	dbiter->Prev();
       return dbiter->status().ok() ? 0 : -1;
@@ -277,6 +302,7 @@ public:
       return make_pair(prefix, key);
     }
     bufferlist value() {
+      bytes += dbiter->value().size();
       return to_bufferlist(dbiter->value());
     }
     int status() {
@@ -289,8 +315,8 @@ public:
     const leveldb::Snapshot *snapshot;
   public:
     LevelDBSnapshotIteratorImpl(leveldb::DB *db, const leveldb::Snapshot *s,
-				leveldb::Iterator *iter) :
-      LevelDBWholeSpaceIteratorImpl(iter), db(db), snapshot(s) { }
+				leveldb::Iterator *iter, PerfCounters *logger) :
+      LevelDBWholeSpaceIteratorImpl(iter, logger), db(db), snapshot(s) { }
 
     ~LevelDBSnapshotIteratorImpl() {
       assert(snapshot != NULL);
@@ -383,7 +409,7 @@ protected:
   WholeSpaceIterator _get_iterator() {
     return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
       new LevelDBWholeSpaceIteratorImpl(
-	db->NewIterator(leveldb::ReadOptions())
+	db->NewIterator(leveldb::ReadOptions()), logger
       )
     );
   }
@@ -397,7 +423,7 @@ protected:
 
     return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
       new LevelDBSnapshotIteratorImpl(db.get(), snapshot,
-	db->NewIterator(options))
+	db->NewIterator(options), logger)
     );
   }
 
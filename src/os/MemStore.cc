@@ -64,7 +64,7 @@ int MemStore::umount()
 int MemStore::_save()
 {
   dout(10) << __func__ << dendl;
-  Mutex::Locker l(apply_lock); // block any writer
+  RWLock::WLocker l(apply_lock); // block any writer
   dump_all();
   set<coll_t> collections;
   for (ceph::unordered_map<coll_t,CollectionRef>::iterator p = coll_map.begin();
@@ -170,7 +170,7 @@ int MemStore::_load()
     int r = cbl.read_file(fn.c_str(), &err);
     if (r < 0)
       return r;
-    CollectionRef c(new Collection);
+    CollectionRef c(new Collection(page_size));
     bufferlist::iterator p = cbl.begin();
     c->decode(p);
     coll_map[*q] = c;
@@ -322,7 +322,7 @@ int MemStore::read(
   else if (offset + l > o->data.length())
     l = o->data.length() - offset;
   bl.clear();
-  bl.substr_of(o->data, offset, l);
+  o->data.read(offset, l, bl);
   return bl.length();
 }
 
@@ -345,7 +345,7 @@ int MemStore::fiemap(coll_t cid, const ghobject_t& oid,
   if (offset + l > o->data.length())
     l = o->data.length() - offset;
   map<uint64_t, uint64_t> m;
-  m[offset] = l;
+  o->data.get_extents(offset, l, &m);
   ::encode(m, bl);
   return 0;  
 }
@@ -659,8 +659,17 @@ int MemStore::queue_transactions(Sequencer *osr,
 				 TrackedOpRef op,
 				 ThreadPool::TPHandle *handle)
 {
-  // fixme: ignore the Sequencer and serialize everything.
-  Mutex::Locker l(apply_lock);
+  if (!osr)
+    osr = &default_osr;
+  OpSequencer *osr_impl;
+  if (osr->p) {
+    osr_impl = static_cast<OpSequencer *>(osr->p);
+  } else {
+    osr_impl = new OpSequencer(&finisher);
+    osr->p = osr_impl;
+  }
+  RWLock::RLocker l(apply_lock);
+  Mutex::Locker ol(osr_impl->apply_lock);
 
   for (list<Transaction*>::iterator p = tls.begin(); p != tls.end(); ++p) {
     // poke the TPHandle heartbeat just to exercise that code path
@@ -1044,7 +1053,7 @@ int MemStore::_touch(coll_t cid, const ghobject_t& oid)
 
   ObjectRef o = c->get_object(oid);
   if (!o) {
-    o.reset(new Object);
+    o.reset(new Object(c->page_size));
     c->object_map[oid] = o;
     c->object_hash[oid] = o;
   }
@@ -1067,53 +1076,35 @@ int MemStore::_write(coll_t cid, const ghobject_t& oid,
   ObjectRef o = c->get_object(oid);
   if (!o) {
     // write implicitly creates a missing object
-    o.reset(new Object);
+    o.reset(new Object(c->page_size));
     c->object_map[oid] = o;
     c->object_hash[oid] = o;
   }
 
-  _write_into_bl(bl, offset, &o->data);
+  o->data.write(offset, bl);
   return 0;
 }
 
-void MemStore::_write_into_bl(const bufferlist& src, unsigned offset,
-			      bufferlist *dst)
-{
-  unsigned len = src.length();
-
-  // before
-  bufferlist newdata;
-  if (dst->length() >= offset) {
-    newdata.substr_of(*dst, 0, offset);
-  } else {
-    newdata.substr_of(*dst, 0, dst->length());
-    bufferptr bp(offset - dst->length());
-    bp.zero();
-    newdata.append(bp);
-  }
-
-  newdata.append(src);
-
-  // after
-  if (dst->length() > offset + len) {
-    bufferlist tail;
-    tail.substr_of(*dst, offset + len, dst->length() - (offset + len));
-    newdata.append(tail);
-  }
-
-  dst->claim(newdata);
-}
-
 int MemStore::_zero(coll_t cid, const ghobject_t& oid,
 		    uint64_t offset, size_t len)
 {
   dout(10) << __func__ << " " << cid << " " << oid << " " << offset << "~"
 	   << len << dendl;
-  bufferptr bp(len);
-  bp.zero();
-  bufferlist bl;
-  bl.push_back(bp);
-  return _write(cid, oid, offset, len, bl);
+  CollectionRef c = get_collection(cid);
+  if (!c)
+    return -ENOENT;
+  RWLock::WLocker l(c->lock);
+
+  ObjectRef o = c->get_object(oid);
+  if (!o) {
+    // zero implicitly creates a missing object, like write
+    o.reset(new Object(c->page_size));
+    c->object_map[oid] = o;
+    c->object_hash[oid] = o;
+  }
+
+  o->data.zero(offset, len);
+  return 0;
 }
 
 int MemStore::_truncate(coll_t cid, const ghobject_t& oid, uint64_t size)
@@ -1127,17 +1118,7 @@ int MemStore::_truncate(coll_t cid, const ghobject_t& oid, uint64_t size)
   ObjectRef o = c->get_object(oid);
   if (!o)
     return -ENOENT;
-  if (o->data.length() > size) {
-    bufferlist bl;
-    bl.substr_of(o->data, 0, size);
-    o->data.claim(bl);
-  } else if (o->data.length() == size) {
-    // do nothing
-  } else {
-    bufferptr bp(size - o->data.length());
-    bp.zero();
-    o->data.append(bp);
-  }
+  o->data.truncate(size);
   return 0;
 }
 
@@ -1221,7 +1202,7 @@ int MemStore::_clone(coll_t cid, const ghobject_t& oldoid,
     return -ENOENT;
   ObjectRef no = c->get_object(newoid);
   if (!no) {
-    no.reset(new Object);
+    no.reset(new Object(c->page_size));
     c->object_map[newoid] = no;
     c->object_hash[newoid] = no;
   }
@@ -1250,7 +1231,7 @@ int MemStore::_clone_range(coll_t cid, const ghobject_t& oldoid,
     return -ENOENT;
   ObjectRef no = c->get_object(newoid);
   if (!no) {
-    no.reset(new Object);
+    no.reset(new Object(c->page_size));
     c->object_map[newoid] = no;
     c->object_hash[newoid] = no;
   }
@@ -1259,8 +1240,8 @@ int MemStore::_clone_range(coll_t cid, const ghobject_t& oldoid,
   if (srcoff + len >= oo->data.length())
     len = oo->data.length() - srcoff;
   bufferlist bl;
-  bl.substr_of(oo->data, srcoff, len);
-  _write_into_bl(bl, dstoff, &no->data);
+  oo->data.read(srcoff, len, bl);
+  no->data.write(dstoff, bl);
   return len;
 }
 
@@ -1356,7 +1337,7 @@ int MemStore::_create_collection(coll_t cid)
   ceph::unordered_map<coll_t,CollectionRef>::iterator cp = coll_map.find(cid);
   if (cp != coll_map.end())
     return -EEXIST;
-  coll_map[cid].reset(new Collection);
+  coll_map[cid].reset(new Collection(page_size));
   return 0;
 }
 
@@ -1446,27 +1427,27 @@ int MemStore::_collection_setattr(coll_t cid, const char *name,
 				  const void *value, size_t size)
 {
   dout(10) << __func__ << " " << cid << " " << name << dendl;
-  ceph::unordered_map<coll_t,CollectionRef>::iterator cp = coll_map.find(cid);
-  if (cp == coll_map.end())
+  CollectionRef c = get_collection(cid);
+  if (!c)
     return -ENOENT;
-  RWLock::WLocker l(cp->second->lock);
+  RWLock::WLocker l(c->lock);
 
-  cp->second->xattr[name] = bufferptr((const char *)value, size);
+  c->xattr[name] = bufferptr((const char *)value, size);
   return 0;
 }
 
 int MemStore::_collection_setattrs(coll_t cid, map<string,bufferptr> &aset)
 {
   dout(10) << __func__ << " " << cid << dendl;
-  ceph::unordered_map<coll_t,CollectionRef>::iterator cp = coll_map.find(cid);
-  if (cp == coll_map.end())
+  CollectionRef c = get_collection(cid);
+  if (!c)
     return -ENOENT;
-  RWLock::WLocker l(cp->second->lock);
+  RWLock::WLocker l(c->lock);
 
   for (map<string,bufferptr>::const_iterator p = aset.begin();
        p != aset.end();
        ++p) {
-    cp->second->xattr[p->first] = p->second;
+    c->xattr[p->first] = p->second;
   }
   return 0;
 }
@@ -1474,14 +1455,14 @@ int MemStore::_collection_setattrs(coll_t cid, map<string,bufferptr> &aset)
 int MemStore::_collection_rmattr(coll_t cid, const char *name)
 {
   dout(10) << __func__ << " " << cid << " " << name << dendl;
-  ceph::unordered_map<coll_t,CollectionRef>::iterator cp = coll_map.find(cid);
-  if (cp == coll_map.end())
+  CollectionRef c = get_collection(cid);
+  if (!c)
     return -ENOENT;
-  RWLock::WLocker l(cp->second->lock);
+  RWLock::WLocker l(c->lock);
 
-  if (cp->second->xattr.count(name) == 0)
+  if (c->xattr.count(name) == 0)
     return -ENODATA;
-  cp->second->xattr.erase(name);
+  c->xattr.erase(name);
   return 0;
 }
 
@@ -22,15 +22,18 @@
 #include "common/Finisher.h"
 #include "common/RWLock.h"
 #include "ObjectStore.h"
+#include "PageSet.h"
 
 class MemStore : public ObjectStore {
 public:
   struct Object {
-    bufferlist data;
+    PageSet data;
     map<string,bufferptr> xattr;
     bufferlist omap_header;
     map<string,bufferlist> omap;
 
+    explicit Object(uint64_t page_size) : data(page_size) {}
+
     void encode(bufferlist& bl) const {
       ENCODE_START(1, 1, bl);
       ::encode(data, bl);
@@ -49,6 +52,7 @@ public:
     }
     void dump(Formatter *f) const {
       f->dump_int("data_len", data.length());
+      f->dump_int("data_allocated", data.get_allocated());
       f->dump_int("omap_header_len", omap_header.length());
 
       f->open_array_section("xattrs");
@@ -80,12 +84,13 @@ public:
     ceph::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
     map<ghobject_t, ObjectRef> object_map;        ///< for iteration
     map<string,bufferptr> xattr;
-    RWLock lock;   ///< for object_{map,hash}
+    uint64_t page_size;  ///< for new objects' data
+    RWLock lock;   ///< for object_{map,hash} and the objects' contents
 
-    // NOTE: The lock only needs to protect the object_map/hash, not the
-    // contents of individual objects.  The osd is already sequencing
-    // reads and writes, so we will never see them concurrently at this
-    // level.
+    // NOTE: The osd is already sequencing reads and writes to an
+    // object, so we will never see them concurrently at this level.
+    // But the data pages are shared with readers (and clones), so
+    // readers take the lock for read and writers for write.
 
     ObjectRef get_object(ghobject_t oid) {
       ceph::unordered_map<ghobject_t,ObjectRef>::iterator o = object_hash.find(oid);
@@ -115,7 +120,7 @@ public:
       while (s--) {
 	ghobject_t k;
 	::decode(k, p);
-	ObjectRef o(new Object);
+	ObjectRef o(new Object(page_size));
 	o->decode(p);
 	object_map.insert(make_pair(k, o));
 	object_hash.insert(make_pair(k, o));
@@ -123,7 +128,8 @@ public:
       DECODE_FINISH(p);
     }
 
-    Collection() : lock("MemStore::Collection::lock") {}
+    explicit Collection(uint64_t page_size)
+      : page_size(page_size), lock("MemStore::Collection::lock") {}
   };
   typedef ceph::shared_ptr<Collection> CollectionRef;
 
@@ -174,9 +180,35 @@ private:
   };
 
 
+  /**
+   * Updates on a sequencer (i.e., a PG) are applied in order under its
+   * lock; the per-collection locks keep sequencers working on
+   * different collections out of each other's way.
+   */
+  struct OpSequencer : public Sequencer_impl {
+    Mutex apply_lock;
+    Finisher *finisher;
+
+    OpSequencer(Finisher *f)
+      : apply_lock("MemStore::OpSequencer::apply_lock"),
+	finisher(f) {}
+
+    void flush() {
+      // updates are applied synchronously; wait for one in progress
+      Mutex::Locker l(apply_lock);
+    }
+    bool flush_commit(Context *c) {
+      // commits are queued on the finisher, in order
+      finisher->queue(c);
+      return false;
+    }
+  };
+
   ceph::unordered_map<coll_t, CollectionRef> coll_map;
   RWLock coll_lock;    ///< rwlock to protect coll_map
-  Mutex apply_lock;    ///< serialize all updates
+  RWLock apply_lock;   ///< updates take it for read, _save() for write
+  Sequencer default_osr;
+  uint64_t page_size;  ///< memstore_page_size
 
   CollectionRef get_collection(coll_t cid);
 
@@ -184,8 +216,6 @@ private:
 
   void _do_transaction(Transaction& t);
 
-  void _write_into_bl(const bufferlist& src, unsigned offset, bufferlist *dst);
-
   int _touch(coll_t cid, const ghobject_t& oid);
   int _write(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl,
       bool replica = false);
@@ -231,6 +261,8 @@ public:
     : ObjectStore(path),
       coll_lock("MemStore::coll_lock"),
       apply_lock("MemStore::apply_lock"),
+      default_osr("default"),
+      page_size(cct->_conf->memstore_page_size),
       finisher(cct),
       sharded(false) { }
   ~MemStore() { }
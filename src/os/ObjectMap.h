@@ -17,6 +17,7 @@
 
 #include "IndexManager.h"
 #include "SequencerPosition.h"
+#include "KeyValueDB.h"
 #include <string>
 #include <vector>
 #include "include/memory.h"
@@ -137,23 +138,59 @@ public:
 
   virtual bool check(std::ostream &out) { return true; }
 
-  class ObjectMapIteratorImpl {
-  public:
-    virtual int seek_to_first() = 0;
-    virtual int upper_bound(const string &after) = 0;
-    virtual int lower_bound(const string &to) = 0;
-    virtual bool valid() = 0;
-    virtual int next() = 0;
-    virtual string key() = 0;
-    virtual bufferlist value() = 0;
-    virtual int status() = 0;
-    virtual ~ObjectMapIteratorImpl() {}
-  };
+  typedef KeyValueDB::SimplestIteratorImpl ObjectMapIteratorImpl;
   typedef ceph::shared_ptr<ObjectMapIteratorImpl> ObjectMapIterator;
   virtual ObjectMapIterator get_iterator(const ghobject_t &oid) {
     return ObjectMapIterator();
   }
 
+  /// One read of a batch (@see get_values_batch)
+  struct OmapRead {
+    ghobject_t oid;
+    string start_after;           ///< [in] keys after this one
+    string filter_prefix;         ///< [in] keys starting with this
+    uint64_t max_return;          ///< [in] at most this many keys
+    map<string, bufferlist> out;  ///< [out] keys and values read
+    int r;                        ///< [out] 0 or negative error code
+
+    OmapRead() : max_return(0), r(0) {}
+    OmapRead(const ghobject_t &oid, const string &start_after,
+	     const string &filter_prefix, uint64_t max_return)
+      : oid(oid), start_after(start_after), filter_prefix(filter_prefix),
+	max_return(max_return), r(0) {}
+  };
+
+  /**
+   * Read a key range of each of several objects
+   *
+   * Implementations can serve all of them from a single iterator
+   * instead of setting one up per object.
+   */
+  virtual void get_values_batch(
+    vector<OmapRead> &reads             ///< [in,out] the reads
+    ) {
+    for (vector<OmapRead>::iterator p = reads.begin(); p != reads.end(); ++p)
+      p->r = read_range(get_iterator(p->oid), &*p);
+  }
+
+  /// Do read off iter, a fresh iterator on read->oid (NULL if none)
+  static int read_range(ObjectMapIterator iter, OmapRead *read) {
+    if (!iter)
+      return -ENOENT;
+    if (read->filter_prefix >= read->start_after)
+      iter->lower_bound(read->filter_prefix);
+    else
+      iter->upper_bound(read->start_after);
+    for (uint64_t i = 0; i < read->max_return && iter->valid();
+	 ++i, iter->next()) {
+      string key = iter->key();
+      if (key.compare(0, read->filter_prefix.size(), read->filter_prefix))
+	break;
+      read->out.insert(make_pair(key, iter->value()));
+    }
+    return iter->status();
+  }
+
 
   virtual ~ObjectMap() {}
 };
@@ -19,6 +19,7 @@
 #include "FileStore.h"
 #include "MemStore.h"
 #include "KeyValueStore.h"
+#include "BlockStore.h"
 #include "common/safe_io.h"
 
 ObjectStore *ObjectStore::create(CephContext *cct,
@@ -36,6 +37,9 @@ ObjectStore *ObjectStore::create(CephContext *cct,
   if (type == "keyvaluestore-dev") {
     return new KeyValueStore(data);
   }
+  if (type == "blockstore-dev") {
+    return new BlockStore(cct, data);
+  }
   return NULL;
 }
 
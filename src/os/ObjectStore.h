@@ -53,6 +53,17 @@ enum {
   l_os_j_wr,
   l_os_j_wr_bytes,
   l_os_j_full,
+  l_os_index_split_pending,
+  l_os_index_split_objects,
+  l_os_index_splits,
+  l_os_index_merges,
+  l_os_index_split_stall_lat,
+  l_os_j_replay_entries,
+  l_os_j_replay_bytes,
+  l_os_j_replay_threads,
+  l_os_j_replay_time,
+  l_os_uring_batch,
+  l_os_uring_lat,
   l_os_committing,
   l_os_commit,
   l_os_commit_len,
@@ -388,6 +399,8 @@ public:
     uint64_t pad_unused_bytes;
     uint32_t largest_data_len, largest_data_off, largest_data_off_in_tbl;
     bufferlist tbl;
+    /// (offset in tbl, length) of each write payload, if known
+    vector<pair<uint32_t, uint32_t> > data_payloads;
     bool sobject_encoding;
     int64_t pool_override;
     bool use_pool_override;
@@ -469,6 +482,7 @@ public:
       std::swap(largest_data_len, other.largest_data_len);
       std::swap(largest_data_off, other.largest_data_off);
       std::swap(largest_data_off_in_tbl, other.largest_data_off_in_tbl);
+      data_payloads.swap(other.data_payloads);
       std::swap(on_applied, other.on_applied);
       std::swap(on_commit, other.on_commit);
       std::swap(on_applied_sync, other.on_applied_sync);
@@ -485,6 +499,11 @@ public:
 	largest_data_off = other.largest_data_off;
 	largest_data_off_in_tbl = tbl.length() + other.largest_data_off_in_tbl;
       }
+      for (vector<pair<uint32_t, uint32_t> >::iterator p =
+	     other.data_payloads.begin();
+	   p != other.data_payloads.end();
+	   ++p)
+	data_payloads.push_back(make_pair(tbl.length() + p->first, p->second));
       tbl.append(other.tbl);
       on_applied.splice(on_applied.end(), other.on_applied);
       on_commit.splice(on_commit.end(), other.on_commit);
@@ -711,6 +730,9 @@ public:
 	largest_data_off = off;
 	largest_data_off_in_tbl = tbl.length() + sizeof(__u32);  // we are about to
       }
+      if (data.length())
+	data_payloads.push_back(make_pair(tbl.length() + sizeof(__u32),
+					  data.length()));
       ::encode(data, tbl);
       ops++;
     }
@@ -1065,6 +1087,22 @@ public:
       decode(dp);
     }
 
+    /**
+     * Encode for the local journal.
+     *
+     * Write payloads of at least align_min bytes are moved out of the
+     * op stream into a trailing data section.  Each payload starts on a
+     * page boundary counted from the start of bl, and the original
+     * buffers are referenced.  If the journal entry itself starts on a
+     * page, an O_DIRECT journal can write them without copying.
+     *
+     * The result can only be decoded by this version or newer, so it
+     * must not go on the wire.
+     *
+     * @return false (and encode nothing) if no payload qualifies
+     */
+    bool encode_journal(bufferlist& bl, unsigned align_min) const;
+
     void encode(bufferlist& bl) const {
       ENCODE_START(7, 5, bl);
       ::encode(ops, bl);
@@ -1077,7 +1115,7 @@ public:
       ENCODE_FINISH(bl);
     }
     void decode(bufferlist::iterator &bl) {
-      DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
+      DECODE_START_LEGACY_COMPAT_LEN(8, 5, 5, bl);
       DECODE_OLDEST(2);
       if (struct_v < 4)
 	sobject_encoding = true;
@@ -1090,15 +1128,40 @@ public:
 	::decode(largest_data_off, bl);
 	::decode(largest_data_off_in_tbl, bl);
       }
-      ::decode(tbl, bl);
+      data_payloads.clear();
+      if (struct_v >= 8) {
+	::decode(tolerate_collection_add_enoent, bl);
+	decode_journal_data(bl);
+      } else {
+	::decode(tbl, bl);
+	// the payload positions are not encoded; only the largest is known
+	if (largest_data_len && largest_data_off_in_tbl)
+	  data_payloads.push_back(make_pair(largest_data_off_in_tbl,
+					    largest_data_len));
+      }
       if (struct_v < 6) {
 	use_pool_override = true;
       }
-      if (struct_v >= 7) {
+      if (struct_v == 7) {
 	::decode(tolerate_collection_add_enoent, bl);
       }
       DECODE_FINISH(bl);
     }
+    /// reassemble tbl from the op stream and data section of encode_journal()
+    void decode_journal_data(bufferlist::iterator &bl);
+
+    /**
+     * Collect what the transaction touches, so that transactions that
+     * touch disjoint sets can be applied in any order (journal replay).
+     *
+     * @param objects [out] objects read or modified
+     * @param colls [out] collections holding those objects
+     * @param coll_ops [out] collections created, removed, renamed, split
+     *                 or whose attrs or hints change
+     * @return false if an op could not be classified
+     */
+    bool get_touched(set<ghobject_t> *objects, set<coll_t> *colls,
+		     set<coll_t> *coll_ops);
 
     void dump(ceph::Formatter *f);
     static void generate_test_instances(list<Transaction*>& o);
@@ -1577,6 +1640,23 @@ public:
     const ghobject_t &oid  ///< [in] object
     ) = 0;
 
+  /**
+   * Read a key range of each of several objects in c
+   *
+   * Each read gets what get_omap_iterator() and a walk from start_after
+   * would; -ENOENT if the object does not exist.  Stores can serve the
+   * whole batch off a single backend iterator.
+   */
+  virtual void omap_get_values_batch(
+    coll_t c,                             ///< [in] collection
+    vector<ObjectMap::OmapRead> &reads    ///< [in,out] the reads
+    ) {
+    for (vector<ObjectMap::OmapRead>::iterator p = reads.begin();
+	 p != reads.end();
+	 ++p)
+      p->r = ObjectMap::read_range(get_omap_iterator(c, p->oid), &*p);
+  }
+
   virtual void sync(Context *onsync) {}
   virtual void sync() {}
   virtual void flush() {}
@@ -0,0 +1,140 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "PageSet.h"
+#include "include/assert.h"
+#include "include/intarith.h"
+
+bufferptr& PageSet::get_page_for_write(uint64_t idx)
+{
+  std::map<uint64_t, bufferptr>::iterator p = pages.lower_bound(idx);
+  if (p == pages.end() || p->first != idx) {
+    bufferptr bp = buffer::create_page_aligned(page_size);
+    bp.zero();
+    p = pages.insert(p, std::make_pair(idx, bp));
+  } else if (p->second.raw_nref() > 1) {
+    // a clone, a reader or the writer's buffer still has it
+    bufferptr bp = buffer::create_page_aligned(page_size);
+    bp.copy_in(0, page_size, p->second.c_str());
+    p->second.swap(bp);
+  }
+  return p->second;
+}
+
+void PageSet::read(uint64_t off, uint64_t l, bufferlist& bl) const
+{
+  uint64_t end = off + l;
+  std::map<uint64_t, bufferptr>::const_iterator p =
+    pages.lower_bound(off / page_size);
+  while (off < end) {
+    uint64_t idx = off / page_size;
+    if (p != pages.end() && p->first == idx) {
+      uint64_t in = off % page_size;
+      uint64_t n = MIN(page_size - in, end - off);
+      bl.push_back(bufferptr(p->second, in, n));
+      off += n;
+      ++p;
+    } else {
+      // a hole, up to the next page we have
+      uint64_t n = end - off;
+      if (p != pages.end())
+	n = MIN(n, p->first * page_size - off);
+      bufferptr bp(n);
+      bp.zero();
+      bl.push_back(bp);
+      off += n;
+    }
+  }
+}
+
+void PageSet::write(uint64_t off, const bufferlist& bl)
+{
+  bufferlist src(bl);  // for the iterator; shares the buffers
+  bufferlist::iterator i = src.begin();
+  uint64_t end = off + bl.length();
+  uint64_t pos = off;
+  while (pos < end) {
+    uint64_t idx = pos / page_size;
+    uint64_t in = pos % page_size;
+    uint64_t n = MIN(page_size - in, end - pos);
+    if (n == page_size) {
+      bufferptr cur = i.get_current_ptr();
+      if (cur.length() >= page_size) {
+	// a whole page out of one buffer: keep a reference to it
+	pages[idx] = bufferptr(cur, 0, page_size);
+	i.advance(page_size);
+	pos += n;
+	continue;
+      }
+    }
+    bufferptr& page = get_page_for_write(idx);
+    i.copy(n, page.c_str() + in);
+    pos += n;
+  }
+  if (end > len)
+    len = end;
+}
+
+void PageSet::zero(uint64_t off, uint64_t l)
+{
+  uint64_t end = off + l;
+  uint64_t first = (off + page_size - 1) / page_size;  // first whole page
+  uint64_t last = end / page_size;                     // past the last one
+
+  // partial head page (the whole range, if it is within one page)
+  if (off % page_size) {
+    uint64_t n = MIN(end, first * page_size) - off;
+    if (pages.count(off / page_size))
+      get_page_for_write(off / page_size).zero(off % page_size, n);
+  }
+  if (first < last)
+    pages.erase(pages.lower_bound(first), pages.lower_bound(last));
+  // partial tail page
+  if ((end % page_size) && last >= first) {
+    if (pages.count(last))
+      get_page_for_write(last).zero(0, end % page_size);
+  }
+  if (end > len)
+    len = end;
+}
+
+void PageSet::truncate(uint64_t size)
+{
+  if (size < len) {
+    // keep everything past the end zeroed, for when it grows again
+    uint64_t first = (size + page_size - 1) / page_size;
+    pages.erase(pages.lower_bound(first), pages.end());
+    if ((size % page_size) && pages.count(size / page_size))
+      get_page_for_write(size / page_size).zero(size % page_size,
+						page_size - size % page_size);
+  }
+  len = size;
+}
+
+void PageSet::get_extents(uint64_t off, uint64_t l,
+			  std::map<uint64_t, uint64_t> *m) const
+{
+  uint64_t end = MIN(off + l, len);
+  uint64_t last_end = 0;
+  for (std::map<uint64_t, bufferptr>::const_iterator p =
+	 pages.lower_bound(off / page_size);
+       p != pages.end() && p->first * page_size < end;
+       ++p) {
+    uint64_t start = MAX(off, p->first * page_size);
+    uint64_t stop = MIN(end, (p->first + 1) * page_size);
+    if (!m->empty() && last_end == start)
+      m->rbegin()->second += stop - start;
+    else
+      (*m)[start] = stop - start;
+    last_end = stop;
+  }
+}
@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_PAGESET_H
+#define CEPH_OS_PAGESET_H
+
+#include <map>
+
+#include "include/buffer.h"
+#include "include/encoding.h"
+
+/**
+ * Object data kept as a sparse set of fixed-size pages.
+ *
+ * A write only touches the pages it covers, and a read hands out
+ * references to the pages instead of copying them.  Pages are shared
+ * (refcounted bufferptrs) between clones, readers and, for whole-page
+ * writes, the buffer that was written; a page is copied before it is
+ * modified if anyone else still holds it.
+ *
+ * Pages that were never written, or were zeroed or truncated away,
+ * are holes and read back as zeros.
+ */
+class PageSet {
+  uint64_t page_size;
+  uint64_t len;
+  std::map<uint64_t, bufferptr> pages;  ///< page index -> page
+
+  /// page idx, allocated if it is a hole and made private if shared
+  bufferptr& get_page_for_write(uint64_t idx);
+
+public:
+  explicit PageSet(uint64_t page_size)
+    : page_size(page_size), len(0) {}
+
+  uint64_t length() const {
+    return len;
+  }
+  uint64_t get_page_size() const {
+    return page_size;
+  }
+  /// bytes held in pages (shared pages are counted by every holder)
+  uint64_t get_allocated() const {
+    return pages.size() * page_size;
+  }
+
+  /// append off~l to bl; holes read back as zeros
+  void read(uint64_t off, uint64_t l, bufferlist& bl) const;
+  /// write bl at off, extending the length if needed
+  void write(uint64_t off, const bufferlist& bl);
+  /// zero off~l, freeing the pages it covers; extends the length
+  void zero(uint64_t off, uint64_t l);
+  void truncate(uint64_t size);
+  /// allocated ranges within off~l, in the fiemap() format
+  void get_extents(uint64_t off, uint64_t l,
+		   std::map<uint64_t, uint64_t> *m) const;
+
+  // encoded as the plain data, so that the page size can change
+  void encode(bufferlist& bl) const {
+    bufferlist data;
+    read(0, len, data);
+    ::encode(data, bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    bufferlist data;
+    ::decode(data, p);
+    pages.clear();
+    len = 0;
+    write(0, data);
+  }
+};
+WRITE_CLASS_ENCODER(PageSet)
+
+#endif
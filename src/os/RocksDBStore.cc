@@ -5,7 +5,11 @@
 #include <map>
 #include <string>
 #include <tr1/memory>
+#include <algorithm>
 #include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "rocksdb/db.h"
 #include "rocksdb/env.h"
@@ -13,9 +17,14 @@
 #include "rocksdb/slice.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/statistics.h"
 
 using std::string;
 #include "common/perf_counters.h"
+#include "common/strtol.h"
+#include "include/str_list.h"
+#include "common/safe_io.h"
+#include "include/compat.h"
 #include "KeyValueDB.h"
 #include "RocksDBStore.h"
 
@@ -42,11 +51,276 @@ int RocksDBStore::init()
   options.disableWAL = g_conf->rocksdb_disableWAL;
   options.wal_dir = g_conf->rocksdb_wal_dir;
   options.info_log_level = g_conf->rocksdb_info_log_level;
+  options.column_families = g_conf->rocksdb_column_families;
   return 0;
 }
 
+string RocksDBStore::cf_spec_t::get_cf_name() const
+{
+  return name + ":" + str_join(prefixes, ",");
+}
+
+int RocksDBStore::cf_spec_t::parse_cf_name(const string &cf_name)
+{
+  size_t pos = cf_name.find(':');
+  if (pos == string::npos || pos == 0)
+    return -EINVAL;
+  name = cf_name.substr(0, pos);
+  get_str_vec(cf_name.substr(pos + 1), ",", prefixes);
+  if (prefixes.empty())
+    return -EINVAL;
+  return 0;
+}
+
+int RocksDBStore::parse_column_families(const string &spec,
+					vector<cf_spec_t> *out,
+					ostream &err)
+{
+  vector<string> entries;
+  get_str_vec(spec, " \t;", entries);
+  set<string> names, prefixes;
+  double shares = 0;
+  for (vector<string>::iterator p = entries.begin(); p != entries.end(); ++p) {
+    vector<string> fields;
+    get_str_vec(*p, "/", fields);
+    size_t eq = fields.empty() ? string::npos : fields[0].find('=');
+    if (eq == string::npos || eq == 0 || eq + 1 == fields[0].size()) {
+      err << "bad column family '" << *p << "'" << std::endl;
+      return -EINVAL;
+    }
+    cf_spec_t cf;
+    cf.name = fields[0].substr(0, eq);
+    if (cf.name.find(':') != string::npos || !names.insert(cf.name).second) {
+      err << "bad or duplicate column family name '" << cf.name << "'"
+	  << std::endl;
+      return -EINVAL;
+    }
+    get_str_vec(fields[0].substr(eq + 1), ",", cf.prefixes);
+    for (vector<string>::iterator q = cf.prefixes.begin();
+	 q != cf.prefixes.end();
+	 ++q) {
+      if (!prefixes.insert(*q).second) {
+	err << "prefix '" << *q << "' is in more than one column family"
+	    << std::endl;
+	return -EINVAL;
+      }
+    }
+    for (unsigned i = 1; i < fields.size(); ++i) {
+      size_t oeq = fields[i].find('=');
+      string key = fields[i].substr(0, oeq);
+      string val = oeq == string::npos ? string() : fields[i].substr(oeq + 1);
+      string perr;
+      if (key == "compaction") {
+	if (val != "level" && val != "universal")
+	  perr = "not level or universal";
+	cf.compaction = val;
+      } else if (key == "cache") {
+	cf.cache_share = strict_strtod(val.c_str(), &perr);
+	if (perr.empty() && (cf.cache_share < 0 || cf.cache_share >= 1))
+	  perr = "not in [0, 1)";
+      } else if (key == "bloom") {
+	cf.bloom = strict_strtol(val.c_str(), 10, &perr);
+	if (perr.empty() && cf.bloom < 0)
+	  perr = "negative";
+      } else {
+	perr = "unknown option";
+      }
+      if (!perr.empty()) {
+	err << "column family " << cf.name << ": bad option '" << fields[i]
+	    << "': " << perr << std::endl;
+	return -EINVAL;
+      }
+    }
+    shares += cf.cache_share;
+    out->push_back(cf);
+  }
+  if (shares >= 1) {
+    err << "column family cache shares add up to " << shares
+	<< ", leaving nothing for the default" << std::endl;
+    return -EINVAL;
+  }
+  return 0;
+}
+
+static rocksdb::ColumnFamilyOptions get_cf_options(
+  const rocksdb::Options &base,
+  const RocksDBStore::cf_spec_t &cf,
+  uint64_t cache_size,
+  vector<const rocksdb::FilterPolicy*> *filterpolicies)
+{
+  rocksdb::ColumnFamilyOptions cfoptions(base);
+  if (cf.compaction == "universal")
+    cfoptions.compaction_style = rocksdb::kCompactionStyleUniversal;
+  else if (cf.compaction == "level")
+    cfoptions.compaction_style = rocksdb::kCompactionStyleLevel;
+  if (cf.cache_share > 0 && cache_size)
+    cfoptions.block_cache =
+      rocksdb::NewLRUCache((uint64_t)(cache_size * cf.cache_share));
+  if (cf.bloom == 0) {
+    cfoptions.filter_policy = NULL;
+  } else if (cf.bloom > 0) {
+    const rocksdb::FilterPolicy *_filterpolicy =
+      rocksdb::NewBloomFilterPolicy(cf.bloom);
+    cfoptions.filter_policy = _filterpolicy;
+    filterpolicies->push_back(_filterpolicy);
+  }
+  return cfoptions;
+}
+
+// outside a migration each prefix is in at most one of cfs
+void RocksDBStore::set_column_families(
+  const vector<cf_spec_t> &cfs,
+  const vector<rocksdb::ColumnFamilyHandle*> &handles)
+{
+  assert(handles.size() == cfs.size() + 1);
+  column_families = cfs;
+  cf_handles = handles;
+  cf_by_prefix.clear();
+  for (unsigned i = 0; i < cfs.size(); ++i) {
+    for (vector<string>::const_iterator p = cfs[i].prefixes.begin();
+	 p != cfs[i].prefixes.end();
+	 ++p)
+      cf_by_prefix[*p] = handles[i + 1];
+  }
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf(const string &prefix)
+{
+  // the longest match; anything that prefix starts with sorts before it
+  rocksdb::ColumnFamilyHandle *cf = cf_handles[0];
+  size_t len = 0;
+  map<string, rocksdb::ColumnFamilyHandle*>::iterator end =
+    cf_by_prefix.upper_bound(prefix);
+  for (map<string, rocksdb::ColumnFamilyHandle*>::iterator p =
+	 cf_by_prefix.begin();
+       p != end;
+       ++p) {
+    if (p->first.length() > len &&
+	prefix.compare(0, p->first.length(), p->first) == 0) {
+      cf = p->second;
+      len = p->first.length();
+    }
+  }
+  return cf;
+}
+
+#define CF_MIGRATION_FILE "CF_MIGRATION"
+
+int RocksDBStore::read_cf_migration(string *spec)
+{
+  char buf[4096];
+  int r = safe_read_file(path.c_str(), CF_MIGRATION_FILE, buf, sizeof(buf));
+  if (r < 0)
+    return r;
+  *spec = string(buf, r);
+  return 0;
+}
+
+int RocksDBStore::write_cf_migration(const string &spec)
+{
+  return safe_write_file(path.c_str(), CF_MIGRATION_FILE,
+			 spec.c_str(), spec.length());
+}
+
+int RocksDBStore::clear_cf_migration()
+{
+  string fn = path + "/" CF_MIGRATION_FILE;
+  if (::unlink(fn.c_str()) < 0)
+    return -errno;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -errno;
+  int r = ::fsync(fd);
+  if (r < 0)
+    r = -errno;
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  return r;
+}
+
 int RocksDBStore::do_open(ostream &out, bool create_if_missing)
 {
+  vector<cf_spec_t> layout;
+  int r = parse_column_families(options.column_families, &layout, out);
+  if (r < 0)
+    return r;
+
+  // an existing store opens with the families it has; a new one is
+  // created with the configured ones
+  struct stat st;
+  bool new_store = ::stat((path + "/CURRENT").c_str(), &st) < 0;
+  vector<string> existing;
+  vector<cf_spec_t> cfs;
+  rocksdb::Status status;
+  if (new_store) {
+    cfs = layout;
+  } else {
+    string spec;
+    r = read_cf_migration(&spec);
+    if (r == 0 && !options.migrating) {
+      out << "an interrupted migrate-column-families to '" << spec
+	  << "' left keys in more than one column family; run"
+	  << " ceph-kvstore-tool migrate-column-families to finish it"
+	  << std::endl;
+      return -EBUSY;
+    }
+    if (r < 0 && r != -ENOENT) {
+      out << "reading " << CF_MIGRATION_FILE << ": " << cpp_strerror(r)
+	  << std::endl;
+      return r;
+    }
+    status = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(), path,
+					     &existing);
+    if (!status.ok()) {
+      out << "listing column families: " << status.ToString() << std::endl;
+      return -EIO;
+    }
+    set<string> prefixes;
+    for (vector<string>::iterator p = existing.begin();
+	 p != existing.end();
+	 ++p) {
+      if (*p == rocksdb::kDefaultColumnFamilyName)
+	continue;
+      cf_spec_t cf;
+      if (cf.parse_cf_name(*p) < 0) {
+	out << "unrecognized column family '" << *p << "'" << std::endl;
+	return -EINVAL;
+      }
+      for (vector<cf_spec_t>::iterator q = layout.begin();
+	   q != layout.end();
+	   ++q) {
+	if (q->name == cf.name) {
+	  cf.compaction = q->compaction;
+	  cf.cache_share = q->cache_share;
+	  cf.bloom = q->bloom;
+	}
+      }
+      // two families holding one prefix is what a migration looks like
+      // half way; the merged iterators and get_cf() would miss keys
+      for (vector<string>::iterator q = cf.prefixes.begin();
+	   q != cf.prefixes.end();
+	   ++q) {
+	if (!prefixes.insert(*q).second && !options.migrating) {
+	  out << "prefix " << *q << " is in more than one column family;"
+	      << " run ceph-kvstore-tool migrate-column-families" << std::endl;
+	  return -EINVAL;
+	}
+      }
+      cfs.push_back(cf);
+    }
+    for (vector<cf_spec_t>::iterator q = layout.begin();
+	 q != layout.end();
+	 ++q) {
+      if (std::find(existing.begin(), existing.end(), q->get_cf_name()) ==
+	  existing.end())
+	derr << "rocksdb column family " << q->get_cf_name()
+	     << " is not in " << path << ", run ceph-kvstore-tool"
+	     << " migrate-column-families to use it" << dendl;
+    }
+  }
+  double cache_shared = 1;
+  for (vector<cf_spec_t>::iterator p = cfs.begin(); p != cfs.end(); ++p)
+    cache_shared -= p->cache_share;
+
   rocksdb::Options ldoptions;
 
   if (options.write_buffer_size)
@@ -62,7 +336,8 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
   if (options.max_open_files)
     ldoptions.max_open_files = options.max_open_files;
   if (options.cache_size) {
-    ldoptions.block_cache = rocksdb::NewLRUCache(options.cache_size);
+    ldoptions.block_cache =
+      rocksdb::NewLRUCache((uint64_t)(options.cache_size * cache_shared));
   }
   if (options.block_size)
     ldoptions.block_size = options.block_size;
@@ -70,7 +345,7 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     const rocksdb::FilterPolicy *_filterpolicy =
 	rocksdb::NewBloomFilterPolicy(options.bloom_size);
     ldoptions.filter_policy = _filterpolicy;
-    filterpolicy = _filterpolicy;
+    filterpolicies.push_back(_filterpolicy);
   }
   if (options.compression_type.length() == 0)
     ldoptions.compression = rocksdb::kNoCompression;
@@ -84,6 +359,10 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     ldoptions.compression = rocksdb::kNoCompression;
   if (options.block_restart_interval)
     ldoptions.block_restart_interval = options.block_restart_interval;
+  if (g_conf->perf) {
+    ldoptions.statistics = rocksdb::CreateDBStatistics();
+    stats = ldoptions.statistics.get();
+  }
 
   ldoptions.error_if_exists = options.error_if_exists;
   ldoptions.paranoid_checks = options.paranoid_checks;
@@ -109,13 +388,41 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     ldoptions.wal_dir = options.wal_dir;
 
 
-  //rocksdb::DB *_db;
-  rocksdb::Status status = rocksdb::DB::Open(ldoptions, path, &db);
+  vector<rocksdb::ColumnFamilyDescriptor> descs;
+  descs.push_back(rocksdb::ColumnFamilyDescriptor(
+    rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions(ldoptions)));
+  if (!new_store) {
+    for (vector<cf_spec_t>::iterator p = cfs.begin(); p != cfs.end(); ++p)
+      descs.push_back(rocksdb::ColumnFamilyDescriptor(
+	p->get_cf_name(),
+	get_cf_options(ldoptions, *p, options.cache_size, &filterpolicies)));
+  }
+  vector<rocksdb::ColumnFamilyHandle*> handles;
+  status = rocksdb::DB::Open(rocksdb::DBOptions(ldoptions), path, descs,
+			     &handles, &db);
   if (!status.ok()) {
     out << status.ToString() << std::endl;
     return -EINVAL;
   }
-  //db.reset(_db);
+  if (new_store) {
+    for (vector<cf_spec_t>::iterator p = cfs.begin(); p != cfs.end(); ++p) {
+      rocksdb::ColumnFamilyHandle *cf;
+      status = db->CreateColumnFamily(
+	get_cf_options(ldoptions, *p, options.cache_size, &filterpolicies),
+	p->get_cf_name(), &cf);
+      if (!status.ok()) {
+	out << "creating column family " << p->get_cf_name() << ": "
+	    << status.ToString() << std::endl;
+	for (vector<rocksdb::ColumnFamilyHandle*>::iterator q = handles.begin();
+	     q != handles.end();
+	     ++q)
+	  delete *q;
+	return -EINVAL;
+      }
+      handles.push_back(cf);
+    }
+  }
+  set_column_families(cfs, handles);
 
   if (g_conf->rocksdb_compact_on_mount) {
     derr << "Compacting rocksdb store..." << dendl;
@@ -131,8 +438,151 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
   plb.add_u64_counter(l_rocksdb_compact_range, "rocksdb_compact_range");
   plb.add_u64_counter(l_rocksdb_compact_queue_merge, "rocksdb_compact_queue_merge");
   plb.add_u64(l_rocksdb_compact_queue_len, "rocksdb_compact_queue_len");
+  plb.add_time_avg(l_rocksdb_get_latency, "rocksdb_get_latency");
+  plb.add_time_avg(l_rocksdb_submit_latency, "rocksdb_submit_latency");
+  plb.add_time_avg(l_rocksdb_submit_sync_latency, "rocksdb_submit_sync_latency");
+  plb.add_u64_avg(l_rocksdb_txn_ops, "rocksdb_transaction_ops");
+  plb.add_u64_avg(l_rocksdb_txn_bytes, "rocksdb_transaction_bytes");
+  plb.add_u64_counter(l_rocksdb_iter_seeks, "rocksdb_iterator_seeks");
+  plb.add_u64_counter(l_rocksdb_iter_nexts, "rocksdb_iterator_nexts");
+  plb.add_u64_counter(l_rocksdb_iter_bytes, "rocksdb_iterator_bytes");
+  plb.add_u64(l_rocksdb_cache_hits, "rocksdb_cache_hits");
+  plb.add_u64(l_rocksdb_cache_misses, "rocksdb_cache_misses");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
+  start_compaction_sched(cct, "rocksdb-compaction");
+  return 0;
+}
+
+int RocksDBStore::migrate_column_families(ostream &out, int keys_per_tx)
+{
+  assert(options.migrating);
+  // the target is recorded before anything changes, so that a crash
+  // part way leaves a store that refuses to open until this is rerun
+  string spec;
+  int r = read_cf_migration(&spec);
+  if (r == 0) {
+    out << "resuming interrupted migration to '" << spec << "'" << std::endl;
+    if (spec != options.column_families)
+      out << "rocksdb_column_families is now '" << options.column_families
+	  << "'; run again afterwards to migrate to it" << std::endl;
+  } else if (r == -ENOENT) {
+    spec = options.column_families;
+    r = write_cf_migration(spec);
+    if (r < 0) {
+      out << "writing " << CF_MIGRATION_FILE << ": " << cpp_strerror(r)
+	  << std::endl;
+      return r;
+    }
+  } else {
+    out << "reading " << CF_MIGRATION_FILE << ": " << cpp_strerror(r)
+	<< std::endl;
+    return r;
+  }
+
+  vector<cf_spec_t> layout;
+  r = parse_column_families(spec, &layout, out);
+  if (r < 0)
+    return r;
+
+  vector<cf_spec_t> old_cfs = column_families;
+  vector<rocksdb::ColumnFamilyHandle*> old_handles = cf_handles;
+  vector<rocksdb::ColumnFamilyHandle*> handles, created;
+  handles.push_back(cf_handles[0]);
+  for (vector<cf_spec_t>::iterator p = layout.begin(); p != layout.end(); ++p) {
+    rocksdb::ColumnFamilyHandle *cf = NULL;
+    for (unsigned i = 0; i < old_cfs.size(); ++i) {
+      if (old_cfs[i].get_cf_name() == p->get_cf_name())
+	cf = old_handles[i + 1];
+    }
+    if (!cf) {
+      rocksdb::Status status = db->CreateColumnFamily(
+	get_cf_options(db->GetOptions(), *p, options.cache_size,
+		       &filterpolicies),
+	p->get_cf_name(), &cf);
+      if (!status.ok()) {
+	out << "creating column family " << p->get_cf_name() << ": "
+	    << status.ToString() << std::endl;
+	for (vector<rocksdb::ColumnFamilyHandle*>::iterator q =
+	       created.begin();
+	     q != created.end();
+	     ++q) {
+	  db->DropColumnFamily(*q);
+	  delete *q;
+	}
+	return -EINVAL;
+      }
+      out << "created column family " << p->get_cf_name() << std::endl;
+      created.push_back(cf);
+    }
+    handles.push_back(cf);
+  }
+  set_column_families(layout, handles);
+
+  // move every key that is now in the wrong family
+  rocksdb::WriteOptions woptions;
+  woptions.sync = true;
+  uint64_t moved = 0;
+  for (vector<rocksdb::ColumnFamilyHandle*>::iterator p = old_handles.begin();
+       p != old_handles.end();
+       ++p) {
+    rocksdb::WriteBatch bat;
+    int batched = 0;
+    rocksdb::Iterator *it = db->NewIterator(rocksdb::ReadOptions(), *p);
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      string prefix;
+      if (split_key(it->key(), &prefix, 0) < 0)
+	continue;
+      rocksdb::ColumnFamilyHandle *cf = get_cf(prefix);
+      if (cf == *p)
+	continue;
+      bat.Put(cf, it->key(), it->value());
+      bat.Delete(*p, it->key());
+      if (++batched >= keys_per_tx) {
+	rocksdb::Status status = db->Write(woptions, &bat);
+	if (!status.ok()) {
+	  out << status.ToString() << std::endl;
+	  delete it;
+	  return -EIO;
+	}
+	moved += batched;
+	batched = 0;
+	bat.Clear();
+      }
+    }
+    rocksdb::Status status = it->status();
+    delete it;
+    if (status.ok() && batched)
+      status = db->Write(woptions, &bat);
+    if (!status.ok()) {
+      out << status.ToString() << std::endl;
+      return -EIO;
+    }
+    moved += batched;
+  }
+  out << "moved " << moved << " keys" << std::endl;
+
+  // and drop the families that are left empty
+  for (unsigned i = 0; i < old_cfs.size(); ++i) {
+    rocksdb::ColumnFamilyHandle *cf = old_handles[i + 1];
+    if (std::find(handles.begin(), handles.end(), cf) != handles.end())
+      continue;
+    rocksdb::Status status = db->DropColumnFamily(cf);
+    delete cf;
+    if (!status.ok()) {
+      out << "dropping column family " << old_cfs[i].get_cf_name() << ": "
+	  << status.ToString() << std::endl;
+      return -EIO;
+    }
+    out << "dropped column family " << old_cfs[i].get_cf_name() << std::endl;
+  }
+
+  r = clear_cf_migration();
+  if (r < 0) {
+    out << "removing " << CF_MIGRATION_FILE << ": " << cpp_strerror(r)
+	<< std::endl;
+    return r;
+  }
   return 0;
 }
 
@@ -152,11 +602,22 @@ RocksDBStore::~RocksDBStore()
   delete logger;
 
   // Ensure db is destroyed before dependent db_cache and filterpolicy
+  for (vector<rocksdb::ColumnFamilyHandle*>::iterator p = cf_handles.begin();
+       p != cf_handles.end();
+       ++p)
+    delete *p;
   delete db;
+  for (vector<const rocksdb::FilterPolicy*>::iterator p =
+	 filterpolicies.begin();
+       p != filterpolicies.end();
+       ++p)
+    delete *p;
 }
 
 void RocksDBStore::close()
 {
+  stop_compaction_sched();
+
   // stop compaction thread
   compact_queue_lock.Lock();
   if (compact_thread.is_started()) {
@@ -174,24 +635,44 @@ void RocksDBStore::close()
 
 int RocksDBStore::submit_transaction(KeyValueDB::Transaction t)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   RocksDBTransactionImpl * _t =
     static_cast<RocksDBTransactionImpl *>(t.get());
   rocksdb::WriteOptions woptions;
   woptions.disableWAL = options.disableWAL;
   rocksdb::Status s = db->Write(woptions, _t->bat);
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
+  logger->tinc(l_rocksdb_submit_latency, lat);
+  logger->inc(l_rocksdb_txn_ops, _t->ops);
+  logger->inc(l_rocksdb_txn_bytes, _t->bytes);
+  if (compaction_sched) {
+    compaction_sched->note_submit(lat);
+    if (s.ok())
+      compaction_sched->note_commit(_t->stats);
+  }
   return s.ok() ? 0 : -1;
 }
 
 int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   RocksDBTransactionImpl * _t =
     static_cast<RocksDBTransactionImpl *>(t.get());
   rocksdb::WriteOptions woptions;
   woptions.sync = true;
   woptions.disableWAL = options.disableWAL;
   rocksdb::Status s = db->Write(woptions, _t->bat);
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
+  logger->tinc(l_rocksdb_submit_sync_latency, lat);
+  logger->inc(l_rocksdb_txn_ops, _t->ops);
+  logger->inc(l_rocksdb_txn_bytes, _t->bytes);
+  if (compaction_sched) {
+    compaction_sched->note_submit(lat);
+    if (s.ok())
+      compaction_sched->note_commit(_t->stats);
+  }
   return s.ok() ? 0 : -1;
 }
 int RocksDBStore::get_info_log_level(string info_log_level)
@@ -212,6 +693,7 @@ int RocksDBStore::get_info_log_level(string info_log_level)
 }
 
 RocksDBStore::RocksDBTransactionImpl::RocksDBTransactionImpl(RocksDBStore *_db)
+  : ops(0), bytes(0)
 {
   db = _db;
   bat = new rocksdb::WriteBatch();
@@ -229,9 +711,14 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   bufferlist &bl = *(buffers.rbegin());
   string key = combine_strings(prefix, k);
   keys.push_back(key);
-  bat->Delete(rocksdb::Slice(*(keys.rbegin())));
-  bat->Put(rocksdb::Slice(*(keys.rbegin())),
+  ++ops;
+  bytes += key.length() + bl.length();
+  rocksdb::ColumnFamilyHandle *cf = db->get_cf(prefix);
+  bat->Delete(cf, rocksdb::Slice(*(keys.rbegin())));
+  bat->Put(cf, rocksdb::Slice(*(keys.rbegin())),
 	  rocksdb::Slice(bl.c_str(), bl.length()));
+  if (db->compaction_sched)
+    stats.note_write(prefix);
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
@@ -239,19 +726,30 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 {
   string key = combine_strings(prefix, k);
   keys.push_back(key);
-  bat->Delete(rocksdb::Slice(*(keys.rbegin())));
+  ++ops;
+  bytes += key.length();
+  bat->Delete(db->get_cf(prefix), rocksdb::Slice(*(keys.rbegin())));
+  if (db->compaction_sched)
+    stats.note_delete(prefix);
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
   KeyValueDB::Iterator it = db->get_iterator(prefix);
+  rocksdb::ColumnFamilyHandle *cf = db->get_cf(prefix);
+  uint64_t removed = 0;
   for (it->seek_to_first();
        it->valid();
        it->next()) {
+    ++removed;
     string key = combine_strings(prefix, it->key());
     keys.push_back(key);
-    bat->Delete(*(keys.rbegin()));
+    ++ops;
+    bytes += key.length();
+    bat->Delete(cf, *(keys.rbegin()));
   }
+  if (db->compaction_sched && removed)
+    stats.note_delete(prefix, removed);
 }
 
 int RocksDBStore::get(
@@ -259,6 +757,7 @@ int RocksDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  utime_t start = ceph_clock_now(g_ceph_context);
   KeyValueDB::Iterator it = get_iterator(prefix);
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
@@ -270,9 +769,21 @@ int RocksDBStore::get(
       break;
   }
   logger->inc(l_rocksdb_gets);
+  logger->tinc(l_rocksdb_get_latency, ceph_clock_now(g_ceph_context) - start);
+  update_cache_stats();
   return 0;
 }
 
+void RocksDBStore::update_cache_stats()
+{
+  if (!stats)
+    return;
+  logger->set(l_rocksdb_cache_hits,
+	      stats->getTickerCount(rocksdb::BLOCK_CACHE_HIT));
+  logger->set(l_rocksdb_cache_misses,
+	      stats->getTickerCount(rocksdb::BLOCK_CACHE_MISS));
+}
+
 string RocksDBStore::combine_strings(const string &prefix, const string &value)
 {
   string out = prefix;
@@ -305,7 +816,10 @@ int RocksDBStore::split_key(rocksdb::Slice in, string *prefix, string *key)
 void RocksDBStore::compact()
 {
   logger->inc(l_rocksdb_compact);
-  db->CompactRange(NULL, NULL);
+  for (vector<rocksdb::ColumnFamilyHandle*>::iterator p = cf_handles.begin();
+       p != cf_handles.end();
+       ++p)
+    db->CompactRange(*p, NULL, NULL);
 }
 
 
@@ -380,40 +894,87 @@ void RocksDBStore::compact_range(const string& start, const string& end)
 {
     rocksdb::Slice cstart(start);
     rocksdb::Slice cend(end);
-    db->CompactRange(&cstart, &cend);
+    // start is a prefix, or a key under the prefix
+    db->CompactRange(get_cf(start.substr(0, start.find('\0'))),
+		     &cstart, &cend);
 }
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
-  delete dbiter;
+  logger->inc(l_rocksdb_iter_seeks, seeks);
+  logger->inc(l_rocksdb_iter_nexts, nexts);
+  logger->inc(l_rocksdb_iter_bytes, bytes);
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    delete *p;
+}
+void RocksDBStore::RocksDBWholeSpaceIteratorImpl::pick(bool smallest)
+{
+  forward = smallest;
+  if (dbiters.size() == 1)
+    return;
+  rocksdb::Iterator *best = NULL;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p) {
+    if (!(*p)->Valid())
+      continue;
+    if (!best ||
+	(smallest && (*p)->key().compare(best->key()) < 0) ||
+	(!smallest && (*p)->key().compare(best->key()) > 0))
+      best = *p;
+  }
+  dbiter = best ? best : dbiters.front();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first()
 {
-  dbiter->SeekToFirst();
-  return dbiter->status().ok() ? 0 : -1;
+  ++seeks;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    (*p)->SeekToFirst();
+  pick(true);
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first(const string &prefix)
 {
+  ++seeks;
   rocksdb::Slice slice_prefix(prefix);
-  dbiter->Seek(slice_prefix);
-  return dbiter->status().ok() ? 0 : -1;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    (*p)->Seek(slice_prefix);
+  pick(true);
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last()
 {
-  dbiter->SeekToLast();
-  return dbiter->status().ok() ? 0 : -1;
+  ++seeks;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    (*p)->SeekToLast();
+  pick(false);
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last(const string &prefix)
 {
+  ++seeks;
   string limit = past_prefix(prefix);
   rocksdb::Slice slice_limit(limit);
-  dbiter->Seek(slice_limit);
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p) {
+    (*p)->Seek(slice_limit);
 
-  if (!dbiter->Valid()) {
-    dbiter->SeekToLast();
-  } else {
-    dbiter->Prev();
+    if (!(*p)->Valid()) {
+      (*p)->SeekToLast();
+    } else {
+      (*p)->Prev();
+    }
   }
-  return dbiter->status().ok() ? 0 : -1;
+  pick(false);
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefix, const string &after)
 {
@@ -423,14 +984,19 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefi
     if (key.first == prefix && key.second == after)
       next();
   }
-  return dbiter->status().ok() ? 0 : -1;
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::lower_bound(const string &prefix, const string &to)
 {
+  ++seeks;
   string bound = combine_strings(prefix, to);
   rocksdb::Slice slice_bound(bound);
-  dbiter->Seek(slice_bound);
-  return dbiter->status().ok() ? 0 : -1;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    (*p)->Seek(slice_bound);
+  pick(true);
+  return status();
 }
 bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::valid()
 {
@@ -438,15 +1004,45 @@ bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::valid()
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::next()
 {
-  if (valid())
+  ++nexts;
+  if (!valid())
+    return status();
+  if (!forward) {
+    // the others are before us; put them past us.  a key is only
+    // ever in one column family.
+    string cur = dbiter->key().ToString();
+    for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+	 p != dbiters.end();
+	 ++p)
+      if (*p != dbiter)
+	(*p)->Seek(cur);
+  }
   dbiter->Next();
-  return dbiter->status().ok() ? 0 : -1;
+  pick(true);
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::prev()
 {
-  if (valid())
-    dbiter->Prev();
-    return dbiter->status().ok() ? 0 : -1;
+  ++nexts;
+  if (!valid())
+    return status();
+  if (forward) {
+    string cur = dbiter->key().ToString();
+    for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+	 p != dbiters.end();
+	 ++p) {
+      if (*p == dbiter)
+	continue;
+      (*p)->Seek(cur);
+      if ((*p)->Valid())
+	(*p)->Prev();
+      else
+	(*p)->SeekToLast();
+    }
+  }
+  dbiter->Prev();
+  pick(false);
+  return status();
 }
 string RocksDBStore::RocksDBWholeSpaceIteratorImpl::key()
 {
@@ -462,11 +1058,17 @@ pair<string,string> RocksDBStore::RocksDBWholeSpaceIteratorImpl::raw_key()
 }
 bufferlist RocksDBStore::RocksDBWholeSpaceIteratorImpl::value()
 {
+  bytes += dbiter->value().size();
   return to_bufferlist(dbiter->value());
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::status()
 {
-  return dbiter->status().ok() ? 0 : -1;
+  for (vector<rocksdb::Iterator*>::iterator p = dbiters.begin();
+       p != dbiters.end();
+       ++p)
+    if (!(*p)->status().ok())
+      return -1;
+  return 0;
 }
 
 bool RocksDBStore::in_prefix(const string &prefix, rocksdb::Slice key)
@@ -482,27 +1084,55 @@ string RocksDBStore::past_prefix(const string &prefix)
 }
 
 
-RocksDBStore::WholeSpaceIterator RocksDBStore::_get_iterator()
+RocksDBStore::WholeSpaceIterator RocksDBStore::get_cf_iterator(
+  rocksdb::ColumnFamilyHandle *cf, bool snapshot)
 {
+  rocksdb::ReadOptions options;
+  const rocksdb::Snapshot *s = NULL;
+  if (snapshot) {
+    s = db->GetSnapshot();
+    options.snapshot = s;
+  }
+
+  vector<rocksdb::Iterator*> iters;
+  if (cf) {
+    iters.push_back(db->NewIterator(options, cf));
+  } else if (cf_handles.size() == 1) {
+    iters.push_back(db->NewIterator(options));
+  } else {
+    rocksdb::Status status = db->NewIterators(options, cf_handles, &iters);
+    assert(status.ok());
+  }
+
+  if (snapshot)
+    return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new RocksDBSnapshotIteratorImpl(db, s, iters, logger)
+    );
   return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
-    new RocksDBWholeSpaceIteratorImpl(
-      db->NewIterator(rocksdb::ReadOptions())
-    )
+    new RocksDBWholeSpaceIteratorImpl(iters, logger)
   );
 }
 
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_iterator()
+{
+  return get_cf_iterator(NULL, false);
+}
+
 RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_iterator()
 {
-  const rocksdb::Snapshot *snapshot;
-  rocksdb::ReadOptions options;
+  return get_cf_iterator(NULL, true);
+}
 
-  snapshot = db->GetSnapshot();
-  options.snapshot = snapshot;
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_iterator(
+  const string &prefix)
+{
+  return get_cf_iterator(get_cf(prefix), false);
+}
 
-  return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
-    new RocksDBSnapshotIteratorImpl(db, snapshot,
-      db->NewIterator(options))
-  );
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_snapshot_iterator(
+  const string &prefix)
+{
+  return get_cf_iterator(get_cf(prefix), true);
 }
 
 RocksDBStore::RocksDBSnapshotIteratorImpl::~RocksDBSnapshotIteratorImpl()
@@ -9,6 +9,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 #include <tr1/memory>
 #include <boost/scoped_ptr.hpp>
 
@@ -30,6 +31,16 @@ enum {
   l_rocksdb_compact_range,
   l_rocksdb_compact_queue_merge,
   l_rocksdb_compact_queue_len,
+  l_rocksdb_get_latency,
+  l_rocksdb_submit_latency,
+  l_rocksdb_submit_sync_latency,
+  l_rocksdb_txn_ops,
+  l_rocksdb_txn_bytes,
+  l_rocksdb_iter_seeks,
+  l_rocksdb_iter_nexts,
+  l_rocksdb_iter_bytes,
+  l_rocksdb_cache_hits,
+  l_rocksdb_cache_misses,
   l_rocksdb_last,
 };
 
@@ -41,6 +52,8 @@ namespace rocksdb{
   class Slice;
   class WriteBatch;
   class Iterator;
+  class ColumnFamilyHandle;
+  class Statistics;
 }
 
 /**
@@ -50,11 +63,66 @@ class RocksDBStore : public KeyValueDB {
   CephContext *cct;
   PerfCounters *logger;
   string path;
-  const rocksdb::FilterPolicy *filterpolicy;
+  vector<const rocksdb::FilterPolicy*> filterpolicies;
   rocksdb::DB *db;
+  rocksdb::Statistics *stats;  ///< owned by the db's options; NULL unless perf
+
+  /// copy the block cache hits and misses to the perf counters
+  void update_cache_stats();
+
+public:
+  /**
+   * cf_spec_t: a column family and the key prefixes kept in it, as
+   * set in rocksdb_column_families:
+   *
+   *   <name>=<prefix>[,<prefix>...][/<option>=<value>...] ...
+   *
+   * where the options are compaction=level|universal, cache=<share of
+   * rocksdb_cache_size> and bloom=<bits per key>.  A KeyValueDB prefix
+   * goes to the family with the longest of its prefixes that it starts
+   * with; everything else stays in the default family.
+   *
+   * The family is named after its prefixes in the store, so a store
+   * always opens with the layout it was created (or migrated) with.
+   */
+  struct cf_spec_t {
+    string name;
+    vector<string> prefixes;
+    string compaction;   ///< empty for the default (level)
+    double cache_share;  ///< 0 to share the default block cache
+    int bloom;           ///< -1 for rocksdb_bloom_size
+
+    cf_spec_t() : cache_share(0), bloom(-1) {}
+
+    /// the name of the rocksdb column family
+    string get_cf_name() const;
+    /// fill in name and prefixes from a rocksdb column family name
+    int parse_cf_name(const string &cf_name);
+  };
+  static int parse_column_families(const string &spec,
+				   vector<cf_spec_t> *out, ostream &err);
+
+private:
+  vector<cf_spec_t> column_families;  ///< open families, but the default
+  vector<rocksdb::ColumnFamilyHandle*> cf_handles;  ///< default first
+  map<string, rocksdb::ColumnFamilyHandle*> cf_by_prefix;
+
+  /// the column family the keys under prefix are kept in
+  rocksdb::ColumnFamilyHandle *get_cf(const string &prefix);
+  void set_column_families(const vector<cf_spec_t> &cfs,
+			   const vector<rocksdb::ColumnFamilyHandle*> &handles);
 
   int do_open(ostream &out, bool create_if_missing);
 
+  /**
+   * A migration in progress is recorded in a file in the store, holding
+   * the rocksdb_column_families it migrates to, until every key is in
+   * its new family.  Until then the store only opens to finish it.
+   */
+  int read_cf_migration(string *spec);
+  int write_cf_migration(const string &spec);
+  int clear_cf_migration();
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -98,6 +166,14 @@ public:
   }
   int get_info_log_level(string info_log_level);
 
+  /**
+   * Move keys into the column families set in rocksdb_column_families,
+   * creating the new families and dropping the ones no longer used.
+   * The store must be open, with options.migrating set, and otherwise
+   * idle.  An interrupted migration is finished first.
+   */
+  int migrate_column_families(ostream &out, int keys_per_tx);
+
   /**
    * options_t: Holds options which are minimally interpreted
    * on initialization and then passed through to RocksDB.
@@ -134,6 +210,8 @@ public:
     string log_file;
     string wal_dir;
     string info_log_level;
+    string column_families; /// see cf_spec_t
+    bool migrating; /// opened for migrate_column_families()
 
     options_t() :
       write_buffer_size(0), //< 0 means default
@@ -151,7 +229,8 @@ public:
       disableDataSync(false),
       disableWAL(false),
       num_levels(0),
-      info_log_level("info")
+      info_log_level("info"),
+      migrating(false)
     {}
   } options;
 
@@ -159,6 +238,8 @@ public:
     cct(c),
     logger(NULL),
     path(path),
+    db(NULL),
+    stats(NULL),
     compact_queue_lock("RocksDBStore::compact_thread_lock"),
     compact_queue_stop(false),
     compact_thread(this),
@@ -184,6 +265,8 @@ public:
     rocksdb::WriteBatch *bat;
     list<bufferlist> buffers;
     list<string> keys;
+    uint64_t ops, bytes;  ///< keys set or removed, and their size
+    CompactionScheduler::txn_stats_t stats;  ///< for compaction_sched
     RocksDBStore *db;
 
     RocksDBTransactionImpl(RocksDBStore *_db);
@@ -216,10 +299,26 @@ public:
   class RocksDBWholeSpaceIteratorImpl :
     public KeyValueDB::WholeSpaceIteratorImpl {
   protected:
-    rocksdb::Iterator *dbiter;
+    /// one per column family, merged in key order
+    vector<rocksdb::Iterator*> dbiters;
+    rocksdb::Iterator *dbiter;  ///< the one we are at
+    bool forward;  ///< the others are past dbiter, not before it
+    PerfCounters *logger;
+    uint64_t seeks, nexts, bytes;  ///< added to logger when we are done
+
+    /// move to the smallest (or largest) key of all the iterators
+    void pick(bool smallest);
   public:
-    RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter) :
-      dbiter(iter) { }
+    RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter,
+				  PerfCounters *logger) :
+      dbiter(iter), forward(true),
+      logger(logger), seeks(0), nexts(0), bytes(0) {
+      dbiters.push_back(iter);
+    }
+    RocksDBWholeSpaceIteratorImpl(const vector<rocksdb::Iterator*> &iters,
+				  PerfCounters *logger) :
+      dbiters(iters), dbiter(iters.front()), forward(true),
+      logger(logger), seeks(0), nexts(0), bytes(0) { }
     //virtual ~RocksDBWholeSpaceIteratorImpl() { }
     ~RocksDBWholeSpaceIteratorImpl();
 
@@ -243,8 +342,9 @@ public:
     const rocksdb::Snapshot *snapshot;
   public:
     RocksDBSnapshotIteratorImpl(rocksdb::DB *db, const rocksdb::Snapshot *s,
-				rocksdb::Iterator *iter) :
-      RocksDBWholeSpaceIteratorImpl(iter), db(db), snapshot(s) { }
+				const vector<rocksdb::Iterator*> &iters,
+				PerfCounters *logger) :
+      RocksDBWholeSpaceIteratorImpl(iters, logger), db(db), snapshot(s) { }
 
     ~RocksDBSnapshotIteratorImpl();
   };
@@ -324,10 +424,18 @@ err:
 
 
 protected:
+  /// iterate over cf, or over all families if it is NULL
+  WholeSpaceIterator get_cf_iterator(rocksdb::ColumnFamilyHandle *cf,
+				     bool snapshot);
+
   WholeSpaceIterator _get_iterator();
 
   WholeSpaceIterator _get_snapshot_iterator();
 
+  WholeSpaceIterator _get_prefix_iterator(const string &prefix);
+
+  WholeSpaceIterator _get_prefix_snapshot_iterator(const string &prefix);
+
 };
 
 #endif
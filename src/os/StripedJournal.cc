@@ -0,0 +1,370 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "StripedJournal.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/Formatter.h"
+
+#define dout_subsys ceph_subsys_journal
+#undef dout_prefix
+#define dout_prefix *_dout << "striped_journal "
+
+StripedJournal::StripedJournal(uuid_d fsid, Finisher *fin, Cond *sync_cond,
+			       const vector<string>& paths, bool dio,
+			       bool ai, bool faio)
+  : Journal(fsid, fin, sync_cond),
+    width(paths.size()),
+    open_width(paths.size()),
+    open_seq(0),
+    last_read_seq(0),
+    completion_lock("StripedJournal::completion_lock")
+{
+  assert(width > 0);
+  for (unsigned i = 0; i < width; ++i)
+    members.push_back(new FileJournal(fsid, fin, sync_cond, paths[i].c_str(),
+				      dio, ai, faio));
+}
+
+StripedJournal::~StripedJournal()
+{
+  for (vector<FileJournal*>::iterator p = members.begin();
+       p != members.end();
+       ++p)
+    delete *p;
+}
+
+void StripedJournal::set_member_state()
+{
+  // FileStore sets these on us after construction; pass them down
+  for (unsigned i = 0; i < width; ++i) {
+    members[i]->logger = logger;
+    members[i]->set_wait_on_full(wait_on_full);
+  }
+}
+
+int StripedJournal::check()
+{
+  // an existing journal is identified by its first member; any others
+  // that are missing are added by open()/make_writeable()
+  return members[0]->check();
+}
+
+int StripedJournal::create()
+{
+  dout(2) << "create " << width << " stripes" << dendl;
+  set_member_state();
+  for (unsigned i = 0; i < width; ++i) {
+    members[i]->set_stripe(i, width);
+    int r = members[i]->create();
+    if (r < 0) {
+      derr << "StripedJournal::create: error creating stripe " << i << " on "
+	   << members[i]->get_path() << ": " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  return 0;
+}
+
+int StripedJournal::open(uint64_t fs_op_seq)
+{
+  dout(2) << "open " << width << " stripes fs_op_seq " << fs_op_seq << dendl;
+  set_member_state();
+
+  int r = members[0]->open(fs_op_seq);
+  if (r < 0)
+    return r;
+  unsigned w = members[0]->get_stripe_width();
+  if (members[0]->get_stripe_index() != 0 || w > width) {
+    derr << "StripedJournal::open: " << members[0]->get_path()
+	 << " is stripe " << members[0]->get_stripe_index() << " of " << w
+	 << ", but " << width << " journal stripes are configured" << dendl;
+    return -EINVAL;
+  }
+
+  // an interrupted upgrade may already have rewritten some of the old
+  // members with the new width (member 0 always goes last)
+  for (unsigned i = 1; i < w; ++i) {
+    r = members[i]->open(fs_op_seq);
+    if (r < 0)
+      return r;
+    if (members[i]->get_stripe_index() != i ||
+	(members[i]->get_stripe_width() != w &&
+	 members[i]->get_stripe_width() != width)) {
+      derr << "StripedJournal::open: " << members[i]->get_path()
+	   << " is stripe " << members[i]->get_stripe_index() << " of "
+	   << members[i]->get_stripe_width() << ", expected stripe " << i
+	   << " of " << w << dendl;
+      return -EINVAL;
+    }
+  }
+  if (w < width)
+    dout(0) << "open journal has " << w << " stripes, will restripe to "
+	    << width << " after replay" << dendl;
+
+  open_width = w;
+  open_seq = fs_op_seq;
+  last_read_seq = 0;
+  heads.clear();
+  heads.resize(open_width);
+
+  // each member skips to its first entry past fs_op_seq; if none of
+  // them has fs_op_seq + 1 the contents are from a newer fs and are
+  // ignored, like FileJournal::open does.  A member may have nothing
+  // past fs_op_seq at all (e.g. trimmed by committed_thru), so ask for
+  // fs_op_seq + 1, not 0, which FileJournal would call corruption.
+  for (unsigned i = 0; i < open_width; ++i)
+    heads[i].next_seq = fs_op_seq + 1;
+  fill_heads();
+  int first = lowest_head();
+  if (first >= 0 && heads[first].seq > fs_op_seq + 1) {
+    dout(10) << "open entry " << heads[first].seq << " > next_seq "
+	     << fs_op_seq + 1 << ", ignoring journal contents" << dendl;
+    for (unsigned i = 0; i < open_width; ++i) {
+      if (heads[i].valid)
+	members[i]->set_read_pos(heads[i].pos);
+      heads[i].valid = false;
+      heads[i].eof = true;
+    }
+  }
+  return 0;
+}
+
+bool StripedJournal::fill_heads()
+{
+  bool any = false;
+  for (unsigned i = 0; i < heads.size(); ++i) {
+    head_t &h = heads[i];
+    if (!h.valid && !h.eof) {
+      h.pos = members[i]->get_read_pos();
+      h.bl.clear();
+      uint64_t seq = h.next_seq;
+      if (members[i]->read_entry(h.bl, seq)) {
+	h.valid = true;
+	h.seq = seq;
+      } else {
+	h.eof = true;
+      }
+    }
+    any = any || h.valid;
+  }
+  return any;
+}
+
+int StripedJournal::lowest_head()
+{
+  int lowest = -1;
+  for (unsigned i = 0; i < heads.size(); ++i) {
+    if (heads[i].valid &&
+	(lowest < 0 || heads[i].seq < heads[lowest].seq))
+      lowest = i;
+  }
+  return lowest;
+}
+
+bool StripedJournal::read_entry(bufferlist &bl, uint64_t &seq)
+{
+  if (!fill_heads())
+    return false;
+  int i = lowest_head();
+  head_t &h = heads[i];
+  if (last_read_seq && h.seq != last_read_seq + 1) {
+    // the member holding last_read_seq + 1 never got it to disk; the
+    // entries after it were never acked, so stop here
+    dout(1) << "read_entry seq " << last_read_seq + 1 << " missing (next is "
+	    << h.seq << " on stripe " << i << "), end of journal" << dendl;
+    return false;
+  }
+  bl.claim(h.bl);
+  seq = h.seq;
+  last_read_seq = h.seq;
+  h.next_seq = h.seq + 1;
+  h.valid = false;
+  return true;
+}
+
+void StripedJournal::close()
+{
+  for (unsigned i = 0; i < width; ++i)
+    members[i]->close();
+}
+
+int StripedJournal::dump(ostream& out)
+{
+  dout(10) << "dump" << dendl;
+  int r = members[0]->open_for_dump();
+  if (r < 0)
+    return r;
+  unsigned w = MIN(members[0]->get_stripe_width(), width);
+  for (unsigned i = 1; i < w; ++i) {
+    r = members[i]->open_for_dump();
+    if (r < 0)
+      return r;
+  }
+  heads.clear();
+  heads.resize(w);
+
+  JSONFormatter f(true);
+
+  f.open_array_section("journal");
+  while (fill_heads()) {
+    head_t &h = heads[lowest_head()];
+    FileJournal::dump_entry(&f, h.pos, h.seq, h.bl);
+    f.flush(cout);
+    h.next_seq = h.seq + 1;
+    h.valid = false;
+  }
+  f.close_section();
+  heads.clear();
+  dout(10) << "dump finish" << dendl;
+  return 0;
+}
+
+void StripedJournal::flush()
+{
+  for (unsigned i = 0; i < width; ++i)
+    members[i]->flush();
+}
+
+void StripedJournal::throttle()
+{
+  for (unsigned i = 0; i < width; ++i)
+    members[i]->throttle();
+}
+
+bool StripedJournal::is_writeable()
+{
+  for (unsigned i = 0; i < width; ++i)
+    if (!members[i]->is_writeable())
+      return false;
+  return true;
+}
+
+int StripedJournal::make_writeable()
+{
+  dout(10) << __func__ << dendl;
+  set_member_state();
+
+  // give back entries we read ahead but did not replay; writing resumes
+  // there and overwrites them
+  for (unsigned i = 0; i < heads.size(); ++i)
+    if (heads[i].valid)
+      members[i]->set_read_pos(heads[i].pos);
+  heads.clear();
+
+  int r;
+  bool restripe = open_width < width;
+  if (restripe) {
+    for (unsigned i = open_width; i < width; ++i) {
+      dout(0) << "make_writeable creating stripe " << i << " on "
+	      << members[i]->get_path() << dendl;
+      members[i]->set_stripe(i, width);
+      r = members[i]->create();
+      if (r < 0)
+	return r;
+      r = members[i]->open(open_seq);
+      if (r < 0)
+	return r;
+    }
+    for (unsigned i = 0; i < open_width; ++i)
+      members[i]->set_stripe(i, width);
+  }
+
+  // complete entries past the end of replay on the other members are
+  // about to be written over; start a new incarnation so that none of
+  // them is taken for one of ours after another crash
+  if (width > 1) {
+    uint64_t incarnation = 0;
+    for (unsigned i = 0; i < width; ++i)
+      incarnation = MAX(incarnation, members[i]->get_incarnation());
+    ++incarnation;
+    uint64_t seq = MAX(open_seq, last_read_seq) + 1;
+    dout(10) << __func__ << " incarnation " << incarnation
+	     << " from seq " << seq << dendl;
+    for (unsigned i = 0; i < width; ++i)
+      members[i]->set_incarnation(incarnation, seq);
+  }
+
+  for (unsigned i = 0; i < width; ++i) {
+    r = members[i]->make_writeable();
+    if (r < 0)
+      return r;
+  }
+
+  if (width > 1) {
+    // the incarnation (and any new width) must be on disk before
+    // anything is written; member 0 goes last, it is what open() trusts
+    for (int i = width - 1; i >= 0; --i) {
+      r = members[i]->write_header_sync();
+      if (r < 0)
+	return r;
+    }
+  }
+  if (restripe) {
+    dout(0) << "make_writeable restriped journal from " << open_width
+	    << " to " << width << " stripes" << dendl;
+    open_width = width;
+  }
+  return 0;
+}
+
+void StripedJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
+				  Context *oncommit, TrackedOpRef osd_op)
+{
+  {
+    Mutex::Locker l(completion_lock);
+    assert(pending.empty() || pending.rbegin()->first < seq);
+    pending[seq] = make_pair(oncommit, false);
+  }
+  member_for(seq)->submit_entry(seq, e, alignment,
+				new C_Journaled(this, seq), osd_op);
+}
+
+void StripedJournal::journaled(uint64_t seq)
+{
+  list<Context*> ready;
+  {
+    Mutex::Locker l(completion_lock);
+    map<uint64_t, pair<Context*, bool> >::iterator p = pending.find(seq);
+    assert(p != pending.end());
+    p->second.second = true;
+    while (!pending.empty() && pending.begin()->second.second) {
+      if (pending.begin()->second.first)
+	ready.push_back(pending.begin()->second.first);
+      pending.erase(pending.begin());
+    }
+  }
+  if (!ready.empty())
+    dout(20) << "journaled seq " << seq << " releasing " << ready.size()
+	     << " completions" << dendl;
+  finish_contexts(g_ceph_context, ready);
+}
+
+void StripedJournal::commit_start(uint64_t seq)
+{
+  for (unsigned i = 0; i < width; ++i)
+    members[i]->commit_start(seq);
+}
+
+void StripedJournal::committed_thru(uint64_t seq)
+{
+  for (unsigned i = 0; i < width; ++i)
+    members[i]->committed_thru(seq);
+}
+
+bool StripedJournal::should_commit_now()
+{
+  for (unsigned i = 0; i < width; ++i)
+    if (members[i]->should_commit_now())
+      return true;
+  return false;
+}
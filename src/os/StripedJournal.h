@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_STRIPEDJOURNAL_H
+#define CEPH_STRIPEDJOURNAL_H
+
+#include <map>
+#include <vector>
+
+#include "Journal.h"
+#include "FileJournal.h"
+#include "common/Mutex.h"
+
+/**
+ * Stripes journal entries round-robin (by seq) over several
+ * FileJournals, each on its own device with its own writer and aio
+ * queue.
+ *
+ * Each member only holds every width-th seq, so commit callbacks are
+ * held back until every lower seq is durable on its own member: a
+ * crash can leave holes, and replay stops at the first missing seq.
+ * Entries past it on the other members are stale; each time the
+ * journal is made writeable the members move to a new incarnation
+ * (see FileJournal::header_t::incarnation) so they stay that way.
+ *
+ * A journal created with fewer members (e.g. a plain single-file
+ * FileJournal) is replayed from the members it had, then the new
+ * members are created and the old headers rewritten with the new
+ * width before anything is striped onto them.
+ */
+class StripedJournal : public Journal {
+  std::vector<FileJournal*> members;
+  unsigned width;       ///< configured number of members
+  unsigned open_width;  ///< members that held entries when we opened
+  uint64_t open_seq;
+
+  /// next entry read from each member but not yet handed to the caller
+  struct head_t {
+    bool valid, eof;
+    uint64_t seq;
+    uint64_t next_seq;  ///< lower bound for the member's next entry
+    off64_t pos;
+    bufferlist bl;
+    head_t() : valid(false), eof(false), seq(0), next_seq(0), pos(0) {}
+  };
+  std::vector<head_t> heads;
+  uint64_t last_read_seq;
+
+  bool fill_heads();
+  int lowest_head();
+
+  /// seq -> (oncommit, journaled); released strictly in seq order
+  Mutex completion_lock;
+  std::map<uint64_t, pair<Context*, bool> > pending;
+
+  void journaled(uint64_t seq);
+
+  class C_Journaled : public Context {
+    StripedJournal *journal;
+    uint64_t seq;
+  public:
+    C_Journaled(StripedJournal *j, uint64_t s) : journal(j), seq(s) {}
+    void finish(int r) {
+      journal->journaled(seq);
+    }
+  };
+
+  void set_member_state();
+  FileJournal *member_for(uint64_t seq) {
+    return members[seq % width];
+  }
+
+public:
+  StripedJournal(uuid_d fsid, Finisher *fin, Cond *sync_cond,
+		 const std::vector<string>& paths, bool dio=false,
+		 bool ai=true, bool faio=false);
+  ~StripedJournal();
+
+  int check();
+  int create();
+  int open(uint64_t fs_op_seq);
+  void close();
+
+  int dump(ostream& out);
+
+  void flush();
+  void throttle();
+
+  bool is_writeable();
+  int make_writeable();
+
+  void submit_entry(uint64_t seq, bufferlist& e, int alignment,
+		    Context *oncommit,
+		    TrackedOpRef osd_op = TrackedOpRef());
+  void commit_start(uint64_t seq);
+  void committed_thru(uint64_t seq);
+  bool read_entry(bufferlist &bl, uint64_t &seq);
+  bool should_commit_now();
+};
+
+#endif
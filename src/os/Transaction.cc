@@ -443,6 +443,192 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
   f->close_section();
 }
 
+bool ObjectStore::Transaction::get_touched(set<ghobject_t> *objects,
+					  set<coll_t> *colls,
+					  set<coll_t> *coll_ops)
+{
+  iterator i = begin();
+  while (i.have_op()) {
+    int op = i.decode_op();
+    switch (op) {
+    case Transaction::OP_NOP:
+    case Transaction::OP_STARTSYNC:
+      break;
+
+    case Transaction::OP_TOUCH:
+    case Transaction::OP_REMOVE:
+    case Transaction::OP_RMATTRS:
+    case Transaction::OP_COLL_REMOVE:
+    case Transaction::OP_OMAP_CLEAR:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      break;
+
+    case Transaction::OP_WRITE:
+      {
+	colls->insert(i.decode_cid());
+	objects->insert(i.decode_oid());
+	i.decode_length();
+	i.decode_length();
+	bufferlist bl;
+	i.decode_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_ZERO:
+    case Transaction::OP_TRIMCACHE:
+    case Transaction::OP_SETALLOCHINT:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      i.decode_length();
+      i.decode_length();
+      break;
+
+    case Transaction::OP_TRUNCATE:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      i.decode_length();
+      break;
+
+    case Transaction::OP_SETATTR:
+    case Transaction::OP_OMAP_SETHEADER:
+      {
+	colls->insert(i.decode_cid());
+	objects->insert(i.decode_oid());
+	if (op == Transaction::OP_SETATTR)
+	  i.decode_attrname();
+	bufferlist bl;
+	i.decode_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_SETATTRS:
+      {
+	colls->insert(i.decode_cid());
+	objects->insert(i.decode_oid());
+	map<string, bufferptr> aset;
+	i.decode_attrset(aset);
+      }
+      break;
+
+    case Transaction::OP_RMATTR:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      i.decode_attrname();
+      break;
+
+    case Transaction::OP_CLONE:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      objects->insert(i.decode_oid());
+      break;
+
+    case Transaction::OP_CLONERANGE:
+    case Transaction::OP_CLONERANGE2:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      objects->insert(i.decode_oid());
+      i.decode_length();
+      i.decode_length();
+      if (op == Transaction::OP_CLONERANGE2)
+	i.decode_length();
+      break;
+
+    case Transaction::OP_MKCOLL:
+    case Transaction::OP_RMCOLL:
+      coll_ops->insert(i.decode_cid());
+      break;
+
+    case Transaction::OP_COLL_HINT:
+      {
+	coll_ops->insert(i.decode_cid());
+	i.decode_u32();
+	bufferlist hint;
+	i.decode_bl(hint);
+      }
+      break;
+
+    case Transaction::OP_COLL_ADD:
+    case Transaction::OP_COLL_MOVE:
+      colls->insert(i.decode_cid());
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      break;
+
+    case Transaction::OP_COLL_SETATTR:
+      {
+	coll_ops->insert(i.decode_cid());
+	i.decode_attrname();
+	bufferlist bl;
+	i.decode_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_COLL_RMATTR:
+      coll_ops->insert(i.decode_cid());
+      i.decode_attrname();
+      break;
+
+    case Transaction::OP_COLL_SETATTRS:
+      {
+	coll_ops->insert(i.decode_cid());
+	map<string, bufferptr> aset;
+	i.decode_attrset(aset);
+      }
+      break;
+
+    case Transaction::OP_COLL_RENAME:
+      coll_ops->insert(i.decode_cid());
+      coll_ops->insert(i.decode_cid());
+      break;
+
+    case Transaction::OP_OMAP_SETKEYS:
+      {
+	colls->insert(i.decode_cid());
+	objects->insert(i.decode_oid());
+	map<string, bufferlist> aset;
+	i.decode_attrset(aset);
+      }
+      break;
+
+    case Transaction::OP_OMAP_RMKEYS:
+      {
+	colls->insert(i.decode_cid());
+	objects->insert(i.decode_oid());
+	set<string> keys;
+	i.decode_keyset(keys);
+      }
+      break;
+
+    case Transaction::OP_OMAP_RMKEYRANGE:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      i.decode_key();
+      i.decode_key();
+      break;
+
+    case Transaction::OP_SPLIT_COLLECTION:
+    case Transaction::OP_SPLIT_COLLECTION2:
+      coll_ops->insert(i.decode_cid());
+      i.decode_u32();
+      i.decode_u32();
+      coll_ops->insert(i.decode_cid());
+      break;
+
+    case Transaction::OP_COLL_MOVE_RENAME:
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      colls->insert(i.decode_cid());
+      objects->insert(i.decode_oid());
+      break;
+
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
 void ObjectStore::Transaction::generate_test_instances(list<ObjectStore::Transaction*>& o)
 {
   o.push_back(new Transaction);
@@ -487,3 +673,121 @@ void ObjectStore::Transaction::generate_test_instances(list<ObjectStore::Transac
   t->collection_setattrs(c, m);
   o.push_back(t);  
 }
+
+static bufferptr make_zero_page()
+{
+  bufferptr bp = buffer::create_page_aligned(CEPH_PAGE_SIZE);
+  bp.zero();
+  return bp;
+}
+
+static void append_zeros(bufferlist& bl, unsigned len)
+{
+  // shared padding for the journal data section; never written to
+  static bufferptr zeros = make_zero_page();
+  if (len)
+    bl.append(zeros, 0, len);
+}
+
+bool ObjectStore::Transaction::encode_journal(bufferlist& bl,
+					      unsigned align_min) const
+{
+  vector<pair<uint32_t, uint32_t> > cuts;
+  for (vector<pair<uint32_t, uint32_t> >::const_iterator p =
+	 data_payloads.begin();
+       p != data_payloads.end();
+       ++p)
+    if (p->second >= align_min && p->second >= CEPH_PAGE_SIZE)
+      cuts.push_back(*p);
+  if (cuts.empty())
+    return false;
+
+  ENCODE_START(8, 8, bl);
+  ::encode(ops, bl);
+  ::encode(pad_unused_bytes, bl);
+  ::encode(largest_data_len, bl);
+  ::encode(largest_data_off, bl);
+  ::encode(largest_data_off_in_tbl, bl);
+  ::encode(tolerate_collection_add_enoent, bl);
+  ::encode(cuts, bl);
+
+  // the op stream, minus the payloads
+  bufferlist meta;
+  uint32_t pos = 0;
+  for (vector<pair<uint32_t, uint32_t> >::iterator p = cuts.begin();
+       p != cuts.end();
+       ++p) {
+    assert(p->first >= pos);
+    if (p->first > pos) {
+      bufferlist seg;
+      seg.substr_of(tbl, pos, p->first - pos);
+      meta.claim_append(seg);
+    }
+    pos = p->first + p->second;
+  }
+  if (tbl.length() > pos) {
+    bufferlist seg;
+    seg.substr_of(tbl, pos, tbl.length() - pos);
+    meta.claim_append(seg);
+  }
+  ::encode(meta, bl);
+
+  // the payloads, each starting on a page.  split off the partial last
+  // page so the rest stays page sized and need not be rebuilt.
+  __u32 pad = (0 - (bl.length() + sizeof(pad))) & ~CEPH_PAGE_MASK;
+  ::encode(pad, bl);
+  append_zeros(bl, pad);
+  for (vector<pair<uint32_t, uint32_t> >::iterator p = cuts.begin();
+       p != cuts.end();
+       ++p) {
+    uint32_t whole = p->second & CEPH_PAGE_MASK;
+    bufferlist payload;
+    payload.substr_of(tbl, p->first, whole);
+    bl.claim_append(payload);
+    if (p->second > whole) {
+      bufferlist tail;
+      tail.substr_of(tbl, p->first + whole, p->second - whole);
+      bl.claim_append(tail);
+    }
+    append_zeros(bl, (0 - p->second) & ~CEPH_PAGE_MASK);
+  }
+  ENCODE_FINISH(bl);
+  return true;
+}
+
+void ObjectStore::Transaction::decode_journal_data(bufferlist::iterator &bl)
+{
+  vector<pair<uint32_t, uint32_t> > cuts;
+  ::decode(cuts, bl);
+  bufferlist meta;
+  ::decode(meta, bl);
+  __u32 pad;
+  ::decode(pad, bl);
+  bl.advance(pad);
+
+  // splice the payloads back into the op stream
+  tbl.clear();
+  uint32_t pos = 0, moved = 0;
+  for (vector<pair<uint32_t, uint32_t> >::iterator p = cuts.begin();
+       p != cuts.end();
+       ++p) {
+    uint32_t end = p->first - moved;
+    if (end > pos) {
+      bufferlist seg;
+      seg.substr_of(meta, pos, end - pos);
+      tbl.claim_append(seg);
+    }
+    pos = end;
+    bufferlist payload;
+    bl.copy(p->second, payload);
+    tbl.claim_append(payload);
+    bl.advance((0 - p->second) & ~CEPH_PAGE_MASK);
+    moved += p->second;
+  }
+  if (meta.length() > pos) {
+    bufferlist seg;
+    seg.substr_of(meta, pos, meta.length() - pos);
+    tbl.claim_append(seg);
+  }
+  data_payloads.swap(cuts);
+}
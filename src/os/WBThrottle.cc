@@ -3,10 +3,22 @@
 
 #include "acconfig.h"
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/types.h>
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
+
 #include "os/WBThrottle.h"
 #include "common/perf_counters.h"
+#include "common/safe_io.h"
+#include "include/compat.h"
 
 WBThrottle::WBThrottle(CephContext *cct) :
+  scale(1.0),
+  window_flushes(0), window_queue_depth(0),
+  dev_stat_fd(-1),
   cur_ios(0), cur_size(0),
   cct(cct),
   logger(NULL),
@@ -28,10 +40,26 @@ WBThrottle::WBThrottle(CephContext *cct) :
   b.add_u64(l_wbthrottle_ios_wb, "ios_wb");
   b.add_u64(l_wbthrottle_inodes_dirtied, "inodes_dirtied");
   b.add_u64(l_wbthrottle_inodes_wb, "inodes_wb");
+  b.add_u64(l_wbthrottle_bytes_start_flusher, "bytes_start_flusher");
+  b.add_u64(l_wbthrottle_bytes_hard_limit, "bytes_hard_limit");
+  b.add_u64(l_wbthrottle_ios_start_flusher, "ios_start_flusher");
+  b.add_u64(l_wbthrottle_ios_hard_limit, "ios_hard_limit");
+  b.add_u64(l_wbthrottle_inodes_start_flusher, "inodes_start_flusher");
+  b.add_u64(l_wbthrottle_inodes_hard_limit, "inodes_hard_limit");
+  b.add_time_avg(l_wbthrottle_flush_lat, "flush_lat");
+  b.add_u64(l_wbthrottle_dev_queue_depth, "dev_queue_depth");
+  b.add_u64_counter(l_wbthrottle_adaptive_raise, "adaptive_raise");
+  b.add_u64_counter(l_wbthrottle_adaptive_lower, "adaptive_lower");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
-  for (unsigned i = l_wbthrottle_first + 1; i != l_wbthrottle_last; ++i)
-    logger->set(i, 0);
+  for (unsigned i = l_wbthrottle_first + 1; i != l_wbthrottle_last; ++i) {
+    if (i != l_wbthrottle_flush_lat)
+      logger->set(i, 0);
+  }
+  {
+    Mutex::Locker l(lock);
+    apply_limits();
+  }
 
   cct->_conf->add_observer(this);
 }
@@ -41,6 +69,8 @@ WBThrottle::~WBThrottle() {
   cct->get_perfcounters_collection()->remove(logger);
   delete logger;
   cct->_conf->remove_observer(this);
+  if (dev_stat_fd >= 0)
+    VOID_TEMP_FAILURE_RETRY(::close(dev_stat_fd));
 }
 
 void WBThrottle::start()
@@ -78,6 +108,9 @@ const char** WBThrottle::get_tracked_conf_keys() const
     "filestore_wbthrottle_xfs_ios_hard_limit",
     "filestore_wbthrottle_xfs_inodes_start_flusher",
     "filestore_wbthrottle_xfs_inodes_hard_limit",
+    "filestore_wbthrottle_adaptive",
+    "filestore_wbthrottle_adaptive_min_scale",
+    "filestore_wbthrottle_adaptive_max_scale",
     NULL
   };
   return KEYS;
@@ -87,37 +120,141 @@ void WBThrottle::set_from_conf()
 {
   assert(lock.is_locked());
   if (fs == BTRFS) {
-    size_limits.first =
+    size_base.first =
       cct->_conf->filestore_wbthrottle_btrfs_bytes_start_flusher;
-    size_limits.second =
+    size_base.second =
       cct->_conf->filestore_wbthrottle_btrfs_bytes_hard_limit;
-    io_limits.first =
+    io_base.first =
       cct->_conf->filestore_wbthrottle_btrfs_ios_start_flusher;
-    io_limits.second =
+    io_base.second =
       cct->_conf->filestore_wbthrottle_btrfs_ios_hard_limit;
-    fd_limits.first =
+    fd_base.first =
       cct->_conf->filestore_wbthrottle_btrfs_inodes_start_flusher;
-    fd_limits.second =
+    fd_base.second =
       cct->_conf->filestore_wbthrottle_btrfs_inodes_hard_limit;
   } else if (fs == XFS) {
-    size_limits.first =
+    size_base.first =
       cct->_conf->filestore_wbthrottle_xfs_bytes_start_flusher;
-    size_limits.second =
+    size_base.second =
       cct->_conf->filestore_wbthrottle_xfs_bytes_hard_limit;
-    io_limits.first =
+    io_base.first =
       cct->_conf->filestore_wbthrottle_xfs_ios_start_flusher;
-    io_limits.second =
+    io_base.second =
       cct->_conf->filestore_wbthrottle_xfs_ios_hard_limit;
-    fd_limits.first =
+    fd_base.first =
       cct->_conf->filestore_wbthrottle_xfs_inodes_start_flusher;
-    fd_limits.second =
+    fd_base.second =
       cct->_conf->filestore_wbthrottle_xfs_inodes_hard_limit;
   } else {
     assert(0 == "invalid value for fs");
   }
+  if (!cct->_conf->filestore_wbthrottle_adaptive) {
+    scale = 1.0;
+  } else {
+    scale = MAX(scale, cct->_conf->filestore_wbthrottle_adaptive_min_scale);
+    scale = MIN(scale, cct->_conf->filestore_wbthrottle_adaptive_max_scale);
+  }
+  window_flushes = 0;
+  window_lat = utime_t();
+  window_queue_depth = 0;
+  apply_limits();
+}
+
+static pair<uint64_t, uint64_t> scale_limits(
+  const pair<uint64_t, uint64_t> &base, double scale)
+{
+  pair<uint64_t, uint64_t> r(MAX((uint64_t)(base.first * scale), 1),
+			     MAX((uint64_t)(base.second * scale), 1));
+  if (r.second < r.first)
+    r.second = r.first;
+  return r;
+}
+
+void WBThrottle::apply_limits()
+{
+  assert(lock.is_locked());
+  size_limits = scale_limits(size_base, scale);
+  io_limits = scale_limits(io_base, scale);
+  fd_limits = scale_limits(fd_base, scale);
+  if (logger) {
+    logger->set(l_wbthrottle_bytes_start_flusher, size_limits.first);
+    logger->set(l_wbthrottle_bytes_hard_limit, size_limits.second);
+    logger->set(l_wbthrottle_ios_start_flusher, io_limits.first);
+    logger->set(l_wbthrottle_ios_hard_limit, io_limits.second);
+    logger->set(l_wbthrottle_inodes_start_flusher, fd_limits.first);
+    logger->set(l_wbthrottle_inodes_hard_limit, fd_limits.second);
+  }
   cond.Signal();
 }
 
+void WBThrottle::set_dev(dev_t dev)
+{
+#if defined(__linux__)
+  char fn[PATH_MAX];
+  snprintf(fn, sizeof(fn), "/sys/dev/block/%u:%u/stat",
+	   major(dev), minor(dev));
+  // btrfs and other anonymous devices have no entry; we then go by
+  // latency alone
+  int fd = ::open(fn, O_RDONLY);
+  Mutex::Locker l(lock);
+  if (dev_stat_fd >= 0)
+    VOID_TEMP_FAILURE_RETRY(::close(dev_stat_fd));
+  dev_stat_fd = fd;
+#endif
+}
+
+uint64_t WBThrottle::read_queue_depth()
+{
+  assert(lock.is_locked());
+  if (dev_stat_fd < 0)
+    return 0;
+  char buf[256];
+  int r = safe_pread(dev_stat_fd, buf, sizeof(buf) - 1, 0);
+  if (r <= 0)
+    return 0;
+  buf[r] = 0;
+  // the ninth field is the number of requests in flight
+  unsigned long long f[9];
+  if (sscanf(buf, "%llu %llu %llu %llu %llu %llu %llu %llu %llu",
+	     &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6], &f[7],
+	     &f[8]) != 9)
+    return 0;
+  return f[8];
+}
+
+void WBThrottle::adapt(utime_t lat, uint64_t queue_depth)
+{
+  assert(lock.is_locked());
+  window_lat += lat;
+  window_queue_depth += queue_depth;
+  if (++window_flushes < MAX(cct->_conf->filestore_wbthrottle_adaptive_window,
+			     1))
+    return;
+
+  double avg_lat = (double)window_lat / window_flushes;
+  uint64_t avg_queue_depth = window_queue_depth / window_flushes;
+  window_flushes = 0;
+  window_lat = utime_t();
+  window_queue_depth = 0;
+
+  double target = cct->_conf->filestore_wbthrottle_adaptive_target_lat;
+  double old_scale = scale;
+  if (avg_lat > target) {
+    scale = MAX(scale * 0.75,
+		cct->_conf->filestore_wbthrottle_adaptive_min_scale);
+  } else if (avg_lat < target / 2 &&
+	     avg_queue_depth <
+	       cct->_conf->filestore_wbthrottle_adaptive_max_queue_depth) {
+    scale = MIN(scale * 1.25,
+		cct->_conf->filestore_wbthrottle_adaptive_max_scale);
+  }
+  if (scale == old_scale)
+    return;
+  logger->inc(scale < old_scale ? l_wbthrottle_adaptive_lower :
+	      l_wbthrottle_adaptive_raise);
+  apply_limits();
+}
+
 void WBThrottle::handle_conf_change(const md_config_t *conf,
 				    const std::set<std::string> &changed)
 {
@@ -160,11 +297,13 @@ void *WBThrottle::entry()
   while (get_next_should_flush(&wb)) {
     clearing = wb.get<0>();
     lock.Unlock();
+    utime_t start = ceph_clock_now(cct);
 #ifdef HAVE_FDATASYNC
     ::fdatasync(**wb.get<1>());
 #else
     ::fsync(**wb.get<1>());
 #endif
+    utime_t lat = ceph_clock_now(cct) - start;
 #ifdef HAVE_POSIX_FADVISE
     if (wb.get<2>().nocache) {
       int fa_r = posix_fadvise(**wb.get<1>(), 0, 0, POSIX_FADV_DONTNEED);
@@ -172,12 +311,18 @@ void *WBThrottle::entry()
     }
 #endif
     lock.Lock();
+    // under the lock: set_dev() may replace dev_stat_fd
+    uint64_t queue_depth = read_queue_depth();
     clearing = ghobject_t();
     cur_ios -= wb.get<2>().ios;
     logger->dec(l_wbthrottle_ios_dirtied, wb.get<2>().ios);
     cur_size -= wb.get<2>().size;
     logger->dec(l_wbthrottle_bytes_dirtied, wb.get<2>().size);
     logger->dec(l_wbthrottle_inodes_dirtied);
+    logger->tinc(l_wbthrottle_flush_lat, lat);
+    logger->set(l_wbthrottle_dev_queue_depth, queue_depth);
+    if (cct->_conf->filestore_wbthrottle_adaptive)
+      adapt(lat, queue_depth);
     cond.Signal();
     wb = boost::tuple<ghobject_t, FDRef, PendingWB>();
   }
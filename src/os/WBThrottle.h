@@ -35,6 +35,16 @@ enum {
   l_wbthrottle_ios_wb,
   l_wbthrottle_inodes_dirtied,
   l_wbthrottle_inodes_wb,
+  l_wbthrottle_bytes_start_flusher,
+  l_wbthrottle_bytes_hard_limit,
+  l_wbthrottle_ios_start_flusher,
+  l_wbthrottle_ios_hard_limit,
+  l_wbthrottle_inodes_start_flusher,
+  l_wbthrottle_inodes_hard_limit,
+  l_wbthrottle_flush_lat,
+  l_wbthrottle_dev_queue_depth,
+  l_wbthrottle_adaptive_raise,
+  l_wbthrottle_adaptive_lower,
   l_wbthrottle_last
 };
 
@@ -59,6 +69,21 @@ class WBThrottle : Thread, public md_config_obs_t {
   /// Limits on unflushed objects
   pair<uint64_t, uint64_t> fd_limits;
 
+  /* The limits above are the configured ones (*_base) times scale.  In
+   * adaptive mode scale follows the observed flush latency: it shrinks
+   * while fsyncs take longer than the target, and grows while they are
+   * well under it and the device queue is not saturated.
+   */
+  pair<uint64_t, uint64_t> size_base, io_base, fd_base;
+  double scale;
+
+  /// flushes since the last adjustment, and their totals
+  uint64_t window_flushes;
+  utime_t window_lat;
+  uint64_t window_queue_depth;
+
+  int dev_stat_fd;  ///< sysfs stat of the backing device, or -1; under lock
+
   uint64_t cur_ios;  /// Currently unflushed IOs
   uint64_t cur_size; /// Currently unflushed bytes
 
@@ -130,6 +155,9 @@ private:
   FS fs;
 
   void set_from_conf();
+  void apply_limits();
+  uint64_t read_queue_depth();
+  void adapt(utime_t lat, uint64_t queue_depth);
 public:
   WBThrottle(CephContext *cct);
   ~WBThrottle();
@@ -143,6 +171,9 @@ public:
     set_from_conf();
   }
 
+  /// Set the device backing the store, whose queue depth adaptive mode watches
+  void set_dev(dev_t dev);
+
   /// Queue wb on oid, fd taking throttle (does not block)
   void queue_wb(
     FDRef fd,              ///< [in] FDRef to oid
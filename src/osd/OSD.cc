@@ -37,6 +37,7 @@
 
 #include "OSD.h"
 #include "OSDMap.h"
+#include "OSDMapMapping.h"
 #include "Watch.h"
 #include "osdc/Objecter.h"
 
@@ -228,6 +229,7 @@ OSDService::OSDService(OSD *osd) :
   remote_reserver(&reserver_finisher, cct->_conf->osd_max_backfills,
 		  cct->_conf->osd_min_recovery_priority),
   pg_temp_lock("OSDService::pg_temp_lock"),
+  peering_latency_lock("OSDService::peering_latency_lock"),
   map_cache_lock("OSDService::map_lock"),
   map_cache(cct, cct->_conf->osd_map_cache_size),
   map_bl_cache(cct->_conf->osd_map_cache_size),
@@ -739,6 +741,39 @@ void OSDService::send_pg_temp()
   monc->send_mon_message(m);
 }
 
+void OSDService::record_peering_latency(epoch_t e, utime_t lat)
+{
+  Mutex::Locker l(peering_latency_lock);
+  peering_latency_t &pl = peering_latency[e];
+  pl.num++;
+  pl.total += lat;
+  if (lat > pl.max)
+    pl.max = lat;
+  pl.hist_ms.add((int32_t)(lat * 1000.0));
+  while (peering_latency.size() > (unsigned)cct->_conf->osd_peering_latency_epochs)
+    peering_latency.erase(peering_latency.begin());
+}
+
+void OSDService::dump_peering_latency(Formatter *f)
+{
+  Mutex::Locker l(peering_latency_lock);
+  f->open_array_section("peering_latency");
+  for (map<epoch_t, peering_latency_t>::iterator p = peering_latency.begin();
+       p != peering_latency.end();
+       ++p) {
+    f->open_object_section("epoch");
+    f->dump_unsigned("epoch", p->first);
+    f->dump_unsigned("pgs", p->second.num);
+    f->dump_float("avg", (double)p->second.total / p->second.num);
+    f->dump_float("max", (double)p->second.max);
+    f->open_object_section("ms");
+    p->second.hist_ms.dump(f);
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+}
+
 
 // --------------------------------------
 // dispatch
@@ -1540,6 +1575,7 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
   op_shardedwq(cct->_conf->osd_op_num_shards, this, 
     cct->_conf->osd_op_thread_timeout, &osd_op_tp),
   peering_wq(this, cct->_conf->osd_op_thread_timeout, &osd_tp),
+  peering_batch(cct, this),
   map_lock("OSD::map_lock"),
   pg_map_lock("OSD::pg_map_lock"),
   debug_drop_pg_create_probability(cct->_conf->osd_debug_drop_pg_create_probability),
@@ -1652,6 +1688,19 @@ bool OSD::asok_command(string command, cmdmap_t& cmdmap, string format,
     f->open_object_section("pq");
     op_shardedwq.dump(f);
     f->close_section();
+  } else if (command == "dump_startup_timing") {
+    utime_t total;
+    f->open_object_section("startup_timing");
+    for (vector<pair<string,utime_t> >::iterator p = startup_timing.begin();
+	 p != startup_timing.end();
+	 ++p) {
+      f->dump_float(p->first.c_str(), (double)p->second);
+      total += p->second;
+    }
+    f->dump_float("total", (double)total);
+    f->close_section();
+  } else if (command == "dump_peering_latency") {
+    service.dump_peering_latency(f);
   } else if (command == "dump_blacklist") {
     list<pair<entity_addr_t,utime_t> > bl;
     OSDMapRef curmap = service.get_osdmap();
@@ -1752,8 +1801,10 @@ int OSD::init()
   if (is_stopping())
     return 0;
 
+  startup_phase_start = ceph_clock_now(cct);
   tick_timer.init();
   service.backfill_request_timer.init();
+  peering_batch.init();
 
   // mount.
   dout(2) << "mounting " << dev_path << " "
@@ -1765,6 +1816,7 @@ int OSD::init()
     derr << "OSD:init: unable to mount object store" << dendl;
     return r;
   }
+  startup_phase_done("mount");
 
   dout(2) << "boot" << dendl;
 
@@ -1835,6 +1887,7 @@ int OSD::init()
     if (r < 0)
       goto out;
   }
+  startup_phase_done("superblock");
 
   class_handler = new ClassHandler(cct);
   cls_initialize(class_handler);
@@ -1844,6 +1897,7 @@ int OSD::init()
     if (r)
       dout(1) << "warning: got an error loading one or more classes: " << cpp_strerror(r) << dendl;
   }
+  startup_phase_done("open_classes");
 
   // load up "current" osdmap
   assert_warn(!osdmap);
@@ -1854,6 +1908,7 @@ int OSD::init()
   }
   osdmap = get_map(superblock.current_epoch);
   check_osdmap_features(store);
+  startup_phase_done("load_osdmap");
 
   create_recoverystate_perf();
 
@@ -1923,12 +1978,14 @@ int OSD::init()
   osd_lock.Lock();
   if (is_stopping())
     return 0;
+  startup_phase_done("authenticate");
 
   check_config();
 
   dout(10) << "ensuring pgs have consumed prior maps" << dendl;
   consume_map();
   peering_wq.drain();
+  startup_phase_done("consume_map");
 
   dout(0) << "done with init, starting boot process" << dendl;
   set_state(STATE_BOOTING);
@@ -1968,6 +2025,17 @@ void OSD::final_init()
 				     asok_hook,
 				     "dump op priority queue state");
   assert(r == 0);
+  r = admin_socket->register_command("dump_startup_timing",
+				     "dump_startup_timing",
+				     asok_hook,
+				     "show how long each phase of startup took");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_peering_latency",
+				     "dump_peering_latency",
+				     asok_hook,
+				     "show how long pgs took to go active, "
+				     "by the epoch they started peering in");
+  assert(r == 0);
   r = admin_socket->register_command("dump_blacklist", "dump_blacklist",
 				     asok_hook,
 				     "dump blacklisted clients and times");
@@ -2112,6 +2180,9 @@ void OSD::create_logger()
   osd_plb.add_u64(l_osd_pg_primary, "numpg_primary"); // num primary pgs
   osd_plb.add_u64(l_osd_pg_replica, "numpg_replica"); // num replica pgs
   osd_plb.add_u64(l_osd_pg_stray, "numpg_stray");   // num stray pgs
+  osd_plb.add_u64(l_osd_pg_log_bytes, "pg_log_bytes"); // memory held by pg logs
+  osd_plb.add_u64_counter(l_osd_peering_msgs, "peering_msgs"); // notifies, queries and infos sent
+  osd_plb.add_u64_counter(l_osd_peering_msg_pgs, "peering_msg_pgs"); // pgs in them
   osd_plb.add_u64(l_osd_hb_to, "heartbeat_to_peers");     // heartbeat peers we send to
   osd_plb.add_u64(l_osd_hb_from, "heartbeat_from_peers"); // heartbeat peers we recv from
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
@@ -2264,6 +2335,8 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
   cct->get_admin_socket()->unregister_command("dump_historic_ops");
   cct->get_admin_socket()->unregister_command("dump_op_pq_state");
+  cct->get_admin_socket()->unregister_command("dump_startup_timing");
+  cct->get_admin_socket()->unregister_command("dump_peering_latency");
   cct->get_admin_socket()->unregister_command("dump_blacklist");
   cct->get_admin_socket()->unregister_command("dump_watchers");
   cct->get_admin_socket()->unregister_command("dump_reservations");
@@ -2296,6 +2369,7 @@ int OSD::shutdown()
   peering_wq.clear();
   scrub_finalize_wq.clear();
   osd_tp.stop();
+  peering_batch.shutdown();
   dout(10) << "osd tp stopped" << dendl;
 
   osd_op_tp.drain();
@@ -2489,16 +2563,19 @@ PG *OSD::_open_lock_pg(
   assert(osd_lock.is_locked());
 
   PG* pg = _make_pg(createmap, pgid);
-  {
-    RWLock::WLocker l(pg_map_lock);
-    pg->lock(no_lockdep_check);
-    pg_map[pgid] = pg;
-    pg->get("PGMap");  // because it's in pg_map
-    service.pg_add_epoch(pg->info.pgid, createmap->get_epoch());
-  }
+  _add_lock_pg(pg, no_lockdep_check);
   return pg;
 }
 
+void OSD::_add_lock_pg(PG *pg, bool no_lockdep_check)
+{
+  RWLock::WLocker l(pg_map_lock);
+  pg->lock(no_lockdep_check);
+  pg_map[pg->pg_id] = pg;
+  pg->get("PGMap");  // because it's in pg_map
+  service.pg_add_epoch(pg->pg_id, pg->get_osdmap()->get_epoch());
+}
+
 PG* OSD::_make_pg(
   OSDMapRef createmap,
   spg_t pgid)
@@ -2758,7 +2835,9 @@ void OSD::load_pgs()
     dout(10) << "load_pgs ignoring unrecognized " << *it << dendl;
   }
 
-  bool has_upgraded = false;
+  startup_phase_done("load_pgs_list");
+
+  list<LoadingPG> loading;
   for (map<spg_t, interval_set<snapid_t> >::iterator i = pgs.begin();
        i != pgs.end();
        ++i) {
@@ -2783,15 +2862,40 @@ void OSD::load_pgs()
     }
 
     dout(10) << "pgid " << pgid << " coll " << coll_t(pgid) << dendl;
-    bufferlist bl;
-    epoch_t map_epoch = PG::peek_map_epoch(store, coll_t(pgid), service.infos_oid, &bl);
+    loading.push_back(LoadingPG(pgid));
+  }
+
+  // read pg state, log and missing, in parallel
+  int num_threads = MIN(cct->_conf->osd_load_pg_threads, (int)loading.size());
+  if (num_threads > 1) {
+    ThreadPool load_tp(cct, "OSD::load_tp", num_threads);
+    LoadPGWQ load_wq(this, cct->_conf->osd_op_thread_timeout, &load_tp);
+    for (list<LoadingPG>::iterator i = loading.begin();
+	 i != loading.end();
+	 ++i)
+      load_wq.queue(&*i);
+    load_tp.start();
+    load_wq.drain();
+    load_tp.stop();
+  } else {
+    for (list<LoadingPG>::iterator i = loading.begin();
+	 i != loading.end();
+	 ++i)
+      _read_pg(&*i);
+  }
+  dout(0) << "load_pgs read " << loading.size() << " pgs with "
+	  << MAX(num_threads, 1) << " threads" << dendl;
+  startup_phase_done("load_pgs_read");
 
-    PG *pg = _open_lock_pg(map_epoch == 0 ? osdmap : service.get_map(map_epoch), pgid);
+  bool has_upgraded = false;
+  for (list<LoadingPG>::iterator i = loading.begin();
+       i != loading.end();
+       ++i) {
+    spg_t pgid(i->pgid);
+    PG *pg = i->pg;
+    _add_lock_pg(pg);
     // there can be no waiters here, so we don't call wake_pg_waiters
 
-    // read pg state, log
-    pg->read_state(store, bl);
-
     if (pg->must_upgrade()) {
       if (!has_upgraded) {
 	derr << "PGs are upgrading" << dendl;
@@ -2799,11 +2903,11 @@ void OSD::load_pgs()
       }
       dout(10) << "PG " << pg->info.pgid
 	       << " must upgrade..." << dendl;
-      pg->upgrade(store, i->second);
-    } else if (!i->second.empty()) {
+      pg->upgrade(store, pgs[pgid]);
+    } else if (!pgs[pgid].empty()) {
       // handle upgrade bug
-      for (interval_set<snapid_t>::iterator j = i->second.begin();
-	   j != i->second.end();
+      for (interval_set<snapid_t>::iterator j = pgs[pgid].begin();
+	   j != pgs[pgid].end();
 	   ++j) {
 	for (snapid_t k = j.get_start();
 	     k != j.get_start() + j.get_len();
@@ -2852,11 +2956,35 @@ void OSD::load_pgs()
     RWLock::RLocker l(pg_map_lock);
     dout(0) << "load_pgs opened " << pg_map.size() << " pgs" << dendl;
   }
-  
+  startup_phase_done("load_pgs_register");
+
   build_past_intervals_parallel();
+  startup_phase_done("build_past_intervals");
+}
+
+void OSD::_read_pg(LoadingPG *l)
+{
+  bufferlist bl;
+  epoch_t map_epoch = PG::peek_map_epoch(store, coll_t(l->pgid),
+					 service.infos_oid, &bl);
+  l->pg = _make_pg(map_epoch == 0 ? osdmap : service.get_map(map_epoch),
+		   l->pgid);
+  l->pg->lock();
+  l->pg->read_state(store, bl);
+  l->pg->unlock();
+}
+
+void OSD::startup_phase_done(const char *phase)
+{
+  utime_t now = ceph_clock_now(cct);
+  utime_t took = now - startup_phase_start;
+  startup_timing.push_back(make_pair(string(phase), took));
+  dout(0) << "init " << phase << " took " << took << dendl;
+  startup_phase_start = now;
 }
 
 
+
 /*
  * build past_intervals efficiently on old, degraded, and buried
  * clusters.  this is important for efficiently catching up osds that
@@ -5968,6 +6096,16 @@ void OSD::osdmap_subscribe(version_t epoch, bool force_request)
   }
 }
 
+void OSD::build_map_mapping(OSDMap *o)
+{
+  utime_t start = ceph_clock_now(cct);
+  o->build_mapping(cct->_conf->osd_map_precompute_threads);
+  dout(10) << "build_map_mapping e" << o->get_epoch()
+	   << " mapped " << o->get_mapping()->get_num_pgs() << " pgs ("
+	   << o->get_mapping()->get_bytes() << " bytes) in "
+	   << (ceph_clock_now(cct) - start) << dendl;
+}
+
 void OSD::handle_osd_map(MOSDMap *m)
 {
   assert(osd_lock.is_locked());
@@ -6045,7 +6183,13 @@ void OSD::handle_osd_map(MOSDMap *m)
   ObjectStore::Transaction *_t = new ObjectStore::Transaction;
   ObjectStore::Transaction &t = *_t;
 
-  // store new maps: queue for disk and put in the osdmap cache
+  // store new maps: queue for disk and put in the osdmap cache.  only
+  // the last map gets precomputed mappings: the maps before it just
+  // carry them forward, and then go without.
+  bool precompute = cct->_conf->osd_map_precompute_mappings;
+  ceph::shared_ptr<OSDMapMapping> mapping;
+  if (!precompute)
+    map_mapping.reset();
   epoch_t last_marked_full = 0;
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
   for (epoch_t e = start; e <= last; e++) {
@@ -6057,6 +6201,11 @@ void OSD::handle_osd_map(MOSDMap *m)
       bufferlist& bl = p->second;
       
       o->decode(bl);
+      mapping.reset();
+      if (precompute && e == last) {
+	build_map_mapping(o);
+	map_mapping = o->disown_mapping();
+      }
       if (o->test_flag(CEPH_OSDMAP_FULL))
 	last_marked_full = e;
 
@@ -6081,6 +6230,12 @@ void OSD::handle_osd_map(MOSDMap *m)
 	OSDMapRef prev = get_map(e - 1);
 	prev->encode(obl);
 	o->decode(obl);
+	if (precompute) {
+	  if (mapping)
+	    o->adopt_mapping(mapping);
+	  else
+	    o->inherit_mapping(*prev);
+	}
       }
 
       OSDMap::Incremental inc;
@@ -6090,6 +6245,13 @@ void OSD::handle_osd_map(MOSDMap *m)
 	derr << "ERROR: bad fsid?  i have " << osdmap->get_fsid() << " and inc has " << inc.fsid << dendl;
 	assert(0 == "bad fsid");
       }
+      if (precompute && e < last) {
+	mapping = o->take_mapping();
+      } else if (precompute) {
+	if (!o->has_mapping())
+	  build_map_mapping(o);
+	map_mapping = o->disown_mapping();
+      }
 
       if (o->test_flag(CEPH_OSDMAP_FULL))
 	last_marked_full = e;
@@ -6563,16 +6725,19 @@ void OSD::consume_map()
   // scan pg's
   {
     RWLock::RLocker l(pg_map_lock);
+    uint64_t pg_log_bytes = 0;
     for (ceph::unordered_map<spg_t,PG*>::iterator it = pg_map.begin();
         it != pg_map.end();
         ++it) {
       PG *pg = it->second;
       pg->lock();
       pg->queue_null(osdmap->get_epoch(), osdmap->get_epoch());
+      pg_log_bytes += pg->pg_log.get_log_mem_bytes();
       pg->unlock();
     }
 
     logger->set(l_osd_pg, pg_map.size());
+    logger->set(l_osd_pg_log_bytes, pg_log_bytes);
   }
   logger->set(l_osd_pg_primary, num_pg_primary);
   logger->set(l_osd_pg_replica, num_pg_replica);
@@ -7019,19 +7184,8 @@ bool OSD::compat_must_dispatch_immediately(PG *pg)
 	  pg->pool.info.ec_pool() ? shard_id_t(i) : shard_id_t::NO_SHARD));
     }
   }
-
-  for (set<pg_shard_t>::iterator i = tmpacting.begin();
-       i != tmpacting.end();
-       ++i) {
-    if (i->osd == whoami || i->osd == CRUSH_ITEM_NONE)
-      continue;
-    ConnectionRef conn =
-      service.get_con_osd_cluster(i->osd, pg->get_osdmap()->get_epoch());
-    if (conn && !conn->has_feature(CEPH_FEATURE_INDEP_PG_MAP)) {
-      return true;
-    }
-  }
-  return false;
+  return peering_batch.must_dispatch_immediately(
+    tmpacting, whoami, pg->get_osdmap()->get_epoch());
 }
 
 void OSD::dispatch_context(PG::RecoveryCtx &ctx, PG *pg, OSDMapRef curmap,
@@ -7039,6 +7193,7 @@ void OSD::dispatch_context(PG::RecoveryCtx &ctx, PG *pg, OSDMapRef curmap,
 {
   if (service.get_osdmap()->is_up(whoami) &&
       is_active()) {
+    peering_batch.flush_overlapping(ctx);
     do_notifies(*ctx.notify_list, curmap);
     do_queries(*ctx.query_map, curmap);
     do_infos(*ctx.info_map, curmap);
@@ -7094,6 +7249,8 @@ void OSD::do_notifies(
       MOSDPGNotify *m = new MOSDPGNotify(curmap->get_epoch(),
 					 it->second);
       con->send_message(m);
+      logger->inc(l_osd_peering_msgs);
+      logger->inc(l_osd_peering_msg_pgs, it->second.size());
     } else {
       dout(7) << __func__ << " osd " << it->first
 	      << " sending separate messages" << dendl;
@@ -7106,6 +7263,8 @@ void OSD::do_notifies(
 	MOSDPGNotify *m = new MOSDPGNotify(i->first.epoch_sent,
 					   list);
 	con->send_message(m);
+	logger->inc(l_osd_peering_msgs);
+	logger->inc(l_osd_peering_msg_pgs);
       }
     }
   }
@@ -7138,6 +7297,8 @@ void OSD::do_queries(map<int, map<spg_t,pg_query_t> >& query_map,
 	      << " on " << pit->second.size() << " PGs" << dendl;
       MOSDPGQuery *m = new MOSDPGQuery(curmap->get_epoch(), pit->second);
       con->send_message(m);
+      logger->inc(l_osd_peering_msgs);
+      logger->inc(l_osd_peering_msg_pgs, pit->second.size());
     } else {
       dout(7) << __func__ << " querying osd." << who
 	      << " sending seperate messages on " << pit->second.size()
@@ -7149,6 +7310,8 @@ void OSD::do_queries(map<int, map<spg_t,pg_query_t> >& query_map,
 	to_send.insert(*i);
 	MOSDPGQuery *m = new MOSDPGQuery(i->second.epoch_sent, to_send);
 	con->send_message(m);
+	logger->inc(l_osd_peering_msgs);
+	logger->inc(l_osd_peering_msg_pgs);
       }
     }
   }
@@ -7186,6 +7349,8 @@ void OSD::do_infos(map<int,
       MOSDPGInfo *m = new MOSDPGInfo(curmap->get_epoch());
       m->pg_list = p->second;
       con->send_message(m);
+      logger->inc(l_osd_peering_msgs);
+      logger->inc(l_osd_peering_msg_pgs, p->second.size());
     } else {
       for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
 	     p->second.begin();
@@ -7196,6 +7361,8 @@ void OSD::do_infos(map<int,
 	MOSDPGInfo *m = new MOSDPGInfo(i->first.epoch_sent);
 	m->pg_list = to_send;
 	con->send_message(m);
+	logger->inc(l_osd_peering_msgs);
+	logger->inc(l_osd_peering_msg_pgs);
       }
     }
   }
@@ -8128,6 +8295,63 @@ void OSD::enqueue_op(PG *pg, OpRequestRef& op)
   pg->queue_op(op);
 }
 
+// classes of the ops in the op queue, for osd_op_queue = mclock.  scrub
+// and snap trim are driven from their own work queues.
+enum {
+  OP_CLASS_CLIENT,
+  OP_CLASS_SUBOP,      ///< replicated writes and reads
+  OP_CLASS_RECOVERY,   ///< recovery and backfill
+  OP_CLASS_MAX
+};
+
+static unsigned get_op_class(const pair<PGRef, OpRequestRef> &item)
+{
+  switch (item.second->get_req()->get_type()) {
+  case CEPH_MSG_OSD_OP:
+    return OP_CLASS_CLIENT;
+  case MSG_OSD_PG_PUSH:
+  case MSG_OSD_PG_PULL:
+  case MSG_OSD_PG_PUSH_REPLY:
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+    return OP_CLASS_RECOVERY;
+  default:
+    return OP_CLASS_SUBOP;
+  }
+}
+
+OSD::ShardedOpWQ::OpQueueT *OSD::ShardedOpWQ::create_queue(CephContext *cct)
+{
+  md_config_t *conf = cct->_conf;
+  if (conf->osd_op_queue == "mclock") {
+    typedef MClockQueue< pair<PGRef, OpRequestRef>, entity_inst_t> MClockQueueT;
+    vector<MClockQueueT::class_info_t> classes(OP_CLASS_MAX);
+    classes[OP_CLASS_CLIENT] = MClockQueueT::class_info_t(
+      "client",
+      conf->osd_op_queue_mclock_client_op_res,
+      conf->osd_op_queue_mclock_client_op_wgt,
+      conf->osd_op_queue_mclock_client_op_lim,
+      true);
+    classes[OP_CLASS_SUBOP] = MClockQueueT::class_info_t(
+      "osd_subop",
+      conf->osd_op_queue_mclock_osd_subop_res,
+      conf->osd_op_queue_mclock_osd_subop_wgt,
+      conf->osd_op_queue_mclock_osd_subop_lim);
+    classes[OP_CLASS_RECOVERY] = MClockQueueT::class_info_t(
+      "recovery",
+      conf->osd_op_queue_mclock_recovery_res,
+      conf->osd_op_queue_mclock_recovery_wgt,
+      conf->osd_op_queue_mclock_recovery_lim);
+    return new MClockQueueT(classes, get_op_class, conf->osd_op_pq_min_cost);
+  }
+  if (conf->osd_op_queue != "prioritized")
+    lgeneric_derr(cct) << "unknown osd_op_queue '" << conf->osd_op_queue
+		       << "', using prioritized" << dendl;
+  return new PrioritizedQueue< pair<PGRef, OpRequestRef>, entity_inst_t>(
+    conf->osd_op_pq_max_tokens_per_priority,
+    conf->osd_op_pq_min_cost);
+}
+
 void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb ) {
 
   uint32_t shard_index = thread_index % num_shards;
@@ -8135,19 +8359,19 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   ShardData* sdata = shard_list[shard_index];
   assert(NULL != sdata);
   sdata->sdata_op_ordering_lock.Lock();
-  if (sdata->pqueue.empty()) {
+  if (sdata->pqueue->empty()) {
     sdata->sdata_op_ordering_lock.Unlock();
     osd->cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
     sdata->sdata_lock.Lock();
     sdata->sdata_cond.WaitInterval(osd->cct, sdata->sdata_lock, utime_t(2, 0));
     sdata->sdata_lock.Unlock();
     sdata->sdata_op_ordering_lock.Lock();
-    if(sdata->pqueue.empty()) {
+    if(sdata->pqueue->empty()) {
       sdata->sdata_op_ordering_lock.Unlock();
       return;
     }
   }
-  pair<PGRef, OpRequestRef> item = sdata->pqueue.dequeue();
+  pair<PGRef, OpRequestRef> item = sdata->pqueue->dequeue();
   sdata->pg_for_processing[&*(item.first)].push_back(item.second);
   sdata->sdata_op_ordering_lock.Unlock();
   ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval, 
@@ -8212,10 +8436,10 @@ void OSD::ShardedOpWQ::_enqueue(pair<PGRef, OpRequestRef> item) {
   sdata->sdata_op_ordering_lock.Lock();
  
   if (priority >= CEPH_MSG_PRIO_LOW)
-    sdata->pqueue.enqueue_strict(
+    sdata->pqueue->enqueue_strict(
       item.second->get_req()->get_source_inst(), priority, item);
   else
-    sdata->pqueue.enqueue(item.second->get_req()->get_source_inst(),
+    sdata->pqueue->enqueue(item.second->get_req()->get_source_inst(),
       priority, cost, item);
   sdata->sdata_op_ordering_lock.Unlock();
 
@@ -8240,10 +8464,10 @@ void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, OpRequestRef> item) {
   unsigned priority = item.second->get_req()->get_priority();
   unsigned cost = item.second->get_req()->get_cost();
   if (priority >= CEPH_MSG_PRIO_LOW)
-    sdata->pqueue.enqueue_strict_front(
+    sdata->pqueue->enqueue_strict_front(
       item.second->get_req()->get_source_inst(),priority, item);
   else
-    sdata->pqueue.enqueue_front(item.second->get_req()->get_source_inst(),
+    sdata->pqueue->enqueue_front(item.second->get_req()->get_source_inst(),
       priority, cost, item);
 
   sdata->sdata_op_ordering_lock.Unlock();
@@ -8334,6 +8558,23 @@ struct C_CompleteSplits : public Context {
   }
 };
 
+void OSD::send_peering_messages(PG::BufferedRecoveryMessages &msgs,
+				OSDMapRef curmap)
+{
+  if (service.get_osdmap()->is_up(whoami) &&
+      is_active()) {
+    do_notifies(msgs.notify_list, curmap);
+    do_queries(msgs.query_map, curmap);
+    do_infos(msgs.info_map, curmap);
+  }
+}
+
+bool OSD::peer_lacks_feature(int osd, epoch_t e, uint64_t feature)
+{
+  ConnectionRef conn = service.get_con_osd_cluster(osd, e);
+  return conn && !conn->has_feature(feature);
+}
+
 void OSD::process_peering_events(
   const list<PG*> &pgs,
   ThreadPool::TPHandle &handle
@@ -8344,6 +8585,7 @@ void OSD::process_peering_events(
   OSDMapRef curmap = service.get_osdmap();
   PG::RecoveryCtx rctx = create_context();
   rctx.handle = &handle;
+  peering_batch.start();
   for (list<PG*>::const_iterator i = pgs.begin();
        i != pgs.end();
        ++i) {
@@ -8382,6 +8624,7 @@ void OSD::process_peering_events(
   }
   if (need_up_thru)
     queue_want_up_thru(same_interval_since);
+  peering_batch.finish(rctx, curmap, peering_wq.is_empty());
   dispatch_context(rctx, 0, curmap, &handle);
 
   service.send_pg_temp();
@@ -49,10 +49,12 @@ using namespace std;
 #include "include/unordered_set.h"
 
 #include "Watch.h"
+#include "PeeringBatch.h"
 #include "common/shared_cache.hpp"
 #include "common/simple_cache.hpp"
 #include "common/sharedptr_registry.hpp"
 #include "common/PrioritizedQueue.h"
+#include "common/MClockQueue.h"
 #include "messages/MOSDOp.h"
 
 #define CEPH_OSD_PROTOCOL    10 /* cluster internal */
@@ -111,6 +113,9 @@ enum {
   l_osd_pg_primary,
   l_osd_pg_replica,
   l_osd_pg_stray,
+  l_osd_pg_log_bytes,
+  l_osd_peering_msgs,
+  l_osd_peering_msg_pgs,
   l_osd_hb_to,
   l_osd_hb_from,
   l_osd_map,
@@ -694,6 +699,19 @@ public:
   }
   void send_pg_temp();
 
+  // -- peering latency --
+  struct peering_latency_t {
+    unsigned num;
+    utime_t total, max;
+    pow2_hist_t hist_ms;
+    peering_latency_t() : num(0) {}
+  };
+  Mutex peering_latency_lock;
+  /// how long pgs took to go active, by the epoch they started peering in
+  map<epoch_t, peering_latency_t> peering_latency;
+  void record_peering_latency(epoch_t e, utime_t lat);
+  void dump_peering_latency(Formatter *f);
+
   void queue_for_peering(PG *pg);
   bool queue_for_recovery(PG *pg);
   bool queue_for_snap_trim(PG *pg) {
@@ -901,7 +919,8 @@ struct C_OSD_SendMessageOnConn: public Context {
 };
 
 class OSD : public Dispatcher,
-	    public md_config_obs_t {
+	    public md_config_obs_t,
+	    public PeeringBatch::Sender {
   /** OSD **/
 public:
   // config observer bits
@@ -1433,18 +1452,26 @@ private:
  
   class ShardedOpWQ: public ShardedThreadPool::ShardedWQ < pair <PGRef, OpRequestRef> > {
 
+    typedef OpQueue< pair<PGRef, OpRequestRef>, entity_inst_t> OpQueueT;
+
     struct ShardData {
       Mutex sdata_lock;
       Cond sdata_cond;
       Mutex sdata_op_ordering_lock;
       map<PG*, list<OpRequestRef> > pg_for_processing;
-      PrioritizedQueue< pair<PGRef, OpRequestRef>, entity_inst_t> pqueue;
-      ShardData(string lock_name, string ordering_lock, uint64_t max_tok_per_prio, uint64_t min_cost):
+      OpQueueT *pqueue;
+      ShardData(string lock_name, string ordering_lock, OpQueueT *q):
           sdata_lock(lock_name.c_str()),
           sdata_op_ordering_lock(ordering_lock.c_str()),
-          pqueue(max_tok_per_prio, min_cost) {}
+          pqueue(q) {}
+      ~ShardData() {
+        delete pqueue;
+      }
     };
 
+    /// the queue osd_op_queue selects
+    static OpQueueT *create_queue(CephContext *cct);
+
     vector<ShardData*> shard_list;
     OSD *osd;
     uint32_t num_shards;
@@ -1458,9 +1485,8 @@ private:
           snprintf(lock_name, sizeof(lock_name), "%s.%d", "OSD:ShardedOpWQ:", i);
           char order_lock[32] = {0};
           snprintf(order_lock, sizeof(order_lock), "%s.%d", "OSD:ShardedOpWQ:order:", i);
-          ShardData* one_shard = new ShardData(lock_name, order_lock, 
-            osd->cct->_conf->osd_op_pq_max_tokens_per_priority, 
-            osd->cct->_conf->osd_op_pq_min_cost);
+          ShardData* one_shard = new ShardData(lock_name, order_lock,
+            create_queue(osd->cct));
           shard_list.push_back(one_shard);
         }
       }
@@ -1493,12 +1519,12 @@ private:
           ShardData* sdata = shard_list[i];
           assert (NULL != sdata);
           sdata->sdata_op_ordering_lock.Lock();
-          sdata->pqueue.dump(f);
+          sdata->pqueue->dump(f);
           sdata->sdata_op_ordering_lock.Unlock();
         }
       }
 
-      struct Pred {
+      struct Pred : public OpQueueT::Filter {
         PG *pg;
         Pred(PG *pg) : pg(pg) {}
         bool operator()(const pair<PGRef, OpRequestRef> &op) {
@@ -1514,13 +1540,15 @@ private:
         assert(sdata != NULL);
         if (!dequeued) {
           sdata->sdata_op_ordering_lock.Lock();
-          sdata->pqueue.remove_by_filter(Pred(pg));
+          Pred f(pg);
+          sdata->pqueue->remove_by_filter(f);
           sdata->pg_for_processing.erase(pg);
           sdata->sdata_op_ordering_lock.Unlock();
         } else {
           list<pair<PGRef, OpRequestRef> > _dequeued;
           sdata->sdata_op_ordering_lock.Lock();
-          sdata->pqueue.remove_by_filter(Pred(pg), &_dequeued);
+          Pred f(pg);
+          sdata->pqueue->remove_by_filter(f, &_dequeued);
           for (list<pair<PGRef, OpRequestRef> >::iterator i = _dequeued.begin();
             i != _dequeued.end(); ++i) {
             dequeued->push_back(i->second);
@@ -1541,7 +1569,7 @@ private:
         ShardData* sdata = shard_list[shard_index];
         assert(NULL != sdata);
         Mutex::Locker l(sdata->sdata_op_ordering_lock);
-        return sdata->pqueue.empty();
+        return sdata->pqueue->empty();
       }
 
   } op_shardedwq;
@@ -1581,6 +1609,12 @@ private:
     bool _empty() {
       return peering_queue.empty();
     }
+    bool is_empty() {
+      lock();
+      bool r = _empty();
+      unlock();
+      return r;
+    }
     void _dequeue(list<PG*> *out);
     void _process(
       const list<PG *> &pgs,
@@ -1608,6 +1642,12 @@ private:
     const list<PG*> &pg,
     ThreadPool::TPHandle &handle);
 
+  // -- peering message batching --
+  PeeringBatch peering_batch;
+  void send_peering_messages(PG::BufferedRecoveryMessages &msgs,
+			     OSDMapRef curmap);
+  bool peer_lacks_feature(int osd, epoch_t e, uint64_t feature);
+
   friend class PG;
   friend class ReplicatedPG;
 
@@ -1626,10 +1666,13 @@ private:
   utime_t         had_map_since;
   RWLock          map_lock;
   list<OpRequestRef>  waiting_for_osdmap;
+  /// precomputed mappings of the newest map; older maps only borrow them
+  ceph::shared_ptr<OSDMapMapping> map_mapping;
 
   friend struct send_map_on_destruct;
 
   void wait_for_new_map(OpRequestRef op);
+  void build_map_mapping(OSDMap *o);
   void handle_osd_map(class MOSDMap *m);
   void note_down_osd(int osd);
   void note_up_osd(int osd);
@@ -1724,9 +1767,56 @@ protected:
     bool primary,
     PG::CephPeeringEvtRef evt);
   
+  /// a pg load_pgs is reading in
+  struct LoadingPG {
+    spg_t pgid;
+    PG *pg;
+    LoadingPG(spg_t p) : pgid(p), pg(NULL) {}
+  };
+  /// reads the pgs' info, log and missing for load_pgs
+  struct LoadPGWQ : public ThreadPool::WorkQueue<LoadingPG> {
+    OSD *osd;
+    list<LoadingPG*> load_queue;
+    LoadPGWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<LoadingPG>("OSD::LoadPGWQ", ti, 0, tp),
+	osd(o) {}
+
+    bool _empty() {
+      return load_queue.empty();
+    }
+    bool _enqueue(LoadingPG *l) {
+      load_queue.push_back(l);
+      return true;
+    }
+    void _dequeue(LoadingPG *l) {
+      assert(0);
+    }
+    LoadingPG *_dequeue() {
+      if (load_queue.empty())
+	return NULL;
+      LoadingPG *l = load_queue.front();
+      load_queue.pop_front();
+      return l;
+    }
+    void _process(LoadingPG *l) {
+      osd->_read_pg(l);
+    }
+    void _clear() {
+      load_queue.clear();
+    }
+  };
+  void _read_pg(LoadingPG *l);
+  void _add_lock_pg(PG *pg, bool no_lockdep_check=false);
+
   void load_pgs();
   void build_past_intervals_parallel();
 
+  // how long each phase of init() took.  filled in before final_init()
+  // registers the admin socket commands, and not changed after.
+  vector<pair<string,utime_t> > startup_timing;
+  utime_t startup_phase_start;
+  void startup_phase_done(const char *phase);
+
   void calc_priors_during(
     spg_t pgid, epoch_t start, epoch_t end, set<pg_shard_t>& pset);
 
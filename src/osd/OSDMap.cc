@@ -16,6 +16,7 @@
  */
 
 #include "OSDMap.h"
+#include "OSDMapMapping.h"
 
 #include "common/config.h"
 #include "common/Formatter.h"
@@ -844,6 +845,7 @@ void OSDMap::get_blacklist(list<pair<entity_addr_t,utime_t> > *bl) const
 
 void OSDMap::set_max_osd(int m)
 {
+  clear_mapping();
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -1185,10 +1187,25 @@ int OSDMap::apply_incremental(const Incremental &inc)
   epoch++;
   modified = inc.modified;
 
+  // set the precomputed mappings aside while we change the map, and
+  // bring them forward once we are done.  borrowed ones may still be
+  // looked at by their owner's map at any time, so we update a copy.
+  bool own = mapping.get() != NULL;
+  ceph::shared_ptr<OSDMapMapping> m = own ? take_mapping() : lent_mapping.lock();
+  lent_mapping.reset();
+  vector<__u32> old_weight;
+  vector<uint8_t> old_state;
+  if (m) {
+    old_weight = osd_weight;
+    old_state = osd_state;
+  }
+
   // full map?
   if (inc.fullmap.length()) {
     bufferlist bl(inc.fullmap);
     decode(bl);
+    if (m)
+      build_mapping(m->get_threads());
     return 0;
   }
 
@@ -1363,9 +1380,24 @@ int OSDMap::apply_incremental(const Incremental &inc)
   }
 
   calc_num_osds();
+
+  if (m) {
+    // the old map may still be using them
+    if (!own || !m.unique())
+      m.reset(new OSDMapMapping(*m));
+    m->update(*this, inc, old_weight, old_state);
+    mapping = m;
+  }
   return 0;
 }
 
+void OSDMap::build_mapping(unsigned threads)
+{
+  ceph::shared_ptr<OSDMapMapping> m(new OSDMapMapping);
+  m->build(*this, threads);
+  mapping = m;
+}
+
 // mapping
 int OSDMap::object_locator_to_pg(
 	const object_t& oid,
@@ -1610,6 +1642,14 @@ void OSDMap::_pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_prim
       *acting_primary = -1;
     return;
   }
+  if (mapping) {
+    if (mapping->get(pg, up, up_primary, acting, acting_primary))
+      return;
+  } else if (!lent_mapping.expired()) {
+    ceph::shared_ptr<OSDMapMapping> m = lent_mapping.lock();
+    if (m && m->get(pg, up, up_primary, acting, acting_primary))
+      return;
+  }
   vector<int> raw;
   vector<int> _up;
   vector<int> _acting;
@@ -2058,6 +2098,10 @@ void OSDMap::post_decode()
   }
 
   calc_num_osds();
+
+  lent_mapping.reset();
+  if (mapping)
+    build_mapping(mapping->get_threads());
 }
 
 void OSDMap::dump_erasure_code_profiles(const map<string,map<string,string> > &profiles,
@@ -46,6 +46,8 @@ using namespace std;
 
 #include "include/unordered_set.h"
 
+class OSDMapMapping;
+
 /*
  * we track up to two intervals during which the osd was alive and
  * healthy.  the most recent is [up_from,up_thru), where up_thru is
@@ -240,9 +242,13 @@ private:
   string cluster_snapshot;
   bool new_blacklist_entries;
 
+  ceph::shared_ptr<OSDMapMapping> mapping;  // precomputed pg mappings, if any
+  ceph::weak_ptr<OSDMapMapping> lent_mapping;  // or somebody else's, while they last
+
  public:
   ceph::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
+  friend class OSDMapMapping;
   friend class OSDMonitor;
   friend class PGMonitor;
   friend class MDS;
@@ -339,6 +345,7 @@ public:
   }
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
+    clear_mapping();
     osd_state[o] = s;
   }
   void set_weightf(int o, float w) {
@@ -346,6 +353,7 @@ public:
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    clear_mapping();
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
@@ -361,6 +369,7 @@ public:
 
   void set_primary_affinity(int o, int w) {
     assert(o < max_osd);
+    clear_mapping();
     if (!osd_primary_affinity)
       osd_primary_affinity.reset(new vector<__u32>(max_osd,
 						   CEPH_OSD_DEFAULT_PRIMARY_AFFINITY));
@@ -624,6 +633,63 @@ private:
                              vector<int> *acting, int *acting_primary) const;
 
 public:
+  /**
+   * Precompute the up and acting sets of every pg, with up to threads
+   * threads, so that pg_to_acting_osds and pg_to_up_acting_osds become
+   * table lookups.  apply_incremental and decode keep the table
+   * current; set_state, set_weight, set_primary_affinity and
+   * set_max_osd drop it.  Callers changing the crush map or the pools
+   * directly must clear_mapping() first.
+   */
+  void build_mapping(unsigned threads);
+  void clear_mapping() {
+    mapping.reset();
+    lent_mapping.reset();
+  }
+  bool has_mapping() const {
+    return mapping || !lent_mapping.expired();
+  }
+  ceph::shared_ptr<const OSDMapMapping> get_mapping() const {
+    if (mapping)
+      return mapping;
+    return lent_mapping.lock();
+  }
+  /**
+   * Borrow the mappings of o, if it has any, and it is at our epoch.
+   * They stay o's: apply_incremental works on a copy.
+   */
+  void inherit_mapping(const OSDMap &o) {
+    if (o.epoch != epoch)
+      return;
+    mapping.reset();
+    lent_mapping = o.mapping;
+    if (!o.mapping)
+      lent_mapping = o.lent_mapping;
+  }
+  /// hand our mappings over, e.g. to the next map, and go without them
+  ceph::shared_ptr<OSDMapMapping> take_mapping() {
+    ceph::shared_ptr<OSDMapMapping> m;
+    m.swap(mapping);
+    lent_mapping.reset();
+    return m;
+  }
+  /// take over m (taken from the previous map), to update in place
+  void adopt_mapping(ceph::shared_ptr<OSDMapMapping> &m) {
+    clear_mapping();
+    mapping.swap(m);
+  }
+  /**
+   * Hand our mappings to the caller but keep using them for as long
+   * as the caller does; after that, lookups go back to CRUSH.  This
+   * lets a cache of old maps hold one set of mappings instead of one
+   * per map.
+   */
+  ceph::shared_ptr<OSDMapMapping> disown_mapping() {
+    ceph::shared_ptr<OSDMapMapping> m = take_mapping();
+    lent_mapping = m;
+    return m;
+  }
+
   /***
    * This is suitable only for looking at raw CRUSH outputs. It skips
    * applying the temp and up checks and should not be used
@@ -0,0 +1,341 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <algorithm>
+
+#include "osd/OSDMapMapping.h"
+#include "common/Thread.h"
+
+// pgs handed to a mapper thread at a time
+#define MAPPING_CHUNK 1024
+
+
+OSDMapMapping::PoolMapping::PoolMapping(int64_t p, const pg_pool_t &pi)
+  : pool(p),
+    size(pi.get_size()),
+    pg_num(pi.get_pg_num()),
+    pg_num_mask(pi.get_pg_num_mask()),
+    pgp_num(pi.get_pgp_num()),
+    type(pi.get_type()),
+    crush_ruleset(pi.get_crush_ruleset()),
+    flags(pi.get_flags())
+{
+  table.resize(pg_num * row_len(), 0);
+}
+
+bool OSDMapMapping::PoolMapping::matches(const pg_pool_t &pi) const
+{
+  return size == pi.get_size() &&
+    pg_num == pi.get_pg_num() &&
+    pgp_num == pi.get_pgp_num() &&
+    type == pi.get_type() &&
+    crush_ruleset == pi.get_crush_ruleset() &&
+    flags == pi.get_flags();
+}
+
+bool OSDMapMapping::PoolMapping::row_has(const int32_t *r,
+					 const set<int> &osds) const
+{
+  const int32_t *raw = r + raw_off();
+  for (int i = 0; i < r[ROW_NUM_RAW]; ++i)
+    if (osds.count(raw[i]))
+      return true;
+  return false;
+}
+
+
+class OSDMapMapping::MapperThread : public Thread {
+  OSDMap osdmap;
+public:
+  vector<pair<PoolMapping*, pair<ps_t,ps_t> > > work;
+
+  MapperThread(const OSDMap &o, bufferlist &crushbl) {
+    osdmap = o;
+    osdmap.crush.reset(new CrushWrapper);
+    bufferlist::iterator p = crushbl.begin();
+    osdmap.crush->decode(p);
+  }
+
+  void *entry() {
+    for (vector<pair<PoolMapping*, pair<ps_t,ps_t> > >::iterator p =
+	   work.begin();
+	 p != work.end();
+	 ++p)
+      _map_pgs(osdmap, p->first, p->second.first, p->second.second);
+    return NULL;
+  }
+};
+
+
+uint64_t OSDMapMapping::get_num_pgs() const
+{
+  uint64_t n = 0;
+  for (map<int64_t,PoolMapping>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p)
+    n += p->second.pg_num;
+  return n;
+}
+
+uint64_t OSDMapMapping::get_bytes() const
+{
+  uint64_t n = 0;
+  for (map<int64_t,PoolMapping>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p)
+    n += p->second.table.size() * sizeof(int32_t);
+  return n;
+}
+
+void OSDMapMapping::build(const OSDMap &osdmap, unsigned t)
+{
+  epoch = osdmap.get_epoch();
+  threads = MAX(t, 1u);
+  pools.clear();
+
+  set<int64_t> all;
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p)
+    all.insert(p->first);
+  _build_pools(osdmap, all);
+}
+
+void OSDMapMapping::_build_pools(const OSDMap &osdmap,
+				 const set<int64_t> &which)
+{
+  vector<pair<PoolMapping*, pair<ps_t,ps_t> > > work;
+  for (set<int64_t>::const_iterator p = which.begin(); p != which.end(); ++p) {
+    const pg_pool_t *pi = osdmap.get_pg_pool(*p);
+    assert(pi);
+    PoolMapping &pm = pools[*p];
+    pm = PoolMapping(*p, *pi);
+    for (ps_t ps = 0; ps < pm.pg_num; ps += MAPPING_CHUNK)
+      work.push_back(make_pair(&pm, make_pair(ps, MIN(ps + MAPPING_CHUNK,
+							pm.pg_num))));
+  }
+
+  unsigned n = MIN((size_t)threads, work.size());
+  if (n <= 1) {
+    for (unsigned i = 0; i < work.size(); ++i)
+      _map_pgs(osdmap, work[i].first, work[i].second.first,
+	       work[i].second.second);
+    return;
+  }
+
+  bufferlist crushbl;
+  osdmap.crush->encode(crushbl);
+  vector<MapperThread*> mappers;
+  for (unsigned i = 0; i < n; ++i)
+    mappers.push_back(new MapperThread(osdmap, crushbl));
+  for (unsigned i = 0; i < work.size(); ++i)
+    mappers[i % n]->work.push_back(work[i]);
+  for (unsigned i = 0; i < n; ++i)
+    mappers[i]->create();
+  for (unsigned i = 0; i < n; ++i) {
+    mappers[i]->join();
+    delete mappers[i];
+  }
+}
+
+void OSDMapMapping::_map_pgs(const OSDMap &osdmap, PoolMapping *pm,
+			     ps_t begin, ps_t end)
+{
+  const pg_pool_t *pi = osdmap.get_pg_pool(pm->pool);
+  for (ps_t ps = begin; ps < end; ++ps)
+    _map_raw(osdmap, *pi, pm, ps);
+}
+
+void OSDMapMapping::_map_raw(const OSDMap &osdmap, const pg_pool_t &pi,
+			     PoolMapping *pm, ps_t ps)
+{
+  vector<int> raw;
+  int primary;
+  osdmap._pg_to_osds(pi, pg_t(ps, pm->pool), &raw, &primary, NULL);
+  int32_t *r = pm->row(ps);
+  assert(raw.size() <= pm->size);
+  r[ROW_NUM_RAW] = raw.size();
+  std::copy(raw.begin(), raw.end(), r + pm->raw_off());
+  _map_up(osdmap, pi, pm, ps);
+}
+
+void OSDMapMapping::_map_up(const OSDMap &osdmap, const pg_pool_t &pi,
+			    PoolMapping *pm, ps_t ps)
+{
+  pg_t pg(ps, pm->pool);
+  int32_t *r = pm->row(ps);
+  vector<int> raw(r + pm->raw_off(), r + pm->raw_off() + r[ROW_NUM_RAW]);
+  vector<int> up;
+  int up_primary;
+  osdmap._raw_to_up_osds(pi, raw, &up, &up_primary);
+  osdmap._apply_primary_affinity(pi.raw_pg_to_pps(pg), pi, &up, &up_primary);
+  r[ROW_UP_PRIMARY] = up_primary;
+  r[ROW_NUM_UP] = up.size();
+  std::copy(up.begin(), up.end(), r + pm->up_off());
+  _map_acting(osdmap, pi, pm, ps);
+}
+
+void OSDMapMapping::_map_acting(const OSDMap &osdmap, const pg_pool_t &pi,
+				PoolMapping *pm, ps_t ps)
+{
+  int32_t *r = pm->row(ps);
+  vector<int> acting;
+  int acting_primary;
+  osdmap._get_temp_osds(pi, pg_t(ps, pm->pool), &acting, &acting_primary);
+  if (acting.empty()) {
+    acting.assign(r + pm->up_off(), r + pm->up_off() + r[ROW_NUM_UP]);
+    if (acting_primary == -1)
+      acting_primary = r[ROW_UP_PRIMARY];
+  }
+  if (acting.size() > pm->size) {
+    // a pg_temp longer than the pool; leave it to the map
+    r[ROW_NUM_ACTING] = -1;
+    return;
+  }
+  r[ROW_ACTING_PRIMARY] = acting_primary;
+  r[ROW_NUM_ACTING] = acting.size();
+  std::copy(acting.begin(), acting.end(), r + pm->acting_off());
+}
+
+void OSDMapMapping::update(const OSDMap &osdmap,
+			   const OSDMap::Incremental &inc,
+			   const vector<__u32> &old_weight,
+			   const vector<uint8_t> &old_state)
+{
+  if (inc.fullmap.length() || inc.crush.length() ||
+      old_weight.size() != (unsigned)osdmap.get_max_osd() ||
+      old_state.size() != (unsigned)osdmap.get_max_osd()) {
+    build(osdmap, threads);
+    return;
+  }
+  epoch = osdmap.get_epoch();
+
+  // osds whose pgs need CRUSH redone, and those that only need up
+  // redone.  CRUSH only ever rejects an osd more often as its weight
+  // goes down, so the pgs that did not map to it are not affected.
+  set<int> remap, reup;
+  for (int o = 0; o < osdmap.get_max_osd(); ++o) {
+    bool existed = old_state[o] & CEPH_OSD_EXISTS;
+    bool was_up = existed && (old_state[o] & CEPH_OSD_UP);
+    if (!existed) {
+      if (osdmap.exists(o)) {
+	build(osdmap, threads);
+	return;
+      }
+      continue;
+    }
+    if (!osdmap.exists(o) || osdmap.get_weight(o) < old_weight[o]) {
+      remap.insert(o);
+      continue;
+    }
+    if (osdmap.get_weight(o) > old_weight[o]) {
+      build(osdmap, threads);
+      return;
+    }
+    if (was_up != osdmap.is_up(o))
+      reup.insert(o);
+  }
+  for (map<int32_t,uint32_t>::const_iterator p =
+	 inc.new_primary_affinity.begin();
+       p != inc.new_primary_affinity.end();
+       ++p)
+    reup.insert(p->first);
+
+  // new, changed and removed pools
+  set<int64_t> rebuild;
+  for (map<int64_t,PoolMapping>::iterator p = pools.begin();
+       p != pools.end(); ) {
+    if (osdmap.have_pg_pool(p->first))
+      ++p;
+    else
+      pools.erase(p++);
+  }
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p) {
+    map<int64_t,PoolMapping>::iterator q = pools.find(p->first);
+    if (q == pools.end() || !q->second.matches(p->second))
+      rebuild.insert(p->first);
+  }
+  if (!rebuild.empty())
+    _build_pools(osdmap, rebuild);
+
+  if (!remap.empty() || !reup.empty()) {
+    for (map<int64_t,PoolMapping>::iterator p = pools.begin();
+	 p != pools.end();
+	 ++p) {
+      if (rebuild.count(p->first))
+	continue;
+      PoolMapping *pm = &p->second;
+      const pg_pool_t *pi = osdmap.get_pg_pool(p->first);
+      for (ps_t ps = 0; ps < pm->pg_num; ++ps) {
+	const int32_t *r = pm->row(ps);
+	if (pm->row_has(r, remap))
+	  _map_raw(osdmap, *pi, pm, ps);
+	else if (pm->row_has(r, reup))
+	  _map_up(osdmap, *pi, pm, ps);
+      }
+    }
+  }
+
+  // temp mappings: new ones, and those through osds that came or went
+  set<pg_t> temps;
+  for (map<pg_t,vector<int32_t> >::const_iterator p = inc.new_pg_temp.begin();
+       p != inc.new_pg_temp.end();
+       ++p)
+    temps.insert(p->first);
+  for (map<pg_t,int32_t>::const_iterator p = inc.new_primary_temp.begin();
+       p != inc.new_primary_temp.end();
+       ++p)
+    temps.insert(p->first);
+  if (!remap.empty() || !reup.empty()) {
+    for (map<pg_t,vector<int32_t> >::const_iterator p =
+	   osdmap.pg_temp->begin();
+	 p != osdmap.pg_temp->end();
+	 ++p)
+      temps.insert(p->first);
+  }
+  for (set<pg_t>::iterator p = temps.begin(); p != temps.end(); ++p) {
+    map<int64_t,PoolMapping>::iterator q = pools.find(p->pool());
+    if (q == pools.end() || rebuild.count(p->pool()) ||
+	p->ps() >= q->second.pg_num)
+      continue;
+    _map_acting(osdmap, *osdmap.get_pg_pool(p->pool()), &q->second, p->ps());
+  }
+}
+
+bool OSDMapMapping::get(const pg_t &pg, vector<int> *up, int *up_primary,
+			vector<int> *acting, int *acting_primary) const
+{
+  if (pg.preferred() >= 0)
+    return false;
+  map<int64_t,PoolMapping>::const_iterator p = pools.find(pg.pool());
+  if (p == pools.end())
+    return false;
+  const PoolMapping &pm = p->second;
+  if (!pm.pg_num)
+    return false;
+  const int32_t *r = pm.row(ceph_stable_mod(pg.ps(), pm.pg_num,
+					    pm.pg_num_mask));
+  if (r[ROW_NUM_ACTING] < 0)
+    return false;
+  if (up)
+    up->assign(r + pm.up_off(), r + pm.up_off() + r[ROW_NUM_UP]);
+  if (up_primary)
+    *up_primary = r[ROW_UP_PRIMARY];
+  if (acting)
+    acting->assign(r + pm.acting_off(),
+		   r + pm.acting_off() + r[ROW_NUM_ACTING]);
+  if (acting_primary)
+    *acting_primary = r[ROW_ACTING_PRIMARY];
+  return true;
+}
@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSDMAPMAPPING_H
+#define CEPH_OSDMAPMAPPING_H
+
+#include <vector>
+#include <map>
+#include <set>
+
+#include "osd/OSDMap.h"
+
+/**
+ * The up and acting sets of every pg of one OSDMap epoch.
+ *
+ * Each pool gets a flat table with a fixed size row per pg, so that
+ * mapping a pg is a pool lookup and an index instead of a run of CRUSH.
+ * A row holds the raw CRUSH output as well as the up and acting sets,
+ * which lets update() redo only what an Incremental may have changed:
+ * acting for pg_temp and primary_temp changes, up for osds going up or
+ * down, CRUSH for the pgs of an osd whose weight went down.  Anything
+ * else (a new crush map, a weight going up, a new osd) redoes it all.
+ *
+ * build() spreads the work over several threads, each with a copy of
+ * the crush map of its own: CrushWrapper::do_rule serializes the
+ * callers of a shared one.
+ */
+class OSDMapMapping {
+  enum {
+    ROW_UP_PRIMARY,
+    ROW_ACTING_PRIMARY,
+    ROW_NUM_RAW,
+    ROW_NUM_UP,
+    ROW_NUM_ACTING,   ///< -1 if the acting set does not fit the row
+    ROW_HEADER
+  };
+
+  struct PoolMapping {
+    int64_t pool;
+    // what the rows depend on
+    unsigned size;
+    unsigned pg_num;
+    unsigned pg_num_mask;
+    unsigned pgp_num;
+    unsigned type;
+    int crush_ruleset;
+    uint64_t flags;
+
+    vector<int32_t> table;
+
+    PoolMapping() : pool(0), size(0), pg_num(0), pg_num_mask(0),
+		    pgp_num(0), type(0), crush_ruleset(0), flags(0) {}
+    PoolMapping(int64_t p, const pg_pool_t &pi);
+
+    bool matches(const pg_pool_t &pi) const;
+
+    unsigned row_len() const {
+      return ROW_HEADER + 3 * size;
+    }
+    int32_t *row(ps_t ps) {
+      return &table[ps * row_len()];
+    }
+    const int32_t *row(ps_t ps) const {
+      return &table[ps * row_len()];
+    }
+    // where the sets start in a row
+    unsigned raw_off() const {
+      return ROW_HEADER;
+    }
+    unsigned up_off() const {
+      return ROW_HEADER + size;
+    }
+    unsigned acting_off() const {
+      return ROW_HEADER + 2 * size;
+    }
+    bool row_has(const int32_t *r, const set<int> &osds) const;
+  };
+
+  class MapperThread;
+
+  epoch_t epoch;
+  unsigned threads;
+  map<int64_t,PoolMapping> pools;
+
+  void _build_pools(const OSDMap &osdmap, const set<int64_t> &which);
+  static void _map_pgs(const OSDMap &osdmap, PoolMapping *pm,
+		       ps_t begin, ps_t end);
+
+  /// redo a row from CRUSH on
+  static void _map_raw(const OSDMap &osdmap, const pg_pool_t &pi,
+		       PoolMapping *pm, ps_t ps);
+  /// redo a row from its raw set on
+  static void _map_up(const OSDMap &osdmap, const pg_pool_t &pi,
+		      PoolMapping *pm, ps_t ps);
+  /// redo the acting set of a row
+  static void _map_acting(const OSDMap &osdmap, const pg_pool_t &pi,
+			  PoolMapping *pm, ps_t ps);
+
+public:
+  OSDMapMapping() : epoch(0), threads(1) {}
+
+  epoch_t get_epoch() const {
+    return epoch;
+  }
+  unsigned get_threads() const {
+    return threads;
+  }
+  uint64_t get_num_pgs() const;
+  uint64_t get_bytes() const;
+
+  /// map every pg of osdmap, with up to threads threads
+  void build(const OSDMap &osdmap, unsigned threads);
+
+  /**
+   * bring the mappings of the epoch before osdmap forward to it
+   *
+   * @param osdmap the map, with inc applied
+   * @param old_weight osd weights before inc was applied
+   * @param old_state osd states before inc was applied
+   */
+  void update(const OSDMap &osdmap, const OSDMap::Incremental &inc,
+	      const vector<__u32> &old_weight,
+	      const vector<uint8_t> &old_state);
+
+  /**
+   * look a pg up; fills in whatever fields are non-NULL
+   *
+   * @return false if the pg is not in the table
+   */
+  bool get(const pg_t &pg, vector<int> *up, int *up_primary,
+	   vector<int> *acting, int *acting_primary) const;
+};
+
+#endif
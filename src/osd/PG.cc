@@ -2956,7 +2956,7 @@ void PG::update_snap_map(
        i != log_entries.end();
        ++i) {
     OSDriver::OSTransaction _t(osdriver.get_transaction(&t));
-    if (i->soid.snap < CEPH_MAXSNAP) {
+    if (i->soid->snap < CEPH_MAXSNAP) {
       if (i->is_delete()) {
 	int r = snap_mapper.remove_oid(
 	  i->soid,
@@ -4570,6 +4570,7 @@ void PG::set_last_peering_reset()
   dout(20) << "set_last_peering_reset " << get_osdmap()->get_epoch() << dendl;
   if (last_peering_reset != get_osdmap()->get_epoch()) {
     last_peering_reset = get_osdmap()->get_epoch();
+    last_peering_reset_stamp = ceph_clock_now(cct);
     reset_interval_flush();
   }
 }
@@ -6469,6 +6470,9 @@ boost::statechart::result PG::RecoveryState::Active::react(const AllReplicasActi
   all_replicas_activated = true;
 
   pg->state_set(PG_STATE_ACTIVE);
+  pg->osd->record_peering_latency(
+    pg->get_last_peering_reset(),
+    ceph_clock_now(pg->cct) - pg->last_peering_reset_stamp);
 
   pg->check_local();
 
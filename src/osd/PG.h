@@ -617,6 +617,7 @@ protected:
   set<pg_shard_t> might_have_unfound;  // These osds might have objects on them
                                        // which are unfound on the primary
   epoch_t last_peering_reset;
+  utime_t last_peering_reset_stamp;  // when we got to last_peering_reset
 
 
   /* heartbeat peers */
@@ -2002,7 +2003,7 @@ public:
   int        get_nrep() const { return acting.size(); }
 
   void reset_peer_features() { peer_features = (uint64_t)-1; }
-  uint64_t get_min_peer_features() { return peer_features; }
+  uint64_t get_min_peer_features() const { return peer_features; }
   void apply_peer_features(uint64_t f) { peer_features &= f; }
 
   void init_primary_up_acting(
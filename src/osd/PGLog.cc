@@ -45,6 +45,63 @@ void PGLog::IndexedLog::advance_rollback_info_trimmed_to(
   }
 }
 
+static bool bl_is_compact(const bufferlist &bl)
+{
+  const list<bufferptr> &buffers = bl.buffers();
+  if (buffers.empty())
+    return true;
+  return buffers.size() == 1 &&
+    buffers.front().raw_length() == buffers.front().length();
+}
+
+static uint64_t bl_mem_bytes(const bufferlist &bl)
+{
+  uint64_t bytes = 0;
+  const list<bufferptr> &buffers = bl.buffers();
+  for (list<bufferptr>::const_iterator p = buffers.begin();
+       p != buffers.end();
+       ++p)
+    bytes += sizeof(bufferptr) + 2 * sizeof(void*) + p->raw_length();
+  return bytes;
+}
+
+void PGLog::IndexedLog::compact(pg_log_entry_t &e,
+				const pg_log_entry_t *indexed)
+{
+  if (indexed && !e.soid.is_shared_with(indexed->soid))
+    e.soid = indexed->soid;
+  if (!bl_is_compact(e.snaps))
+    e.snaps.rebuild();
+  if (!bl_is_compact(e.mod_desc.bl))
+    e.mod_desc.bl.rebuild();
+}
+
+uint64_t PGLog::IndexedLog::get_entry_bytes(const pg_log_entry_t &e)
+{
+  // the list node, the entry itself and what its bufferlists hold
+  uint64_t bytes = 2 * sizeof(void*) + sizeof(pg_log_entry_t);
+  bytes += bl_mem_bytes(e.snaps);
+  bytes += bl_mem_bytes(e.mod_desc.bl);
+  return bytes;
+}
+
+uint64_t PGLog::IndexedLog::get_object_bytes(const hobject_t &hoid)
+{
+  // the names of the index key, and the hobject_t the entries share,
+  // with its shared_ptr count
+  return 2 * get_name_bytes(hoid) + sizeof(hobject_t) + 4 * sizeof(void*);
+}
+
+uint64_t PGLog::IndexedLog::get_mem_bytes() const
+{
+  // a hash node holds the pair and a link to the next node
+  return entry_bytes + name_bytes +
+    objects.size() * (sizeof(hobject_t) + 2 * sizeof(void*)) +
+    objects.bucket_count() * sizeof(void*) +
+    caller_ops.size() * (sizeof(osd_reqid_t) + 2 * sizeof(void*)) +
+    caller_ops.bucket_count() * sizeof(void*);
+}
+
 void PGLog::IndexedLog::split_into(
   pg_t child_pgid,
   unsigned split_bits,
@@ -60,7 +117,7 @@ void PGLog::IndexedLog::split_into(
   for (list<pg_log_entry_t>::iterator i = oldlog.begin();
        i != oldlog.end();
        ) {
-    if ((i->soid.hash & mask) == child_pgid.m_seed) {
+    if ((i->soid->hash & mask) == child_pgid.m_seed) {
       olog->log.push_back(*i);
     } else {
       log.push_back(*i);
@@ -1020,7 +1077,7 @@ void PGLog::read_log_old(ObjectStore *store, coll_t coll, hobject_t log_oid,
       assert(!e.invalid_hash);
 
       if (e.invalid_pool) {
-	e.soid.pool = info.pgid.pool();
+	e.soid.edit().pool = info.pgid.pool();
       }
 
       e.offset = pos;
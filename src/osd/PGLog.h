@@ -53,6 +53,12 @@ struct PGLog {
   /**
    * IndexLog - adds in-memory index of the log, by oid.
    * plus some methods to manipulate it all.
+   *
+   * Entries are compacted as they are indexed: all entries of an object
+   * share one copy of its hobject_t, and their bufferlists are copied out
+   * of whatever larger buffer they were encoded or decoded into (a page
+   * for each encode on the primary, the whole message on a replica).
+   * The memory the log takes is accounted for as it goes.
    */
   struct IndexedLog : public pg_log_t {
     ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
@@ -72,14 +78,38 @@ struct PGLog {
      * tail, and rbegin() works nicely for head.
      */
     list<pg_log_entry_t>::reverse_iterator rollback_info_trimmed_to_riter;
+
+    uint64_t entry_bytes;  ///< indexed entries, with their bufferlists
+    uint64_t name_bytes;   ///< object names, once per indexed object
+
+    /**
+     * share the hobject_t of e with the other entries of its object, and
+     * give its bufferlists buffers of their own size
+     *
+     * @param indexed the indexed entry of e's object, if there is one yet
+     */
+    static void compact(pg_log_entry_t &e, const pg_log_entry_t *indexed);
   public:
     void advance_rollback_info_trimmed_to(eversion_t to, LogEntryHandler *h);
 
+    /// estimate of the memory held by an entry of the log
+    static uint64_t get_entry_bytes(const pg_log_entry_t &e);
+    static uint64_t get_name_bytes(const hobject_t &hoid) {
+      return hoid.oid.name.length() + hoid.get_key().length() +
+	hoid.nspace.length();
+    }
+    /// estimate of the memory held for an indexed object, but its hash node
+    static uint64_t get_object_bytes(const hobject_t &hoid);
+    /// estimate of the memory held by the log and its index
+    uint64_t get_mem_bytes() const;
+
     /****/
     IndexedLog() :
       complete_to(log.end()),
       last_requested(0),
-      rollback_info_trimmed_to_riter(log.rbegin())
+      rollback_info_trimmed_to_riter(log.rbegin()),
+      entry_bytes(0),
+      name_bytes(0)
       {}
 
     void claim_log_and_clear_rollback_info(const pg_log_t& o) {
@@ -135,10 +165,22 @@ struct PGLog {
     void index() {
       objects.clear();
       caller_ops.clear();
+      entry_bytes = 0;
+      name_bytes = 0;
       for (list<pg_log_entry_t>::iterator i = log.begin();
            i != log.end();
            ++i) {
-        objects[i->soid] = &(*i);
+	ceph::unordered_map<hobject_t,pg_log_entry_t*>::iterator p =
+	  objects.find(i->soid);
+	if (p == objects.end()) {
+	  compact(*i, NULL);
+	  objects[i->soid] = &(*i);
+	  name_bytes += get_object_bytes(i->soid);
+	} else {
+	  compact(*i, p->second);
+	  p->second = &(*i);
+	}
+	entry_bytes += get_entry_bytes(*i);
 	if (i->reqid_is_indexed()) {
 	  //assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	  caller_ops[i->reqid] = &(*i);
@@ -152,9 +194,18 @@ struct PGLog {
     }
 
     void index(pg_log_entry_t& e) {
-      if (objects.count(e.soid) == 0 || 
-          objects[e.soid]->version < e.version)
-        objects[e.soid] = &e;
+      ceph::unordered_map<hobject_t,pg_log_entry_t*>::iterator p =
+	objects.find(e.soid);
+      if (p == objects.end()) {
+	compact(e, NULL);
+	objects[e.soid] = &e;
+	name_bytes += get_object_bytes(e.soid);
+      } else {
+	compact(e, p->second);
+	if (p->second->version < e.version)
+	  p->second = &e;
+      }
+      entry_bytes += get_entry_bytes(e);
       if (e.reqid_is_indexed()) {
 	//assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	caller_ops[e.reqid] = &e;
@@ -163,11 +214,16 @@ struct PGLog {
     void unindex() {
       objects.clear();
       caller_ops.clear();
+      entry_bytes = 0;
+      name_bytes = 0;
     }
     void unindex(pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
-      if (objects.count(e.soid) && objects[e.soid]->version == e.version)
+      if (objects.count(e.soid) && objects[e.soid]->version == e.version) {
         objects.erase(e.soid);
+	name_bytes -= get_object_bytes(e.soid);
+      }
+      entry_bytes -= get_entry_bytes(e);
       if (e.reqid_is_indexed() &&
 	  caller_ops.count(e.reqid) &&  // divergent merge_log indexes new before unindexing old
 	  caller_ops[e.reqid] == &e)
@@ -188,9 +244,7 @@ struct PGLog {
       head = e.version;
 
       // to our index
-      objects[e.soid] = &(log.back());
-      if (e.reqid_is_indexed())
-	caller_ops[e.reqid] = &(log.back());
+      index(log.back());
     }
 
     void trim(
@@ -354,6 +408,9 @@ public:
     log.add(e);
   }
 
+  /// estimate of the memory held by the in-memory log
+  uint64_t get_log_mem_bytes() const { return log.get_mem_bytes(); }
+
   void reset_recovery_pointers() { log.reset_recovery_pointers(); }
 
   static void clear_info_log(
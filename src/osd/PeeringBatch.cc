@@ -0,0 +1,241 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "PeeringBatch.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "include/ceph_features.h"
+
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix *_dout << "peering_batch "
+
+class PeeringBatch::C_Flush : public Context {
+  PeeringBatch *batch;
+public:
+  C_Flush(PeeringBatch *batch) : batch(batch) {}
+  void finish(int r) {
+    // the timer holds our lock
+    batch->flush_event = NULL;
+    batch->_flush();
+  }
+};
+
+PeeringBatch::PeeringBatch(CephContext *cct, Sender *sender)
+  : cct(cct),
+    sender(sender),
+    lock("PeeringBatch::lock"),
+    timer(cct, lock),
+    flush_event(NULL),
+    running(0),
+    num_pgs(0)
+{
+}
+
+void PeeringBatch::init()
+{
+  timer.init();
+}
+
+void PeeringBatch::shutdown()
+{
+  Mutex::Locker l(lock);
+  timer.shutdown();
+  flush_event = NULL;
+  msgs = PG::BufferedRecoveryMessages();
+  pgs.clear();
+  num_pgs = 0;
+  osdmap.reset();
+}
+
+bool PeeringBatch::_overlaps(const PG::RecoveryCtx &rctx) const
+{
+  assert(lock.is_locked());
+  if (!num_pgs)
+    return false;
+  for (map<int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	 rctx.notify_list->begin();
+       p != rctx.notify_list->end();
+       ++p) {
+    map<int, set<pg_t> >::const_iterator q = pgs.find(p->first);
+    if (q == pgs.end())
+      continue;
+    for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
+	   p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      if (q->second.count(i->first.info.pgid.pgid))
+	return true;
+  }
+  for (map<int, map<spg_t, pg_query_t> >::iterator p =
+	 rctx.query_map->begin();
+       p != rctx.query_map->end();
+       ++p) {
+    map<int, set<pg_t> >::const_iterator q = pgs.find(p->first);
+    if (q == pgs.end())
+      continue;
+    for (map<spg_t, pg_query_t>::iterator i = p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      if (q->second.count(i->first.pgid))
+	return true;
+  }
+  for (map<int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	 rctx.info_map->begin();
+       p != rctx.info_map->end();
+       ++p) {
+    map<int, set<pg_t> >::const_iterator q = pgs.find(p->first);
+    if (q == pgs.end())
+      continue;
+    for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
+	   p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      if (q->second.count(i->first.info.pgid.pgid))
+	return true;
+  }
+  return false;
+}
+
+void PeeringBatch::_add(PG::RecoveryCtx &rctx, OSDMapRef curmap)
+{
+  assert(lock.is_locked());
+  unsigned before = num_pgs;
+  for (map<int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	 rctx.notify_list->begin();
+       p != rctx.notify_list->end();
+       ++p) {
+    set<pg_t> &peer_pgs = pgs[p->first];
+    for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
+	   p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      peer_pgs.insert(i->first.info.pgid.pgid);
+    vector<pair<pg_notify_t, pg_interval_map_t> > &v =
+      msgs.notify_list[p->first];
+    v.insert(v.end(), p->second.begin(), p->second.end());
+    num_pgs += p->second.size();
+  }
+  for (map<int, map<spg_t, pg_query_t> >::iterator p =
+	 rctx.query_map->begin();
+       p != rctx.query_map->end();
+       ++p) {
+    set<pg_t> &peer_pgs = pgs[p->first];
+    map<spg_t, pg_query_t> &m = msgs.query_map[p->first];
+    for (map<spg_t, pg_query_t>::iterator i = p->second.begin();
+	 i != p->second.end();
+	 ++i) {
+      peer_pgs.insert(i->first.pgid);
+      m[i->first] = i->second;
+    }
+    num_pgs += p->second.size();
+  }
+  for (map<int, vector<pair<pg_notify_t, pg_interval_map_t> > >::iterator p =
+	 rctx.info_map->begin();
+       p != rctx.info_map->end();
+       ++p) {
+    set<pg_t> &peer_pgs = pgs[p->first];
+    for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator i =
+	   p->second.begin();
+	 i != p->second.end();
+	 ++i)
+      peer_pgs.insert(i->first.info.pgid.pgid);
+    vector<pair<pg_notify_t, pg_interval_map_t> > &v =
+      msgs.info_map[p->first];
+    v.insert(v.end(), p->second.begin(), p->second.end());
+    num_pgs += p->second.size();
+  }
+  rctx.notify_list->clear();
+  rctx.query_map->clear();
+  rctx.info_map->clear();
+
+  if (num_pgs == before)
+    return;
+  if (!before) {
+    stamp = ceph_clock_now(cct);
+    flush_event = new C_Flush(this);
+    timer.add_event_after(cct->_conf->osd_peering_batch_max_delay,
+			  flush_event);
+  }
+  if (!osdmap || osdmap->get_epoch() < curmap->get_epoch())
+    osdmap = curmap;
+}
+
+void PeeringBatch::_flush()
+{
+  assert(lock.is_locked());
+  if (flush_event) {
+    timer.cancel_event(flush_event);
+    flush_event = NULL;
+  }
+  if (!num_pgs)
+    return;
+  dout(10) << __func__ << " " << num_pgs << " pgs to " << pgs.size()
+	   << " osds, held for " << ceph_clock_now(cct) - stamp << dendl;
+  sender->send_peering_messages(msgs, osdmap);
+  msgs = PG::BufferedRecoveryMessages();
+  pgs.clear();
+  num_pgs = 0;
+  osdmap.reset();
+}
+
+void PeeringBatch::start()
+{
+  Mutex::Locker l(lock);
+  ++running;
+}
+
+void PeeringBatch::finish(PG::RecoveryCtx &rctx, OSDMapRef curmap,
+			  bool queue_empty)
+{
+  Mutex::Locker l(lock);
+  assert(running > 0);
+  --running;
+
+  // what is held for a pg goes out before what it sent since
+  uint64_t max_pgs = cct->_conf->osd_peering_batch_max_pgs;
+  if (!max_pgs || _overlaps(rctx))
+    _flush();
+  if (!max_pgs)
+    return;
+
+  _add(rctx, curmap);
+  if (num_pgs >= max_pgs || (running == 0 && queue_empty))
+    _flush();
+}
+
+void PeeringBatch::flush()
+{
+  Mutex::Locker l(lock);
+  _flush();
+}
+
+void PeeringBatch::flush_overlapping(const PG::RecoveryCtx &rctx)
+{
+  Mutex::Locker l(lock);
+  if (_overlaps(rctx))
+    _flush();
+}
+
+bool PeeringBatch::must_dispatch_immediately(const set<pg_shard_t> &peers,
+					     int whoami, epoch_t e)
+{
+  for (set<pg_shard_t>::const_iterator i = peers.begin();
+       i != peers.end();
+       ++i) {
+    if (i->osd == whoami || i->osd == CRUSH_ITEM_NONE)
+      continue;
+    if (sender->peer_lacks_feature(i->osd, e, CEPH_FEATURE_INDEP_PG_MAP))
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+#ifndef CEPH_OSD_PEERINGBATCH_H
+#define CEPH_OSD_PEERINGBATCH_H
+
+#include <map>
+#include <set>
+
+#include "common/Mutex.h"
+#include "common/Timer.h"
+#include "PG.h"
+
+/**
+ * PeeringBatch - the peering messages of the peering_wq batches
+ *
+ * They are held until a whole pass of the queue is done, so that each
+ * peer gets one message of each kind (and the map once) for all of the
+ * pgs instead of one per batch.  They go out earlier when
+ * osd_peering_batch_max_pgs pgs have some held, when the oldest has
+ * waited osd_peering_batch_max_delay, and before anything else goes out
+ * for one of their pgs, so that each pg's messages keep their order.
+ */
+class PeeringBatch {
+public:
+  /// sends the messages, and knows the peers
+  class Sender {
+  public:
+    virtual void send_peering_messages(PG::BufferedRecoveryMessages &msgs,
+				       OSDMapRef osdmap) = 0;
+    /// whether we are connected to osd, and it does not have feature
+    virtual bool peer_lacks_feature(int osd, epoch_t e, uint64_t feature) = 0;
+    virtual ~Sender() {}
+  };
+
+private:
+  CephContext *cct;
+  Sender *sender;
+
+  Mutex lock;
+  SafeTimer timer;                 ///< sends what is held once it is too old
+  Context *flush_event;            ///< scheduled with timer, if anything is held
+  unsigned running;                ///< batches being processed
+  PG::BufferedRecoveryMessages msgs;
+  map<int, set<pg_t> > pgs;        ///< by peer, the pgs with messages held
+  unsigned num_pgs;                ///< messages held, one per pg and peer
+  utime_t stamp;                   ///< when the oldest was held
+  OSDMapRef osdmap;                ///< newest map the messages were made with
+
+  class C_Flush;
+
+  bool _overlaps(const PG::RecoveryCtx &rctx) const;
+  void _add(PG::RecoveryCtx &rctx, OSDMapRef curmap);
+  void _flush();
+
+public:
+  PeeringBatch(CephContext *cct, Sender *sender);
+
+  void init();
+  /// drop what is held
+  void shutdown();
+
+  /// a batch of the peering_wq is being processed
+  void start();
+  /**
+   * take the messages of rctx, and send what is held if it is time
+   *
+   * @param queue_empty whether the peering_wq has nothing left to process
+   */
+  void finish(PG::RecoveryCtx &rctx, OSDMapRef curmap, bool queue_empty);
+  /// send what is held
+  void flush();
+  /// send what is held for the pgs of rctx, before rctx goes out directly
+  void flush_overlapping(const PG::RecoveryCtx &rctx);
+
+  /**
+   * Whether the messages of a pg have to go out as soon as the pg is
+   * done with: some of its peers predate INDEP_PG_MAP, and take one
+   * message per pg.
+   *
+   * @param peers the shards of the pg
+   * @param whoami us, to skip
+   * @param e the epoch of the pg
+   */
+  bool must_dispatch_immediately(const set<pg_shard_t> &peers, int whoami,
+				 epoch_t e);
+
+  unsigned get_num_pgs() {
+    Mutex::Locker l(lock);
+    return num_pgs;
+  }
+};
+
+#endif
@@ -258,7 +258,8 @@ private:
     int priority,
     map<pg_shard_t, vector<PullOp> > &pulls);
 
-  int build_push_op(const ObjectRecoveryInfo &recovery_info,
+  int build_push_op(pg_shard_t peer,
+		    const ObjectRecoveryInfo &recovery_info,
 		    const ObjectRecoveryProgress &progress,
 		    ObjectRecoveryProgress *out_progress,
 		    PushOp *out_op,
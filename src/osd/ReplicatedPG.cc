@@ -613,6 +613,7 @@ int ReplicatedPG::do_command(cmdmap_t cmdmap, ostream& ss,
     f->dump_string("state", pg_state_string(get_state()));
     f->dump_stream("snap_trimq") << snap_trimq;
     f->dump_unsigned("epoch", get_osdmap()->get_epoch());
+    f->dump_unsigned("log_mem_bytes", pg_log.get_log_mem_bytes());
     f->open_array_section("up");
     for (vector<int>::iterator p = up.begin(); p != up.end(); ++p)
       f->dump_unsigned("osd", *p);
@@ -4571,22 +4572,16 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	map<string, bufferlist> out_set;
 
 	if (!pool.info.require_rollback()) {
-	  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(
-	    coll, soid
-	    );
-          if (!iter) {
-            result = -ENOENT;
-            goto fail;
-          }
-	  iter->upper_bound(start_after);
-	  if (filter_prefix >= start_after) iter->lower_bound(filter_prefix);
-	  for (uint64_t i = 0;
-	       i < max_return && iter->valid() &&
-		 iter->key().substr(0, filter_prefix.size()) == filter_prefix;
-	       ++i, iter->next()) {
-	    dout(20) << "Found key " << iter->key() << dendl;
-	    out_set.insert(make_pair(iter->key(), iter->value()));
+	  vector<ObjectMap::OmapRead> reads(1);
+	  reads[0] = ObjectMap::OmapRead(soid, start_after, filter_prefix,
+					 max_return);
+	  osd->store->omap_get_values_batch(coll, reads);
+	  if (reads[0].r < 0) {
+	    result = reads[0].r;
+	    goto fail;
 	  }
+	  dout(20) << "Found " << reads[0].out.size() << " keys" << dendl;
+	  out_set.swap(reads[0].out);
 	} // else return empty out_set
 	::encode(out_set, osd_op.outdata);
 	ctx->delta_stats.num_rd_kb += SHIFT_ROUND_UP(osd_op.outdata.length(), 10);
@@ -8003,8 +7998,8 @@ void ReplicatedBackend::sub_op_modify(OpRequestRef op)
       for (vector<pg_log_entry_t>::iterator i = log.begin();
 	  i != log.end();
 	  ++i) {
-	if (!i->soid.is_max() && i->soid.pool == -1)
-	  i->soid.pool = get_info().pgid.pool();
+	if (!i->soid->is_max() && i->soid->pool == -1)
+	  i->soid.edit().pool = get_info().pgid.pool();
       }
       rm->opt.set_pool_override(get_info().pgid.pool());
     }
@@ -8543,7 +8538,8 @@ void ReplicatedBackend::prep_push(
   pi.recovery_progress.omap_complete = 0;
 
   ObjectRecoveryProgress new_progress;
-  int r = build_push_op(pi.recovery_info,
+  int r = build_push_op(peer,
+			pi.recovery_info,
 			pi.recovery_progress,
 			&new_progress,
 			pop,
@@ -8612,6 +8608,9 @@ void ReplicatedBackend::submit_push_data(
     get_parent()->on_local_recover_start(recovery_info.soid, t);
     t->remove(get_temp_coll(t), recovery_info.soid);
     t->touch(target_coll, recovery_info.soid);
+    // a sparse push leaves holes unwritten; don't let stale data show
+    // through them
+    t->truncate(target_coll, recovery_info.soid, 0);
     t->omap_setheader(target_coll, recovery_info.soid, omap_header);
   }
   uint64_t off = 0;
@@ -8638,6 +8637,10 @@ void ReplicatedBackend::submit_push_data(
       t->collection_move(coll, target_coll, recovery_info.soid);
     }
 
+    // ...nor a trailing hole short of the object size
+    if (recovery_info.size != (uint64_t)-1)
+      t->truncate(coll, recovery_info.soid, recovery_info.size);
+
     submit_push_complete(recovery_info, t);
   }
 }
@@ -8895,7 +8898,8 @@ void ReplicatedBackend::send_pulls(int prio, map<pg_shard_t, vector<PullOp> > &p
   }
 }
 
-int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
+int ReplicatedBackend::build_push_op(pg_shard_t peer,
+				     const ObjectRecoveryInfo &recovery_info,
 				     const ObjectRecoveryProgress &progress,
 				     ObjectRecoveryProgress *out_progress,
 				     PushOp *out_op,
@@ -8965,6 +8969,35 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
     out_op->data_included.clear();
   }
 
+  // skip the holes if the target knows to truncate the object to its
+  // full size; progress still covers the whole span
+  uint64_t sparse_end = 0;
+  ConnectionRef con;
+  if (!out_op->data_included.empty() &&
+      cct->_conf->osd_recovery_sparse_push)
+    con = get_parent()->get_con_osd_cluster(peer.osd,
+					    get_osdmap()->get_epoch());
+  if (con && con->has_feature(CEPH_FEATURE_OSD_SPARSE_PUSH)) {
+    uint64_t start = out_op->data_included.range_start();
+    uint64_t end = out_op->data_included.range_end();
+    bufferlist bl;
+    int r = store->fiemap(coll, recovery_info.soid, start, end - start, bl);
+    if (r >= 0) {
+      map<uint64_t, uint64_t> m;
+      bufferlist::iterator bp = bl.begin();
+      ::decode(m, bp);
+      interval_set<uint64_t> extents;
+      for (map<uint64_t, uint64_t>::iterator q = m.begin(); q != m.end(); ++q)
+	if (q->second)
+	  extents.insert(q->first, q->second);
+      extents.intersection_of(out_op->data_included);
+      dout(20) << __func__ << " sparse " << out_op->data_included
+	       << " -> " << extents << dendl;
+      out_op->data_included.swap(extents);
+      sparse_end = end;
+    }
+  }
+
   for (interval_set<uint64_t>::iterator p = out_op->data_included.begin();
        p != out_op->data_included.end();
        ++p) {
@@ -8983,6 +9016,8 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
 
   if (!out_op->data_included.empty())
     new_progress.data_recovered_to = out_op->data_included.range_end();
+  if (sparse_end > new_progress.data_recovered_to)
+    new_progress.data_recovered_to = sparse_end;
 
   if (new_progress.is_complete(recovery_info)) {
     new_progress.data_complete = true;
@@ -9080,6 +9115,7 @@ bool ReplicatedBackend::handle_push_reply(pg_shard_t peer, PushReplyOp &op, Push
 	       << " of " << pi->recovery_info.copy_subset << dendl;
       ObjectRecoveryProgress new_progress;
       int r = build_push_op(
+	peer,
 	pi->recovery_info,
 	pi->recovery_progress, &new_progress, reply,
 	&(pi->stat));
@@ -9188,7 +9224,7 @@ void ReplicatedBackend::handle_pull(pg_shard_t peer, PullOp &op, PushOp *reply)
       assert(recovery_info.clone_subset.empty());
     }
 
-    r = build_push_op(recovery_info, progress, 0, reply);
+    r = build_push_op(peer, recovery_info, progress, 0, reply);
     if (r < 0)
       prep_push_op_blank(soid, reply);
   }
@@ -2692,6 +2692,25 @@ void ObjectModDesc::decode(bufferlist::iterator &_bl)
   DECODE_FINISH(_bl);
 }
 
+// -- shared_hobject_t --
+
+const hobject_t shared_hobject_t::empty;
+
+hobject_t &shared_hobject_t::edit()
+{
+  if (!obj)
+    obj.reset(new hobject_t);
+  else if (!obj.unique())
+    obj.reset(new hobject_t(*obj));
+  return *obj;
+}
+
+void shared_hobject_t::decode(bufferlist::iterator &bl)
+{
+  obj.reset(new hobject_t);
+  ::decode(*obj, bl);
+}
+
 // -- pg_log_entry_t --
 
 string pg_log_entry_t::get_key_name() const
@@ -2756,8 +2775,8 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
   if (struct_v < 2) {
     sobject_t old_soid;
     ::decode(old_soid, bl);
-    soid.oid = old_soid.oid;
-    soid.snap = old_soid.snap;
+    soid.edit().oid = old_soid.oid;
+    soid.edit().snap = old_soid.snap;
     invalid_hash = true;
   } else {
     ::decode(soid, bl);
@@ -2895,8 +2914,8 @@ void pg_log_t::decode(bufferlist::iterator &bl, int64_t pool)
     for (list<pg_log_entry_t>::iterator i = log.begin();
 	 i != log.end();
 	 ++i) {
-      if (!i->soid.is_max() && i->soid.pool == -1)
-	i->soid.pool = pool;
+      if (!i->soid->is_max() && i->soid->pool == -1)
+	i->soid.edit().pool = pool;
     }
   }
 }
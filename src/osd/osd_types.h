@@ -2037,6 +2037,51 @@ public:
 WRITE_CLASS_ENCODER(ObjectModDesc)
 
 
+/**
+ * shared_hobject_t - an hobject_t that copies share
+ *
+ * Copies point at the same hobject_t, names and all, whatever the
+ * std::string implementation.  PGLog::IndexedLog uses that to keep one
+ * copy of the names of an object however many log entries it has.
+ * It reads as a const hobject_t; edit() gives it a copy of its own to
+ * change.
+ */
+class shared_hobject_t {
+  ceph::shared_ptr<hobject_t> obj;
+  static const hobject_t empty;
+
+public:
+  shared_hobject_t() {}
+  shared_hobject_t(const hobject_t &o) : obj(new hobject_t(o)) {}
+
+  const hobject_t &get() const {
+    return obj ? *obj : empty;
+  }
+  operator const hobject_t&() const {
+    return get();
+  }
+  const hobject_t *operator->() const {
+    return &get();
+  }
+  hobject_t &edit();
+
+  /// whether o is not just equal to us, but the same copy
+  bool is_shared_with(const shared_hobject_t &o) const {
+    return obj == o.obj;
+  }
+
+  void encode(bufferlist &bl) const {
+    ::encode(get(), bl);
+  }
+  void decode(bufferlist::iterator &bl);
+};
+WRITE_CLASS_ENCODER(shared_hobject_t)
+
+inline ostream& operator<<(ostream& out, const shared_hobject_t& o) {
+  return out << o.get();
+}
+
+
 /**
  * pg_log_entry_t - single entry/event in pg log
  *
@@ -2082,7 +2127,7 @@ struct pg_log_entry_t {
   }
 
   __s32      op;
-  hobject_t  soid;
+  shared_hobject_t soid;
   eversion_t version, prior_version, reverting_to;
   version_t user_version; // the user version for this entry
   osd_reqid_t reqid;  // caller+tid to uniquely identify request
@@ -827,6 +827,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	ldout(cct, 3) << "handle_osd_map decoding full epoch "
 		      << m->get_last() << dendl;
 	osdmap->decode(m->maps[m->get_last()]);
+	// kept current by apply_incremental and decode from here on
+	if (cct->_conf->osd_map_precompute_mappings)
+	  osdmap->build_mapping(cct->_conf->osd_map_precompute_threads);
 
 	_scan_requests(homeless_session, false, false,
 		       need_resend, need_resend_linger,
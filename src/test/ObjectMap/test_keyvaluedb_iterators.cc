@@ -19,7 +19,11 @@
 #include "test/ObjectMap/KeyValueDBMemory.h"
 #include "os/KeyValueDB.h"
 #include "os/LevelDBStore.h"
+#ifdef HAVE_LIBROCKSDB
+#include "os/RocksDBStore.h"
+#endif
 #include <sys/types.h>
+#include <fcntl.h>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
 #include "gtest/gtest.h"
@@ -1767,6 +1771,252 @@ TEST_F(EmptyStore, UpperBoundMockDB)
 }
 
 
+#ifdef HAVE_LIBROCKSDB
+// ------- RocksDB column families -------
+/**
+ * A rocksdb store with its prefixes split over column families, so that
+ * whole space iterators merge several rocksdb iterators.  Everything is
+ * checked step by step against the mock store.
+ */
+class ColumnFamilyTest : public IteratorTest
+{
+public:
+  static const char *layout;
+  boost::scoped_ptr<RocksDBStore> rdb;
+  vector<string> prefixes;  ///< including some that hold no keys
+  vector<string> keys;
+
+  RocksDBStore *open_rocksdb(const string &path, const string &cfs,
+			     bool migrating, int *r) {
+    RocksDBStore *store = new RocksDBStore(g_ceph_context, path);
+    store->init();
+    store->options.column_families = cfs;
+    store->options.migrating = migrating;
+    *r = store->create_and_open(std::cerr);
+    return store;
+  }
+
+  void init(KeyValueDB *store) {
+    KeyValueDB::Transaction tx = store->get_transaction();
+    // _0_ and _D_ are in the default family, around the others
+    const char *p[] = { "_0_", "_A_", "_B_", "_C_", "_D_" };
+    for (unsigned i = 0; i < sizeof(p) / sizeof(p[0]); ++i)
+      for (vector<string>::iterator k = keys.begin(); k != keys.end(); ++k)
+	tx->set(p[i], *k, _gen_val(string(p[i]) + *k));
+    store->submit_transaction_sync(tx);
+  }
+
+  virtual void SetUp() {
+    IteratorTest::SetUp();
+
+    const char *p[] = { "", "_", "_0_", "_00_", "_A_", "_B", "_B_",
+			"_C_", "_CC_", "_D_", "_Z_" };
+    prefixes.assign(p, p + sizeof(p) / sizeof(p[0]));
+    keys.push_back("aaa");
+    keys.push_back("mmm");
+    keys.push_back("zzz");
+
+    int r;
+    rdb.reset(open_rocksdb(store_path + ".rocksdb", layout, false, &r));
+    ASSERT_EQ(0, r);
+    clear(rdb.get());
+    clear(mock.get());
+    init(rdb.get());
+    init(mock.get());
+  }
+
+  virtual void TearDown() {
+    rdb.reset();
+    IteratorTest::TearDown();
+  }
+
+  ::testing::AssertionResult same(KeyValueDB::WholeSpaceIterator it,
+				  KeyValueDB::WholeSpaceIterator mock_it) {
+    if (it->valid() != mock_it->valid())
+      return ::testing::AssertionFailure()
+	<< " valid " << it->valid() << " mock valid " << mock_it->valid();
+    if (!it->valid())
+      return ::testing::AssertionSuccess();
+    pair<string,string> k = it->raw_key();
+    pair<string,string> mock_k = mock_it->raw_key();
+    if (k != mock_k)
+      return ::testing::AssertionFailure()
+	<< " key (" << k.first << "," << k.second << ")"
+	<< " mock key (" << mock_k.first << "," << mock_k.second << ")";
+    if (it->key() != k.second)
+      return ::testing::AssertionFailure()
+	<< " key '" << it->key() << "' does not match pair key '"
+	<< k.second << "'";
+    if (_bl_to_str(it->value()) != _bl_to_str(mock_it->value()))
+      return ::testing::AssertionFailure()
+	<< " key (" << k.first << "," << k.second << ")"
+	<< " value '" << _bl_to_str(it->value()) << "'"
+	<< " mock value '" << _bl_to_str(mock_it->value()) << "'";
+    return ::testing::AssertionSuccess();
+  }
+
+  /**
+   * Walk both iterators the same way, 'n' for next and 'p' for prev,
+   * checking that they agree after every step.
+   */
+  void walk(KeyValueDB::WholeSpaceIterator it,
+	    KeyValueDB::WholeSpaceIterator mock_it,
+	    const string &steps) {
+    ASSERT_TRUE(same(it, mock_it));
+    for (unsigned i = 0; i < steps.length(); ++i) {
+      if (!mock_it->valid())
+	break;
+      if (steps[i] == 'n') {
+	it->next();
+	mock_it->next();
+      } else {
+	it->prev();
+	mock_it->prev();
+      }
+      ASSERT_TRUE(same(it, mock_it)) << " after step " << i << " of "
+				     << steps;
+    }
+  }
+};
+
+const char *ColumnFamilyTest::layout = "a=_A_ bc=_B_,_C_";
+
+TEST_F(ColumnFamilyTest, Traverse)
+{
+  KeyValueDB::WholeSpaceIterator it = rdb->get_iterator();
+  KeyValueDB::WholeSpaceIterator mock_it = mock->get_iterator();
+  it->seek_to_first();
+  mock_it->seek_to_first();
+  walk(it, mock_it, string(20, 'n'));
+  ASSERT_FALSE(HasFatalFailure());
+  ASSERT_FALSE(it->valid());
+
+  it->seek_to_last();
+  mock_it->seek_to_last();
+  walk(it, mock_it, string(20, 'p'));
+  ASSERT_FALSE(HasFatalFailure());
+  ASSERT_FALSE(it->valid());
+
+  it = rdb->get_snapshot_iterator();
+  mock_it = mock->get_snapshot_iterator();
+  it->seek_to_first();
+  mock_it->seek_to_first();
+  walk(it, mock_it, string(20, 'n'));
+  ASSERT_FALSE(HasFatalFailure());
+}
+
+TEST_F(ColumnFamilyTest, SeekAndSwitchDirection)
+{
+  // turning round at every family boundary, and on the first and last keys
+  const char *steps[] = { "nnnpnpppnnnnn", "pnpnnpnnnnpppppp",
+			  "nnnnnnnnnnnnnnpppnnn", "ppppnnnnppppppppnp" };
+  for (vector<string>::iterator p = prefixes.begin();
+       p != prefixes.end();
+       ++p) {
+    for (unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+      SCOPED_TRACE("prefix '" + *p + "' steps " + steps[i]);
+      KeyValueDB::WholeSpaceIterator it = rdb->get_iterator();
+      KeyValueDB::WholeSpaceIterator mock_it = mock->get_iterator();
+
+      it->seek_to_first(*p);
+      mock_it->seek_to_first(*p);
+      walk(it, mock_it, steps[i]);
+      ASSERT_FALSE(HasFatalFailure());
+
+      it->seek_to_last(*p);
+      mock_it->seek_to_last(*p);
+      walk(it, mock_it, steps[i]);
+      ASSERT_FALSE(HasFatalFailure());
+    }
+  }
+}
+
+TEST_F(ColumnFamilyTest, Bounds)
+{
+  const char *k[] = { "", "a", "aaa", "aab", "mmm", "zzz", "zzzz" };
+  for (vector<string>::iterator p = prefixes.begin();
+       p != prefixes.end();
+       ++p) {
+    for (unsigned i = 0; i < sizeof(k) / sizeof(k[0]); ++i) {
+      SCOPED_TRACE("prefix '" + *p + "' key '" + k[i] + "'");
+      KeyValueDB::WholeSpaceIterator it = rdb->get_iterator();
+      KeyValueDB::WholeSpaceIterator mock_it = mock->get_iterator();
+
+      it->lower_bound(*p, k[i]);
+      mock_it->lower_bound(*p, k[i]);
+      walk(it, mock_it, "pnnpn");
+      ASSERT_FALSE(HasFatalFailure());
+
+      it->upper_bound(*p, k[i]);
+      mock_it->upper_bound(*p, k[i]);
+      walk(it, mock_it, "nppnp");
+      ASSERT_FALSE(HasFatalFailure());
+    }
+  }
+}
+
+TEST_F(ColumnFamilyTest, PrefixIterator)
+{
+  for (vector<string>::iterator p = prefixes.begin();
+       p != prefixes.end();
+       ++p) {
+    SCOPED_TRACE("prefix '" + *p + "'");
+    KeyValueDB::Iterator it = rdb->get_iterator(*p);
+    KeyValueDB::Iterator mock_it = mock->get_iterator(*p);
+    it->seek_to_first();
+    mock_it->seek_to_first();
+    while (mock_it->valid()) {
+      ASSERT_TRUE(it->valid());
+      ASSERT_EQ(mock_it->key(), it->key());
+      ASSERT_EQ(_bl_to_str(mock_it->value()), _bl_to_str(it->value()));
+      it->next();
+      mock_it->next();
+    }
+    ASSERT_FALSE(it->valid());
+  }
+}
+
+TEST_F(ColumnFamilyTest, InterruptedMigration)
+{
+  string path = store_path + ".rocksdb-migrate";
+  string target = "ad=_A_,_D_";
+  ASSERT_EQ(0, ::system(("rm -fr " + path).c_str()));
+  int r;
+  boost::scoped_ptr<RocksDBStore> store(
+    open_rocksdb(path, layout, false, &r));
+  ASSERT_EQ(0, r);
+  init(store.get());
+  store.reset();
+
+  // as left by a migration to 'target' that stopped before moving keys
+  int fd = ::open((path + "/CF_MIGRATION").c_str(),
+		  O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ((int)target.length(),
+	    ::write(fd, target.c_str(), target.length()));
+  ::close(fd);
+
+  store.reset(open_rocksdb(path, target, false, &r));
+  ASSERT_EQ(-EBUSY, r);
+
+  // finishes the recorded migration whatever is configured now
+  store.reset(open_rocksdb(path, layout, true, &r));
+  ASSERT_EQ(0, r);
+  ASSERT_EQ(0, store->migrate_column_families(std::cerr, 2));
+  store.reset();
+
+  store.reset(open_rocksdb(path, target, false, &r));
+  ASSERT_EQ(0, r);
+  KeyValueDB::WholeSpaceIterator it = store->get_iterator();
+  KeyValueDB::WholeSpaceIterator mock_it = mock->get_iterator();
+  it->seek_to_first();
+  mock_it->seek_to_first();
+  walk(it, mock_it, string(20, 'n'));
+  ASSERT_FALSE(HasFatalFailure());
+  ASSERT_FALSE(it->valid());
+}
+#endif
+
 int main(int argc, char *argv[])
 {
   vector<const char*> args;
@@ -745,6 +745,65 @@ TEST_F(ObjectMapTest, OddEvenClone) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, GetValuesBatch) {
+  ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)));
+  ghobject_t hoid3(hobject_t(sobject_t("foo3", CEPH_NOSNAP)));
+  ghobject_t hoid4(hobject_t(sobject_t("foo4", CEPH_NOSNAP)));
+  ghobject_t missing(hobject_t(sobject_t("missing", CEPH_NOSNAP)));
+
+  for (unsigned i = 0; i < 20; ++i) {
+    tester.set_key(hoid, "key" + num_str(i), "val" + num_str(i));
+    tester.set_key(hoid, "pre_" + num_str(i), "val" + num_str(i));
+    tester.set_key(hoid3, "key" + num_str(i), "val" + num_str(i));
+  }
+  tester.set_key(hoid4, "key", "val");
+  // hoid3 and hoid2 end up with a parent
+  db->clone(hoid3, hoid2);
+  tester.remove_key(hoid2, "key" + num_str(3));
+
+  vector<ObjectMap::OmapRead> reads;
+  reads.push_back(ObjectMap::OmapRead(hoid, "", "", 5));
+  // picks up where the last one stopped
+  reads.push_back(ObjectMap::OmapRead(hoid, "key" + num_str(4), "", 5));
+  reads.push_back(ObjectMap::OmapRead(hoid, "", "pre_", 100));
+  // and back again
+  reads.push_back(ObjectMap::OmapRead(hoid, "key" + num_str(1), "key", 2));
+  reads.push_back(ObjectMap::OmapRead(hoid2, "", "", 5));
+  reads.push_back(ObjectMap::OmapRead(hoid4, "", "", 5));
+  reads.push_back(ObjectMap::OmapRead(missing, "", "", 5));
+  reads.push_back(ObjectMap::OmapRead(hoid, "pre_" + num_str(18), "", 5));
+
+  vector<ObjectMap::OmapRead> expected = reads;
+  for (vector<ObjectMap::OmapRead>::iterator p = expected.begin();
+       p != expected.end();
+       ++p)
+    p->r = ObjectMap::read_range(db->get_iterator(p->oid), &*p);
+  db->get_values_batch(reads);
+
+  ASSERT_EQ(expected.size(), reads.size());
+  for (unsigned i = 0; i < reads.size(); ++i) {
+    ASSERT_EQ(expected[i].r, reads[i].r);
+    ASSERT_EQ(expected[i].out.size(), reads[i].out.size());
+    map<string, bufferlist>::iterator e = expected[i].out.begin();
+    map<string, bufferlist>::iterator g = reads[i].out.begin();
+    for (; e != expected[i].out.end(); ++e, ++g) {
+      ASSERT_EQ(e->first, g->first);
+      ASSERT_TRUE(e->second.contents_equal(g->second));
+    }
+  }
+
+  ASSERT_EQ(5u, reads[0].out.size());
+  ASSERT_EQ("key" + num_str(5), reads[1].out.begin()->first);
+  ASSERT_EQ(20u, reads[2].out.size());
+  ASSERT_EQ("key" + num_str(2), reads[3].out.begin()->first);
+  ASSERT_EQ(0u, reads[4].out.count("key" + num_str(3)));
+  ASSERT_EQ(5u, reads[4].out.size());
+  ASSERT_EQ(1u, reads[5].out.size());
+  ASSERT_EQ(0u, reads[6].out.size());
+  ASSERT_EQ(1u, reads[7].out.size());
+}
+
 TEST_F(ObjectMapTest, RandomTest) {
   tester.def_init();
   for (unsigned i = 0; i < 5000; ++i) {
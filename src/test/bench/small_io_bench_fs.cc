@@ -70,6 +70,8 @@ int main(int argc, char **argv)
      "path to filestore directory, mandatory")
     ("journal-path", po::value<string>(),
      "path to journal, mandatory")
+    ("objectstore", po::value<string>()->default_value("filestore"),
+     "ObjectStore backend (filestore, keyvaluestore-dev, memstore, ...)")
     ("offset-align", po::value<unsigned>()->default_value(4096),
      "align offset by")
     ("write-infos", po::value<bool>()->default_value(false),
@@ -132,8 +134,16 @@ int main(int argc, char **argv)
   ops.insert(make_pair(vm["write-ratio"].as<double>(), Bencher::WRITE));
   ops.insert(make_pair(1-vm["write-ratio"].as<double>(), Bencher::READ));
 
-  FileStore fs(vm["filestore-path"].as<string>(),
-	       vm["journal-path"].as<string>());
+  ObjectStore *store = ObjectStore::create(g_ceph_context,
+					   vm["objectstore"].as<string>(),
+					   vm["filestore-path"].as<string>(),
+					   vm["journal-path"].as<string>());
+  if (!store) {
+    cout << "unknown objectstore " << vm["objectstore"].as<string>()
+	 << std::endl;
+    return 1;
+  }
+  ObjectStore &fs = *store;
 
   if (fs.mkfs() < 0) {
     cout << "mkfs failed" << std::endl;
@@ -245,6 +255,7 @@ int main(int argc, char **argv)
   }
 
   fs.umount();
+  delete store;
   if (vm["op-dump-file"].as<string>().size()) {
     myfile.close();
   }
@@ -1884,6 +1884,32 @@ TEST(BufferList, write_fd) {
   ::unlink("testfile");
 }
 
+TEST(BufferList, write_fd_offset) {
+  ::unlink("testfile");
+  int fd = ::open("testfile", O_RDWR|O_CREAT|O_TRUNC, 0600);
+  bufferlist bl;
+  for (unsigned i = 0; i < IOV_MAX * 2; i++) {
+    bufferptr ptr("A", 1);
+    bl.push_back(ptr);
+  }
+  uint64_t offset = 200;
+  EXPECT_EQ(0, bl.write_fd(fd, offset));
+#ifdef HAVE_PWRITEV
+  // the file offset is left alone
+  EXPECT_EQ(0, ::lseek(fd, 0, SEEK_CUR));
+#endif
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  ::fstat(fd, &st);
+  EXPECT_EQ(IOV_MAX * 2 + offset, (unsigned)st.st_size);
+  char buf[IOV_MAX * 2];
+  EXPECT_EQ(IOV_MAX * 2, ::pread(fd, buf, sizeof(buf), offset));
+  for (unsigned i = 0; i < sizeof(buf); i++)
+    ASSERT_EQ('A', buf[i]);
+  ::close(fd);
+  ::unlink("testfile");
+}
+
 TEST(BufferList, crc32c) {
   bufferlist bl;
   __u32 crc = 0;
@@ -0,0 +1,316 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Simulate an OSD op queue shard, in virtual time, to see what each
+ * class of ops gets from osd_op_queue = mclock or prioritized.
+ *
+ * One server completes --capacity ops per second.  --clients clients
+ * send ops at --client-rate each, except for client 0, the noisy
+ * tenant, which sends at --noisy-rate.  Recovery, scrub and snap trim
+ * are always backlogged, with --depth ops queued each.  The achieved
+ * iops and latencies of each class and client are printed as JSON next
+ * to their settings.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "common/MClockQueue.h"
+#include "common/PrioritizedQueue.h"
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/Formatter.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+
+enum {
+  SIM_CLIENT,
+  SIM_RECOVERY,
+  SIM_SCRUB,
+  SIM_SNAPTRIM,
+  SIM_MAX
+};
+
+struct sim_class_t {
+  const char *name;
+  float reservation;
+  float weight;
+  float limit;
+  int priority;     ///< for prioritized
+};
+
+static sim_class_t sim_classes[SIM_MAX] = {
+  // name        res    wgt   lim  prio
+  { "client",    100,   500,  0,   63 },
+  { "recovery",  0,     10,   0,   10 },
+  { "scrub",     0,     5,    0,   5 },
+  { "snaptrim",  0,     5,    50,  5 },
+};
+
+struct SimOp {
+  unsigned cls;
+  int client;
+  double arrival;
+  SimOp(unsigned cls = 0, int client = 0, double arrival = 0)
+    : cls(cls), client(client), arrival(arrival) {}
+};
+
+static unsigned sim_op_class(const SimOp &op)
+{
+  return op.cls;
+}
+
+typedef OpQueue<SimOp, int> SimQueueT;
+
+/// an mclock queue running on the simulated clock
+class SimMClockQueue : public MClockQueue<SimOp, int> {
+  const double *clock;
+protected:
+  double now() const {
+    return *clock;
+  }
+public:
+  SimMClockQueue(const vector<class_info_t> &c, unsigned min_cost,
+		 const double *clock)
+    : MClockQueue<SimOp, int>(c, sim_op_class, min_cost), clock(clock) {}
+};
+
+struct sim_stats_t {
+  double offered;       ///< ops/s, 0 if backlogged
+  uint64_t ops;
+  vector<double> lats;  ///< seconds
+  sim_stats_t() : offered(0), ops(0) {}
+
+  void dump(Formatter *f, double seconds) {
+    std::sort(lats.begin(), lats.end());
+    double sum = 0;
+    for (vector<double>::iterator p = lats.begin(); p != lats.end(); ++p)
+      sum += *p;
+    if (offered > 0)
+      f->dump_float("offered_iops", offered);
+    else
+      f->dump_string("offered_iops", "backlogged");
+    f->dump_float("iops", ops / seconds);
+    f->dump_float("avg_latency_ms",
+		  lats.empty() ? 0 : sum * 1000.0 / lats.size());
+    f->dump_float("p99_latency_ms",
+		  lats.empty() ? 0 :
+		  lats[(size_t)(.99 * (lats.size() - 1))] * 1000.0);
+  }
+};
+
+static void usage(const char *pname)
+{
+  cerr << "usage: " << pname << " [options]\n"
+       << "  --queue mclock|prioritized   (default mclock)\n"
+       << "  --seconds N          simulated (default 60)\n"
+       << "  --capacity N         ops/s the osd completes (default 1000)\n"
+       << "  --clients N          (default 4)\n"
+       << "  --client-rate N      ops/s offered by each client (default 150)\n"
+       << "  --noisy-rate N       ops/s offered by client 0 (default 2000)\n"
+       << "  --depth N            ops queued by each background class (default 16)\n"
+       << "  --cost N             of each op, in bytes (default 4096)\n"
+       << "  --min-cost N         osd_op_pq_min_cost (default 65536)\n"
+       << "  --<class>-res N, --<class>-wgt N, --<class>-lim N, --<class>-prio N\n"
+       << "                       settings of each class:";
+  for (int i = 0; i < SIM_MAX; ++i)
+    cerr << " " << sim_classes[i].name;
+  cerr << "\n"
+       << "                       (the client ones are for each client)\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+static double exp_interval(unsigned *seed, double rate)
+{
+  double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+  return -::log(u) / rate;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  string queue = "mclock";
+  int seconds = 60, capacity = 1000, num_clients = 4, depth = 16;
+  int cost = 4096, min_cost = 65536;
+  float client_rate = 150, noisy_rate = 2000;
+  std::ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    bool found = false;
+    for (int c = 0; c < SIM_MAX && !found; ++c) {
+      string prefix = string("--") + sim_classes[c].name;
+      float prio = sim_classes[c].priority;
+      if (ceph_argparse_withfloat(args, i, &sim_classes[c].reservation, &err,
+				  (prefix + "-res").c_str(), (char*)NULL) ||
+	  ceph_argparse_withfloat(args, i, &sim_classes[c].weight, &err,
+				  (prefix + "-wgt").c_str(), (char*)NULL) ||
+	  ceph_argparse_withfloat(args, i, &sim_classes[c].limit, &err,
+				  (prefix + "-lim").c_str(), (char*)NULL)) {
+	found = true;
+      } else if (ceph_argparse_withfloat(args, i, &prio, &err,
+					 (prefix + "-prio").c_str(),
+					 (char*)NULL)) {
+	sim_classes[c].priority = prio;
+	found = true;
+      }
+    }
+    if (found) {
+    } else if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &queue, "--queue", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &seconds, &err,
+				     "--seconds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &capacity, &err,
+				     "--capacity", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_clients, &err,
+				     "--clients", (char*)NULL)) {
+    } else if (ceph_argparse_withfloat(args, i, &client_rate, &err,
+				       "--client-rate", (char*)NULL)) {
+    } else if (ceph_argparse_withfloat(args, i, &noisy_rate, &err,
+				       "--noisy-rate", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &depth, &err,
+				     "--depth", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &cost, &err,
+				     "--cost", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &min_cost, &err,
+				     "--min-cost", (char*)NULL)) {
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (seconds < 1 || capacity < 1 || num_clients < 1 || depth < 0 ||
+      cost < 0 || min_cost < 1 ||
+      (queue != "mclock" && queue != "prioritized")) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  double t = 0;
+  SimQueueT *q;
+  if (queue == "mclock") {
+    vector<SimMClockQueue::class_info_t> classes;
+    for (int c = 0; c < SIM_MAX; ++c)
+      classes.push_back(SimMClockQueue::class_info_t(
+	sim_classes[c].name, sim_classes[c].reservation,
+	sim_classes[c].weight, sim_classes[c].limit, c == SIM_CLIENT));
+    q = new SimMClockQueue(classes, min_cost, &t);
+  } else {
+    q = new PrioritizedQueue<SimOp, int>(
+      g_conf->osd_op_pq_max_tokens_per_priority, min_cost);
+  }
+
+  // background classes are queued under clients of their own, as the
+  // osd would see them from the peers
+  vector<sim_stats_t> class_stats(SIM_MAX);
+  vector<sim_stats_t> client_stats(num_clients);
+  vector<double> next_arrival(num_clients);
+  unsigned seed = 1;
+  for (int i = 0; i < num_clients; ++i) {
+    client_stats[i].offered = (i == 0 && noisy_rate > 0) ?
+      noisy_rate : client_rate;
+    class_stats[SIM_CLIENT].offered += client_stats[i].offered;
+    next_arrival[i] = exp_interval(&seed, client_stats[i].offered);
+  }
+  for (int c = SIM_CLIENT + 1; c < SIM_MAX; ++c)
+    for (int i = 0; i < depth; ++i)
+      q->enqueue(-c, sim_classes[c].priority, cost, SimOp(c, -c, 0));
+
+  double service = 1.0 / capacity;
+  while (t < seconds) {
+    double next = seconds;
+    for (int i = 0; i < num_clients; ++i) {
+      while (next_arrival[i] <= t) {
+	q->enqueue(i, sim_classes[SIM_CLIENT].priority, cost,
+		   SimOp(SIM_CLIENT, i, next_arrival[i]));
+	next_arrival[i] += exp_interval(&seed, client_stats[i].offered);
+      }
+      next = std::min(next, next_arrival[i]);
+    }
+    if (q->empty()) {
+      t = next;
+      continue;
+    }
+
+    SimOp op = q->dequeue();
+    t += service;
+    double lat = t - op.arrival;
+    class_stats[op.cls].ops++;
+    class_stats[op.cls].lats.push_back(lat);
+    if (op.cls == SIM_CLIENT) {
+      client_stats[op.client].ops++;
+      client_stats[op.client].lats.push_back(lat);
+    } else {
+      q->enqueue(op.client, sim_classes[op.cls].priority, cost,
+		 SimOp(op.cls, op.client, t));
+    }
+  }
+
+  JSONFormatter f(true);
+  f.open_object_section("mclock_sim");
+  f.dump_string("queue", queue);
+  f.dump_int("seconds", seconds);
+  f.dump_int("capacity", capacity);
+  f.dump_int("cost", cost);
+  f.dump_int("min_cost", min_cost);
+  f.open_array_section("classes");
+  for (int c = 0; c < SIM_MAX; ++c) {
+    f.open_object_section("class");
+    f.dump_string("name", sim_classes[c].name);
+    if (queue == "mclock") {
+      f.dump_float("reservation", sim_classes[c].reservation);
+      f.dump_float("weight", sim_classes[c].weight);
+      f.dump_float("limit", sim_classes[c].limit);
+    } else {
+      f.dump_int("priority", sim_classes[c].priority);
+    }
+    class_stats[c].dump(&f, seconds);
+    f.close_section();
+  }
+  f.close_section();
+  f.open_array_section("clients");
+  for (int i = 0; i < num_clients; ++i) {
+    f.open_object_section("client");
+    f.dump_int("id", i);
+    client_stats[i].dump(&f, seconds);
+    f.close_section();
+  }
+  f.close_section();
+  f.open_object_section("queue_state");
+  q->dump(&f);
+  f.close_section();
+  f.close_section();
+  f.flush(cout);
+  cout << std::endl;
+
+  delete q;
+  return 0;
+}
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "common/MClockQueue.h"
+
+struct Op {
+  unsigned cls;
+  int client;
+  int seq;
+  Op(unsigned cls = 0, int client = 0, int seq = 0)
+    : cls(cls), client(client), seq(seq) {}
+};
+
+static unsigned op_class(const Op &op)
+{
+  return op.cls;
+}
+
+typedef MClockQueue<Op, int> BaseQueue;
+typedef BaseQueue::class_info_t class_info_t;
+
+/// with a clock of our own
+class TestQueue : public BaseQueue {
+public:
+  double t;
+  TestQueue(const vector<class_info_t> &c)
+    : BaseQueue(c, op_class, 1), t(0) {}
+protected:
+  double now() const {
+    return t;
+  }
+};
+
+static void fill(TestQueue *q, unsigned cls, int client, int n)
+{
+  for (int i = 0; i < n; ++i)
+    q->enqueue(client, 0, 1, Op(cls, client, i));
+}
+
+/// serve n ops at rate ops/s, counting them by class
+static void serve(TestQueue *q, int n, double rate, map<unsigned, int> *out)
+{
+  for (int i = 0; i < n && !q->empty(); ++i) {
+    Op op = q->dequeue();
+    (*out)[op.cls]++;
+    q->t += 1.0 / rate;
+  }
+}
+
+TEST(MClockQueue, StrictFirst)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("a"));
+  TestQueue q(classes);
+  q.enqueue(1, 0, 1, Op(0, 1, 1));
+  q.enqueue_strict(1, 200, Op(0, 1, 2));
+  q.enqueue_strict(1, 100, Op(0, 1, 3));
+  ASSERT_EQ(3u, q.length());
+  ASSERT_EQ(2, q.dequeue().seq);
+  ASSERT_EQ(3, q.dequeue().seq);
+  ASSERT_EQ(1, q.dequeue().seq);
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(MClockQueue, Weight)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("a", 0, 1));
+  classes.push_back(class_info_t("b", 0, 3));
+  TestQueue q(classes);
+  fill(&q, 0, 1, 1000);
+  fill(&q, 1, 1, 1000);
+  map<unsigned, int> served;
+  serve(&q, 400, 100, &served);
+  ASSERT_NEAR(100, served[0], 2);
+  ASSERT_NEAR(300, served[1], 2);
+}
+
+TEST(MClockQueue, Reservation)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("a", 10, 1));
+  classes.push_back(class_info_t("b", 0, 100));
+  TestQueue q(classes);
+  fill(&q, 0, 1, 1000);
+  fill(&q, 1, 1, 1000);
+  // 100 ops/s for 5s: a gets its 10/s although its weight would only
+  // give it 1/101 of that
+  map<unsigned, int> served;
+  serve(&q, 500, 100, &served);
+  ASSERT_NEAR(50, served[0], 2);
+  ASSERT_EQ(500 - served[0], served[1]);
+  ASSERT_GT(q.get_served(0, BaseQueue::PHASE_RESERVATION),
+	    q.get_served(0, BaseQueue::PHASE_WEIGHT));
+}
+
+TEST(MClockQueue, Limit)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("a", 0, 100, 10));
+  classes.push_back(class_info_t("b", 0, 1));
+  TestQueue q(classes);
+  fill(&q, 0, 1, 1000);
+  fill(&q, 1, 1, 1000);
+  map<unsigned, int> served;
+  serve(&q, 500, 100, &served);
+  ASSERT_NEAR(50, served[0], 2);
+
+  // with nothing else to do, the limit does not hold
+  TestQueue q2(classes);
+  fill(&q2, 0, 1, 1000);
+  served.clear();
+  serve(&q2, 500, 100, &served);
+  ASSERT_EQ(500, served[0]);
+  ASSERT_GT(q2.get_served(0, BaseQueue::PHASE_OVER_LIMIT), 0u);
+}
+
+TEST(MClockQueue, PerClient)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("client", 0, 1, 0, true));
+  classes.push_back(class_info_t("recovery", 0, 1));
+  TestQueue q(classes);
+  // a noisy client does not get more than a quiet one
+  fill(&q, 0, 1, 1000);
+  fill(&q, 0, 2, 100);
+  // and in a shared class, clients do not count
+  for (int i = 0; i < 50; ++i) {
+    q.enqueue(3, 0, 1, Op(1, 3, i));
+    q.enqueue(4, 0, 1, Op(1, 4, i));
+  }
+  map<int, int> served;
+  for (int i = 0; i < 150; ++i) {
+    served[q.dequeue().client]++;
+    q.t += .01;
+  }
+  ASSERT_NEAR(50, served[1], 2);
+  ASSERT_NEAR(50, served[2], 2);
+  ASSERT_NEAR(50, served[3] + served[4], 2);
+
+  list<Op> removed;
+  unsigned len = q.length();
+  q.remove_by_class(1, &removed);
+  ASSERT_EQ(len - removed.size(), q.length());
+  for (list<Op>::iterator p = removed.begin(); p != removed.end(); ++p)
+    ASSERT_EQ(1, p->client);
+
+  // a client's ops in a shared class go too, and only its
+  removed.clear();
+  len = q.length();
+  q.remove_by_class(3, &removed);
+  ASSERT_FALSE(removed.empty());
+  ASSERT_EQ(len - removed.size(), q.length());
+  for (list<Op>::iterator p = removed.begin(); p != removed.end(); ++p)
+    ASSERT_EQ(3, p->client);
+  int left4 = 0;
+  while (!q.empty()) {
+    int client = q.dequeue().client;
+    ASSERT_NE(1, client);
+    ASSERT_NE(3, client);
+    left4 += client == 4;
+  }
+  ASSERT_NEAR(25, left4, 2);
+}
+
+struct SeqFilter : public OpQueue<Op, int>::Filter {
+  bool operator()(const Op &op) {
+    return op.seq % 2;
+  }
+};
+
+TEST(MClockQueue, RemoveAndRequeue)
+{
+  vector<class_info_t> classes;
+  classes.push_back(class_info_t("a"));
+  TestQueue q(classes);
+  fill(&q, 0, 1, 10);
+  q.enqueue_strict(1, 200, Op(0, 1, 11));
+
+  SeqFilter f;
+  list<Op> removed;
+  OpQueue<Op, int> *oq = &q;
+  oq->remove_by_filter(f, &removed);
+  ASSERT_EQ(6u, removed.size());
+  ASSERT_EQ(1, removed.front().seq);
+  ASSERT_EQ(11, removed.back().seq);
+  ASSERT_EQ(5u, q.length());
+
+  // a requeued op goes ahead of the rest of its client's
+  q.enqueue_front(1, 0, 1, Op(0, 1, 3));
+  ASSERT_EQ(3, q.dequeue().seq);
+  for (int i = 0; i < 10; i += 2)
+    ASSERT_EQ(i, q.dequeue().seq);
+  ASSERT_TRUE(q.empty());
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_mclock_queue && ./unittest_mclock_queue"
+// End:
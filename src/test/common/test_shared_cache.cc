@@ -266,6 +266,32 @@ TEST(SharedCache_all, lru) {
   ASSERT_TRUE(cache.lookup(0));
 }
 
+TEST(SharedCache_all, evicted) {
+  const size_t SIZE = 2;
+  SharedLRU<int, int> cache(NULL, SIZE);
+
+  bool existed = false;
+  unsigned evicted = 1;
+  shared_ptr<int> ptr = cache.add(0, new int(0), &existed, &evicted);
+  ASSERT_EQ(0u, evicted);
+  cache.add(1, new int(1), &existed, &evicted);
+  ASSERT_EQ(0u, evicted);
+  cache.add(2, new int(2), &existed, &evicted);
+  ASSERT_EQ(1u, evicted);
+
+  // 0 is still referenced; looking it up puts it back in the lru
+  ASSERT_TRUE(cache.lookup(0, &evicted));
+  ASSERT_EQ(1u, evicted);
+  ASSERT_TRUE(cache.lookup(0, &evicted));
+  ASSERT_EQ(0u, evicted);
+
+  int *tmpint = new int(0);
+  cache.add(0, tmpint, &existed, &evicted);
+  ASSERT_TRUE(existed);
+  ASSERT_EQ(0u, evicted);
+  delete tmpint;
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
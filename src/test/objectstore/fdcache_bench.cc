@@ -0,0 +1,236 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measure how FileStore::lfn_open (and so the FDCache) scales with the
+ * number of op threads.  Every thread reads one byte from random
+ * objects spread over a few collections; each read goes through
+ * lfn_open.  With --objects below filestore_fd_cache_size nearly every
+ * open is a cache hit; above it the miss path (index lookup and
+ * open(2)) dominates.
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "os/FileStore.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "common/Thread.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "global/global_init.h"
+#include "include/atomic.h"
+
+static void usage(const char *pname)
+{
+  cerr << "usage: " << pname << " <store_path> <journal_path> [options]\n"
+       << "  --objects N        objects to create (default 1000)\n"
+       << "  --collections N    collections to spread them over (default 8)\n"
+       << "  --seconds N        run time for each thread count (default 5)\n"
+       << "  --max-threads N    last thread count, doubling from 1 (default 32)\n"
+       << "  --dump-counters    dump the fdcache perf counters after each run\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+struct BenchState {
+  ObjectStore *store;
+  vector<pair<coll_t, ghobject_t> > objects;
+  utime_t end;
+  atomic_t ops;
+  atomic_t errors;
+};
+
+class OpenThread : public Thread {
+  BenchState *state;
+  unsigned seed;
+public:
+  utime_t lat_sum;
+  uint64_t count;
+
+  OpenThread(BenchState *s, unsigned seed) : state(s), seed(seed), count(0) {}
+
+  void *entry() {
+    bufferlist bl;
+    while (true) {
+      // check the clock every so often rather than on every op
+      if ((count & 63) == 0 && ceph_clock_now(g_ceph_context) > state->end)
+	break;
+      const pair<coll_t, ghobject_t> &o =
+	state->objects[rand_r(&seed) % state->objects.size()];
+      utime_t start = ceph_clock_now(g_ceph_context);
+      bl.clear();
+      int r = state->store->read(o.first, o.second, 0, 1, bl);
+      lat_sum += ceph_clock_now(g_ceph_context) - start;
+      ++count;
+      if (r < 0)
+	state->errors.inc();
+    }
+    state->ops.add(count);
+    return NULL;
+  }
+};
+
+static int populate(ObjectStore *store, int num_objects, int num_colls,
+		    vector<pair<coll_t, ghobject_t> > *objects)
+{
+  ObjectStore::Sequencer osr("fdcache_bench");
+  bufferlist data;
+  data.append("fdcache_bench");
+  for (int c = 0; c < num_colls; ++c) {
+    ostringstream cname;
+    cname << "fdcache_bench_" << c;
+    coll_t cid(cname.str());
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    int r = store->apply_transaction(&osr, t);
+    if (r < 0)
+      return r;
+  }
+
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  for (int i = 0; i < num_objects; ++i) {
+    ostringstream cname, oname;
+    cname << "fdcache_bench_" << (i % num_colls);
+    oname << "obj_" << i;
+    coll_t cid(cname.str());
+    ghobject_t oid(hobject_t(sobject_t(oname.str(), CEPH_NOSNAP)));
+    t->write(cid, oid, 0, data.length(), data);
+    objects->push_back(make_pair(cid, oid));
+    if (t->get_num_ops() >= 100 || i == num_objects - 1) {
+      int r = store->apply_transaction(&osr, *t);
+      delete t;
+      if (r < 0)
+	return r;
+      t = new ObjectStore::Transaction;
+    }
+  }
+  delete t;
+  return 0;
+}
+
+static void dump_counters(ostream &out)
+{
+  JSONFormatter f(true);
+  g_ceph_context->get_perfcounters_collection()->dump_formatted(&f, false);
+  f.flush(out);
+  out << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_objects = 1000, num_colls = 8, seconds = 5, max_threads = 32;
+  bool dump = false;
+  std::ostringstream err;
+  vector<const char*> positional;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &num_objects, &err,
+				     "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_colls, &err,
+				     "--collections", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &seconds, &err,
+				     "--seconds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &max_threads, &err,
+				     "--max-threads", (char*)NULL)) {
+    } else if (ceph_argparse_flag(args, i, "--dump-counters", (char*)NULL)) {
+      dump = true;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      positional.push_back(*i);
+      ++i;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (positional.size() != 2 || num_objects < 1 || num_colls < 1 ||
+      max_threads < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  FileStore *store = new FileStore(positional[0], positional[1]);
+  int r = store->mkfs();
+  if (r < 0) {
+    cerr << "mkfs failed: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  r = store->mount();
+  if (r < 0) {
+    cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+
+  BenchState state;
+  state.store = store;
+  r = populate(store, num_objects, num_colls, &state.objects);
+  if (r < 0) {
+    cerr << "populate failed: " << cpp_strerror(r) << std::endl;
+    store->umount();
+    return 1;
+  }
+
+  cout << "objects " << num_objects
+       << " collections " << num_colls
+       << " fd_cache_size " << g_conf->filestore_fd_cache_size
+       << " fd_cache_shards " << g_conf->filestore_fd_cache_shards
+       << std::endl;
+  cout << "threads\tops/s\tavg_lat_us\terrors" << std::endl;
+  for (int n = 1; n <= max_threads; n *= 2) {
+    state.ops.set(0);
+    state.errors.set(0);
+    state.end = ceph_clock_now(g_ceph_context);
+    state.end += (double)seconds;
+    utime_t start = ceph_clock_now(g_ceph_context);
+
+    vector<OpenThread*> threads;
+    for (int i = 0; i < n; ++i) {
+      threads.push_back(new OpenThread(&state, i + 1));
+      threads.back()->create();
+    }
+    utime_t lat_sum;
+    for (vector<OpenThread*>::iterator p = threads.begin();
+	 p != threads.end();
+	 ++p) {
+      (*p)->join();
+      lat_sum += (*p)->lat_sum;
+      delete *p;
+    }
+    double elapsed = ceph_clock_now(g_ceph_context) - start;
+    uint64_t ops = state.ops.read();
+    cout << n << "\t" << (uint64_t)(ops / elapsed)
+	 << "\t" << (ops ? (double)lat_sum * 1000000.0 / ops : 0)
+	 << "\t" << state.errors.read() << std::endl;
+    if (dump)
+      dump_counters(cout);
+  }
+
+  store->umount();
+  delete store;
+  return 0;
+}
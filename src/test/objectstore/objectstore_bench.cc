@@ -0,0 +1,627 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Drive any ObjectStore (filestore, keyvaluestore, memstore, blockstore)
+ * through a set of workloads and report throughput and latency
+ * percentiles as JSON, to compare backends and catch regressions.
+ *
+ * Each of the --sequencers threads gets its own sequencer and
+ * collection of --objects objects, filled in before the first workload
+ * runs.  Every op is synchronous: writes are timed until they are both
+ * readable and committed.
+ *
+ * For the workloads that write, the bytes the whole process sent to
+ * the storage layer (write_bytes in /proc/self/io, which covers the
+ * journal and the kv store as well as the data) are reported against
+ * the bytes written, as the write amplification.  The store is synced
+ * before and after each workload, so that it is charged for its own
+ * writeback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "os/ObjectStore.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Formatter.h"
+#include "common/Thread.h"
+#include "common/errno.h"
+#include "include/str_list.h"
+#include "global/global_init.h"
+
+enum workload_t {
+  W_SEQ_WRITE,
+  W_RAND_WRITE,
+  W_SEQ_READ,
+  W_RAND_READ,
+  W_OMAP_WRITE,
+  W_OMAP_READ,
+  W_XATTR_WRITE,
+  W_XATTR_READ,
+  W_CLONE,
+  W_LIST,
+  W_MAX
+};
+
+static const char *workload_names[W_MAX] = {
+  "seq-write",
+  "rand-write",
+  "seq-read",
+  "rand-read",
+  "omap-write",
+  "omap-read",
+  "xattr-write",
+  "xattr-read",
+  "clone",
+  "list",
+};
+
+static int get_workload(const string &name)
+{
+  for (int i = 0; i < W_MAX; ++i)
+    if (name == workload_names[i])
+      return i;
+  return -1;
+}
+
+static bool is_write(workload_t w)
+{
+  return w == W_SEQ_WRITE || w == W_RAND_WRITE || w == W_OMAP_WRITE ||
+    w == W_XATTR_WRITE || w == W_CLONE;
+}
+
+/// bytes this process has caused to be written to storage, or -errno
+static int get_write_bytes(uint64_t *out)
+{
+  FILE *f = fopen("/proc/self/io", "r");
+  if (!f)
+    return -errno;
+  char line[256];
+  int r = -ENOENT;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long long v;
+    if (sscanf(line, "write_bytes: %llu", &v) == 1) {
+      *out = v;
+      r = 0;
+      break;
+    }
+  }
+  fclose(f);
+  return r;
+}
+
+static void usage(const char *pname)
+{
+  cerr << "usage: " << pname << " <type> <store_path> <journal_path> [options]\n"
+       << "  <type> is one of filestore, keyvaluestore, memstore, blockstore-dev\n"
+       << "  --workloads A,B,..    to run, in order (default all):\n"
+       << "                        ";
+  for (int i = 0; i < W_MAX; ++i)
+    cerr << (i ? "," : "") << workload_names[i];
+  cerr << "\n"
+       << "  --sequencers N        threads, each with its own sequencer (default 4)\n"
+       << "  --objects N           objects per sequencer (default 32)\n"
+       << "  --object-size N       (default 4194304)\n"
+       << "  --block-size N        of each read and write (default 4096)\n"
+       << "  --seconds N           run time of each workload (default 10)\n"
+       << "  --ops N               ops per sequencer instead of a run time\n"
+       << "  --omap-keys N         keys per object (default 1024)\n"
+       << "  --omap-keys-per-op N  (default 8)\n"
+       << "  --omap-value-size N   (default 100)\n"
+       << "  --xattrs N            per object, besides \"_\" (default 4)\n"
+       << "  --xattr-size N        (default 256)\n"
+       << "  --clones N            kept per sequencer by clone (default 16)\n"
+       << "  --list-batch N        objects per list call (default 64)\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+struct bench_config_t {
+  int sequencers;
+  int objects;
+  int object_size;
+  int block_size;
+  int seconds;
+  int ops;
+  int omap_keys;
+  int omap_keys_per_op;
+  int omap_value_size;
+  int xattrs;
+  int xattr_size;
+  int clones;
+  int list_batch;
+
+  bench_config_t()
+    : sequencers(4), objects(32), object_size(4 << 20), block_size(4096),
+      seconds(10), ops(0), omap_keys(1024), omap_keys_per_op(8),
+      omap_value_size(100), xattrs(4), xattr_size(256), clones(16),
+      list_batch(64) {}
+
+  void dump(Formatter *f) const {
+    f->dump_int("sequencers", sequencers);
+    f->dump_int("objects", objects);
+    f->dump_int("object_size", object_size);
+    f->dump_int("block_size", block_size);
+    f->dump_int("seconds", seconds);
+    f->dump_int("ops", ops);
+    f->dump_int("omap_keys", omap_keys);
+    f->dump_int("omap_keys_per_op", omap_keys_per_op);
+    f->dump_int("omap_value_size", omap_value_size);
+    f->dump_int("xattrs", xattrs);
+    f->dump_int("xattr_size", xattr_size);
+    f->dump_int("clones", clones);
+    f->dump_int("list_batch", list_batch);
+  }
+};
+
+static bufferlist make_data(int len, char c)
+{
+  bufferptr bp = buffer::create_page_aligned(len);
+  memset(bp.c_str(), c, len);
+  bufferlist bl;
+  bl.append(bp);
+  return bl;
+}
+
+static string get_key(int i)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key_%08d", i);
+  return buf;
+}
+
+static string get_xattr_name(int i)
+{
+  // "_" is the object info, read on every osd op
+  if (i == 0)
+    return "_";
+  ostringstream ss;
+  ss << "attr_" << i;
+  return ss.str();
+}
+
+class Worker : public Thread {
+  ObjectStore *store;
+  const bench_config_t &conf;
+  coll_t cid;
+  ObjectStore::Sequencer osr;
+  unsigned seed;
+  bufferlist block, value, xattr;
+
+  workload_t workload;
+  utime_t end;
+  uint64_t pos;                 ///< next block, for the sequential ones
+  snapid_t next_snap;
+  std::deque<ghobject_t> clones;
+  ghobject_t list_pos;
+
+  ghobject_t get_oid(int i) const {
+    ostringstream ss;
+    ss << "obj_" << i;
+    return ghobject_t(hobject_t(sobject_t(ss.str(), CEPH_NOSNAP)));
+  }
+  int rand_int(int n) {
+    return rand_r(&seed) % n;
+  }
+  int blocks_per_object() const {
+    return std::max(conf.object_size / conf.block_size, 1);
+  }
+  uint64_t next_block(bool seq) {
+    uint64_t total = (uint64_t)conf.objects * blocks_per_object();
+    if (seq)
+      return pos++ % total;
+    return ((uint64_t)rand_r(&seed) * RAND_MAX + rand_r(&seed)) % total;
+  }
+
+  int submit(ObjectStore::Transaction *t) {
+    C_SaferCond applied, committed;
+    int r = store->queue_transaction(&osr, t, &applied, &committed);
+    if (r < 0)
+      return r;
+    applied.wait();
+    return committed.wait();
+  }
+
+  /// run one op of the current workload, returning bytes moved or -errno
+  int do_op();
+
+public:
+  vector<double> lats;          ///< usec
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t errors;
+
+  Worker(ObjectStore *store, const bench_config_t &conf, int id)
+    : store(store), conf(conf), osr("objectstore_bench"), seed(id + 1),
+      workload(W_MAX), pos(0), next_snap(1), ops(0), bytes(0), errors(0) {
+    ostringstream ss;
+    ss << "objectstore_bench_" << id;
+    cid = coll_t(ss.str());
+    block = make_data(conf.block_size, 'b');
+    value = make_data(conf.omap_value_size, 'v');
+    xattr = make_data(conf.xattr_size, 'x');
+  }
+
+  int populate();
+  void start(workload_t w, utime_t until) {
+    workload = w;
+    end = until;
+    pos = 0;
+    lats.clear();
+    ops = bytes = errors = 0;
+    create();
+  }
+
+  void *entry() {
+    while (true) {
+      if (conf.ops) {
+	if (ops >= (uint64_t)conf.ops)
+	  break;
+      } else if (ceph_clock_now(g_ceph_context) > end) {
+	break;
+      }
+      utime_t start = ceph_clock_now(g_ceph_context);
+      int r = do_op();
+      utime_t lat = ceph_clock_now(g_ceph_context) - start;
+      lats.push_back((double)lat * 1000000.0);
+      ++ops;
+      if (r < 0)
+	++errors;
+      else
+	bytes += r;
+    }
+    return NULL;
+  }
+};
+
+int Worker::populate()
+{
+  ObjectStore::Transaction t;
+  t.create_collection(cid);
+  int r = submit(&t);
+  if (r < 0)
+    return r;
+
+  bufferlist data = make_data(conf.object_size, 'p');
+  for (int i = 0; i < conf.objects; ++i) {
+    ObjectStore::Transaction t;
+    ghobject_t oid = get_oid(i);
+    t.write(cid, oid, 0, data.length(), data);
+    map<string, bufferlist> attrs;
+    for (int j = 0; j <= conf.xattrs; ++j)
+      attrs[get_xattr_name(j)] = xattr;
+    t.setattrs(cid, oid, attrs);
+    map<string, bufferlist> keys;
+    for (int j = 0; j < conf.omap_keys; ++j)
+      keys[get_key(j)] = value;
+    t.omap_setkeys(cid, oid, keys);
+    r = submit(&t);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int Worker::do_op()
+{
+  int bpo = blocks_per_object();
+  switch (workload) {
+  case W_SEQ_WRITE:
+  case W_RAND_WRITE:
+    {
+      uint64_t b = next_block(workload == W_SEQ_WRITE);
+      ObjectStore::Transaction t;
+      t.write(cid, get_oid(b / bpo), (b % bpo) * conf.block_size,
+	      block.length(), block);
+      int r = submit(&t);
+      return r < 0 ? r : block.length();
+    }
+
+  case W_SEQ_READ:
+  case W_RAND_READ:
+    {
+      uint64_t b = next_block(workload == W_SEQ_READ);
+      bufferlist bl;
+      return store->read(cid, get_oid(b / bpo), (b % bpo) * conf.block_size,
+			 conf.block_size, bl);
+    }
+
+  case W_OMAP_WRITE:
+    {
+      map<string, bufferlist> keys;
+      for (int i = 0; i < conf.omap_keys_per_op; ++i)
+	keys[get_key(rand_int(conf.omap_keys))] = value;
+      ObjectStore::Transaction t;
+      t.omap_setkeys(cid, get_oid(rand_int(conf.objects)), keys);
+      int r = submit(&t);
+      return r < 0 ? r : keys.size() * value.length();
+    }
+
+  case W_OMAP_READ:
+    {
+      set<string> keys;
+      for (int i = 0; i < conf.omap_keys_per_op; ++i)
+	keys.insert(get_key(rand_int(conf.omap_keys)));
+      map<string, bufferlist> out;
+      int r = store->omap_get_values(cid, get_oid(rand_int(conf.objects)),
+				     keys, &out);
+      if (r < 0)
+	return r;
+      int len = 0;
+      for (map<string, bufferlist>::iterator p = out.begin();
+	   p != out.end();
+	   ++p)
+	len += p->second.length();
+      return len;
+    }
+
+  case W_XATTR_WRITE:
+    {
+      ObjectStore::Transaction t;
+      t.setattr(cid, get_oid(rand_int(conf.objects)),
+		get_xattr_name(rand_int(conf.xattrs + 1)), xattr);
+      int r = submit(&t);
+      return r < 0 ? r : xattr.length();
+    }
+
+  case W_XATTR_READ:
+    {
+      bufferptr bp;
+      return store->getattr(cid, get_oid(rand_int(conf.objects)),
+			    get_xattr_name(rand_int(conf.xattrs + 1)).c_str(),
+			    bp);
+    }
+
+  case W_CLONE:
+    {
+      // like a write to a snapped object: clone the head, then write it
+      uint64_t b = next_block(false);
+      ghobject_t head = get_oid(b / bpo);
+      ghobject_t clone = head;
+      clone.hobj.snap = next_snap;
+      ++next_snap;
+      ObjectStore::Transaction t;
+      t.clone(cid, head, clone);
+      t.write(cid, head, (b % bpo) * conf.block_size, block.length(), block);
+      clones.push_back(clone);
+      if (clones.size() > (size_t)conf.clones) {
+	t.remove(cid, clones.front());
+	clones.pop_front();
+      }
+      int r = submit(&t);
+      return r < 0 ? r : block.length();
+    }
+
+  case W_LIST:
+    {
+      vector<ghobject_t> ls;
+      ghobject_t next;
+      int r = store->collection_list_partial(cid, list_pos, conf.list_batch,
+					     conf.list_batch, 0, &ls, &next);
+      if (r < 0)
+	return r;
+      list_pos = next.is_max() ? ghobject_t() : next;
+      return 0;
+    }
+
+  default:
+    assert(0 == "bad workload");
+  }
+  return 0;
+}
+
+static double percentile(const vector<double> &v, double p)
+{
+  if (v.empty())
+    return 0;
+  return v[(size_t)(p * (v.size() - 1) + 0.5)];
+}
+
+static void run(ObjectStore *store, const bench_config_t &conf, workload_t w,
+		vector<Worker*> &workers, Formatter *f)
+{
+  uint64_t wb_start = 0, wb_end = 0;
+  store->sync_and_flush();
+  int wb_r = get_write_bytes(&wb_start);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t end = start;
+  end += (double)conf.seconds;
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+    (*p)->start(w, end);
+
+  vector<double> lats;
+  uint64_t ops = 0, bytes = 0, errors = 0;
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p) {
+    (*p)->join();
+    lats.insert(lats.end(), (*p)->lats.begin(), (*p)->lats.end());
+    ops += (*p)->ops;
+    bytes += (*p)->bytes;
+    errors += (*p)->errors;
+  }
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  if (wb_r == 0 && is_write(w)) {
+    store->sync_and_flush();
+    wb_r = get_write_bytes(&wb_end);
+  }
+  std::sort(lats.begin(), lats.end());
+  double sum = 0;
+  for (vector<double>::iterator p = lats.begin(); p != lats.end(); ++p)
+    sum += *p;
+
+  f->open_object_section("workload");
+  f->dump_string("name", workload_names[w]);
+  f->dump_unsigned("ops", ops);
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("errors", errors);
+  f->dump_float("seconds", elapsed);
+  f->dump_float("ops_per_sec", elapsed > 0 ? ops / elapsed : 0);
+  f->dump_float("bytes_per_sec", elapsed > 0 ? bytes / elapsed : 0);
+  if (wb_r == 0 && is_write(w)) {
+    f->dump_unsigned("device_write_bytes", wb_end - wb_start);
+    f->dump_float("write_amplification",
+		  bytes ? (double)(wb_end - wb_start) / bytes : 0);
+  }
+  f->open_object_section("latency_us");
+  f->dump_float("avg", lats.empty() ? 0 : sum / lats.size());
+  f->dump_float("min", lats.empty() ? 0 : lats.front());
+  f->dump_float("p50", percentile(lats, .5));
+  f->dump_float("p90", percentile(lats, .9));
+  f->dump_float("p99", percentile(lats, .99));
+  f->dump_float("p999", percentile(lats, .999));
+  f->dump_float("max", lats.empty() ? 0 : lats.back());
+  f->close_section();
+  f->close_section();
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  bench_config_t conf;
+  string workload_list;
+  std::ostringstream err;
+  vector<const char*> positional;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &workload_list,
+				     "--workloads", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.sequencers, &err,
+				     "--sequencers", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.objects, &err,
+				     "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.object_size, &err,
+				     "--object-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.block_size, &err,
+				     "--block-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.seconds, &err,
+				     "--seconds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.ops, &err,
+				     "--ops", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.omap_keys, &err,
+				     "--omap-keys", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.omap_keys_per_op, &err,
+				     "--omap-keys-per-op", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.omap_value_size, &err,
+				     "--omap-value-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.xattrs, &err,
+				     "--xattrs", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.xattr_size, &err,
+				     "--xattr-size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.clones, &err,
+				     "--clones", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.list_batch, &err,
+				     "--list-batch", (char*)NULL)) {
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      positional.push_back(*i);
+      ++i;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (positional.size() != 3 || conf.sequencers < 1 || conf.objects < 1 ||
+      conf.object_size < 1 || conf.block_size < 1 || conf.omap_keys < 1 ||
+      conf.xattrs < 0 || conf.list_batch < 1 || conf.clones < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  vector<workload_t> workloads;
+  if (workload_list.empty()) {
+    for (int i = 0; i < W_MAX; ++i)
+      workloads.push_back((workload_t)i);
+  } else {
+    list<string> names;
+    get_str_list(workload_list, names);
+    for (list<string>::iterator p = names.begin(); p != names.end(); ++p) {
+      int w = get_workload(*p);
+      if (w < 0) {
+	cerr << "unknown workload '" << *p << "'" << std::endl;
+	usage(argv[0]);
+	return 1;
+      }
+      workloads.push_back((workload_t)w);
+    }
+  }
+
+  ObjectStore *store = ObjectStore::create(g_ceph_context, positional[0],
+					   positional[1], positional[2]);
+  if (!store) {
+    cerr << "unknown store type '" << positional[0] << "'" << std::endl;
+    return 1;
+  }
+  int r = store->mkfs();
+  if (r < 0) {
+    cerr << "mkfs failed: " << cpp_strerror(r) << std::endl;
+    delete store;
+    return 1;
+  }
+  r = store->mount();
+  if (r < 0) {
+    cerr << "mount failed: " << cpp_strerror(r) << std::endl;
+    delete store;
+    return 1;
+  }
+
+  vector<Worker*> workers;
+  for (int i = 0; i < conf.sequencers; ++i) {
+    workers.push_back(new Worker(store, conf, i));
+    r = workers.back()->populate();
+    if (r < 0) {
+      cerr << "populate failed: " << cpp_strerror(r) << std::endl;
+      break;
+    }
+  }
+
+  if (r >= 0) {
+    JSONFormatter f(true);
+    f.open_object_section("objectstore_bench");
+    f.dump_string("type", positional[0]);
+    f.open_object_section("config");
+    conf.dump(&f);
+    f.close_section();
+    f.open_array_section("workloads");
+    for (vector<workload_t>::iterator p = workloads.begin();
+	 p != workloads.end();
+	 ++p)
+      run(store, conf, *p, workers, &f);
+    f.close_section();
+    f.close_section();
+    f.flush(cout);
+    cout << std::endl;
+  }
+
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+    delete *p;
+  store->umount();
+  delete store;
+  return r < 0 ? 1 : 0;
+}
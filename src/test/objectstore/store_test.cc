@@ -1342,6 +1342,172 @@ TEST_P(StoreTest, XattrTest) {
   ASSERT_TRUE(bl2 == attrs["attr3"]);
 }
 
+TEST_P(StoreTest, HotXattrTest) {
+  coll_t cid("hot_xattr");
+  ghobject_t hoid(hobject_t("hotxattr", "", CEPH_NOSNAP, 0, 0, ""));
+  ghobject_t clone(hobject_t("hotxattr", "", 1, 0, 0, ""));
+  bufferlist oi, ss, other;
+  oi.append("object info");
+  ss.append("snapset");
+  other.append("other");
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    t.setattr(cid, hoid, "_", oi);
+    t.setattr(cid, hoid, "other", other);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // written before they were packed, then packed on the next update
+  g_ceph_context->_conf->set_val("filestore_pack_hot_xattrs", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  oi.append(" v2");
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "_", oi);
+    t.setattr(cid, hoid, "snapset", ss);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+
+  bufferptr bp;
+  r = store->getattr(cid, hoid, "_", bp);
+  ASSERT_GE(r, 0);
+  bufferlist bl;
+  bl.push_back(bp);
+  ASSERT_TRUE(bl == oi);
+
+  map<string, bufferptr> aset;
+  r = store->getattrs(cid, hoid, aset);
+  ASSERT_EQ(0, r);
+  ASSERT_EQ(3u, aset.size());
+  bl.clear();
+  bl.push_back(aset["snapset"]);
+  ASSERT_TRUE(bl == ss);
+
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, clone);
+    t.rmattr(cid, hoid, "snapset");
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  r = store->getattr(cid, hoid, "snapset", bp);
+  ASSERT_EQ(-ENODATA, r);
+  r = store->getattr(cid, clone, "snapset", bp);
+  ASSERT_GE(r, 0);
+  ASSERT_EQ(ss.length(), bp.length());
+
+  // still readable once packing is turned off again
+  g_ceph_context->_conf->set_val("filestore_pack_hot_xattrs", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+  oi.append(" v3");
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, clone, "_", oi);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  r = store->getattr(cid, clone, "_", bp);
+  ASSERT_GE(r, 0);
+  bl.clear();
+  bl.push_back(bp);
+  ASSERT_TRUE(bl == oi);
+
+  {
+    ObjectStore::Transaction t;
+    t.rmattrs(cid, clone);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  aset.clear();
+  r = store->getattrs(cid, clone, aset);
+  ASSERT_EQ(0, r);
+  ASSERT_TRUE(aset.empty());
+  r = store->getattr(cid, clone, "_", bp);
+  ASSERT_EQ(-ENODATA, r);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, clone);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, HotXattrLinkTest) {
+  // FileStore caches packed hot xattrs per FD, and a second link to the
+  // inode gets an FD of its own
+  if (GetParam() != string("filestore"))
+    return;
+  FileStore *fs = static_cast<FileStore*>(store.get());
+  coll_t cid("hot_xattr_link");
+  ghobject_t hoid(hobject_t("hotxattrlink", "", CEPH_NOSNAP, 0, 0, ""));
+  ghobject_t hoid2(hobject_t("hotxattrlink2", "", CEPH_NOSNAP, 0, 0, ""));
+  bufferlist oi;
+  oi.append("object info");
+  g_ceph_context->_conf->set_val("filestore_pack_hot_xattrs", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    t.setattr(cid, hoid, "_", oi);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  // loads the copy in hoid's FD
+  bufferptr bp;
+  r = store->getattr(cid, hoid, "_", bp);
+  ASSERT_EQ((int)oi.length(), r);
+
+  r = fs->lfn_link(cid, cid, hoid, hoid2);
+  ASSERT_EQ(0, r);
+
+  // updates through either link are seen through the other
+  oi.append(" v2");
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid2, "_", oi);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  r = store->getattr(cid, hoid, "_", bp);
+  ASSERT_EQ((int)oi.length(), r);
+  bufferlist bl;
+  bl.push_back(bp);
+  ASSERT_TRUE(bl == oi);
+  oi.append(" v3");
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "_", oi);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  r = store->getattr(cid, hoid2, "_", bp);
+  ASSERT_EQ((int)oi.length(), r);
+  bl.clear();
+  bl.push_back(bp);
+  ASSERT_TRUE(bl == oi);
+
+  g_ceph_context->_conf->set_val("filestore_pack_hot_xattrs", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 void colsplittest(
   ObjectStore *store,
   unsigned num_objects,
@@ -1617,6 +1783,149 @@ TEST_P(StoreTest, BigRGWObjectName) {
   }
 }
 
+TEST_P(StoreTest, SparseReadCloneRange) {
+  int r;
+  coll_t cid = coll_t("coll");
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  const unsigned len = 1 << 20;
+  bufferlist a, b, junk;
+  a.append(string(4096, 'a'));
+  b.append(string(4096, 'b'));
+  junk.append(string(len, 'x'));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.write(cid, hoid, 0, a.length(), a);
+    t.write(cid, hoid, len - b.length(), b.length(), b);
+    t.write(cid, hoid2, 0, junk.length(), junk);
+    cerr << "Creating sparse object" << std::endl;
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist expected;
+  expected.append(a);
+  expected.append_zero(len - a.length() - b.length());
+  expected.append(b);
+  {
+    bufferlist bl;
+    r = store->read(cid, hoid, 0, len, bl);
+    ASSERT_EQ((int)len, r);
+    ASSERT_TRUE(bl.contents_equal(expected));
+
+    // past eof, and a read ending in the hole
+    bl.clear();
+    r = store->read(cid, hoid, len - 10, 100, bl);
+    ASSERT_EQ(10, r);
+    bl.clear();
+    r = store->read(cid, hoid, 100, len / 2, bl);
+    ASSERT_EQ((int)len / 2, r);
+    bufferlist sub;
+    sub.substr_of(expected, 100, len / 2);
+    ASSERT_TRUE(bl.contents_equal(sub));
+  }
+  {
+    bufferlist bl;
+    r = store->fiemap(cid, hoid, 0, len, bl);
+    ASSERT_EQ(0, r);
+    map<uint64_t, uint64_t> m;
+    bufferlist::iterator p = bl.begin();
+    ::decode(m, p);
+    ASSERT_FALSE(m.empty());
+    ASSERT_EQ(0u, m.begin()->first);
+    ASSERT_GE(m.rbegin()->first + m.rbegin()->second, (uint64_t)len);
+  }
+  {
+    // the holes must overwrite what was there
+    ObjectStore::Transaction t;
+    t.clone_range(cid, hoid, hoid2, 0, len, 0);
+    cerr << "Clone range over existing data" << std::endl;
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    bufferlist bl;
+    r = store->read(cid, hoid2, 0, len, bl);
+    ASSERT_EQ((int)len, r);
+    ASSERT_TRUE(bl.contents_equal(expected));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, SmallAppendOverwrite) {
+  int r;
+  coll_t cid = coll_t("coll");
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  // a model of the object; every step is read back in full
+  string expected;
+  for (int i = 0; i < 60; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    string data(100 + i, 'a' + i % 26);
+    bl.append(data);
+    if (i % 10 == 9) {
+      // overwrite across a strip boundary
+      uint64_t off = expected.length() / 2;
+      t.write(cid, hoid, off, bl.length(), bl);
+      expected.replace(off, data.length(), data);
+    } else if (i % 10 == 5) {
+      // cut into the middle of a strip, then extend with zeros
+      uint64_t size = expected.length() - 77;
+      t.truncate(cid, hoid, size);
+      t.truncate(cid, hoid, size + 33);
+      expected.resize(size);
+      expected.append(33, '\0');
+    } else {
+      t.write(cid, hoid, expected.length(), bl.length(), bl);
+      expected.append(data);
+    }
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+
+    bufferlist in;
+    r = store->read(cid, hoid, 0, expected.length() + 100, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_EQ(expected, string(in.c_str(), in.length()));
+  }
+  {
+    // a write past the end leaves a hole
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append("tail");
+    uint64_t off = expected.length() + 5000;
+    t.write(cid, hoid, off, bl.length(), bl);
+    expected.append(5000, '\0');
+    expected.append("tail");
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+    bufferlist in;
+    r = store->read(cid, hoid, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_EQ(expected, string(in.c_str(), in.length()));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, SetAllocHint) {
   coll_t cid("alloc_hint");
   ghobject_t hoid(hobject_t("test_hint", "", CEPH_NOSNAP, 0, 0, ""));
@@ -1654,10 +1963,142 @@ TEST_P(StoreTest, SetAllocHint) {
   }
 }
 
+static ghobject_t group_commit_obj(unsigned osr, unsigned n)
+{
+  ostringstream name;
+  name << "group_commit_" << osr << "_" << n;
+  return ghobject_t(hobject_t(sobject_t(name.str(), CEPH_NOSNAP)));
+}
+
+TEST_P(StoreTest, GroupCommit) {
+  // several sequencers with ops in flight at once, so that their commits
+  // can be batched; each op clones what the previous op of its sequencer
+  // wrote, so it has to see that, and all of it has to survive a remount
+  const unsigned num_osrs = 4, num_ops = 20;
+  coll_t cid("group_commit");
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  vector<ObjectStore::Sequencer*> osrs;
+  for (unsigned i = 0; i < num_osrs; ++i) {
+    ostringstream name;
+    name << "group_commit_" << i;
+    osrs.push_back(new ObjectStore::Sequencer(name.str()));
+  }
+  C_SaferCond committed;
+  {
+    C_GatherBuilder gather(g_ceph_context, &committed);
+    for (unsigned n = 0; n < num_ops; ++n) {
+      for (unsigned i = 0; i < num_osrs; ++i) {
+	ObjectStore::Transaction *t = new ObjectStore::Transaction;
+	if (n == 0) {
+	  bufferlist bl;
+	  bl.append(string(100 + i, 'a' + i));
+	  t->write(cid, group_commit_obj(i, n), 0, bl.length(), bl);
+	} else {
+	  t->clone(cid, group_commit_obj(i, n - 1), group_commit_obj(i, n));
+	}
+	r = store->queue_transaction(osrs[i], t,
+				     new ObjectStore::C_DeleteTransaction(t),
+				     gather.new_sub());
+	EXPECT_EQ(r, 0);
+      }
+    }
+    gather.activate();
+  }
+  ASSERT_EQ(0, committed.wait());
+  for (unsigned i = 0; i < num_osrs; ++i) {
+    osrs[i]->flush();
+    delete osrs[i];
+  }
+
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  for (unsigned i = 0; i < num_osrs; ++i) {
+    for (unsigned n = 0; n < num_ops; ++n) {
+      bufferlist in;
+      r = store->read(cid, group_commit_obj(i, n), 0, 0, in);
+      ASSERT_EQ((int)(100 + i), r);
+      ASSERT_EQ(string(100 + i, 'a' + i), string(in.c_str(), in.length()));
+    }
+  }
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_osrs; ++i)
+      for (unsigned n = 0; n < num_ops; ++n)
+	t.remove(cid, group_commit_obj(i, n));
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, OMapCloneRmKeys) {
+  // rm_keys on either side of a clone in the transaction that cloned
+  coll_t cid("omap_clone_rmkeys");
+  ghobject_t hoid(hobject_t("omapclone", "", CEPH_NOSNAP, 0, 0, ""));
+  ghobject_t hoid2(hobject_t("omapclone", "", 1, 0, 0, ""));
+  map<string, bufferlist> keys;
+  keys["a"].append("1");
+  keys["b"].append("2");
+  keys["c"].append("3");
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    t.touch(cid, hoid);
+    t.omap_setkeys(cid, hoid, keys);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    ObjectStore::Transaction t;
+    set<string> rm;
+    t.clone(cid, hoid, hoid2);
+    rm.insert("a");
+    t.omap_rmkeys(cid, hoid2, rm);
+    rm.clear();
+    rm.insert("b");
+    t.omap_rmkeys(cid, hoid, rm);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    bufferlist header;
+    map<string, bufferlist> got;
+    r = store->omap_get(cid, hoid, &header, &got);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(2u, got.size());
+    ASSERT_EQ(1u, got.count("a"));
+    ASSERT_EQ(1u, got.count("c"));
+    got.clear();
+    r = store->omap_get(cid, hoid2, &header, &got);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(2u, got.size());
+    ASSERT_EQ(1u, got.count("b"));
+    ASSERT_EQ(1u, got.count("c"));
+
+    store->umount();
+    ASSERT_EQ(0, store->mount());
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 INSTANTIATE_TEST_CASE_P(
   ObjectStore,
   StoreTest,
-  ::testing::Values("memstore", "filestore", "keyvaluestore-dev"));
+  ::testing::Values("memstore", "filestore", "keyvaluestore-dev", "blockstore-dev"));
 
 #else
 
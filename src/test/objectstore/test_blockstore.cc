@@ -0,0 +1,584 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include "os/BlockStore.h"
+#include "os/GenericObjectMap.h"
+#include "test/ObjectMap/KeyValueDBMemory.h"
+#include "common/ceph_argparse.h"
+#include "include/stringify.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include <boost/scoped_ptr.hpp>
+#include <gtest/gtest.h>
+
+/**
+ * KeyValueDBMemory, safe to read from while the kv sync thread
+ * commits: iterators work on a copy.
+ */
+class LockedKeyValueDBMemory : public KeyValueDBMemory {
+  Mutex lock;
+public:
+  LockedKeyValueDBMemory() : lock("LockedKeyValueDBMemory::lock") {}
+
+  int get(const string &prefix, const std::set<string> &keys,
+	  std::map<string, bufferlist> *out) {
+    Mutex::Locker l(lock);
+    return KeyValueDBMemory::get(prefix, keys, out);
+  }
+  int submit_transaction(Transaction t) {
+    Mutex::Locker l(lock);
+    return KeyValueDBMemory::submit_transaction(t);
+  }
+  int submit_transaction_sync(Transaction t) {
+    return submit_transaction(t);
+  }
+
+  /// the keys under prefix; only while the store is not mounted
+  unsigned count(const string &prefix) {
+    unsigned n = 0;
+    std::map<std::pair<string,string>,bufferlist>::iterator p =
+      db.lower_bound(std::make_pair(prefix, string()));
+    for (; p != db.end() && p->first.first == prefix; ++p)
+      ++n;
+    return n;
+  }
+
+protected:
+  WholeSpaceIterator _get_iterator() {
+    Mutex::Locker l(lock);
+    return KeyValueDBMemory::_get_snapshot_iterator();
+  }
+};
+
+static string u64_key(uint64_t v)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+  return string(buf);
+}
+
+static bufferlist make_data(unsigned len, char c)
+{
+  bufferlist bl;
+  bl.append(string(len, c));
+  return bl;
+}
+
+class BlockStoreTest : public ::testing::Test {
+public:
+  LockedKeyValueDBMemory kvdb;
+  boost::scoped_ptr<BlockStore> store;
+  ObjectStore::Sequencer osr;
+  coll_t cid;
+  uint64_t initial_free;
+
+  BlockStoreTest() : osr("test"), cid("blockstore_test"), initial_free(0) {}
+
+  virtual void SetUp() {
+    int r = ::mkdir("blockstore_test_temp_dir", 0777);
+    ASSERT_TRUE(r == 0 || errno == EEXIST);
+    store.reset(new BlockStore(g_ceph_context, "blockstore_test_temp_dir"));
+    store->set_kvdb(&kvdb);
+    ASSERT_EQ(0, store->mkfs());
+    ASSERT_EQ(0, store->mount());
+    initial_free = free_bytes();
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+  }
+
+  virtual void TearDown() {
+    store->umount();
+  }
+
+  uint64_t free_bytes() {
+    struct statfs st;
+    store->statfs(&st);
+    return st.f_bfree * st.f_bsize;
+  }
+
+  string read(const ghobject_t& oid, uint64_t off, uint64_t len) {
+    bufferlist bl;
+    store->read(cid, oid, off, len, bl);
+    return string(bl.c_str(), bl.length());
+  }
+
+  void queue(ObjectStore::Transaction *t) {
+    store->queue_transaction_and_cleanup(&osr, t);
+  }
+
+  void write(const ghobject_t& oid, uint64_t off, const bufferlist& bl) {
+    ObjectStore::Transaction t;
+    t.write(cid, oid, off, bl.length(), bl);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+  }
+
+  void remove(const ghobject_t& oid) {
+    ObjectStore::Transaction t;
+    t.remove(cid, oid);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+  }
+
+  // these look at the kv records; only while the store is not mounted
+  bs_onode_t get_onode(const ghobject_t& oid) {
+    bs_onode_t o;
+    bufferlist bl = kvdb.db[std::make_pair(string("O"),
+					   GenericObjectMap::header_key(cid, oid))];
+    bufferlist::iterator p = bl.begin();
+    ::decode(o, p);
+    return o;
+  }
+  bool have_ref(uint64_t ref) {
+    return kvdb.db.count(std::make_pair(string("R"), u64_key(ref)));
+  }
+  uint32_t get_refs(uint64_t ref) {
+    bs_ref_t r;
+    bufferlist bl = kvdb.db[std::make_pair(string("R"), u64_key(ref))];
+    bufferlist::iterator p = bl.begin();
+    ::decode(r, p);
+    return r.refs;
+  }
+};
+
+TEST_F(BlockStoreTest, WALReplay)
+{
+  ghobject_t oid(hobject_t(sobject_t("wal", CEPH_NOSNAP)));
+  write(oid, 0, make_data(65536, 'a'));
+  // small overwrite of an unshared extent: logged, applied after commit
+  write(oid, 4096, make_data(4096, 'b'));
+  ASSERT_EQ(string(4096, 'a') + string(4096, 'b') + string(4096, 'a'),
+	    read(oid, 0, 12288));
+
+  ASSERT_EQ(0, store->umount());
+  // applied records are trimmed by the final sync
+  ASSERT_EQ(0u, kvdb.count("L"));
+  // a committed record that never made it to the device
+  bs_onode_t o = get_onode(oid);
+  ASSERT_EQ(1u, o.block_map.size());
+  bs_wal_op_t op;
+  op.offset = o.block_map[0].offset + 8192;
+  op.data = make_data(4096, 'c');
+  list<bs_wal_op_t> ops;
+  ops.push_back(op);
+  bufferlist bl;
+  ::encode(ops, bl);
+  kvdb.set("L", u64_key(1), bl);
+
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(string(4096, 'a') + string(4096, 'b') + string(4096, 'c') +
+	    string(4096, 'a'),
+	    read(oid, 0, 16384));
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0u, kvdb.count("L"));
+  ASSERT_EQ(0, store->mount());
+}
+
+TEST_F(BlockStoreTest, DeferredRelease)
+{
+  ghobject_t a(hobject_t(sobject_t("a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("b", CEPH_NOSNAP)));
+  write(a, 0, make_data(1 << 20, 'a'));
+  write(b, 0, make_data(1 << 20, 'b'));
+  ASSERT_EQ(initial_free - (2 << 20), free_bytes());
+
+  // released after the removal commits, and the record goes with the
+  // next commit
+  remove(a);
+  ASSERT_EQ(initial_free - (1 << 20), free_bytes());
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0u, kvdb.count("D"));
+
+  // as if we crashed after committing the removal of b, before its
+  // space went back to the free list
+  bs_onode_t o = get_onode(b);
+  interval_set<uint64_t> released;
+  for (map<uint64_t,bs_extent_t>::iterator p = o.block_map.begin();
+       p != o.block_map.end();
+       ++p) {
+    released.insert(p->second.offset, p->second.length);
+    kvdb.rmkey("R", u64_key(p->second.ref));
+  }
+  kvdb.rmkey("O", GenericObjectMap::header_key(cid, b));
+  bufferlist bl;
+  ::encode(released, bl);
+  kvdb.set("D", u64_key(1), bl);
+
+  ASSERT_EQ(0, store->mount());
+  ASSERT_FALSE(store->exists(cid, b));
+  ASSERT_EQ(initial_free, free_bytes());
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0u, kvdb.count("D"));
+  ASSERT_EQ(0u, kvdb.count("R"));
+  // it all merged back into the one extent mkfs made
+  ASSERT_EQ(1u, kvdb.count("B"));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(initial_free, free_bytes());
+}
+
+TEST_F(BlockStoreTest, CloneRefs)
+{
+  ghobject_t a(hobject_t(sobject_t("a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("b", CEPH_NOSNAP)));
+  ghobject_t c(hobject_t(sobject_t("c", CEPH_NOSNAP)));
+  write(a, 0, make_data(262144, 'a'));
+  uint64_t used = initial_free - free_bytes();
+  ASSERT_EQ(262144u, used);
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, a, b);
+    t.clone(cid, a, c);
+    ASSERT_EQ(0u, store->apply_transaction(t));
+  }
+  // clones share the extent
+  ASSERT_EQ(initial_free - used, free_bytes());
+
+  ASSERT_EQ(0, store->umount());
+  bs_onode_t o = get_onode(a);
+  ASSERT_EQ(1u, o.block_map.size());
+  uint64_t ref = o.block_map[0].ref;
+  ASSERT_EQ(3u, get_refs(ref));
+  ASSERT_EQ(0, store->mount());
+
+  // b is rewritten entirely: it lets go of the shared extent
+  write(b, 0, make_data(262144, 'b'));
+  // c keeps the head and tail around a cow write: two pieces, two refs
+  write(c, 65536, make_data(4096, 'c'));
+  ASSERT_EQ(string(262144, 'a'), read(a, 0, 262144));
+  ASSERT_EQ(string(262144, 'b'), read(b, 0, 262144));
+  ASSERT_EQ(string(65536, 'a') + string(4096, 'c') + string(192512, 'a'),
+	    read(c, 0, 262144));
+
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(3u, get_refs(ref));
+  ASSERT_EQ(3u, get_onode(c).block_map.size());
+  ASSERT_EQ(0, store->mount());
+
+  remove(a);
+  remove(c);
+  // only now is the shared extent gone
+  ASSERT_EQ(0, store->umount());
+  ASSERT_FALSE(have_ref(ref));
+  ASSERT_EQ(1u, kvdb.count("R"));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(string(262144, 'b'), read(b, 0, 262144));
+  remove(b);
+  ASSERT_EQ(initial_free, free_bytes());
+
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0u, kvdb.count("R"));
+  ASSERT_EQ(0u, kvdb.count("D"));
+  ASSERT_EQ(1u, kvdb.count("B"));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(initial_free, free_bytes());
+}
+
+TEST_F(BlockStoreTest, PipelinedTransactions)
+{
+  // each transaction depends on the ones queued before it, none of
+  // which we wait for
+  coll_t c2("pipelined");
+  ghobject_t a(hobject_t(sobject_t("a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("b", CEPH_NOSNAP)));
+  ghobject_t c(hobject_t(sobject_t("c", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->create_collection(c2);
+    t->write(c2, a, 0, 8192, make_data(8192, 'a'));
+    queue(t);
+  }
+  {
+    // into an extent whose data may not be written yet
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->write(c2, a, 4096, 100, make_data(100, 'b'));
+    map<string,bufferlist> keys;
+    keys["k1"] = make_data(10, '1');
+    keys["k2"] = make_data(10, '2');
+    t->omap_setkeys(c2, a, keys);
+    queue(t);
+  }
+  {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->clone(c2, a, b);
+    set<string> keys;
+    keys.insert("k1");
+    t->omap_rmkeys(c2, a, keys);
+    bufferlist bl = make_data(3, 'x');
+    t->collection_setattr(c2, "attr", bl);
+    queue(t);
+  }
+  {
+    // cow of a shared extent; reads back what is still pending
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->write(c2, b, 4000, 200, make_data(200, 'c'));
+    t->clone(c2, a, c);
+    queue(t);
+  }
+  osr.flush();
+
+  bufferlist bl;
+  ASSERT_EQ(8192, store->read(c2, b, 0, 8192, bl));
+  ASSERT_EQ(string(4000, 'a') + string(200, 'c') + string(96, 'b') +
+	    string(3896, 'a'),
+	    string(bl.c_str(), bl.length()));
+  bl.clear();
+  ASSERT_EQ(8192, store->read(c2, a, 0, 8192, bl));
+  ASSERT_EQ(string(4096, 'a') + string(100, 'b') + string(3996, 'a'),
+	    string(bl.c_str(), bl.length()));
+  map<string,bufferlist> omap;
+  bufferlist header;
+  ASSERT_EQ(0, store->omap_get(c2, b, &header, &omap));
+  ASSERT_EQ(2u, omap.size());
+  omap.clear();
+  ASSERT_EQ(0, store->omap_get(c2, c, &header, &omap));
+  ASSERT_EQ(1u, omap.size());
+  ASSERT_EQ(1u, omap.count("k2"));
+  bl.clear();
+  ASSERT_EQ(3, store->collection_getattr(c2, "attr", bl));
+
+  {
+    // the collection is empty as of the removals queued before it
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->remove(c2, a);
+    t->remove(c2, b);
+    queue(t);
+    t = new ObjectStore::Transaction;
+    t->remove(c2, c);
+    queue(t);
+    t = new ObjectStore::Transaction;
+    t->remove_collection(c2);
+    queue(t);
+    t = new ObjectStore::Transaction;
+    t->create_collection(c2);
+    t->touch(c2, c);
+    queue(t);
+  }
+  osr.flush();
+  vector<ghobject_t> ls;
+  ASSERT_EQ(0, store->collection_list(c2, ls));
+  ASSERT_EQ(1u, ls.size());
+  ASSERT_EQ(c, ls[0]);
+  bl.clear();
+  ASSERT_EQ(-ENOENT, store->collection_getattr(c2, "attr", bl));
+
+  ObjectStore::Transaction t;
+  t.remove(c2, c);
+  t.remove_collection(c2);
+  ASSERT_EQ(0u, store->apply_transaction(t));
+  ASSERT_EQ(initial_free, free_bytes());
+}
+
+/**
+ * Random writes, zeros, truncates, clones, removes and omap updates on
+ * a collection of our own, queued without waiting, checked against a
+ * model of what the objects should hold.
+ */
+class StressWorker : public Thread {
+public:
+  ObjectStore *store;
+  ObjectStore::Sequencer osr;
+  coll_t cid;
+  unsigned seed;
+  unsigned ops;
+  map<ghobject_t, string> data;
+  map<ghobject_t, map<string, string> > omap;
+  unsigned errors;
+
+  StressWorker(ObjectStore *s, int n, unsigned ops)
+    : store(s), osr("stress"), cid(stringify("stress_") + stringify(n)),
+      seed(n + 1), ops(ops), errors(0) {}
+
+  ghobject_t pick() {
+    return ghobject_t(hobject_t(sobject_t(stringify(rand_r(&seed) % 8),
+					  CEPH_NOSNAP)));
+  }
+
+  void queue(ObjectStore::Transaction *t) {
+    store->queue_transaction_and_cleanup(&osr, t);
+  }
+
+  bool check(const ghobject_t& oid) {
+    bufferlist bl;
+    int r = store->read(cid, oid, 0, 0, bl);
+    if (!data.count(oid))
+      return r == -ENOENT;
+    const string& want = data[oid];
+    if (r != (int)want.length() || string(bl.c_str(), bl.length()) != want)
+      return false;
+    map<string,bufferlist> got;
+    bufferlist header;
+    store->omap_get(cid, oid, &header, &got);
+    map<string,string>& keys = omap[oid];
+    if (got.size() != keys.size())
+      return false;
+    for (map<string,string>::iterator p = keys.begin(); p != keys.end(); ++p)
+      if (!got.count(p->first) ||
+	  string(got[p->first].c_str(), got[p->first].length()) != p->second)
+	return false;
+    return true;
+  }
+
+  unsigned check_all() {
+    unsigned bad = 0;
+    for (int i = 0; i < 8; ++i) {
+      ghobject_t oid(hobject_t(sobject_t(stringify(i), CEPH_NOSNAP)));
+      if (!check(oid))
+	++bad;
+    }
+    return bad;
+  }
+
+  void *entry() {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->create_collection(cid);
+    queue(t);
+    for (unsigned i = 0; i < ops; ++i) {
+      ghobject_t oid = pick();
+      bool exists = data.count(oid);
+      string& d = data[oid];
+      t = new ObjectStore::Transaction;
+      switch (exists ? rand_r(&seed) % 7 : 0) {
+      case 0:
+      case 1:
+	{
+	  uint64_t off = rand_r(&seed) % (512 << 10);
+	  uint64_t len = rand_r(&seed) % 2 ? 1 + rand_r(&seed) % 8192 :
+	    4096 * (1 + rand_r(&seed) % 64);
+	  char c = 'a' + rand_r(&seed) % 26;
+	  t->write(cid, oid, off, len, make_data(len, c));
+	  if (d.length() < off + len)
+	    d.resize(off + len);
+	  d.replace(off, len, string(len, c));
+	}
+	break;
+      case 2:
+	{
+	  uint64_t off = rand_r(&seed) % (d.length() + 1);
+	  uint64_t len = rand_r(&seed) % (d.length() - off + 1);
+	  t->zero(cid, oid, off, len);
+	  d.replace(off, len, string(len, '\0'));
+	}
+	break;
+      case 3:
+	{
+	  uint64_t size = rand_r(&seed) % (d.length() + 65536);
+	  t->truncate(cid, oid, size);
+	  d.resize(size);
+	}
+	break;
+      case 4:
+	{
+	  ghobject_t noid = pick();
+	  if (noid != oid) {
+	    t->clone(cid, oid, noid);
+	    data[noid] = d;
+	    omap[noid] = omap[oid];
+	  }
+	}
+	break;
+      case 5:
+	t->remove(cid, oid);
+	data.erase(oid);
+	omap.erase(oid);
+	break;
+      case 6:
+	{
+	  map<string,bufferlist> keys;
+	  string k = stringify(rand_r(&seed) % 16);
+	  string v = stringify(i);
+	  keys[k] = make_data(0, 0);
+	  keys[k].append(v);
+	  t->omap_setkeys(cid, oid, keys);
+	  omap[oid][k] = v;
+	}
+	break;
+      }
+      queue(t);
+      if (rand_r(&seed) % 32 == 0) {
+	// what is readable once we catch up is what we queued
+	osr.flush();
+	if (!check(oid))
+	  ++errors;
+      }
+    }
+    osr.flush();
+    return NULL;
+  }
+
+  void cleanup() {
+    ObjectStore::Transaction t;
+    for (map<ghobject_t,string>::iterator p = data.begin();
+	 p != data.end();
+	 ++p)
+      t.remove(cid, p->first);
+    t.remove_collection(cid);
+    store->apply_transaction(&osr, t);
+    data.clear();
+    omap.clear();
+  }
+};
+
+TEST_F(BlockStoreTest, Stress)
+{
+  vector<StressWorker*> workers;
+  for (int i = 0; i < 6; ++i) {
+    workers.push_back(new StressWorker(store.get(), i, 400));
+    workers.back()->create();
+  }
+  for (vector<StressWorker*>::iterator p = workers.begin();
+       p != workers.end();
+       ++p) {
+    (*p)->join();
+    EXPECT_EQ(0u, (*p)->errors);
+    EXPECT_EQ(0u, (*p)->check_all());
+  }
+
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->mount());
+  for (vector<StressWorker*>::iterator p = workers.begin();
+       p != workers.end();
+       ++p) {
+    EXPECT_EQ(0u, (*p)->check_all());
+    (*p)->cleanup();
+  }
+  ASSERT_EQ(initial_free, free_bytes());
+
+  ASSERT_EQ(0, store->umount());
+  // no leaked refs or space, and the kv free list agrees
+  EXPECT_EQ(0u, kvdb.count("R"));
+  EXPECT_EQ(0u, kvdb.count("D"));
+  EXPECT_EQ(1u, kvdb.count("B"));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(initial_free, free_bytes());
+
+  for (vector<StressWorker*>::iterator p = workers.begin();
+       p != workers.end();
+       ++p)
+    delete *p;
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("blockstore_block_file_size", "268435456");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,156 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "os/PageSet.h"
+#include <gtest/gtest.h>
+
+static bufferlist make_data(unsigned len, char c)
+{
+  bufferlist bl;
+  bl.append(string(len, c));
+  return bl;
+}
+
+static string read_str(const PageSet& ps, uint64_t off, uint64_t len)
+{
+  bufferlist bl;
+  ps.read(off, len, bl);
+  return string(bl.c_str(), bl.length());
+}
+
+TEST(PageSet, WriteRead)
+{
+  PageSet ps(16);
+  ps.write(10, make_data(30, 'a'));
+  ASSERT_EQ(40u, ps.length());
+  // pages 0, 1 and 2
+  ASSERT_EQ(48u, ps.get_allocated());
+  ASSERT_EQ(string(10, '\0') + string(30, 'a'), read_str(ps, 0, 40));
+
+  // a hole before the next page
+  ps.write(100, make_data(4, 'b'));
+  ASSERT_EQ(104u, ps.length());
+  ASSERT_EQ(string(2, 'a') + string(60, '\0') + string(4, 'b'),
+	    read_str(ps, 38, 66));
+
+  map<uint64_t, uint64_t> m;
+  ps.get_extents(0, 200, &m);
+  ASSERT_EQ(2u, m.size());
+  ASSERT_EQ(48u, m[0]);
+  ASSERT_EQ(8u, m[96]);
+}
+
+TEST(PageSet, ReadSharesPages)
+{
+  PageSet ps(16);
+  ps.write(0, make_data(32, 'a'));
+
+  bufferlist bl;
+  ps.read(0, 32, bl);
+  ASSERT_EQ(2u, bl.buffers().size());
+
+  // the reader's copy does not change under it
+  ps.write(4, make_data(4, 'b'));
+  ASSERT_EQ(string(32, 'a'), string(bl.c_str(), bl.length()));
+  ASSERT_EQ(string(4, 'a') + string(4, 'b') + string(24, 'a'),
+	    read_str(ps, 0, 32));
+}
+
+TEST(PageSet, WholePagesAreReferenced)
+{
+  PageSet ps(16);
+  bufferptr bp(32);
+  memset(bp.c_str(), 'a', 32);
+  bufferlist src;
+  src.append(bp);
+  ps.write(16, src);
+
+  bufferlist bl;
+  ps.read(16, 16, bl);
+  ASSERT_EQ(bp.c_str(), bl.buffers().front().c_str());
+
+  // and copied before they are modified
+  ps.write(20, make_data(1, 'b'));
+  ASSERT_EQ('a', bp.c_str()[4]);
+  ASSERT_EQ("aaaab", read_str(ps, 16, 5));
+}
+
+TEST(PageSet, Clone)
+{
+  PageSet ps(16);
+  ps.write(0, make_data(40, 'a'));
+  PageSet clone = ps;
+  clone.write(0, make_data(20, 'b'));
+  ASSERT_EQ(string(40, 'a'), read_str(ps, 0, 40));
+  ASSERT_EQ(string(20, 'b') + string(20, 'a'), read_str(clone, 0, 40));
+}
+
+TEST(PageSet, Zero)
+{
+  PageSet ps(16);
+  ps.write(0, make_data(64, 'a'));
+  ps.zero(8, 40);
+  ASSERT_EQ(64u, ps.length());
+  // pages 1 and 2 are freed, page 0 is zeroed in part
+  ASSERT_EQ(32u, ps.get_allocated());
+  ASSERT_EQ(string(8, 'a') + string(40, '\0') + string(16, 'a'),
+	    read_str(ps, 0, 64));
+
+  ps.zero(60, 20);
+  ASSERT_EQ(80u, ps.length());
+  ASSERT_EQ(string(4, 'a') + string(20, '\0'), read_str(ps, 56, 24));
+
+  // within one page
+  ps.zero(1, 2);
+  ASSERT_EQ(string("a\0\0a", 4), read_str(ps, 0, 4));
+}
+
+TEST(PageSet, Truncate)
+{
+  PageSet ps(16);
+  ps.write(0, make_data(64, 'a'));
+  ps.truncate(20);
+  ASSERT_EQ(20u, ps.length());
+  ASSERT_EQ(32u, ps.get_allocated());
+
+  // growing again reads back zeros past the old end
+  ps.truncate(40);
+  ASSERT_EQ(string(20, 'a') + string(20, '\0'), read_str(ps, 0, 40));
+  ps.write(50, make_data(2, 'b'));
+  ASSERT_EQ(string(12, '\0'), read_str(ps, 38, 12));
+}
+
+TEST(PageSet, Encode)
+{
+  PageSet ps(16);
+  ps.write(5, make_data(30, 'a'));
+  bufferlist bl;
+  ::encode(ps, bl);
+
+  // the plain data, and so independent of the page size
+  bufferlist::iterator p = bl.begin();
+  bufferlist data;
+  ::decode(data, p);
+  ASSERT_EQ(string(5, '\0') + string(30, 'a'),
+	    string(data.c_str(), data.length()));
+
+  PageSet other(64);
+  p = bl.begin();
+  ::decode(other, p);
+  ASSERT_EQ(35u, other.length());
+  ASSERT_EQ(read_str(ps, 0, 35), read_str(other, 0, 35));
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_pageset && ./unittest_pageset"
+// End:
@@ -0,0 +1,499 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/ObjectStore.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+static bufferlist make_data(unsigned len, char c)
+{
+  bufferptr bp = buffer::create_page_aligned(len);
+  memset(bp.c_str(), c, len);
+  bufferlist bl;
+  bl.append(bp);
+  return bl;
+}
+
+static void build(ObjectStore::Transaction *t, bufferlist *big,
+		  bufferlist *odd, bufferlist *small)
+{
+  coll_t cid("coll");
+  ghobject_t oid(hobject_t(sobject_t("obj", CEPH_NOSNAP)));
+  bufferlist attr;
+  attr.append("value");
+  *big = make_data(4 << 20, 'b');
+  *odd = make_data((128 << 10) + 123, 'o');
+  *small = make_data(100, 's');
+  t->touch(cid, oid);
+  t->write(cid, oid, 0, big->length(), *big);
+  t->setattr(cid, oid, "attr", attr);
+  t->write(cid, oid, 8 << 20, small->length(), *small);
+  t->write(cid, oid, 16 << 20, odd->length(), *odd);
+}
+
+/// the write payloads, in op order
+static void get_writes(ObjectStore::Transaction *t, list<bufferlist> *out)
+{
+  ObjectStore::Transaction::iterator i = t->begin();
+  while (i.have_op()) {
+    int op = i.decode_op();
+    switch (op) {
+    case ObjectStore::Transaction::OP_TOUCH:
+      i.decode_cid();
+      i.decode_oid();
+      break;
+    case ObjectStore::Transaction::OP_WRITE:
+      {
+	i.decode_cid();
+	i.decode_oid();
+	i.decode_length();
+	i.decode_length();
+	bufferlist bl;
+	i.decode_bl(bl);
+	out->push_back(bl);
+      }
+      break;
+    case ObjectStore::Transaction::OP_SETATTR:
+      {
+	i.decode_cid();
+	i.decode_oid();
+	i.decode_attrname();
+	bufferlist bl;
+	i.decode_bl(bl);
+      }
+      break;
+    default:
+      ASSERT_TRUE(0 == "unexpected op");
+    }
+  }
+}
+
+TEST(Transaction, EncodeJournalRoundTrip)
+{
+  ObjectStore::Transaction t;
+  bufferlist big, odd, small;
+  build(&t, &big, &odd, &small);
+
+  // start mid-page, like an entry with other transactions ahead of it
+  bufferlist bl;
+  bl.append("prefix");
+  ASSERT_TRUE(t.encode_journal(bl, 64 << 10));
+
+  bufferlist::iterator p = bl.begin();
+  p.advance(6);
+  ObjectStore::Transaction d(p);
+  ASSERT_TRUE(p.end());
+  ASSERT_EQ(t.get_num_ops(), d.get_num_ops());
+  ASSERT_EQ(t.get_data_length(), d.get_data_length());
+
+  list<bufferlist> writes;
+  get_writes(&d, &writes);
+  ASSERT_EQ(3u, writes.size());
+  ASSERT_TRUE(writes.front().contents_equal(big));
+  writes.pop_front();
+  ASSERT_TRUE(writes.front().contents_equal(small));
+  writes.pop_front();
+  ASSERT_TRUE(writes.front().contents_equal(odd));
+
+  // and again, from the decoded copy
+  bufferlist orig, again;
+  ASSERT_TRUE(t.encode_journal(orig, 64 << 10));
+  ASSERT_TRUE(d.encode_journal(again, 64 << 10));
+  ASSERT_TRUE(orig.contents_equal(again));
+}
+
+TEST(Transaction, EncodeJournalAvoidsCopies)
+{
+  ObjectStore::Transaction t;
+  bufferlist big, odd, small;
+  build(&t, &big, &odd, &small);
+
+  // what an O_DIRECT journal does to the entry
+  bufferlist legacy;
+  ::encode(t, legacy);
+  legacy.rebuild_page_aligned();
+
+  bufferlist aligned;
+  ASSERT_TRUE(t.encode_journal(aligned, 64 << 10));
+  aligned.rebuild_page_aligned();
+
+  // the legacy encoding interleaves the payloads with the ops, so all
+  // of them are copied; only the partial pages are copied now
+  ASSERT_GE(legacy.get_memcopy_count(), big.length() + odd.length());
+  ASSERT_LT(aligned.get_memcopy_count(), 4 * CEPH_PAGE_SIZE);
+}
+
+TEST(Transaction, EncodeJournalSmallWrites)
+{
+  ObjectStore::Transaction t;
+  bufferlist small = make_data(100, 's');
+  t.write(coll_t("coll"), ghobject_t(hobject_t(sobject_t("obj", CEPH_NOSNAP))),
+	  0, small.length(), small);
+  bufferlist bl;
+  ASSERT_FALSE(t.encode_journal(bl, 64 << 10));
+  ASSERT_EQ(0u, bl.length());
+}
+
+TEST(Transaction, LegacyDecodeKeepsLargestPayload)
+{
+  ObjectStore::Transaction t;
+  bufferlist big, odd, small;
+  build(&t, &big, &odd, &small);
+
+  // as received from a peer: only the largest payload is known
+  bufferlist bl;
+  ::encode(t, bl);
+  bufferlist::iterator p = bl.begin();
+  ObjectStore::Transaction d(p);
+
+  bufferlist aligned;
+  ASSERT_TRUE(d.encode_journal(aligned, 64 << 10));
+  bufferlist::iterator q = aligned.begin();
+  ObjectStore::Transaction d2(q);
+  list<bufferlist> writes;
+  get_writes(&d2, &writes);
+  ASSERT_EQ(3u, writes.size());
+  ASSERT_TRUE(writes.front().contents_equal(big));
+  ASSERT_TRUE(writes.back().contents_equal(odd));
+}
+
+typedef ObjectStore::Transaction Transaction;
+
+class TestGetTouched : public ::testing::Test {
+public:
+  coll_t c1, c2;
+  ghobject_t o1, o2;
+  bufferlist bl;
+  set<ghobject_t> objects;
+  set<coll_t> colls, coll_ops;
+
+  TestGetTouched()
+    : c1("c1"), c2("c2"),
+      o1(hobject_t(sobject_t("o1", CEPH_NOSNAP))),
+      o2(hobject_t(sobject_t("o2", CEPH_NOSNAP))) {
+    bl.append("value");
+  }
+
+  bool touched(Transaction &t) {
+    objects.clear();
+    colls.clear();
+    coll_ops.clear();
+    return t.get_touched(&objects, &colls, &coll_ops);
+  }
+
+  /// t touches only o1 in c1
+  void expect_o1(Transaction &t) {
+    EXPECT_TRUE(touched(t));
+    EXPECT_EQ(1u, objects.size());
+    EXPECT_EQ(1u, objects.count(o1));
+    EXPECT_EQ(1u, colls.size());
+    EXPECT_EQ(1u, colls.count(c1));
+    EXPECT_TRUE(coll_ops.empty());
+  }
+
+  /// t only changes c1 itself
+  void expect_c1_op(Transaction &t) {
+    EXPECT_TRUE(touched(t));
+    EXPECT_TRUE(objects.empty());
+    EXPECT_TRUE(colls.empty());
+    EXPECT_EQ(1u, coll_ops.size());
+    EXPECT_EQ(1u, coll_ops.count(c1));
+  }
+
+  /// decode ops in the raw tbl format of struct_v 7, for ops that
+  /// only older osds generate
+  static void legacy(Transaction *t, const bufferlist &tbl, uint64_t ops) {
+    bufferlist bl;
+    ENCODE_START(7, 5, bl);
+    ::encode(ops, bl);
+    ::encode((uint64_t)0, bl);  // pad_unused_bytes
+    ::encode((uint32_t)0, bl);  // largest_data_len
+    ::encode((uint32_t)0, bl);  // largest_data_off
+    ::encode((uint32_t)0, bl);  // largest_data_off_in_tbl
+    ::encode(tbl, bl);
+    ::encode(false, bl);        // tolerate_collection_add_enoent
+    ENCODE_FINISH(bl);
+    bufferlist::iterator p = bl.begin();
+    t->decode(p);
+  }
+};
+
+TEST_F(TestGetTouched, empty) {
+  Transaction t;
+  t.nop();
+  t.start_sync();
+  EXPECT_TRUE(touched(t));
+  EXPECT_TRUE(objects.empty());
+  EXPECT_TRUE(colls.empty());
+  EXPECT_TRUE(coll_ops.empty());
+}
+
+TEST_F(TestGetTouched, object_ops) {
+  {
+    Transaction t;
+    t.touch(c1, o1);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.write(c1, o1, 0, bl.length(), bl);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.zero(c1, o1, 0, 10);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.truncate(c1, o1, 10);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.remove(c1, o1);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.set_alloc_hint(c1, o1, 4 << 20, 4 << 10);
+    expect_o1(t);
+  }
+}
+
+TEST_F(TestGetTouched, attr_and_omap_ops) {
+  map<string, bufferptr> attrs;
+  attrs["a"] = buffer::copy("x", 1);
+  map<string, bufferlist> keys;
+  keys["k"] = bl;
+  set<string> rmkeys;
+  rmkeys.insert("k");
+  {
+    Transaction t;
+    t.setattr(c1, o1, "a", bl);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.setattrs(c1, o1, attrs);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.rmattr(c1, o1, "a");
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.rmattrs(c1, o1);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.omap_clear(c1, o1);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.omap_setkeys(c1, o1, keys);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.omap_rmkeys(c1, o1, rmkeys);
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.omap_rmkeyrange(c1, o1, "a", "z");
+    expect_o1(t);
+  }
+  {
+    Transaction t;
+    t.omap_setheader(c1, o1, bl);
+    expect_o1(t);
+  }
+}
+
+TEST_F(TestGetTouched, clone) {
+  Transaction t;
+  t.clone(c1, o1, o2);
+  t.clone_range(c1, o1, o2, 0, 10, 20);
+  EXPECT_TRUE(touched(t));
+  EXPECT_EQ(2u, objects.size());
+  EXPECT_EQ(1u, objects.count(o1));
+  EXPECT_EQ(1u, objects.count(o2));
+  EXPECT_EQ(1u, colls.size());
+  EXPECT_EQ(1u, colls.count(c1));
+  EXPECT_TRUE(coll_ops.empty());
+}
+
+TEST_F(TestGetTouched, move_and_rename) {
+  {
+    Transaction t;
+    t.collection_move(c2, c1, o1);  // COLL_ADD + COLL_REMOVE
+    EXPECT_TRUE(touched(t));
+    EXPECT_EQ(1u, objects.size());
+    EXPECT_EQ(1u, objects.count(o1));
+    EXPECT_EQ(2u, colls.size());
+    EXPECT_EQ(1u, colls.count(c1));
+    EXPECT_EQ(1u, colls.count(c2));
+    EXPECT_TRUE(coll_ops.empty());
+  }
+  {
+    Transaction t;
+    t.collection_move_rename(c1, o1, c2, o2);
+    EXPECT_TRUE(touched(t));
+    EXPECT_EQ(2u, objects.size());
+    EXPECT_EQ(1u, objects.count(o1));
+    EXPECT_EQ(1u, objects.count(o2));
+    EXPECT_EQ(2u, colls.size());
+    EXPECT_EQ(1u, colls.count(c1));
+    EXPECT_EQ(1u, colls.count(c2));
+    EXPECT_TRUE(coll_ops.empty());
+  }
+}
+
+TEST_F(TestGetTouched, collection_ops) {
+  map<string, bufferptr> attrs;
+  attrs["a"] = buffer::copy("x", 1);
+  {
+    Transaction t;
+    t.create_collection(c1);
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.remove_collection(c1);
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.collection_hint(c1, 1, bl);
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.collection_setattr(c1, "a", bl);
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.collection_rmattr(c1, "a");
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.collection_setattrs(c1, attrs);
+    expect_c1_op(t);
+  }
+  {
+    Transaction t;
+    t.split_collection(c1, 4, 1, c2);
+    EXPECT_TRUE(touched(t));
+    EXPECT_TRUE(objects.empty());
+    EXPECT_TRUE(colls.empty());
+    EXPECT_EQ(2u, coll_ops.size());
+    EXPECT_EQ(1u, coll_ops.count(c1));
+    EXPECT_EQ(1u, coll_ops.count(c2));
+  }
+}
+
+TEST_F(TestGetTouched, legacy_ops) {
+  bufferlist tbl;
+  __u32 op;
+  op = Transaction::OP_TRIMCACHE;
+  ::encode(op, tbl);
+  ::encode(c1, tbl);
+  ::encode(o1, tbl);
+  ::encode((uint64_t)0, tbl);
+  ::encode((uint64_t)10, tbl);
+  op = Transaction::OP_CLONERANGE;
+  ::encode(op, tbl);
+  ::encode(c1, tbl);
+  ::encode(o1, tbl);
+  ::encode(o2, tbl);
+  ::encode((uint64_t)0, tbl);
+  ::encode((uint64_t)10, tbl);
+  op = Transaction::OP_COLL_MOVE;
+  ::encode(op, tbl);
+  ::encode(c2, tbl);
+  ::encode(c1, tbl);
+  ::encode(o1, tbl);
+  Transaction t;
+  legacy(&t, tbl, 3);
+  EXPECT_TRUE(touched(t));
+  EXPECT_EQ(2u, objects.size());
+  EXPECT_EQ(1u, objects.count(o1));
+  EXPECT_EQ(1u, objects.count(o2));
+  EXPECT_EQ(2u, colls.size());
+  EXPECT_EQ(1u, colls.count(c1));
+  EXPECT_EQ(1u, colls.count(c2));
+  EXPECT_TRUE(coll_ops.empty());
+
+  tbl.clear();
+  op = Transaction::OP_COLL_RENAME;
+  ::encode(op, tbl);
+  ::encode(c1, tbl);
+  ::encode(c2, tbl);
+  op = Transaction::OP_SPLIT_COLLECTION;
+  ::encode(op, tbl);
+  ::encode(c1, tbl);
+  ::encode((uint32_t)4, tbl);
+  ::encode((uint32_t)1, tbl);
+  ::encode(c2, tbl);
+  Transaction t2;
+  legacy(&t2, tbl, 2);
+  EXPECT_TRUE(touched(t2));
+  EXPECT_TRUE(objects.empty());
+  EXPECT_TRUE(colls.empty());
+  EXPECT_EQ(2u, coll_ops.size());
+  EXPECT_EQ(1u, coll_ops.count(c1));
+  EXPECT_EQ(1u, coll_ops.count(c2));
+}
+
+TEST_F(TestGetTouched, unknown_op) {
+  bufferlist tbl;
+  __u32 op = 1000;
+  ::encode(op, tbl);
+  Transaction t;
+  legacy(&t, tbl, 1);
+  EXPECT_FALSE(touched(t));
+}
+
+TEST_F(TestGetTouched, accumulates) {
+  Transaction t;
+  t.create_collection(c2);
+  t.touch(c1, o1);
+  t.collection_move_rename(c1, o1, c2, o2);
+  EXPECT_TRUE(touched(t));
+  EXPECT_EQ(2u, objects.size());
+  EXPECT_EQ(2u, colls.size());
+  EXPECT_EQ(1u, coll_ops.size());
+  EXPECT_EQ(1u, coll_ops.count(c2));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_transaction && ./unittest_transaction"
+// End:
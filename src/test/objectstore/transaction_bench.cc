@@ -0,0 +1,164 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measure what it costs to turn an ObjectStore::Transaction into a
+ * journal entry and back.  For each write size this builds a
+ * transaction with a single write (plus the attr updates an OSD write
+ * carries), encodes it, makes it page aligned the way FileJournal does
+ * under directio, and decodes it again; once with the plain encoding
+ * and once with the journal encoding (encode_journal).
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "os/ObjectStore.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "global/global_init.h"
+
+static void usage(const char *pname)
+{
+  cerr << "usage: " << pname << " [options]\n"
+       << "  --iterations N     transactions per size (default 1000)\n"
+       << "  --size N           write size in bytes; may be repeated\n"
+       << "                     (default 4096 and 4194304)\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+struct result_t {
+  utime_t build, encode, align, decode;
+  uint64_t copied;
+  result_t() : copied(0) {}
+};
+
+static void build(ObjectStore::Transaction *t, const bufferlist& data)
+{
+  coll_t cid("transaction_bench");
+  ghobject_t oid(hobject_t(sobject_t("obj", CEPH_NOSNAP)));
+  bufferlist attr;
+  attr.append(string(250, 'a'));
+  t->write(cid, oid, 0, data.length(), data);
+  t->setattr(cid, oid, "_", attr);
+  t->setattr(cid, oid, "snapset", attr);
+}
+
+static void run(int iterations, const bufferlist& data, bool journal,
+		result_t *res)
+{
+  for (int i = 0; i < iterations; ++i) {
+    utime_t start = ceph_clock_now(g_ceph_context);
+    ObjectStore::Transaction t;
+    build(&t, data);
+    utime_t built = ceph_clock_now(g_ceph_context);
+
+    bufferlist bl;
+    if (!journal || !t.encode_journal(bl, g_conf->journal_align_min_size))
+      ::encode(t, bl);
+    utime_t encoded = ceph_clock_now(g_ceph_context);
+
+    bl.rebuild_page_aligned();
+    utime_t aligned = ceph_clock_now(g_ceph_context);
+
+    bufferlist::iterator p = bl.begin();
+    ObjectStore::Transaction d(p);
+    utime_t decoded = ceph_clock_now(g_ceph_context);
+
+    res->build += built - start;
+    res->encode += encoded - built;
+    res->align += aligned - encoded;
+    res->decode += decoded - aligned;
+    res->copied += bl.get_memcopy_count();
+  }
+}
+
+static double per_op_us(utime_t t, int iterations)
+{
+  return (double)t * 1000000.0 / iterations;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int iterations = 1000;
+  vector<int> sizes;
+  std::ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    int size;
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &iterations, &err,
+				     "--iterations", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &size, &err,
+				     "--size", (char*)NULL)) {
+      sizes.push_back(size);
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (sizes.empty()) {
+    sizes.push_back(4096);
+    sizes.push_back(4 << 20);
+  }
+  if (iterations < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  cout << "iterations " << iterations
+       << " journal_align_min_size " << g_conf->journal_align_min_size
+       << std::endl;
+  cout << "size\tencoding\tbuild_us\tencode_us\talign_us\tdecode_us"
+       << "\tcopied_bytes" << std::endl;
+  for (vector<int>::iterator s = sizes.begin(); s != sizes.end(); ++s) {
+    if (*s < 1) {
+      usage(argv[0]);
+      return 1;
+    }
+    // payloads come off the wire page aligned
+    bufferptr bp = buffer::create_page_aligned(*s);
+    memset(bp.c_str(), 0x5a, *s);
+    bufferlist data;
+    data.append(bp);
+
+    for (int journal = 0; journal < 2; ++journal) {
+      result_t res;
+      run(iterations, data, journal, &res);
+      cout << *s << "\t" << (journal ? "journal" : "plain")
+	   << "\t" << per_op_us(res.build, iterations)
+	   << "\t" << per_op_us(res.encode, iterations)
+	   << "\t" << per_op_us(res.align, iterations)
+	   << "\t" << per_op_us(res.decode, iterations)
+	   << "\t" << res.copied / iterations
+	   << std::endl;
+    }
+  }
+  return 0;
+}
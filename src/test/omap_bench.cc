@@ -19,6 +19,9 @@
 #include "include/utime.h"
 #include "global/global_context.h"
 #include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "os/DBObjectMap.h"
+#include "os/KeyValueDB.h"
 #include "test/omap_bench.h"
 
 #include <string>
@@ -57,6 +60,8 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--local") == 0) {
+	local_dir = args[i+1];
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: ostorebench [options]\n"
@@ -86,10 +91,17 @@ int OmapBench::setup(int argc, const char** argv) {
       	   << " to be specified size.\n"
       	   << "                        (default "<<value_size;
       cout <<"\n  --name          the rados id to use (default "<<rados_id;
-      cout<<")\n";
+      cout << ")\n"
+	   << "	--local         run against an object map in this directory "
+	   << "instead of a\n"
+	   << "                        cluster; each of the threads writes and "
+	   << "reads back\n"
+	   << "                        its own objects\n";
       exit(1);
     }
   }
+  if (!local_dir.empty())
+    return setup_local(args);
   int r = rados.init(rados_id.c_str());
   if (r < 0) {
     cout << "error during init" << std::endl;
@@ -124,6 +136,40 @@ int OmapBench::setup(int argc, const char** argv) {
   return 0;
 }
 
+int OmapBench::setup_local(vector<const char*>& args) {
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  KeyValueDB *db = KeyValueDB::create(g_ceph_context, "leveldb", local_dir);
+  if (!db) {
+    cout << "error creating leveldb store" << std::endl;
+    return -EINVAL;
+  }
+  stringstream err;
+  int r = db->init();
+  if (r == 0)
+    r = db->create_and_open(err);
+  if (r < 0) {
+    cout << "error opening " << local_dir << ": " << err.str() << std::endl;
+    delete db;
+    return r;
+  }
+  DBObjectMap *omap = new DBObjectMap(db);
+  r = omap->init();
+  if (r < 0) {
+    cout << "error initializing object map" << std::endl;
+    delete omap;
+    return r;
+  }
+  local_omap = omap;
+  test = &OmapBench::test_local_objects_in_parallel;
+  return 0;
+}
+
+OmapBench::~OmapBench() {
+  delete local_omap;
+}
+
 //Writer functions
 Writer::Writer(OmapBench *omap_bench) : ob(omap_bench) {
   stringstream name;
@@ -168,20 +214,28 @@ void AioWriter::set_aioc(librados::callback_t complete,
 void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
   AioWriter *aiow = reinterpret_cast<AioWriter *>(arg);
   aiow->stop_time();
-  Mutex * data_lock = &aiow->ob->data_lock;
   Mutex * thread_is_free_lock = &aiow->ob->thread_is_free_lock;
   Cond * thread_is_free = &aiow->ob->thread_is_free;
   int &busythreads_count = aiow->ob->busythreads_count;
-  o_bench_data &data = aiow->ob->data;
-  int INCREMENT = aiow->ob->increment;
   int err = aiow->get_aioc()->get_return_value();
   if (err < 0) {
     cout << "error writing AioCompletion";
     return;
   }
   double time = aiow->get_time();
+  OmapBench *ob = aiow->ob;
   delete aiow;
-  data_lock->Lock();
+  ob->record_latency(time);
+
+  thread_is_free_lock->Lock();
+  busythreads_count--;
+  thread_is_free->Signal();
+  thread_is_free_lock->Unlock();
+}
+
+void OmapBench::record_latency(double time) {
+  int INCREMENT = increment;
+  data_lock.Lock();
   data.avg_latency = (data.avg_latency * data.completed_ops + time)
       / (data.completed_ops + 1);
   data.completed_ops++;
@@ -197,12 +251,7 @@ void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
     data.mode.first = time/INCREMENT;
     data.mode.second = data.freq_map[time/INCREMENT];
   }
-  data_lock->Unlock();
-
-  thread_is_free_lock->Lock();
-  busythreads_count--;
-  thread_is_free->Signal();
-  thread_is_free_lock->Unlock();
+  data_lock.Unlock();
 }
 
 string OmapBench::random_string(int len) {
@@ -405,6 +454,58 @@ int OmapBench::test_write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+void *LocalWorker::entry() {
+  for (int i = first; i < ob->objects; i += ob->threads) {
+    stringstream name;
+    name << ob->prefix << i + 1;
+    ghobject_t oid(hobject_t(sobject_t(name.str(), CEPH_NOSNAP)));
+    map<string, bufferlist> omap;
+    int r = ob->omap_generator(ob->entries_per_omap, ob->key_size,
+			       ob->value_size, &omap);
+    if (r < 0)
+      return (void*)(long)r;
+    set<string> keys;
+    for (map<string, bufferlist>::iterator p = omap.begin();
+	 p != omap.end(); ++p)
+      keys.insert(p->first);
+
+    utime_t start = ceph_clock_now(g_ceph_context);
+    r = ob->local_omap->set_keys(oid, omap);
+    if (r < 0) {
+      cout << "set_keys on " << oid << " failed with code " << r << std::endl;
+      return (void*)(long)r;
+    }
+    map<string, bufferlist> got;
+    r = ob->local_omap->get_values(oid, keys, &got);
+    if (r < 0 || got.size() != omap.size()) {
+      cout << "get_values on " << oid << " failed with code " << r << std::endl;
+      return (void*)(long)(r < 0 ? r : -EIO);
+    }
+    utime_t end = ceph_clock_now(g_ceph_context);
+    ob->record_latency((end - start) * 1000);
+  }
+  return 0;
+}
+
+int OmapBench::test_local_objects_in_parallel(omap_generator_t omap_gen) {
+  omap_generator = omap_gen;
+  vector<LocalWorker*> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(new LocalWorker(this, i));
+    workers.back()->create();
+  }
+  int ret = 0;
+  for (vector<LocalWorker*>::iterator p = workers.begin();
+       p != workers.end(); ++p) {
+    void *r;
+    (*p)->join(&r);
+    if ((long)r < 0)
+      ret = (long)r;
+    delete *p;
+  }
+  return ret;
+}
+
 /**
  * runs the specified test with the specified parameters and generates
  * a histogram of latencies
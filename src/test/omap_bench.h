@@ -16,6 +16,7 @@
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "include/rados/librados.hpp"
 #include <string>
 #include <map>
@@ -40,6 +41,7 @@ struct o_bench_data {
 };
 
 class OmapBench;
+class ObjectMap;
 
 typedef int (*omap_generator_t)(const int omap_entries, const int key_size,
 				const int value_size,
@@ -78,6 +80,18 @@ public:
       librados::callback_t safe);
 };
 
+/**
+ * Writes and reads back the omaps of its own share of the objects,
+ * directly against a local ObjectMap (--local)
+ */
+class LocalWorker : public Thread {
+  OmapBench *ob;
+  int first;
+public:
+  LocalWorker(OmapBench *ob, int first) : ob(ob), first(first) {}
+  void *entry();
+};
+
 class OmapBench{
 protected:
   librados::IoCtx io_ctx;
@@ -104,8 +118,12 @@ protected:
   int value_size;
   double increment;
 
+  string local_dir;
+  ObjectMap *local_omap;
+
   friend class Writer;
   friend class AioWriter;
+  friend class LocalWorker;
 
 public:
   OmapBench()
@@ -119,13 +137,20 @@ public:
       rados_id("admin"),
       prefix(rados_id+".obj."),
       threads(3), objects(100), entries_per_omap(10), key_size(10),
-      value_size(100), increment(10)
+      value_size(100), increment(10),
+      local_omap(NULL)
   {}
+  ~OmapBench();
   /**
    * Parses command line args, initializes rados and ioctx
    */
   int setup(int argc, const char** argv);
 
+  /**
+   * Opens the local object map in local_dir (--local)
+   */
+  int setup_local(vector<const char*>& args);
+
   /**
    * Callback for when an AioCompletion (called from an AioWriter)
    * is safe. deletes the AioWriter that called it,
@@ -136,6 +161,11 @@ public:
    */
   static void aio_is_safe(rados_completion_t c, void *arg);
 
+  /**
+   * Adds an op that took time ms to data
+   */
+  void record_latency(double time);
+
   /**
    * Generates a random string len characters long
    */
@@ -200,6 +230,15 @@ public:
    */
   int test_write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /*
+   * Writes and reads back omaps generated by omap_gen on OBJECTS objects
+   * of a local ObjectMap, with THREADS threads working on distinct
+   * objects at the same time.
+   *
+   * @param omap_gen the method used to generate the omaps.
+   */
+  int test_local_objects_in_parallel(omap_generator_t omap_gen);
+
 };
 
 
@@ -0,0 +1,177 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+#include <algorithm>
+
+#include "os/CompactionScheduler.h"
+#include "test/ObjectMap/KeyValueDBMemory.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+/// remembers the prefixes it was asked to compact
+class CompactingDB : public KeyValueDBMemory {
+public:
+  Mutex lock;
+  vector<string> compacted;
+
+  CompactingDB() : lock("CompactingDB::lock") {}
+
+  void compact_prefix(const string &prefix) {
+    Mutex::Locker l(lock);
+    compacted.push_back(prefix);
+  }
+
+  /// wait up to secs for a pass to compact prefix
+  bool wait_compacted(const string &prefix, double secs) {
+    for (int i = 0; i < secs * 10; ++i) {
+      {
+	Mutex::Locker l(lock);
+	if (std::find(compacted.begin(), compacted.end(), prefix) !=
+	    compacted.end())
+	  return true;
+      }
+      usleep(100000);
+    }
+    return false;
+  }
+};
+
+class TestCompactionScheduler : public ::testing::Test {
+public:
+  CompactingDB db;
+  CompactionScheduler *sched;
+
+  TestCompactionScheduler() : sched(NULL) {}
+
+  virtual void SetUp() {
+    // passes every second, never too busy
+    g_ceph_context->_conf->set_val("kvdb_compact_interval", "1");
+    g_ceph_context->_conf->set_val("kvdb_compact_max_ops", "1000000000");
+    g_ceph_context->_conf->set_val("kvdb_compact_load_threshold", "1000");
+    g_ceph_context->_conf->set_val("kvdb_compact_min_tombstones", "100");
+    g_ceph_context->_conf->set_val("kvdb_compact_tombstone_ratio", ".3");
+    g_ceph_context->_conf->set_val("kvdb_compact_read_amp", "2");
+    g_ceph_context->_conf->apply_changes(NULL);
+    sched = new CompactionScheduler(g_ceph_context, &db, "test-compaction");
+    sched->start();
+  }
+
+  virtual void TearDown() {
+    sched->shutdown();
+    delete sched;
+  }
+
+  void commit(const string &prefix, int writes, int deletes) {
+    CompactionScheduler::txn_stats_t t;
+    for (int i = 0; i < writes; ++i)
+      t.note_write(prefix);
+    if (deletes)
+      t.note_delete(prefix, deletes);
+    sched->note_commit(t);
+  }
+};
+
+TEST_F(TestCompactionScheduler, counts_at_commit) {
+  // a transaction that is built but never applied counts for nothing
+  CompactionScheduler::txn_stats_t aborted;
+  aborted.note_delete("_A_", 1000);
+  EXPECT_FALSE(db.wait_compacted("_A_", 2.5));
+
+  commit("_A_", 10, 1000);
+  EXPECT_TRUE(db.wait_compacted("_A_", 5));
+}
+
+TEST_F(TestCompactionScheduler, tombstone_ratio) {
+  // mostly writes: not worth it until seeks in it are slow
+  commit("_W_", 1000, 150);
+  EXPECT_FALSE(db.wait_compacted("_W_", 2.5));
+
+  sched->note_seeks("_F_", 1000, utime_t(0, 1000000));
+  sched->note_seeks("_W_", 10, utime_t(1, 0));
+  EXPECT_TRUE(db.wait_compacted("_W_", 5));
+}
+
+class Committer : public Thread {
+public:
+  TestCompactionScheduler *test;
+  int txns;
+  Committer(TestCompactionScheduler *test, int txns)
+    : test(test), txns(txns) {}
+  void *entry() {
+    for (int i = 0; i < txns; ++i) {
+      test->commit("_B_", 0, 1);
+      test->commit("_C_", 1, 0);
+      test->sched->note_seeks("_D_", 1, utime_t(0, 1000));
+    }
+    return NULL;
+  }
+};
+
+TEST_F(TestCompactionScheduler, concurrent) {
+  // every delete has to be counted for _B_ to reach the minimum
+  const int threads = 8, txns = 2000;
+  g_ceph_context->_conf->set_val("kvdb_compact_min_tombstones", "16000");
+  g_ceph_context->_conf->apply_changes(NULL);
+  vector<Committer*> committers;
+  for (int i = 0; i < threads; ++i) {
+    committers.push_back(new Committer(this, txns));
+    committers.back()->create();
+  }
+  for (int i = 0; i < threads; ++i) {
+    committers[i]->join();
+    delete committers[i];
+  }
+  EXPECT_TRUE(db.wait_compacted("_B_", 5));
+  {
+    Mutex::Locker l(db.lock);
+    EXPECT_EQ(0, std::count(db.compacted.begin(), db.compacted.end(),
+			    string("_C_")));
+  }
+
+  // one short of the minimum
+  {
+    Mutex::Locker l(db.lock);
+    db.compacted.clear();
+  }
+  for (int i = 0; i < threads; ++i) {
+    committers[i] = new Committer(this, txns - (i == 0));
+    committers[i]->create();
+  }
+  for (int i = 0; i < threads; ++i) {
+    committers[i]->join();
+    delete committers[i];
+  }
+  EXPECT_FALSE(db.wait_compacted("_B_", 2.5));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ;
+ *   make unittest_compaction_scheduler &&
+ *   ./unittest_compaction_scheduler
+ * End:
+ */
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <signal.h>
 #include "os/LFNIndex.h"
+#include "os/HashIndex.h"
 #include "os/chain_xattr.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
@@ -441,6 +442,282 @@ TEST_F(TestLFNIndex, get_mangled_name) {
   }
 }
 
+// runs before the TestWrapLFNIndex base so that the index sees the cache
+struct LFNCacheEnabler {
+  LFNCacheEnabler() {
+    g_ceph_context->_conf->set_val("filestore_index_lfn_cache_size", "16");
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+  ~LFNCacheEnabler() {
+    g_ceph_context->_conf->set_val("filestore_index_lfn_cache_size", "0");
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+};
+
+class TestLFNIndexCache : public LFNCacheEnabler, public TestWrapLFNIndex,
+			  public ::testing::Test {
+public:
+  TestLFNIndexCache() : TestWrapLFNIndex(coll_t("ABC"), "PATH", CollectionIndex::HOBJECT_WITH_POOL) {
+  }
+
+  virtual void SetUp() {
+    ::chmod("PATH", 0700);
+    ASSERT_EQ(0, ::system("rm -fr PATH"));
+    ASSERT_EQ(0, ::mkdir("PATH", 0700));
+  }
+
+  virtual void TearDown() {
+    ASSERT_EQ(0, ::system("rm -fr PATH"));
+  }
+};
+
+TEST_F(TestLFNIndexCache, lookup_and_unlink) {
+  const vector<string> path;
+  std::string mangled_name;
+  int exists;
+  const std::string object_name(1024, 'A');
+  ghobject_t hoid(hobject_t(sobject_t(object_name, CEPH_NOSNAP)));
+
+  EXPECT_EQ(0, get_mangled_name(path, hoid, &mangled_name, &exists));
+  EXPECT_EQ(0, exists);
+  EXPECT_NE(std::string::npos, mangled_name.find("0_long"));
+  std::string pathname("PATH/" + mangled_name);
+  EXPECT_EQ(0, ::close(::creat(pathname.c_str(), 0600)));
+  EXPECT_EQ(0, created(hoid, pathname.c_str()));
+
+  //
+  // the resolution is cached by created(): it is found without
+  // reading the lfn attr, here rewritten behind the index's back
+  //
+  string LFN_ATTR = "user.cephos.lfn";
+  char buf[100];
+  snprintf(buf, sizeof(buf), "%d", index_version);
+  LFN_ATTR += string(buf);
+  const std::string other_name = object_name + "SUFFIX";
+  EXPECT_EQ(other_name.size(), (unsigned)chain_setxattr(pathname.c_str(), LFN_ATTR.c_str(), other_name.c_str(), other_name.size()));
+  std::string cached_name;
+  exists = 666;
+  EXPECT_EQ(0, get_mangled_name(path, hoid, &cached_name, &exists));
+  EXPECT_EQ(mangled_name, cached_name);
+  EXPECT_EQ(1, exists);
+
+  //
+  // unlinking through the index drops the entry
+  //
+  EXPECT_EQ(0, remove_object(path, hoid));
+  EXPECT_EQ(-1, ::access(pathname.c_str(), 0));
+  EXPECT_EQ(ENOENT, errno);
+  exists = 666;
+  EXPECT_EQ(0, get_mangled_name(path, hoid, &cached_name, &exists));
+  EXPECT_EQ(mangled_name, cached_name);
+  EXPECT_EQ(0, exists);
+}
+
+class TestHashIndex : public HashIndex, public ::testing::Test {
+public:
+  enum {
+    NUM_OBJECTS = 40,
+    NUM_CREATED = 10
+  };
+
+  // splits directories holding more than 16 objects
+  TestHashIndex() : HashIndex(coll_t("ABC"), "PATH", 1, 1, CollectionIndex::HOBJECT_WITH_POOL) {
+  }
+
+  virtual void SetUp() {
+    ::chmod("PATH", 0700);
+    ASSERT_EQ(0, ::system("rm -fr PATH"));
+    ASSERT_EQ(0, ::mkdir("PATH", 0700));
+    ASSERT_LE(0, init());
+    // fill the root past the split threshold without splitting it
+    HashIndex fill(coll_t("ABC"), "PATH", 100, 100, CollectionIndex::HOBJECT_WITH_POOL);
+    for (int i = 0; i < NUM_OBJECTS; ++i)
+      ASSERT_EQ(0, create(fill, obj(i)));
+  }
+
+  virtual void TearDown() {
+    ASSERT_EQ(0, ::system("rm -fr PATH"));
+  }
+
+  /// objects spread evenly over the 16 first level subdirs
+  static ghobject_t obj(int i) {
+    char name[20];
+    snprintf(name, sizeof(name), "obj%d", i);
+    return ghobject_t(hobject_t(object_t(name), "", CEPH_NOSNAP, i, 0, ""));
+  }
+
+  static int create(HashIndex &index, const ghobject_t &oid) {
+    IndexedPath path;
+    int exists;
+    int r = index.lookup(oid, &path, &exists);
+    if (r < 0)
+      return r;
+    if (exists)
+      return -EEXIST;
+    int fd = ::creat(path->path(), 0600);
+    if (fd < 0)
+      return -errno;
+    ::close(fd);
+    return index.created(oid, path->path());
+  }
+
+  /// @return link count of the file of oid, 0 if not found
+  static int nlink(HashIndex &index, const ghobject_t &oid, string *file = 0) {
+    IndexedPath path;
+    int exists;
+    if (index.lookup(oid, &path, &exists) < 0 || !exists)
+      return 0;
+    if (file)
+      *file = path->path();
+    struct stat st;
+    if (::stat(path->path(), &st) < 0)
+      return 0;
+    return st.st_nlink;
+  }
+
+  /// Objects in live, and only those, are found, in a subdir iff split
+  void check_objects(HashIndex &index, const set<int> &live, bool split) {
+    for (int i = 0; i < NUM_OBJECTS + NUM_CREATED; ++i) {
+      string file;
+      if (!live.count(i)) {
+	EXPECT_EQ(0, nlink(index, obj(i))) << "obj" << i;
+	continue;
+      }
+      EXPECT_EQ(1, nlink(index, obj(i), &file)) << "obj" << i;
+      EXPECT_EQ(split, file.find("/DIR_") != string::npos) << file;
+    }
+    vector<ghobject_t> ls;
+    EXPECT_EQ(0, index.collection_list(&ls));
+    EXPECT_EQ(live.size(), ls.size());
+    set<string> subdirs;
+    EXPECT_EQ(0, list_subdirs(vector<string>(), &subdirs));
+    EXPECT_EQ(split ? 16u : 0u, subdirs.size());
+    EXPECT_EQ(-1, ::access(get_staging_path().c_str(), 0));
+  }
+
+  /// Stage half of the objects, @return those staged
+  set<int> stage_half(HashIndex &stage, AsyncSplit **s) {
+    set<int> staged;
+    EXPECT_EQ(0, prepare_async_split(vector<string>(), stage, s));
+    EXPECT_TRUE(*s);
+    if (!*s)
+      return staged;
+    EXPECT_EQ(1, stage_async_split(stage, *s, NUM_OBJECTS / 2, NULL));
+    for (int i = 0; i < NUM_OBJECTS; ++i) {
+      int n = nlink(*this, obj(i));
+      EXPECT_LE(1, n);
+      if (n == 2)
+	staged.insert(i);
+    }
+    EXPECT_EQ(NUM_OBJECTS / 2, (int)staged.size());
+    return staged;
+  }
+};
+
+TEST_F(TestHashIndex, async_split) {
+  HashIndex stage(coll_t("ABC"), get_staging_path().c_str(), 1, 1, CollectionIndex::HOBJECT_WITH_POOL);
+  AsyncSplit *s = 0;
+  set<int> staged = stage_half(stage, &s);
+  ASSERT_TRUE(s);
+
+  //
+  // lookups, removes and creates use the old directory while staging
+  //
+  set<int> live;
+  for (int i = 0; i < NUM_OBJECTS; ++i) {
+    string file;
+    EXPECT_LE(1, nlink(*this, obj(i), &file));
+    EXPECT_EQ(string::npos, file.find("/DIR_")) << file;
+    live.insert(i);
+  }
+  int removed_staged = *staged.begin();
+  int removed_unstaged = -1;
+  for (int i = 0; i < NUM_OBJECTS; ++i)
+    if (!staged.count(i))
+      removed_unstaged = i;
+  ASSERT_NE(-1, removed_unstaged);
+  EXPECT_EQ(0, unlink(obj(removed_staged)));
+  EXPECT_EQ(0, unlink(obj(removed_unstaged)));
+  live.erase(removed_staged);
+  live.erase(removed_unstaged);
+  for (int i = NUM_OBJECTS; i < NUM_OBJECTS + NUM_CREATED; ++i) {
+    EXPECT_EQ(0, create(*this, obj(i)));
+    live.insert(i);
+  }
+  // the creates do not split the directory inline under us
+  set<string> subdirs;
+  EXPECT_EQ(0, list_subdirs(vector<string>(), &subdirs));
+  EXPECT_TRUE(subdirs.empty());
+
+  //
+  // the switch-over catches up with them
+  //
+  int r;
+  while ((r = stage_async_split(stage, s, NUM_OBJECTS / 2, NULL)) > 0) ;
+  EXPECT_EQ(0, r);
+  EXPECT_EQ(0, sync_async_split(stage, s));
+  EXPECT_EQ(0, complete_async_split(stage, s, true, NULL));
+  check_objects(*this, live, true);
+}
+
+TEST_F(TestHashIndex, async_split_crash_while_staging) {
+  HashIndex stage(coll_t("ABC"), get_staging_path().c_str(), 1, 1, CollectionIndex::HOBJECT_WITH_POOL);
+  AsyncSplit *s = 0;
+  stage_half(stage, &s);
+  ASSERT_TRUE(s);
+
+  //
+  // after a crash the staged links are dropped on mount and the
+  // directory is left as it was
+  //
+  HashIndex restarted(coll_t("ABC"), "PATH", 1, 1, CollectionIndex::HOBJECT_WITH_POOL);
+  EXPECT_EQ(0, restarted.cleanup());
+  set<int> live;
+  for (int i = 0; i < NUM_OBJECTS; ++i)
+    live.insert(i);
+  check_objects(restarted, live, false);
+
+  //
+  // the next create splits it
+  //
+  EXPECT_EQ(0, create(restarted, obj(NUM_OBJECTS)));
+  live.insert(NUM_OBJECTS);
+  check_objects(restarted, live, true);
+}
+
+TEST_F(TestHashIndex, async_split_crash_during_switch_over) {
+  const vector<string> path;
+  HashIndex stage(coll_t("ABC"), get_staging_path().c_str(), 1, 1, CollectionIndex::HOBJECT_WITH_POOL);
+  AsyncSplit *s = 0;
+  stage_half(stage, &s);
+  ASSERT_TRUE(s);
+  int r;
+  while ((r = stage_async_split(stage, s, NUM_OBJECTS / 2, NULL)) > 0) ;
+  EXPECT_EQ(0, r);
+  EXPECT_EQ(0, sync_async_split(stage, s));
+
+  //
+  // crash after tagging the split and renaming one of the staged
+  // subdirs into place
+  //
+  EXPECT_LE(0, start_split(path));
+  vector<string> dst(path);
+  dst.push_back(*s->subdirs.begin());
+  string placed = get_full_path_subdir(dst);
+  string staged = get_staging_path() + placed.substr(get_base_path().size());
+  EXPECT_EQ(0, ::rename(staged.c_str(), placed.c_str()));
+
+  //
+  // mount completes the split
+  //
+  HashIndex restarted(coll_t("ABC"), "PATH", 1, 1, CollectionIndex::HOBJECT_WITH_POOL);
+  EXPECT_EQ(0, restarted.cleanup());
+  set<int> live;
+  for (int i = 0; i < NUM_OBJECTS; ++i)
+    live.insert(i);
+  check_objects(restarted, live, true);
+}
+
 int main(int argc, char **argv) {
   int fd = ::creat("detect", 0600);
   int ret = chain_fsetxattr(fd, "user.test", "A", 1);
@@ -454,6 +731,9 @@ int main(int argc, char **argv) {
 
     global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
     common_init_finish(g_ceph_context);
+    // most tests rewrite lfn attrs behind the index's back
+    g_ceph_context->_conf->set_val("filestore_index_lfn_cache_size", "0");
+    g_ceph_context->_conf->apply_changes(NULL);
 
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -1,11 +1,13 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 #include "gtest/gtest.h"
 #include "osd/OSDMap.h"
+#include "osd/OSDMapMapping.h"
 
 #include "global/global_context.h"
 #include "global/global_init.h"
 #include "common/common_init.h"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -400,3 +402,179 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
     osdmap.set_primary_affinity(1, 0x10000);
   }
 }
+
+// the precomputed mappings of m agree with CRUSH
+static void check_precomputed_mappings(const OSDMap &m)
+{
+  ASSERT_TRUE(m.has_mapping());
+  ASSERT_EQ(m.get_epoch(), m.get_mapping()->get_epoch());
+  OSDMap plain;
+  plain.deepish_copy_from(m);
+  plain.clear_mapping();
+  for (map<int64_t,pg_pool_t>::const_iterator p = m.get_pools().begin();
+       p != m.get_pools().end();
+       ++p) {
+    // past pg_num too, for raw pgs
+    for (unsigned ps = 0; ps < p->second.get_pg_num() * 2; ++ps) {
+      pg_t pgid(ps, p->first);
+      vector<int> up, acting, plain_up, plain_acting;
+      int up_primary, acting_primary, plain_up_primary, plain_acting_primary;
+      m.pg_to_up_acting_osds(pgid, &up, &up_primary,
+			     &acting, &acting_primary);
+      plain.pg_to_up_acting_osds(pgid, &plain_up, &plain_up_primary,
+				 &plain_acting, &plain_acting_primary);
+      ASSERT_EQ(plain_up, up) << pgid;
+      ASSERT_EQ(plain_up_primary, up_primary) << pgid;
+      ASSERT_EQ(plain_acting, acting) << pgid;
+      ASSERT_EQ(plain_acting_primary, acting_primary) << pgid;
+    }
+  }
+}
+
+TEST_F(OSDMapTest, PrecomputedMappings) {
+  set_up_map();
+  osdmap.build_mapping(2);
+  ASSERT_EQ(osdmap.get_epoch(), osdmap.get_mapping()->get_epoch());
+  ASSERT_LT(0u, osdmap.get_mapping()->get_num_pgs());
+  check_precomputed_mappings(osdmap);
+
+  // a copy shares the mappings, and keeps them as the original moves on
+  OSDMap before;
+  before.deepish_copy_from(osdmap);
+  ASSERT_EQ(osdmap.get_mapping(), before.get_mapping());
+
+  // down
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_state[1] = CEPH_OSD_UP;
+    osdmap.apply_incremental(inc);
+    ASSERT_FALSE(osdmap.is_up(1));
+    check_precomputed_mappings(osdmap);
+    check_precomputed_mappings(before);
+  }
+  // out
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[2] = CEPH_OSD_OUT;
+    osdmap.apply_incremental(inc);
+    check_precomputed_mappings(osdmap);
+  }
+  // temps
+  {
+    vector<int> up, acting;
+    int up_primary, acting_primary;
+    pg_t pgid(0, 0);
+    osdmap.pg_to_up_acting_osds(pgid, &up, &up_primary,
+				&acting, &acting_primary);
+    ASSERT_LE(2u, up.size());
+    std::reverse(up.begin(), up.end());
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_pg_temp[pgid] = up;
+    inc.new_primary_temp[pg_t(1, 0)] = 3;
+    osdmap.apply_incremental(inc);
+    osdmap.pg_to_up_acting_osds(pgid, &up, &up_primary,
+				&acting, &acting_primary);
+    ASSERT_EQ(inc.new_pg_temp[pgid], acting);
+    check_precomputed_mappings(osdmap);
+  }
+  // up again
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_up_client[1] = entity_addr_t();
+    osdmap.apply_incremental(inc);
+    ASSERT_TRUE(osdmap.is_up(1));
+    check_precomputed_mappings(osdmap);
+  }
+  // primary affinity
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_primary_affinity[3] = 0x4000;
+    osdmap.apply_incremental(inc);
+    check_precomputed_mappings(osdmap);
+  }
+  // in again
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[2] = CEPH_OSD_IN;
+    osdmap.apply_incremental(inc);
+    check_precomputed_mappings(osdmap);
+  }
+  // pg_num
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    pg_pool_t *p = inc.get_new_pool(0, osdmap.get_pg_pool(0));
+    p->set_pg_num(p->get_pg_num() * 2);
+    p->set_pgp_num(p->get_pgp_num() * 2);
+    osdmap.apply_incremental(inc);
+    check_precomputed_mappings(osdmap);
+  }
+  // removed pool
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.old_pools.insert(osdmap.lookup_pg_pool_name("ec"));
+    osdmap.apply_incremental(inc);
+    check_precomputed_mappings(osdmap);
+  }
+  // full map
+  {
+    bufferlist bl;
+    osdmap.encode(bl);
+    osdmap.decode(bl);
+    check_precomputed_mappings(osdmap);
+  }
+
+  // changing the map by hand drops them
+  osdmap.set_primary_affinity(0, 0);
+  ASSERT_FALSE(osdmap.has_mapping());
+}
+
+TEST_F(OSDMapTest, BorrowedMappings) {
+  set_up_map();
+  osdmap.build_mapping(2);
+  ceph::shared_ptr<OSDMapMapping> owner = osdmap.disown_mapping();
+  ASSERT_TRUE(owner.unique());
+  ASSERT_EQ(owner, osdmap.get_mapping());
+  check_precomputed_mappings(osdmap);
+
+  // the next map borrows them, and updates a copy
+  OSDMap next;
+  next.deepish_copy_from(osdmap);
+  next.clear_mapping();
+  next.inherit_mapping(osdmap);
+  ASSERT_EQ(owner, next.get_mapping());
+  {
+    OSDMap::Incremental inc(next.get_epoch() + 1);
+    inc.new_state[1] = CEPH_OSD_UP;
+    next.apply_incremental(inc);
+  }
+  ASSERT_NE(owner, next.get_mapping());
+  ASSERT_EQ(osdmap.get_epoch(), owner->get_epoch());
+  check_precomputed_mappings(next);
+  check_precomputed_mappings(osdmap);
+
+  // taken ones are not shared with anybody, and are updated in place
+  OSDMap after;
+  after.deepish_copy_from(next);
+  ceph::shared_ptr<OSDMapMapping> m = next.take_mapping();
+  ASSERT_FALSE(next.has_mapping());
+  const OSDMapMapping *p = m.get();
+  after.adopt_mapping(m);
+  ASSERT_FALSE(m);
+  {
+    OSDMap::Incremental inc(after.get_epoch() + 1);
+    inc.new_weight[2] = CEPH_OSD_OUT;
+    after.apply_incremental(inc);
+  }
+  ASSERT_EQ(p, after.get_mapping().get());
+  check_precomputed_mappings(after);
+
+  // once the owner lets go, the old map goes back to CRUSH
+  owner.reset();
+  ASSERT_FALSE(osdmap.has_mapping());
+  vector<int> up, acting;
+  int up_primary, acting_primary;
+  osdmap.pg_to_up_acting_osds(pg_t(0, 0), &up, &up_primary,
+			      &acting, &acting_primary);
+  ASSERT_LE(2u, up.size());
+  ASSERT_EQ(up, acting);
+}
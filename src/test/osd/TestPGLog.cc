@@ -324,7 +324,7 @@ TEST_F(PGLogTest, rewind_divergent_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = newhead = eversion_t(1, 4);
@@ -406,7 +406,7 @@ TEST_F(PGLogTest, rewind_divergent_log) {
       info.log_tail = log.tail = eversion_t(1, 1);
       newhead = eversion_t(1, 3);
       e.version = divergent_version = eversion_t(1, 5);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       divergent_object = e.soid;
       e.op = pg_log_entry_t::DELETE;
       e.prior_version = prior_version = eversion_t(0, 2);
@@ -450,7 +450,7 @@ TEST_F(PGLogTest, merge_old_entry) {
 
     info.last_backfill = hobject_t();
     info.last_backfill.hash = 1;
-    oe.soid.hash = 2;
+    oe.soid.edit().hash = 2;
 
     EXPECT_FALSE(is_dirty());
     EXPECT_TRUE(remove_snap.empty());
@@ -651,7 +651,7 @@ TEST_F(PGLogTest, merge_old_entry) {
     list<hobject_t> remove_snap;
 
     info.log_tail = eversion_t(2,1);
-    oe.soid.hash = 1;
+    oe.soid.edit().hash = 1;
     oe.op = pg_log_entry_t::MODIFY;
     oe.prior_version = eversion_t(1,1);
 
@@ -689,7 +689,7 @@ TEST_F(PGLogTest, merge_old_entry) {
     list<hobject_t> remove_snap;
 
     info.log_tail = eversion_t(2,1);
-    oe.soid.hash = 1;
+    oe.soid.edit().hash = 1;
     oe.op = pg_log_entry_t::DELETE;
     oe.prior_version = eversion_t(1,1);
 
@@ -728,7 +728,7 @@ TEST_F(PGLogTest, merge_old_entry) {
     list<hobject_t> remove_snap;
 
     info.log_tail = eversion_t(10,1);
-    oe.soid.hash = 1;
+    oe.soid.edit().hash = 1;
     oe.op = pg_log_entry_t::MODIFY;
     oe.prior_version = eversion_t();
 
@@ -907,11 +907,11 @@ TEST_F(PGLogTest, merge_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 4);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = eversion_t(1, 5);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
@@ -919,11 +919,11 @@ TEST_F(PGLogTest, merge_log) {
       info.last_update = log.head;
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = eversion_t(1, 5);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       olog.log.push_back(e);
       olog.head = e.version;
     }
@@ -1004,14 +1004,14 @@ TEST_F(PGLogTest, merge_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = eversion_t(1, 2);
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       log.log.push_back(e);
       e.version = eversion_t(1,3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       divergent_object = e.soid;
       e.op = pg_log_entry_t::DELETE;
       log.log.push_back(e);
@@ -1021,18 +1021,18 @@ TEST_F(PGLogTest, merge_log) {
       info.last_update = log.head;
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = eversion_t(1, 2);
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       olog.log.push_back(e);
       e.version = eversion_t(2, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::MODIFY;
       olog.log.push_back(e);
       e.version = eversion_t(2, 4);
-      e.soid.hash = 0x7;
+      e.soid.edit().hash = 0x7;
       e.op = pg_log_entry_t::DELETE;
       olog.log.push_back(e);
       olog.head = e.version;
@@ -1117,14 +1117,14 @@ TEST_F(PGLogTest, merge_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = eversion_t(1, 4);
-      e.soid.hash = 0x7;
+      e.soid.edit().hash = 0x7;
       log.log.push_back(e);
       e.version = eversion_t(1, 5);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
@@ -1132,11 +1132,11 @@ TEST_F(PGLogTest, merge_log) {
       info.last_update = log.head;
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = eversion_t(1, 4);
-      e.soid.hash = 0x7;
+      e.soid.edit().hash = 0x7;
       olog.log.push_back(e);
       olog.head = e.version;
     }
@@ -1232,10 +1232,10 @@ TEST_F(PGLogTest, merge_log) {
 
       log.tail = eversion_t();
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.log.push_back(e);
       e.version = eversion_t(1, 2);
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
@@ -1244,10 +1244,10 @@ TEST_F(PGLogTest, merge_log) {
 
       olog.tail = eversion_t(2, 3);
       e.version = eversion_t(2, 4);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       olog.log.push_back(e);
       e.version = eversion_t(2, 5);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.log.push_back(e);
       olog.head = e.version;
     }
@@ -1326,22 +1326,22 @@ TEST_F(PGLogTest, proc_replica_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 2);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = eversion_t(1, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = eversion_t(2, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       olog.log.push_back(e);
       olog.head = e.version;
@@ -1378,7 +1378,7 @@ TEST_F(PGLogTest, proc_replica_log) {
 
       {
 	e.soid = divergent_object;
-	e.soid.hash = 0x1;
+	e.soid.edit().hash = 0x1;
 	e.version = eversion_t(1, 1);
 	log.tail = e.version;
 	log.log.push_back(e);
@@ -1389,24 +1389,24 @@ TEST_F(PGLogTest, proc_replica_log) {
 	log.tail = e.version;
 	log.log.push_back(e);
 
-	e.soid.hash = 0x3;
+	e.soid.edit().hash = 0x3;
 	e.version = eversion_t(1, 4);
 	log.log.push_back(e);
 
-	e.soid.hash = 0x7;
+	e.soid.edit().hash = 0x7;
 	e.version = eversion_t(1, 5);
 	log.log.push_back(e);
 
-	e.soid.hash = 0x8;
+	e.soid.edit().hash = 0x8;
 	e.version = eversion_t(1, 6);
 	log.log.push_back(e);
 
-	e.soid.hash = 0x9;
+	e.soid.edit().hash = 0x9;
 	e.op = pg_log_entry_t::DELETE;
 	e.version = eversion_t(2, 7);
 	log.log.push_back(e);
 
-	e.soid.hash = 0xa;
+	e.soid.edit().hash = 0xa;
 	e.version = eversion_t(2, 8);
 	log.head = e.version;
 	log.log.push_back(e);
@@ -1415,7 +1415,7 @@ TEST_F(PGLogTest, proc_replica_log) {
 
       {
 	e.soid = divergent_object;
-	e.soid.hash = 0x1;
+	e.soid.edit().hash = 0x1;
 	e.version = eversion_t(1, 1);
 	olog.tail = e.version;
 	olog.log.push_back(e);
@@ -1426,19 +1426,19 @@ TEST_F(PGLogTest, proc_replica_log) {
 	olog.log.push_back(e);
 
 	e.prior_version = eversion_t(0, 0);
-	e.soid.hash = 0x3;
+	e.soid.edit().hash = 0x3;
 	e.version = eversion_t(1, 4);
 	olog.log.push_back(e);
 
-	e.soid.hash = 0x7;
+	e.soid.edit().hash = 0x7;
 	e.version = eversion_t(1, 5);
 	olog.log.push_back(e);
 
-	e.soid.hash = 0x8;
+	e.soid.edit().hash = 0x8;
 	e.version = eversion_t(1, 6);
 	olog.log.push_back(e);
 
-	e.soid.hash = 0x9; // should not be added to missing, create
+	e.soid.edit().hash = 0x9; // should not be added to missing, create
 	e.op = pg_log_entry_t::MODIFY;
 	e.version = eversion_t(1, 7);
 	olog.log.push_back(e);
@@ -1509,28 +1509,28 @@ TEST_F(PGLogTest, proc_replica_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       log.log.push_back(e);
       e.version = eversion_t(1,3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       olog.log.push_back(e);
       e.version = eversion_t(2, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       olog.log.push_back(e);
       olog.head = e.version;
@@ -1593,28 +1593,28 @@ TEST_F(PGLogTest, proc_replica_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       log.log.push_back(e);
       e.version = eversion_t(1, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       log.log.push_back(e);
       log.head = e.version;
       log.index();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x5;
+      e.soid.edit().hash = 0x5;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       olog.log.push_back(e);
       e.version = eversion_t(2, 3);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       divergent_object = e.soid;
       omissing.add(divergent_object, e.version, eversion_t());
       e.op = pg_log_entry_t::MODIFY;
@@ -1684,15 +1684,15 @@ TEST_F(PGLogTest, proc_replica_log) {
       e.mod_desc.mark_unrollbackable();
 
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       log.tail = e.version;
       log.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       log.log.push_back(e);
       e.version = new_version;
       e.prior_version = eversion_t(1, 1);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       e.op = pg_log_entry_t::DELETE;
       log.log.push_back(e);
       log.head = e.version;
@@ -1700,15 +1700,15 @@ TEST_F(PGLogTest, proc_replica_log) {
 
       e.op = pg_log_entry_t::MODIFY;
       e.version = eversion_t(1, 1);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       olog.tail = e.version;
       olog.log.push_back(e);
       e.version = last_update;
-      e.soid.hash = 0x3;
+      e.soid.edit().hash = 0x3;
       olog.log.push_back(e);
       e.version = divergent_version;
       e.prior_version = eversion_t(1, 1);
-      e.soid.hash = 0x9;
+      e.soid.edit().hash = 0x9;
       divergent_object = e.soid;
       omissing.add(divergent_object, e.version, eversion_t());
       e.op = pg_log_entry_t::MODIFY;
@@ -1862,6 +1862,84 @@ TEST_F(PGLogTest, merge_log_prior_version_have) {
   run_test_case(t);
 }
 
+static bool bl_is_compact(const bufferlist &bl)
+{
+  return bl.buffers().size() == 1 &&
+    bl.buffers().front().raw_length() == bl.length();
+}
+
+TEST_F(PGLogTest, compact_entries) {
+  clear();
+
+  // as the primary logs them: each rollback info encoded into a page
+  for (unsigned i = 1; i <= 3; ++i) {
+    pg_log_entry_t e = mk_ple_mod_rb(mk_obj(1), mk_evt(10, i),
+				     mk_evt(10, i - 1));
+    e.mod_desc.append(i * 4096);
+    ASSERT_FALSE(bl_is_compact(e.mod_desc.bl));
+    add(e);
+  }
+  for (list<pg_log_entry_t>::const_iterator i = log.log.begin();
+       i != log.log.end();
+       ++i) {
+    EXPECT_TRUE(bl_is_compact(i->mod_desc.bl));
+    EXPECT_TRUE(log.log.front().soid.is_shared_with(i->soid));
+  }
+
+  // changing the object of a copy leaves the log alone
+  pg_log_entry_t copy = log.log.back();
+  ASSERT_TRUE(copy.soid.is_shared_with(log.log.back().soid));
+  copy.soid.edit().hash = 0x7;
+  EXPECT_FALSE(copy.soid.is_shared_with(log.log.back().soid));
+  EXPECT_NE(copy.soid.get(), log.log.back().soid.get());
+
+  // what was accounted for as the entries came is what index() finds
+  uint64_t bytes = get_log_mem_bytes();
+  EXPECT_GT(bytes, 3 * sizeof(pg_log_entry_t));
+  index();
+  EXPECT_EQ(bytes, get_log_mem_bytes());
+
+  LogHandler h;
+  uint64_t first = IndexedLog::get_entry_bytes(log.log.front());
+  log.trim(&h, mk_evt(10, 1), NULL);
+  EXPECT_EQ(bytes - first, get_log_mem_bytes());
+  bytes = get_log_mem_bytes();
+  index();
+  EXPECT_EQ(bytes, get_log_mem_bytes());
+
+  // as a replica gets them: all in the buffer of the message
+  pg_log_t olog;
+  for (unsigned i = 1; i <= 3; ++i) {
+    olog.log.push_back(mk_ple_mod_rb(mk_obj(2), mk_evt(11, i),
+				     mk_evt(11, i - 1)));
+    olog.log.back().mod_desc.append(i * 4096);
+  }
+  olog.head = olog.log.back().version;
+  bufferlist bl;
+  ::encode(olog, bl);
+  bufferlist::iterator p = bl.begin();
+  pg_log_t dlog;
+  ::decode(dlog, p);
+  ASSERT_FALSE(bl_is_compact(dlog.log.front().mod_desc.bl));
+
+  IndexedLog rlog;
+  rlog.claim_log_and_clear_rollback_info(dlog);
+  ASSERT_EQ(3u, rlog.log.size());
+  for (list<pg_log_entry_t>::const_iterator i = rlog.log.begin();
+       i != rlog.log.end();
+       ++i) {
+    EXPECT_TRUE(bl_is_compact(i->mod_desc.bl));
+    EXPECT_TRUE(rlog.log.front().soid.is_shared_with(i->soid));
+  }
+  EXPECT_LT(rlog.get_mem_bytes(), 3 * (sizeof(pg_log_entry_t) + 1024));
+
+  rlog.trim(&h, rlog.head, NULL);
+  EXPECT_EQ(0u, rlog.objects.size());
+  EXPECT_EQ(rlog.objects.bucket_count() * sizeof(void*) +
+	    rlog.caller_ops.bucket_count() * sizeof(void*),
+	    rlog.get_mem_bytes());
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
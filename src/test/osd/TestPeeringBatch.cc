@@ -0,0 +1,234 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+
+#include "osd/PeeringBatch.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+/// remembers what it was asked to send
+class TestSender : public PeeringBatch::Sender {
+public:
+  Mutex lock;
+  vector<PG::BufferedRecoveryMessages> sent;
+  set<int> old_peers;  ///< peers without INDEP_PG_MAP
+
+  TestSender() : lock("TestSender::lock") {}
+
+  void send_peering_messages(PG::BufferedRecoveryMessages &msgs,
+			     OSDMapRef osdmap) {
+    Mutex::Locker l(lock);
+    sent.push_back(msgs);
+  }
+  bool peer_lacks_feature(int osd, epoch_t e, uint64_t feature) {
+    return feature == CEPH_FEATURE_INDEP_PG_MAP && old_peers.count(osd);
+  }
+
+  size_t num_sent() {
+    Mutex::Locker l(lock);
+    return sent.size();
+  }
+  /// wait up to secs for something to be sent
+  bool wait_sent(double secs) {
+    for (int i = 0; i < secs * 100; ++i) {
+      if (num_sent())
+	return true;
+      usleep(10000);
+    }
+    return false;
+  }
+};
+
+/// the messages of the pgs of one peering_wq batch
+struct TestCtx {
+  PG::BufferedRecoveryMessages buf;
+  PG::RecoveryCtx rctx;
+
+  TestCtx()
+    : rctx(&buf.query_map, &buf.info_map, &buf.notify_list,
+	   NULL, NULL, NULL) {}
+
+  TestCtx &notify(int peer, unsigned ps) {
+    pg_info_t info(spg_t(pg_t(ps, 1)));
+    buf.notify_list[peer].push_back(
+      make_pair(pg_notify_t(shard_id_t::NO_SHARD, shard_id_t::NO_SHARD,
+			    1, 1, info),
+		pg_interval_map_t()));
+    return *this;
+  }
+  TestCtx &query(int peer, unsigned ps) {
+    buf.query_map[peer][spg_t(pg_t(ps, 1))] =
+      pg_query_t(pg_query_t::INFO, shard_id_t::NO_SHARD,
+		 shard_id_t::NO_SHARD, pg_history_t(), 1);
+    return *this;
+  }
+  bool empty() const {
+    return buf.notify_list.empty() && buf.query_map.empty() &&
+      buf.info_map.empty();
+  }
+};
+
+class PeeringBatchTest : public ::testing::Test {
+public:
+  TestSender sender;
+  PeeringBatch *batch;
+  OSDMapRef osdmap;
+
+  PeeringBatchTest() : batch(NULL), osdmap(new OSDMap) {}
+
+  virtual void SetUp() {
+    set_conf("1000", "10");
+    batch = new PeeringBatch(g_ceph_context, &sender);
+    batch->init();
+  }
+
+  virtual void TearDown() {
+    batch->shutdown();
+    delete batch;
+  }
+
+  void set_conf(const char *max_pgs, const char *max_delay) {
+    g_ceph_context->_conf->set_val("osd_peering_batch_max_pgs", max_pgs);
+    g_ceph_context->_conf->set_val("osd_peering_batch_max_delay", max_delay);
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+
+  /// run one batch of the peering_wq, which leaves ctx's messages
+  void run(TestCtx &ctx, bool queue_empty) {
+    batch->start();
+    batch->finish(ctx.rctx, osdmap, queue_empty);
+  }
+};
+
+TEST_F(PeeringBatchTest, batches_a_pass) {
+  // two threads take a batch each
+  batch->start();
+  batch->start();
+  TestCtx a, b;
+  a.notify(1, 0).query(2, 0);
+  batch->finish(a.rctx, osdmap, true);
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ(0u, sender.num_sent());
+  EXPECT_EQ(2u, batch->get_num_pgs());
+
+  // the pass is done once the last of them is, and the queue is empty
+  b.notify(1, 1);
+  batch->finish(b.rctx, osdmap, true);
+  ASSERT_EQ(1u, sender.num_sent());
+  EXPECT_EQ(2u, sender.sent[0].notify_list[1].size());
+  EXPECT_EQ(1u, sender.sent[0].query_map[2].size());
+  EXPECT_EQ(0u, batch->get_num_pgs());
+}
+
+TEST_F(PeeringBatchTest, max_pgs) {
+  set_conf("2", "10");
+  TestCtx a, b;
+  a.notify(1, 0);
+  run(a, false);
+  EXPECT_EQ(0u, sender.num_sent());
+  b.notify(2, 1);
+  run(b, false);
+  EXPECT_EQ(1u, sender.num_sent());
+
+  // 0 leaves the messages of each batch to the caller
+  set_conf("0", "10");
+  TestCtx c;
+  c.notify(1, 2);
+  run(c, false);
+  EXPECT_EQ(1u, sender.num_sent());
+  EXPECT_FALSE(c.empty());
+}
+
+TEST_F(PeeringBatchTest, max_delay) {
+  // nothing else happens, and the pass never ends: the timer sends them
+  set_conf("1000", ".2");
+  TestCtx a;
+  a.notify(1, 0);
+  run(a, false);
+  EXPECT_EQ(0u, sender.num_sent());
+  EXPECT_TRUE(sender.wait_sent(5));
+  EXPECT_EQ(0u, batch->get_num_pgs());
+
+  // and only once
+  usleep(500000);
+  EXPECT_EQ(1u, sender.num_sent());
+}
+
+TEST_F(PeeringBatchTest, order_in_batches) {
+  TestCtx a, b;
+  a.notify(1, 0);
+  run(a, false);
+
+  // pg 0 sends to osd.1 again: what it sent before goes first
+  b.notify(1, 0).notify(1, 1);
+  run(b, false);
+  ASSERT_EQ(1u, sender.num_sent());
+  EXPECT_EQ(1u, sender.sent[0].notify_list[1].size());
+  EXPECT_EQ(2u, batch->get_num_pgs());
+}
+
+TEST_F(PeeringBatchTest, order_with_direct_sends) {
+  TestCtx a;
+  a.notify(1, 0).query(2, 1);
+  run(a, false);
+
+  // other pgs, or the same pg to another peer, do not have to wait
+  TestCtx other;
+  other.notify(1, 1).query(3, 0);
+  batch->flush_overlapping(other.rctx);
+  EXPECT_EQ(0u, sender.num_sent());
+
+  TestCtx same;
+  same.query(2, 1);
+  batch->flush_overlapping(same.rctx);
+  ASSERT_EQ(1u, sender.num_sent());
+  EXPECT_EQ(1u, sender.sent[0].notify_list[1].size());
+  EXPECT_EQ(0u, batch->get_num_pgs());
+  EXPECT_FALSE(same.empty());
+}
+
+TEST_F(PeeringBatchTest, must_dispatch_immediately) {
+  sender.old_peers.insert(3);
+  sender.old_peers.insert(CRUSH_ITEM_NONE);
+  set<pg_shard_t> peers;
+  peers.insert(pg_shard_t(0));
+  peers.insert(pg_shard_t(1));
+  peers.insert(pg_shard_t(CRUSH_ITEM_NONE));
+  EXPECT_FALSE(batch->must_dispatch_immediately(peers, 0, 1));
+
+  // one old peer is enough, but we do not count
+  peers.insert(pg_shard_t(3, shard_id_t(2)));
+  EXPECT_TRUE(batch->must_dispatch_immediately(peers, 0, 1));
+  peers.erase(pg_shard_t(0));
+  EXPECT_FALSE(batch->must_dispatch_immediately(peers, 3, 1));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ;
+ *   make unittest_peering_batch &&
+ *   ./unittest_peering_batch
+ * End:
+ */
@@ -0,0 +1,278 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Time merge_log and proc_replica_log on logs the size of a pg's, and
+ * report how much memory the in-memory logs take, as JSON.
+ *
+ * The primary logs --entries entries over --objects objects, the way
+ * an osd adds them.  The replica missed the last --behind of them and
+ * has --divergent entries of its own instead.  merge_log brings the
+ * replica up to date from the primary's log as it comes out of a
+ * message; proc_replica_log has the primary look at the replica's.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "osd/PGLog.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "global/global_init.h"
+
+struct bench_config_t {
+  int entries;
+  int objects;
+  int behind;
+  int divergent;
+  int iterations;
+  bool rollback;
+
+  bench_config_t()
+    : entries(3000), objects(1000), behind(100), divergent(10),
+      iterations(100), rollback(false) {}
+
+  void dump(Formatter *f) const {
+    f->dump_int("entries", entries);
+    f->dump_int("objects", objects);
+    f->dump_int("behind", behind);
+    f->dump_int("divergent", divergent);
+    f->dump_int("iterations", iterations);
+    f->dump_bool("rollback", rollback);
+  }
+};
+
+static void usage(const char *pname)
+{
+  cerr << "usage: " << pname << " [options]\n"
+       << "  --entries N      in the primary's log (default 3000)\n"
+       << "  --objects N      the entries are spread over (default 1000)\n"
+       << "  --behind N       entries the replica missed (default 100)\n"
+       << "  --divergent N    entries only the replica has (default 10)\n"
+       << "  --iterations N   of each (default 100)\n"
+       << "  --rollback       entries carry rollback info, as on ec pools\n"
+       << std::endl;
+  generic_client_usage();
+}
+
+/// a PGLog we can set up directly
+class BenchLog : public PGLog {
+public:
+  BenchLog() : PGLog(g_ceph_context) {}
+  IndexedLog &get_indexed_log() {
+    return log;
+  }
+};
+
+struct NullHandler : public PGLog::LogEntryHandler {
+  void rollback(const pg_log_entry_t &entry) {}
+  void remove(const hobject_t &hoid) {}
+  void trim(const pg_log_entry_t &entry) {}
+};
+
+static hobject_t make_oid(int i)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "rbd_data.1014b2ae8944a.%016x", i);
+  return hobject_t(object_t(name), "", CEPH_NOSNAP, i * 2654435761u, 1, "");
+}
+
+static pg_log_entry_t make_entry(const bench_config_t &conf,
+				 const hobject_t &oid,
+				 eversion_t v, eversion_t pv, uint64_t tid)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, v, pv, v.version,
+		   osd_reqid_t(entity_name_t::CLIENT(4100), 0, tid),
+		   ceph_clock_now(g_ceph_context));
+  if (conf.rollback)
+    e.mod_desc.append(tid * 4096);
+  else
+    e.mod_desc.mark_unrollbackable();
+  return e;
+}
+
+/**
+ * fill in the primary's and the replica's logs
+ *
+ * The first entries - behind entries are in both logs, in epoch 10.
+ * The rest of the primary's are in epoch 12, and the replica's
+ * divergent ones in epoch 11.
+ */
+static void make_logs(const bench_config_t &conf,
+		      BenchLog *primary, pg_info_t *pinfo,
+		      BenchLog *replica, pg_info_t *rinfo)
+{
+  int shared = conf.entries - conf.behind;
+  vector<eversion_t> last(conf.objects);
+  vector<eversion_t> last_shared;
+  for (int i = 1; i <= conf.entries; ++i) {
+    if (i == shared + 1)
+      last_shared = last;
+    int o = (i * 7919) % conf.objects;
+    eversion_t v(i <= shared ? 10 : 12, i);
+    pg_log_entry_t e = make_entry(conf, make_oid(o), v, last[o], i);
+    last[o] = v;
+    primary->add(e);
+    if (i <= shared)
+      replica->add(e);
+  }
+  if (last_shared.empty())
+    last_shared = last;
+  for (int i = 1; i <= conf.divergent; ++i) {
+    int o = ((shared + i) * 7919) % conf.objects;
+    eversion_t v(11, shared + i);
+    pg_log_entry_t e = make_entry(conf, make_oid(o), v, last_shared[o],
+				  conf.entries + i);
+    last_shared[o] = v;
+    replica->add(e);
+  }
+
+  PGLog::IndexedLog &plog = primary->get_indexed_log();
+  pinfo->last_update = pinfo->last_complete = plog.head;
+  pinfo->log_tail = plog.tail;
+  pinfo->last_backfill = hobject_t::get_max();
+  PGLog::IndexedLog &rlog = replica->get_indexed_log();
+  rinfo->last_update = rinfo->last_complete = rlog.head;
+  rinfo->log_tail = rlog.tail;
+  rinfo->last_backfill = hobject_t::get_max();
+}
+
+struct timing_t {
+  vector<double> lats;  ///< seconds
+
+  void dump(Formatter *f) const {
+    vector<double> l(lats);
+    std::sort(l.begin(), l.end());
+    double sum = 0;
+    for (vector<double>::iterator p = l.begin(); p != l.end(); ++p)
+      sum += *p;
+    f->dump_int("iterations", l.size());
+    if (l.empty())
+      return;
+    f->dump_float("avg_us", sum * 1000000.0 / l.size());
+    f->dump_float("min_us", l.front() * 1000000.0);
+    f->dump_float("p99_us", l[(size_t)(.99 * (l.size() - 1))] * 1000000.0);
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  bench_config_t conf;
+  std::ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &conf.entries, &err,
+				     "--entries", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.objects, &err,
+				     "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.behind, &err,
+				     "--behind", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.divergent, &err,
+				     "--divergent", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &conf.iterations, &err,
+				     "--iterations", (char*)NULL)) {
+    } else if (ceph_argparse_flag(args, i, "--rollback", (char*)NULL)) {
+      conf.rollback = true;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (conf.entries < 1 || conf.objects < 1 || conf.behind < 0 ||
+      conf.behind >= conf.entries || conf.divergent < 0 ||
+      conf.divergent > conf.behind || conf.iterations < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  NullHandler h;
+  pg_shard_t from(1, shard_id_t::NO_SHARD);
+  timing_t merge, proc;
+  uint64_t primary_bytes = 0, replica_bytes = 0, merged_bytes = 0;
+  uint64_t message_bytes = 0;
+  for (int i = 0; i < conf.iterations; ++i) {
+    BenchLog primary, replica;
+    pg_info_t pinfo, rinfo;
+    make_logs(conf, &primary, &pinfo, &replica, &rinfo);
+    primary_bytes = primary.get_log_mem_bytes();
+    replica_bytes = replica.get_log_mem_bytes();
+
+    // the primary's log, as the replica gets it
+    bufferlist bl;
+    ::encode(static_cast<const pg_log_t&>(primary.get_log()), bl);
+    message_bytes = bl.length();
+    bufferlist::iterator p = bl.begin();
+    pg_log_t olog;
+    ::decode(olog, p);
+
+    {
+      ObjectStore::Transaction t;
+      pg_info_t oinfo(pinfo);
+      pg_missing_t omissing;
+      utime_t start = ceph_clock_now(g_ceph_context);
+      primary.proc_replica_log(t, oinfo, replica.get_log(), omissing, from);
+      proc.lats.push_back(ceph_clock_now(g_ceph_context) - start);
+    }
+    {
+      ObjectStore::Transaction t;
+      bool dirty_info = false, dirty_big_info = false;
+      utime_t start = ceph_clock_now(g_ceph_context);
+      replica.merge_log(t, pinfo, olog, from, rinfo, &h,
+			dirty_info, dirty_big_info);
+      merge.lats.push_back(ceph_clock_now(g_ceph_context) - start);
+      merged_bytes = replica.get_log_mem_bytes();
+    }
+  }
+
+  JSONFormatter f(true);
+  f.open_object_section("pglog_bench");
+  f.open_object_section("config");
+  conf.dump(&f);
+  f.close_section();
+  f.dump_unsigned("entry_size", sizeof(pg_log_entry_t));
+  f.dump_unsigned("message_bytes", message_bytes);
+  f.dump_unsigned("primary_log_mem_bytes", primary_bytes);
+  f.dump_float("primary_log_mem_bytes_per_entry",
+	       (double)primary_bytes / conf.entries);
+  f.dump_unsigned("replica_log_mem_bytes", replica_bytes);
+  f.dump_unsigned("merged_log_mem_bytes", merged_bytes);
+  f.open_object_section("merge_log");
+  merge.dump(&f);
+  f.close_section();
+  f.open_object_section("proc_replica_log");
+  proc.dump(&f);
+  f.close_section();
+  f.close_section();
+  f.flush(cout);
+  cout << std::endl;
+  return 0;
+}
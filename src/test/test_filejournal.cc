@@ -9,13 +9,16 @@
 #include "common/config.h"
 #include "common/Finisher.h"
 #include "os/FileJournal.h"
+#include "os/StripedJournal.h"
 #include "include/Context.h"
+#include "include/stringify.h"
 #include "common/Mutex.h"
 #include "common/safe_io.h"
 
 Finisher *finisher;
 Cond sync_cond;
 char path[200];
+char path2[210];
 uuid_d fsid;
 bool directio = false;
 bool aio = false;
@@ -79,6 +82,7 @@ int main(int argc, char **argv) {
     srand(getpid()+time(0));
     snprintf(path, sizeof(path), "/tmp/ceph_test_filejournal.tmp.%d", rand());
   }
+  snprintf(path2, sizeof(path2), "%s.1", path);
   cout << "path " << path << std::endl;
 
   ::testing::InitGoogleTest(&argc, argv);
@@ -104,6 +108,7 @@ int main(int argc, char **argv) {
   finisher->stop();
 
   unlink(path);
+  unlink(path2);
   
   return r;
 }
@@ -395,6 +400,169 @@ TEST(TestFileJournal, WriteTrimSmall) {
   j.close();
 }
 
+static vector<string> stripe_paths()
+{
+  vector<string> paths;
+  paths.push_back(path);
+  paths.push_back(path2);
+  return paths;
+}
+
+static void submit_numbered(Journal *j, uint64_t from, uint64_t to,
+			    const string &tag = "")
+{
+  C_Sync s;
+  C_GatherBuilder gb(g_ceph_context, s.c);
+  for (uint64_t i = from; i <= to; ++i) {
+    bufferlist bl;
+    bl.append(tag + stringify(i));
+    j->submit_entry(i, bl, 0, gb.new_sub());
+  }
+  gb.activate();
+}
+
+static void read_numbered(Journal *j, uint64_t from, uint64_t to,
+			  const string &tag = "")
+{
+  for (uint64_t i = from; i <= to; ++i) {
+    bufferlist bl;
+    uint64_t seq = from;
+    ASSERT_TRUE(j->read_entry(bl, seq));
+    ASSERT_EQ(i, seq);
+    string v;
+    bl.copy(0, bl.length(), v);
+    ASSERT_EQ(tag + stringify(i), v);
+  }
+  bufferlist bl;
+  uint64_t seq = to + 1;
+  ASSERT_FALSE(j->read_entry(bl, seq));
+}
+
+TEST(TestFileJournal, StripedReplay) {
+  fsid.generate_random();
+  StripedJournal j(fsid, finisher, &sync_cond, stripe_paths(), directio, aio);
+  ASSERT_EQ(0, j.create());
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 1, 9);
+  j.close();
+
+  // every member skips its own entries up to fs_op_seq
+  ASSERT_EQ(0, j.open(4));
+  read_numbered(&j, 5, 9);
+  ASSERT_EQ(0, j.make_writeable());
+  j.close();
+}
+
+TEST(TestFileJournal, StripedUpgrade) {
+  fsid.generate_random();
+  {
+    FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+    ASSERT_EQ(0, j.create());
+    j.make_writeable();
+    submit_numbered(&j, 1, 3);
+    j.close();
+  }
+  unlink(path2);
+
+  StripedJournal j(fsid, finisher, &sync_cond, stripe_paths(), directio, aio);
+  ASSERT_EQ(0, j.check());
+  ASSERT_EQ(0, j.open(0));
+  read_numbered(&j, 1, 3);
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 4, 8);
+  j.close();
+
+  {
+    FileJournal j0(fsid, finisher, &sync_cond, path, directio, aio);
+    ASSERT_EQ(0, j0.open_for_dump());
+    ASSERT_EQ(0u, j0.get_stripe_index());
+    ASSERT_EQ(2u, j0.get_stripe_width());
+  }
+
+  ASSERT_EQ(0, j.open(3));
+  read_numbered(&j, 4, 8);
+  ASSERT_EQ(0, j.make_writeable());
+  j.close();
+}
+
+TEST(TestFileJournal, StripedHole) {
+  // stands in for a crash before 5 made it to disk
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  StripedJournal j(fsid, finisher, &sync_cond, stripe_paths(), directio, aio);
+  ASSERT_EQ(0, j.create());
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 1, 9, "a");
+  j.close();
+
+  // lose 5 on the second member; 6..9 are complete but were never acked
+  {
+    FileJournal j1(fsid, finisher, &sync_cond, path2, directio, aio);
+    ASSERT_EQ(0, j1.open(0));
+    int fd = open(path2, O_WRONLY);
+    j1.corrupt_payload(fd, 5);
+    ::close(fd);
+    j1.make_writeable();
+    j1.close();
+  }
+
+  ASSERT_EQ(0, j.open(0));
+  read_numbered(&j, 1, 4, "a");
+  ASSERT_EQ(0, j.make_writeable());
+  // same size as the stale entries, so that the ones after them still
+  // line up
+  submit_numbered(&j, 5, 6, "b");
+  j.close();
+
+  ASSERT_EQ(0, j.open(4));
+  read_numbered(&j, 5, 6, "b");
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 7, 8, "c");
+  j.close();
+
+  ASSERT_EQ(0, j.open(6));
+  read_numbered(&j, 7, 8, "c");
+  ASSERT_EQ(0, j.make_writeable());
+  j.close();
+
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST(TestFileJournal, StripedTrimmed) {
+  fsid.generate_random();
+  StripedJournal j(fsid, finisher, &sync_cond, stripe_paths(), directio, aio);
+  ASSERT_EQ(0, j.create());
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 1, 9);
+  j.committed_thru(6);
+  j.close();
+
+  // only one member has anything past 8
+  ASSERT_EQ(0, j.open(8));
+  read_numbered(&j, 9, 9);
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 10, 12);
+  j.committed_thru(12);
+  j.close();
+
+  // a clean umount leaves every member empty
+  ASSERT_EQ(0, j.open(12));
+  bufferlist bl;
+  uint64_t seq = 13;
+  ASSERT_FALSE(j.read_entry(bl, seq));
+  ASSERT_EQ(0, j.make_writeable());
+  submit_numbered(&j, 13, 15);
+  j.close();
+
+  ASSERT_EQ(0, j.open(12));
+  read_numbered(&j, 13, 15);
+  ASSERT_EQ(0, j.make_writeable());
+  j.close();
+}
+
 TEST(TestFileJournal, ReplayDetectCorruptFooterMagic) {
   g_ceph_context->_conf->set_val("journal_ignore_corruption", "true");
   g_ceph_context->_conf->set_val("journal_write_header_frequency", "1");
@@ -23,19 +23,38 @@
 
 #include "global/global_init.h"
 #include "include/stringify.h"
-#include "os/LevelDBStore.h"
+#include "os/KeyValueDB.h"
+#ifdef HAVE_LIBROCKSDB
+#include "os/RocksDBStore.h"
+#endif
 
 using namespace std;
 
 class StoreTool
 {
   boost::scoped_ptr<KeyValueDB> db;
+  string store_type;
   string store_path;
 
   public:
-  StoreTool(const string &path) : store_path(path) {
-    LevelDBStore *db_ptr = new LevelDBStore(g_ceph_context, store_path);
-    assert(!db_ptr->open(std::cerr));
+  StoreTool(const string &type, const string &path, bool migrate = false)
+    : store_type(type), store_path(path) {
+    KeyValueDB *db_ptr = KeyValueDB::create(g_ceph_context, type, store_path);
+    if (!db_ptr) {
+      std::cerr << "unknown store type '" << type << "'" << std::endl;
+      exit(1);
+    }
+    db_ptr->init();
+#ifdef HAVE_LIBROCKSDB
+    // only a migration may open a store that one left half done
+    if (migrate && type == "rocksdb")
+      static_cast<RocksDBStore*>(db_ptr)->options.migrating = true;
+#endif
+    if (db_ptr->open(std::cerr) < 0) {
+      std::cerr << "failed to open " << type << " store at " << path
+		<< std::endl;
+      exit(1);
+    }
     db.reset(db_ptr);
   }
 
@@ -139,15 +158,23 @@ class StoreTool
     return (ret == 0);
   }
 
-  int copy_store_to(const string &other_path, const int num_keys_per_tx) {
+  int copy_store_to(const string &other_path, const int num_keys_per_tx,
+                    const string &other_type) {
 
     if (num_keys_per_tx <= 0) {
       std::cerr << "must specify a number of keys/tx > 0" << std::endl;
       return -EINVAL;
     }
 
-    // open or create a leveldb store at @p other_path
-    LevelDBStore other(g_ceph_context, other_path);
+    // open or create a store of @p other_type at @p other_path
+    boost::scoped_ptr<KeyValueDB> other_ptr(
+      KeyValueDB::create(g_ceph_context, other_type, other_path));
+    if (!other_ptr) {
+      std::cerr << "unknown store type '" << other_type << "'" << std::endl;
+      return -EINVAL;
+    }
+    KeyValueDB &other = *other_ptr;
+    other.init();
     int err = other.create_and_open(std::cerr);
     if (err < 0)
       return err;
@@ -202,11 +229,28 @@ class StoreTool
 
     return 0;
   }
+
+  int migrate_column_families(const int num_keys_per_tx) {
+    if (num_keys_per_tx <= 0) {
+      std::cerr << "must specify a number of keys/tx > 0" << std::endl;
+      return -EINVAL;
+    }
+#ifdef HAVE_LIBROCKSDB
+    if (store_type == "rocksdb") {
+      RocksDBStore *rdb = static_cast<RocksDBStore*>(db.get());
+      return rdb->migrate_column_families(std::cout, num_keys_per_tx);
+    }
+#endif
+    std::cerr << "column families are only supported by rocksdb stores"
+              << std::endl;
+    return -EOPNOTSUPP;
+  }
 };
 
 void usage(const char *pname)
 {
-  std::cerr << "Usage: " << pname << " <store path> command [args...]\n"
+  std::cerr << "Usage: " << pname
+    << " [--type leveldb|rocksdb] <store path> command [args...]\n"
     << "\n"
     << "Commands:\n"
     << "  list [prefix]\n"
@@ -216,8 +260,13 @@ void usage(const char *pname)
     << "  crc <prefix> <key>\n"
     << "  get-size [<prefix> <key>]\n"
     << "  set <prefix> <key> [ver <N>|in <file>]\n"
-    << "  store-copy <path> [num-keys-per-tx]\n"
+    << "  store-copy <path> [num-keys-per-tx [leveldb|rocksdb]]\n"
     << "  store-crc <path>\n"
+    << "  migrate-column-families [num-keys-per-tx]\n"
+    << "\n"
+    << "migrate-column-families moves the keys of a rocksdb store into the\n"
+    << "column families set in rocksdb_column_families.  A store left by an\n"
+    << "interrupted migration will not open until it is run again.\n"
     << std::endl;
 }
 
@@ -232,6 +281,15 @@ int main(int argc, const char *argv[])
       CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
   common_init_finish(g_ceph_context);
 
+  string type = "leveldb";
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &type, "--type", (char*)NULL)) {
+    } else {
+      ++i;
+    }
+  }
 
   if (args.size() < 2) {
     usage(argv[0]);
@@ -241,12 +299,12 @@ int main(int argc, const char *argv[])
   string path(args[0]);
   string cmd(args[1]);
 
-  StoreTool st(path);
+  StoreTool st(type, path, cmd == "migrate-column-families");
 
   if (cmd == "list" || cmd == "list-crc") {
     string prefix;
-    if (argc > 3)
-      prefix = argv[3];
+    if (args.size() > 2)
+      prefix = args[2];
 
     bool do_crc = (cmd == "list-crc");
 
@@ -254,13 +312,13 @@ int main(int argc, const char *argv[])
 
   } else if (cmd == "exists") {
     string key;
-    if (argc < 4) {
+    if (args.size() < 3) {
       usage(argv[0]);
       return 1;
     }
-    string prefix(argv[3]);
-    if (argc > 4)
-      key = argv[4];
+    string prefix(args[2]);
+    if (args.size() > 3)
+      key = args[3];
 
     bool ret = st.exists(prefix, key);
     std::cout << "(" << prefix << ", " << key << ") "
@@ -269,12 +327,12 @@ int main(int argc, const char *argv[])
     return (ret ? 0 : 1);
 
   } else if (cmd == "get") {
-    if (argc < 5) {
+    if (args.size() < 4) {
       usage(argv[0]);
       return 1;
     }
-    string prefix(argv[3]);
-    string key(argv[4]);
+    string prefix(args[2]);
+    string key(args[3]);
 
     bool exists = false;
     bufferlist bl = st.get(prefix, key, exists);
@@ -285,9 +343,9 @@ int main(int argc, const char *argv[])
     }
     std::cout << std::endl;
 
-    if (argc >= 6) {
-      string subcmd(argv[5]);
-      string out(argv[6]);
+    if (args.size() >= 5) {
+      string subcmd(args[4]);
+      string out(args[5]);
 
       if (subcmd != "out") {
         std::cerr << "unrecognized subcmd '" << subcmd << "'"
@@ -300,7 +358,7 @@ int main(int argc, const char *argv[])
         return 1;
       }
 
-      int err = bl.write_file(argv[6], 0644);
+      int err = bl.write_file(args[5], 0644);
       if (err < 0) {
         std::cerr << "error writing value to '" << out << "': "
                   << cpp_strerror(err) << std::endl;
@@ -313,12 +371,12 @@ int main(int argc, const char *argv[])
     }
 
   } else if (cmd == "crc") {
-    if (argc < 5) {
+    if (args.size() < 4) {
       usage(argv[0]);
       return 1;
     }
-    string prefix(argv[3]);
-    string key(argv[4]);
+    string prefix(args[2]);
+    string key(args[3]);
 
     bool exists = false;
     bufferlist bl = st.get(prefix, key, exists);
@@ -332,15 +390,15 @@ int main(int argc, const char *argv[])
   } else if (cmd == "get-size") {
     std::cout << "estimated store size: " << st.get_size() << std::endl;
 
-    if (argc < 4)
+    if (args.size() < 3)
       return 0;
 
-    if (argc < 5) {
+    if (args.size() < 4) {
       usage(argv[0]);
       return 1;
     }
-    string prefix(argv[3]);
-    string key(argv[4]);
+    string prefix(args[2]);
+    string key(args[3]);
 
     bool exists = false;
     bufferlist bl = st.get(prefix, key, exists);
@@ -353,25 +411,25 @@ int main(int argc, const char *argv[])
               << ") size " << si_t(bl.length()) << std::endl;
 
   } else if (cmd == "set") {
-    if (argc < 7) {
+    if (args.size() < 6) {
       usage(argv[0]);
       return 1;
     }
-    string prefix(argv[3]);
-    string key(argv[4]);
-    string subcmd(argv[5]);
+    string prefix(args[2]);
+    string key(args[3]);
+    string subcmd(args[4]);
 
     bufferlist val;
     string errstr;
     if (subcmd == "ver") {
-      version_t v = (version_t) strict_strtoll(argv[6], 10, &errstr);
+      version_t v = (version_t) strict_strtoll(args[5], 10, &errstr);
       if (!errstr.empty()) {
         std::cerr << "error reading version: " << errstr << std::endl;
         return 1;
       }
       ::encode(v, val);
     } else if (subcmd == "in") {
-      int ret = val.read_file(argv[6], &errstr);
+      int ret = val.read_file(args[5], &errstr);
       if (ret < 0 || !errstr.empty()) {
         std::cerr << "error reading file: " << errstr << std::endl;
         return 1;
@@ -390,21 +448,25 @@ int main(int argc, const char *argv[])
     }
   } else if (cmd == "store-copy") {
     int num_keys_per_tx = 128; // magic number that just feels right.
-    if (argc < 4) {
+    if (args.size() < 3) {
       usage(argv[0]);
       return 1;
-    } else if (argc > 4) {
+    } else if (args.size() > 3) {
       string err;
-      num_keys_per_tx = strict_strtol(argv[4], 10, &err);
+      num_keys_per_tx = strict_strtol(args[3], 10, &err);
       if (!err.empty()) {
         std::cerr << "invalid num_keys_per_tx: " << err << std::endl;
         return 1;
       }
     }
 
-    int ret = st.copy_store_to(argv[3], num_keys_per_tx);
+    string other_type = "leveldb";
+    if (args.size() > 4)
+      other_type = args[4];
+
+    int ret = st.copy_store_to(args[2], num_keys_per_tx, other_type);
     if (ret < 0) {
-      std::cerr << "error copying store to path '" << argv[3]
+      std::cerr << "error copying store to path '" << args[2]
                 << "': " << cpp_strerror(ret) << std::endl;
       return 1;
     }
@@ -413,6 +475,24 @@ int main(int argc, const char *argv[])
     uint32_t crc = st.traverse(string(), true, NULL);
     std::cout << "store at '" << path << "' crc " << crc << std::endl;
 
+  } else if (cmd == "migrate-column-families") {
+    int num_keys_per_tx = 128;
+    if (args.size() > 2) {
+      string err;
+      num_keys_per_tx = strict_strtol(args[2], 10, &err);
+      if (!err.empty()) {
+        std::cerr << "invalid num_keys_per_tx: " << err << std::endl;
+        return 1;
+      }
+    }
+
+    int ret = st.migrate_column_families(num_keys_per_tx);
+    if (ret < 0) {
+      std::cerr << "error migrating column families: " << cpp_strerror(ret)
+                << std::endl;
+      return 1;
+    }
+
   } else {
     std::cerr << "Unrecognized command: " << cmd << std::endl;
     return 1;
@@ -29,6 +29,8 @@ void usage()
   cout << "   --export-crush <file>   write osdmap's crush map to <file>" << std::endl;
   cout << "   --import-crush <file>   replace osdmap's crush map with <file>" << std::endl;
   cout << "   --test-map-pgs [--pool <poolid>] map all pgs" << std::endl;
+  cout << "   --mapping-threads <n>   with --test-map-pgs, time it, after precomputing" << std::endl;
+  cout << "                           the mappings with n threads (0 to not)" << std::endl;
   cout << "   --mark-up-in            mark osds up and in (but do not persist)" << std::endl;
   cout << "   --clear-temp            clear pg_temp and primary_temp" << std::endl;
   cout << "   --test-random           do random placements" << std::endl;
@@ -70,6 +72,7 @@ int main(int argc, const char **argv)
   bool clear_temp = false;
   bool test_map_pgs = false;
   bool test_random = false;
+  int mapping_threads = -1;
 
   std::string val;
   std::ostringstream err;
@@ -98,6 +101,11 @@ int main(int argc, const char **argv)
       clear_temp = true;
     } else if (ceph_argparse_flag(args, i, "--test-map-pgs", (char*)NULL)) {
       test_map_pgs = true;
+    } else if (ceph_argparse_withint(args, i, &mapping_threads, &err, "--mapping-threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else if (ceph_argparse_flag(args, i, "--test-random", (char*)NULL)) {
       test_random = true;
     } else if (ceph_argparse_flag(args, i, "--clobber", (char*)NULL)) {
@@ -319,6 +327,15 @@ int main(int argc, const char **argv)
     vector<int> size(30, 0);
     if (test_random)
       srand(getpid());
+    utime_t start = ceph_clock_now(g_ceph_context);
+    if (mapping_threads > 0) {
+      osdmap.build_mapping(mapping_threads);
+      utime_t now = ceph_clock_now(g_ceph_context);
+      cout << "precomputed mappings with " << mapping_threads
+	   << " threads in " << (now - start) << std::endl;
+      start = now;
+    }
+    uint64_t mapped = 0;
     const map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
     for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
 	 p != pools.end(); ++p) {
@@ -340,6 +357,7 @@ int main(int argc, const char **argv)
 	} else {
 	  osdmap.pg_to_acting_osds(pgid, &osds, &primary);
 	}
+	++mapped;
 	size[osds.size()]++;
 
 	for (unsigned i=0; i<osds.size(); i++) {
@@ -353,6 +371,10 @@ int main(int argc, const char **argv)
       }
     }
 
+    if (mapping_threads >= 0)
+      cout << "mapped " << mapped << " pgs in "
+	   << (ceph_clock_now(g_ceph_context) - start) << std::endl;
+
     uint64_t total = 0;
     int in = 0;
     int min_osd = -1;